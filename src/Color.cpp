@@ -193,12 +193,15 @@ namespace KRE
 			color_table["yellowgreen"] = Color(154, 205, 50);		
 		}
 
-		color_table_type& get_color_table() 
+		const color_table_type& get_color_table() 
 		{
-			static color_table_type res;
-			if(res.empty()) {
-				create_color_table(res);
-			}
+			// Built by the static's initialiser, which C++11 runs exactly once even
+			// when documents are parsed on several threads at the same time.
+			static const color_table_type res = []() {
+				color_table_type table;
+				create_color_table(table);
+				return table;
+			}();
 			return res;
 		}
 
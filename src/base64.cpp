@@ -0,0 +1,277 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BASE64_USE_SSE2
+#endif
+
+#include <cstring>
+
+#include "base64.hpp"
+
+namespace base64
+{
+	namespace 
+	{
+		const char* const alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		enum {
+			BAD = 0xff,
+			SPACE = 0xfe,
+			PAD = 0xfd,
+		};
+
+		struct decode_table
+		{
+			decode_table() {
+				memset(values, BAD, sizeof(values));
+				for(int n = 0; n != 64; ++n) {
+					values[static_cast<uint8_t>(alphabet[n])] = static_cast<uint8_t>(n);
+				}
+				values[static_cast<uint8_t>(' ')] = values[static_cast<uint8_t>('\t')] = SPACE;
+				values[static_cast<uint8_t>('\r')] = values[static_cast<uint8_t>('\n')] = SPACE;
+				values[static_cast<uint8_t>('=')] = PAD;
+			}
+			uint8_t values[256];
+		};
+
+		const decode_table table;
+
+		// Decodes from p up to end one character at a time, keeping partial groups
+		// of four in quad/nquad. Returns where it stopped: end, or if resync is set
+		// the first place after p that a group of four starts with at least 16 
+		// characters left, so the caller can go back to decoding in blocks. 
+		// nullptr for bad input.
+		const char* decode_chars(const char* p, const char* end, uint32_t& quad, int& nquad, int& npad, bool resync, std::vector<uint8_t>* out)
+		{
+			const char* begin = p;
+			while(p != end) {
+				const uint8_t v = table.values[static_cast<uint8_t>(*p)];
+				if(v < 64) {
+					if(npad != 0) {
+						// Data after padding.
+						return nullptr;
+					}
+					if(resync && nquad == 0 && p != begin && end - p >= 16) {
+						return p;
+					}
+					quad = (quad << 6) | v;
+					if(++nquad == 4) {
+						out->push_back(static_cast<uint8_t>(quad >> 16));
+						out->push_back(static_cast<uint8_t>(quad >> 8));
+						out->push_back(static_cast<uint8_t>(quad));
+						quad = 0;
+						nquad = 0;
+					}
+				} else if(v == PAD) {
+					// Only allowed to complete a group, e.g. "xx==" or "xxx=".
+					if(nquad + npad < 2 || nquad + npad >= 4) {
+						return nullptr;
+					}
+					++npad;
+					if(nquad + npad == 4) {
+						if(nquad == 2) {
+							out->push_back(static_cast<uint8_t>(quad >> 4));
+						} else {
+							out->push_back(static_cast<uint8_t>(quad >> 10));
+							out->push_back(static_cast<uint8_t>(quad >> 2));
+						}
+						quad = 0;
+						nquad = 0;
+						npad = 4;
+					}
+				} else if(v != SPACE) {
+					return nullptr;
+				}
+				++p;
+			}
+			return p;
+		}
+
+		// The final group, if there was no padding.
+		bool finish(uint32_t quad, int nquad, int npad, std::vector<uint8_t>* out)
+		{
+			if(npad != 0 && npad != 4) {
+				return false;
+			}
+			switch(nquad) {
+				case 0: return true;
+				case 2: out->push_back(static_cast<uint8_t>(quad >> 4)); return true;
+				case 3: 
+					out->push_back(static_cast<uint8_t>(quad >> 10));
+					out->push_back(static_cast<uint8_t>(quad >> 2));
+					return true;
+				default: break;
+			}
+			return false;
+		}
+
+#ifdef BASE64_USE_SSE2
+		// Decodes 16 characters to 12 bytes, written as four 4 byte stores at
+		// out, out+3, out+6 and out+9, so 13 bytes must be writable. Returns false,
+		// writing nothing, if any of the characters isn't plain base64.
+		inline bool decode_block(const char* p, uint8_t* out)
+		{
+			const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			// Characters above 0x7f are negative here, so fall outside every range.
+			const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+			const __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+			const __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+			const __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+			const __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+			const __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+			if(_mm_movemask_epi8(valid) != 0xffff) {
+				return false;
+			}
+			// Add whichever offset takes the character to its 6-bit value.
+			__m128i offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+			offset = _mm_or_si128(offset, _mm_and_si128(lower, _mm_set1_epi8(26 - 'a')));
+			offset = _mm_or_si128(offset, _mm_and_si128(digit, _mm_set1_epi8(52 - '0')));
+			offset = _mm_or_si128(offset, _mm_and_si128(plus, _mm_set1_epi8(62 - '+')));
+			offset = _mm_or_si128(offset, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+			const __m128i v = _mm_add_epi8(c, offset);
+
+			// Each 32-bit lane holds values a, b, c, d in its bytes. Rearrange their
+			// bits into the three output bytes, in order, in the low 24 bits.
+			const __m128i byte0 = _mm_or_si128(
+				_mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0x3f)), 2),
+				_mm_and_si128(_mm_srli_epi32(v, 12), _mm_set1_epi32(0x3)));
+			const __m128i byte1 = _mm_or_si128(
+				_mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf00)), 4),
+				_mm_and_si128(_mm_srli_epi32(v, 10), _mm_set1_epi32(0xf00)));
+			const __m128i byte2 = _mm_or_si128(
+				_mm_and_si128(_mm_slli_epi32(v, 6), _mm_set1_epi32(0xc00000)),
+				_mm_and_si128(_mm_srli_epi32(v, 8), _mm_set1_epi32(0x3f0000)));
+			const __m128i bytes = _mm_or_si128(_mm_or_si128(byte0, byte1), byte2);
+
+			// No byte shuffle in SSE2, so the lanes go out as overlapping stores.
+			uint32_t lanes[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), bytes);
+			memcpy(out, &lanes[0], 4);
+			memcpy(out + 3, &lanes[1], 4);
+			memcpy(out + 6, &lanes[2], 4);
+			memcpy(out + 9, &lanes[3], 4);
+			return true;
+		}
+#endif
+	}
+
+	bool decode(const char* p, size_t n, std::vector<uint8_t>* out)
+	{
+#ifdef BASE64_USE_SSE2
+		const char* end = p + n;
+		uint32_t quad = 0;
+		int nquad = 0;
+		int npad = 0;
+		const size_t start = out->size();
+		out->resize(start + n / 4 * 3 + 4);
+		size_t written = start;
+		std::vector<uint8_t> tail;
+		while(p != end) {
+			while(end - p >= 16 && decode_block(p, &(*out)[written])) {
+				p += 16;
+				written += 12;
+			}
+			// Whole groups up to a line break, or the end.
+			while(nquad == 0 && end - p >= 4) {
+				const uint8_t* v = table.values;
+				const uint32_t a = v[static_cast<uint8_t>(p[0])], b = v[static_cast<uint8_t>(p[1])];
+				const uint32_t c = v[static_cast<uint8_t>(p[2])], d = v[static_cast<uint8_t>(p[3])];
+				if((a | b | c | d) >= 64) {
+					break;
+				}
+				const uint32_t group = (a << 18) | (b << 12) | (c << 6) | d;
+				(*out)[written++] = static_cast<uint8_t>(group >> 16);
+				(*out)[written++] = static_cast<uint8_t>(group >> 8);
+				(*out)[written++] = static_cast<uint8_t>(group);
+				p += 4;
+			}
+			if(p == end) {
+				break;
+			}
+			if(table.values[static_cast<uint8_t>(*p)] == SPACE) {
+				++p;
+				continue;
+			}
+			// Padding or a group split by whitespace. Go one at a time until 
+			// there's a run of base64 to go back to blocks for.
+			tail.clear();
+			p = decode_chars(p, end, quad, nquad, npad, true, &tail);
+			std::copy(tail.begin(), tail.end(), out->begin() + written);
+			written += tail.size();
+			if(p == nullptr) {
+				out->resize(written);
+				return false;
+			}
+		}
+		tail.clear();
+		const bool ok = finish(quad, nquad, npad, &tail);
+		std::copy(tail.begin(), tail.end(), out->begin() + written);
+		out->resize(written + tail.size());
+		return ok;
+#else
+		return decode_scalar(p, n, out);
+#endif
+	}
+
+	bool decode_scalar(const char* p, size_t n, std::vector<uint8_t>* out)
+	{
+		uint32_t quad = 0;
+		int nquad = 0;
+		int npad = 0;
+		out->reserve(out->size() + n / 4 * 3);
+		if(decode_chars(p, p + n, quad, nquad, npad, false, out) == nullptr) {
+			return false;
+		}
+		return finish(quad, nquad, npad, out);
+	}
+
+	std::string encode(const uint8_t* p, size_t n)
+	{
+		std::string res;
+		res.reserve((n + 2) / 3 * 4);
+		size_t i = 0;
+		for(; i + 3 <= n; i += 3) {
+			const uint32_t v = (p[i] << 16) | (p[i+1] << 8) | p[i+2];
+			res += alphabet[(v >> 18) & 0x3f];
+			res += alphabet[(v >> 12) & 0x3f];
+			res += alphabet[(v >> 6) & 0x3f];
+			res += alphabet[v & 0x3f];
+		}
+		if(i + 1 == n) {
+			const uint32_t v = p[i] << 16;
+			res += alphabet[(v >> 18) & 0x3f];
+			res += alphabet[(v >> 12) & 0x3f];
+			res += "==";
+		} else if(i + 2 == n) {
+			const uint32_t v = (p[i] << 16) | (p[i+1] << 8);
+			res += alphabet[(v >> 18) & 0x3f];
+			res += alphabet[(v >> 12) & 0x3f];
+			res += alphabet[(v >> 6) & 0x3f];
+			res += '=';
+		}
+		return res;
+	}
+}
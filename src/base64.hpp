@@ -0,0 +1,47 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Base64 as used in data: URIs (RFC 4648, '+' and '/', '=' padding). 
+
+namespace base64
+{
+	// Decodes n characters from p, appending the bytes to out. Whitespace is 
+	// skipped. Returns false if anything other than base64 characters, 
+	// whitespace and trailing padding is found, out then holds what was 
+	// decoded before the bad character. Runs of plain base64 are decoded 16
+	// characters at a time where SSE2 is available.
+	bool decode(const char* p, size_t n, std::vector<uint8_t>* out);
+
+	// Decoder without the SSE2 path, for checking and timing against.
+	bool decode_scalar(const char* p, size_t n, std::vector<uint8_t>* out);
+
+	std::string encode(const uint8_t* p, size_t n);
+}
@@ -0,0 +1,476 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+// Benchmark of the full load and render pipeline over a corpus of files,
+// by default the bundled icon sets. Every file is run through a number of
+// warm-up passes and then timed repeatedly, reporting the 50th, 90th and 99th
+// percentile of each phase, both per file and for the whole corpus.
+//
+// svg_bench [--warmup=N] [--reps=N] [--size=N] [--output=FILE] [--lazy-paths]
+//           [--optimise-tree] [--batch-fills] [--quality=preview|normal|best]
+//           [--lod] [--threads=N] [--baseline=FILE] [--tolerance=PERCENT]
+//           [<file|dir> ...]
+// svg_bench --kernels [--reps=N]
+//
+// Phase times for the corpus are the sum over all files for one repetition.
+// When a baseline (the --output of an earlier run) is given the corpus p50 of
+// each phase is compared against it and the exit status is 2 if any got slower
+// than the tolerance allows. The settings that change the timings are saved
+// with the results, if the baseline was run with different ones nothing is
+// compared and the exit status is 3.
+//
+// --lazy-paths leaves path decoding to the render phase, comparing a run with
+// it against one without shows what it saves on load. --optimise-tree flattens
+// groups and bakes path transforms after resolving, which is counted in the
+// resolve phase and should show up as a cheaper render phase. --batch-fills
+// merges runs of same-coloured fills while rendering. --quality=preview trades
+// antialiasing and curve accuracy for render time, as used for thumbnails.
+// --lod precomputes simplified paths for small sizes. --threads sets how many
+// threads filter effects use, by default all the cores.
+//
+// --kernels times the inner loops that work on raw data instead, e.g. base64
+// decoding of embedded images and the filter effect kernels, printing the best
+// throughput of the repetitions.
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include <cairo.h>
+
+#include "asserts.hpp"
+#include "base64.hpp"
+#include "filesystem.hpp"
+#include "json.hpp"
+#include "svg/svg_bitmap.hpp"
+#include "svg/svg_filter_kernels.hpp"
+#include "svg/svg_parse.hpp"
+
+namespace 
+{
+	enum Phase {
+		PHASE_READ_XML,
+		PHASE_CONSTRUCT,
+		PHASE_RESOLVE,
+		PHASE_RENDER,
+		PHASE_ENCODE_PNG,
+		PHASE_TOTAL,
+		PHASE_COUNT,
+	};
+
+	const char* const phase_names[PHASE_COUNT] = {
+		"read_xml", "construct", "resolve", "render", "encode_png", "total",
+	};
+
+	// Milliseconds for each phase of every repetition.
+	typedef std::vector<double> sample_list[PHASE_COUNT];
+
+	double seconds_since(const std::chrono::steady_clock::time_point& start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	cairo_status_t discard_png_data(void* closure, const unsigned char* data, unsigned int length)
+	{
+		*static_cast<size_t*>(closure) += length;
+		return CAIRO_STATUS_SUCCESS;
+	}
+
+	// Encodes to memory rather than disk so the file system doesn't add noise.
+	void encode_png(const KRE::SVG::bitmap& bmp)
+	{
+		cairo_surface_t* surface = cairo_image_surface_create_for_data(const_cast<uint8_t*>(bmp.data()), CAIRO_FORMAT_ARGB32, bmp.width(), bmp.height(), bmp.stride());
+		size_t bytes = 0;
+		auto status = cairo_surface_write_to_png_stream(surface, discard_png_data, &bytes);
+		cairo_surface_destroy(surface);
+		ASSERT_LOG(status == CAIRO_STATUS_SUCCESS, "Unable to encode png: " << cairo_status_to_string(status));
+	}
+
+	void run_once(const std::string& filename, unsigned size, KRE::SVG::parse_options opts, const KRE::SVG::render_params& params, double* times)
+	{
+		KRE::SVG::parse_timings timings;
+		opts.timings = &timings;
+		KRE::SVG::parse doc(filename, opts);
+		times[PHASE_READ_XML] = timings.read_xml * 1000.0;
+		times[PHASE_CONSTRUCT] = timings.construct * 1000.0;
+		times[PHASE_RESOLVE] = timings.resolve * 1000.0;
+
+		auto start = std::chrono::steady_clock::now();
+		auto bmp = KRE::SVG::render_bitmap(doc, size, size, params);
+		times[PHASE_RENDER] = seconds_since(start) * 1000.0;
+
+		start = std::chrono::steady_clock::now();
+		encode_png(*bmp);
+		times[PHASE_ENCODE_PNG] = seconds_since(start) * 1000.0;
+
+		times[PHASE_TOTAL] = 0;
+		for(int n = 0; n != PHASE_TOTAL; ++n) {
+			times[PHASE_TOTAL] += times[n];
+		}
+	}
+
+	// Nearest-rank percentile.
+	double percentile(std::vector<double> samples, double pc)
+	{
+		ASSERT_LOG(!samples.empty(), "No samples to take a percentile of");
+		std::sort(samples.begin(), samples.end());
+		size_t rank = static_cast<size_t>(pc / 100.0 * samples.size() + 0.999999);
+		rank = std::max<size_t>(1, std::min(rank, samples.size()));
+		return samples[rank - 1];
+	}
+
+	variant summarise(const sample_list& samples)
+	{
+		variant_map res;
+		for(int n = 0; n != PHASE_COUNT; ++n) {
+			variant_map m;
+			m[variant("p50")] = variant(percentile(samples[n], 50));
+			m[variant("p90")] = variant(percentile(samples[n], 90));
+			m[variant("p99")] = variant(percentile(samples[n], 99));
+			res[variant(phase_names[n])] = variant(m);
+		}
+		return variant(res);
+	}
+
+	void collect_files(const std::string& arg, std::vector<std::string>* files)
+	{
+		if(!sys::is_directory(arg)) {
+			files->emplace_back(arg);
+			return;
+		}
+		std::vector<std::string> names;
+		sys::get_files_in_dir(arg, &names);
+		for(auto& name : names) {
+			if(name.size() > 4 && name.substr(name.size() - 4) == ".svg") {
+				files->emplace_back(arg + "/" + name);
+			}
+		}
+	}
+
+	// Runs fn reps times, printing the throughput of the fastest run in MB/s of
+	// the given number of bytes.
+	void time_kernel(const std::string& name, size_t bytes, int reps, const std::function<void()>& fn)
+	{
+		double best = 0;
+		for(int r = 0; r != reps; ++r) {
+			auto start = std::chrono::steady_clock::now();
+			fn();
+			const double t = seconds_since(start);
+			if(r == 0 || t < best) {
+				best = t;
+			}
+		}
+		std::cerr << "  " << name << ": " << (best > 0 ? bytes / best / 1e6 : 0.0) << " MB/s" << std::endl;
+	}
+
+	int run_kernels(int reps)
+	{
+		std::vector<uint8_t> data(16 * 1024 * 1024);
+		uint32_t seed = 1;
+		for(auto& b : data) {
+			seed = seed * 1664525 + 1013904223;
+			b = static_cast<uint8_t>(seed >> 24);
+		}
+		const std::string encoded = base64::encode(&data[0], data.size());
+		// As written by most tools, in lines of 76 characters.
+		std::string wrapped;
+		for(size_t n = 0; n < encoded.size(); n += 76) {
+			wrapped += encoded.substr(n, 76);
+			wrapped += '\n';
+		}
+
+		std::cerr << "Kernels, best of " << reps << ":" << std::endl;
+		std::vector<uint8_t> out;
+		out.reserve(data.size());
+		time_kernel("base64 decode", encoded.size(), reps, [&]() { 
+			out.clear(); 
+			base64::decode(encoded.data(), encoded.size(), &out); 
+		});
+		ASSERT_LOG(out == data, "base64 decode doesn't round trip");
+		time_kernel("base64 decode, wrapped lines", wrapped.size(), reps, [&]() { 
+			out.clear(); 
+			base64::decode(wrapped.data(), wrapped.size(), &out); 
+		});
+		ASSERT_LOG(out == data, "base64 decode of wrapped lines doesn't round trip");
+		time_kernel("base64 decode, scalar", encoded.size(), reps, [&]() { 
+			out.clear(); 
+			base64::decode_scalar(encoded.data(), encoded.size(), &out); 
+		});
+
+		// Filter kernels on a 1024x1024 premultiplied image. Each run copies the
+		// image first, which is timed too, so the copy is timed on its own.
+		KRE::SVG::filter_image img(1024, 1024), other(1024, 1024);
+		for(auto& p : img.pixels) {
+			seed = seed * 1664525 + 1013904223;
+			const uint32_t a = seed >> 24;
+			p = (a << 24) | (((seed >> 16) & 0xff) * a / 255 << 16) | (((seed >> 8) & 0xff) * a / 255 << 8) | ((seed & 0xff) * a / 255);
+		}
+		for(size_t n = 0; n != other.pixels.size(); ++n) {
+			other.pixels[n] = img.pixels[other.pixels.size() - 1 - n];
+		}
+		KRE::SVG::filter_image work;
+		const double k[4] = { 0.5, 0.5, 0.5, 0 };
+		const float saturate[20] = {
+			0.6065f, 0.3575f, 0.036f, 0, 0,
+			0.1065f, 0.8575f, 0.036f, 0, 0,
+			0.1065f, 0.3575f, 0.536f, 0, 0,
+			0, 0, 0, 1, 0,
+		};
+		time_kernel("filter image copy", img.bytes(), reps, [&]() { work = img; });
+		time_kernel("gaussian blur 8px, 1 thread", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::gaussian_blur(work, 8, 8, 1); 
+		});
+		time_kernel("gaussian blur 8px, all cores", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::gaussian_blur(work, 8, 8, 0); 
+		});
+		time_kernel("composite over", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::composite_images(work, other, KRE::SVG::CompositeOperator::OVER, k, 1); 
+		});
+		time_kernel("composite arithmetic", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::composite_images(work, other, KRE::SVG::CompositeOperator::ARITHMETIC, k, 1); 
+		});
+		time_kernel("blend multiply", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::blend_images(work, other, KRE::SVG::BlendMode::MULTIPLY, 1); 
+		});
+		time_kernel("color matrix", img.bytes(), reps, [&]() { 
+			work = img; 
+			KRE::SVG::color_matrix(work, saturate, 1); 
+		});
+		std::vector<uint8_t> mask(img.pixels.size());
+		time_kernel("luminance to A8 mask", img.bytes(), reps, [&]() { 
+			KRE::SVG::luminance_to_alpha(reinterpret_cast<const uint8_t*>(&img.pixels[0]), img.width * 4, &mask[0], img.width, img.width, img.height); 
+		});
+		return 0;
+	}
+
+	// The config entries that change the timings, runs can only be compared if
+	// these are the same.
+	const char* const compared_settings[] = {
+		"size", "files", "quality", "level_of_detail", "lazy_paths", "optimise_tree", "batch_fills", "threads",
+	};
+
+	std::string setting_string(const variant& v)
+	{
+		if(v.is_bool()) {
+			return v.as_bool() ? "true" : "false";
+		}
+		return v.as_string();
+	}
+
+	// Returns false, after printing the differences, if the runs were made with
+	// different settings. Baselines from before a setting was saved are assumed
+	// to have used the default.
+	bool same_settings(const variant& baseline, const variant& current)
+	{
+		bool same = true;
+		const variant& base_config = baseline["config"];
+		const variant& cur_config = current["config"];
+		for(auto name : compared_settings) {
+			if(!base_config.has_key(name)) {
+				std::cerr << "Baseline doesn't record " << name << ", assuming it matches" << std::endl;
+				continue;
+			}
+			const std::string before = setting_string(base_config[name]);
+			const std::string after = setting_string(cur_config[name]);
+			if(before != after) {
+				std::cerr << "Baseline was run with " << name << "=" << before << ", this run used " << after << std::endl;
+				same = false;
+			}
+		}
+		return same;
+	}
+
+	// Returns the number of phases that regressed.
+	int compare_baseline(const variant& baseline, const variant& current, double tolerance)
+	{
+		int regressions = 0;
+		const variant& base_phases = baseline["phases"];
+		const variant& cur_phases = current["phases"];
+		for(int n = 0; n != PHASE_COUNT; ++n) {
+			if(!base_phases.has_key(phase_names[n])) {
+				continue;
+			}
+			const double before = base_phases[phase_names[n]]["p50"].as_float();
+			const double after = cur_phases[phase_names[n]]["p50"].as_float();
+			const double change = before > 0 ? (after - before) / before * 100.0 : 0.0;
+			const bool regressed = change > tolerance;
+			std::cerr << (regressed ? "REGRESSION " : "           ") << phase_names[n] << ": " 
+				<< before << "ms -> " << after << "ms (" << (change >= 0 ? "+" : "") << change << "%)" << std::endl;
+			if(regressed) {
+				++regressions;
+			}
+		}
+		return regressions;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int warmup = 2;
+	int reps = 10;
+	unsigned size = 512;
+	double tolerance = 10.0;
+	std::string output_file;
+	std::string baseline_file;
+	std::vector<std::string> files;
+	KRE::SVG::parse_options popts;
+	KRE::SVG::render_params rparams;
+	bool kernels = false;
+	for(int n = 1; n != argc; ++n) {
+		const std::string arg(argv[n]);
+		if(arg.substr(0, 9) == "--warmup=") {
+			warmup = boost::lexical_cast<int>(arg.substr(9));
+		} else if(arg.substr(0, 7) == "--reps=") {
+			reps = boost::lexical_cast<int>(arg.substr(7));
+		} else if(arg.substr(0, 7) == "--size=") {
+			size = boost::lexical_cast<unsigned>(arg.substr(7));
+		} else if(arg.substr(0, 9) == "--output=") {
+			output_file = arg.substr(9);
+		} else if(arg.substr(0, 11) == "--baseline=") {
+			baseline_file = arg.substr(11);
+		} else if(arg.substr(0, 12) == "--tolerance=") {
+			tolerance = boost::lexical_cast<double>(arg.substr(12));
+		} else if(arg == "--lazy-paths") {
+			popts.lazy_paths = true;
+		} else if(arg == "--optimise-tree") {
+			popts.optimise_tree = true;
+		} else if(arg == "--batch-fills") {
+			rparams.batch_fills = true;
+		} else if(arg == "--lod") {
+			popts.level_of_detail = true;
+		} else if(arg.substr(0, 10) == "--threads=") {
+			rparams.filter_threads = boost::lexical_cast<int>(arg.substr(10));
+		} else if(arg == "--kernels") {
+			kernels = true;
+		} else if(arg.substr(0, 10) == "--quality=") {
+			if(!KRE::SVG::parse_render_quality(arg.substr(10), &rparams.quality)) {
+				std::cerr << "Unknown quality: " << arg.substr(10) << std::endl;
+				return 1;
+			}
+		} else if(arg[0] == '-') {
+			std::cerr << "Unknown option: " << arg << std::endl;
+			return 1;
+		} else {
+			collect_files(arg, &files);
+		}
+	}
+	if(kernels) {
+		return run_kernels(reps);
+	}
+	if(files.empty()) {
+		collect_files("icons", &files);
+		collect_files("citadel_icons", &files);
+	}
+	if(files.empty()) {
+		std::cerr << "No input files found." << std::endl;
+		return 1;
+	}
+	ASSERT_LOG(reps > 0 && size > 0, "Repetitions and size must be positive");
+	// Sorted so the run order, and therefore cache behaviour, is repeatable.
+	std::sort(files.begin(), files.end());
+
+	double times[PHASE_COUNT];
+	for(int w = 0; w != warmup; ++w) {
+		for(auto& f : files) {
+			run_once(f, size, popts, rparams, times);
+		}
+	}
+
+	std::map<std::string, sample_list> per_file;
+	sample_list corpus;
+	for(int r = 0; r != reps; ++r) {
+		double totals[PHASE_COUNT] = {};
+		for(auto& f : files) {
+			run_once(f, size, popts, rparams, times);
+			sample_list& samples = per_file[f];
+			for(int n = 0; n != PHASE_COUNT; ++n) {
+				samples[n].emplace_back(times[n]);
+				totals[n] += times[n];
+			}
+		}
+		for(int n = 0; n != PHASE_COUNT; ++n) {
+			corpus[n].emplace_back(totals[n]);
+		}
+	}
+
+	variant_map config;
+	config[variant("warmup")] = variant(warmup);
+	config[variant("repetitions")] = variant(reps);
+	config[variant("size")] = variant(static_cast<int>(size));
+	config[variant("files")] = variant(static_cast<int>(files.size()));
+	config[variant("quality")] = variant(static_cast<int>(rparams.quality));
+	config[variant("level_of_detail")] = variant::from_bool(popts.level_of_detail);
+	config[variant("lazy_paths")] = variant::from_bool(popts.lazy_paths);
+	config[variant("optimise_tree")] = variant::from_bool(popts.optimise_tree);
+	config[variant("batch_fills")] = variant::from_bool(rparams.batch_fills);
+	config[variant("threads")] = variant(rparams.filter_threads > 0 ? rparams.filter_threads : static_cast<int>(std::thread::hardware_concurrency()));
+	variant_map files_map;
+	for(auto& pf : per_file) {
+		files_map[variant(pf.first)] = summarise(pf.second);
+	}
+	variant_map result_map;
+	result_map[variant("config")] = variant(config);
+	result_map[variant("phases")] = summarise(corpus);
+	result_map[variant("files")] = variant(files_map);
+	const variant result(result_map);
+
+	std::cerr << files.size() << " files, " << reps << " repetitions at " << size << "x" << size << ", corpus milliseconds:" << std::endl;
+	for(int n = 0; n != PHASE_COUNT; ++n) {
+		std::cerr << "  " << phase_names[n] << ": p50 " << percentile(corpus[n], 50) 
+			<< ", p90 " << percentile(corpus[n], 90) << ", p99 " << percentile(corpus[n], 99) << std::endl;
+	}
+
+	if(output_file.empty()) {
+		json::write(std::cout, result);
+		std::cout << std::endl;
+	} else {
+		std::ofstream os(output_file.c_str());
+		ASSERT_LOG(os, "Unable to write benchmark results to " << output_file);
+		json::write(os, result);
+	}
+
+	if(!baseline_file.empty()) {
+		const variant baseline = json::parse_from_file(baseline_file);
+		if(!same_settings(baseline, result)) {
+			std::cerr << "*** " << baseline_file << " was run with different settings, not comparing ***" << std::endl;
+			return 3;
+		}
+		const int regressions = compare_baseline(baseline, result, tolerance);
+		if(regressions > 0) {
+			std::cerr << "*** " << regressions << " phase(s) regressed by more than " << tolerance << "% against " << baseline_file << " ***" << std::endl;
+			return 2;
+		}
+	}
+	return 0;
+}
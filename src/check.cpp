@@ -0,0 +1,398 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+// Checks of the parser, optimiser and compiled documents that don't need anything
+// drawn to look at, run with 'make check'.
+// Each check reads a small document written to a temporary file and looks at
+// the resulting tree or output. The exit status is the number of checks that failed.
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "asserts.hpp"
+#include "svg/svg_binary.hpp"
+#include "svg/svg_element.hpp"
+#include "svg/svg_filter_kernels.hpp"
+#include "svg/svg_optimise.hpp"
+#include "svg/svg_parse.hpp"
+#include "svg/svg_path_parse.hpp"
+
+namespace
+{
+	struct check
+	{
+		const char* name;
+		std::function<bool()> fn;
+	};
+
+	// A file holding contents, removed again when this goes out of scope.
+	struct temp_file
+	{
+		explicit temp_file(const std::string& contents)
+			: path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("svg_check-%%%%-%%%%.svg"))
+		{
+			std::ofstream f(path.string().c_str(), std::ios::binary);
+			f << contents;
+		}
+		~temp_file()
+		{
+			boost::system::error_code ec;
+			boost::filesystem::remove(path, ec);
+		}
+		boost::filesystem::path path;
+	};
+
+	// Parses document with nothing pruned, so that definitions can be looked up
+	// by id afterwards.
+	std::shared_ptr<KRE::SVG::parse> parse_string(const std::string& document)
+	{
+		temp_file f(document);
+		KRE::SVG::parse_options opts;
+		opts.prune_definitions = false;
+		return std::make_shared<KRE::SVG::parse>(f.path.string(), opts);
+	}
+
+	std::string optimise_string(const std::string& document)
+	{
+		temp_file f(document);
+		std::ostringstream os;
+		KRE::SVG::optimise(f.path.string(), os);
+		return os.str();
+	}
+
+	bool contains(const std::string& s, const std::string& part)
+	{
+		return s.find(part) != std::string::npos;
+	}
+
+	KRE::SVG::element_ptr find(const KRE::SVG::parse& doc, const std::string& id)
+	{
+		for(auto& e : doc.elements()) {
+			auto child = e->find_child(id);
+			if(child) {
+				return child;
+			}
+		}
+		return KRE::SVG::element_ptr();
+	}
+
+	bool filter_reference_resolves()
+	{
+		auto doc = parse_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<defs><filter id='blur'><feGaussianBlur stdDeviation='2'/></filter></defs>"
+			"<rect id='r' width='8' height='8' filter='url(#blur)'/>"
+			"</svg>");
+		auto r = find(*doc, "r");
+		return r && r->has_filter();
+	}
+
+	bool marker_references_resolve()
+	{
+		auto doc = parse_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<defs><marker id='dot' markerWidth='2' markerHeight='2'><circle cx='1' cy='1' r='1'/></marker></defs>"
+			"<path id='p' d='M1 1L8 8L15 1' stroke='black' marker-start='url(#dot)' marker-mid='url(#dot)' marker-end='url(#dot)'/>"
+			"</svg>");
+		auto p = find(*doc, "p");
+		return p && p->has_markers();
+	}
+
+	// Path data as header type followed by the points of each element, to compare
+	// against what's expected.
+	std::vector<double> path_values(const std::string& d)
+	{
+		KRE::SVG::path_geometry geom(KRE::SVG::parse_path(d));
+		std::vector<double> res;
+		auto& data = geom.data();
+		for(size_t n = 0; n < data.size(); n += data[n].header.length) {
+			res.push_back(data[n].header.type);
+			for(int i = 1; i < data[n].header.length; ++i) {
+				res.push_back(data[n+i].point.x);
+				res.push_back(data[n+i].point.y);
+			}
+		}
+		return res;
+	}
+
+	bool path_geometry_keeps_full_precision()
+	{
+		// Both would be lost to cairo's 24.8 fixed point.
+		const std::vector<double> expected = {
+			CAIRO_PATH_MOVE_TO, 0.001, 0.002,
+			CAIRO_PATH_LINE_TO, 1000000.25, 0.003,
+		};
+		return path_values("M0.001 0.002L1000000.25 0.003") == expected;
+	}
+
+	bool path_geometry_resolves_relative_and_close()
+	{
+		// After a close, relative commands are from the start of the sub-path, 
+		// which an explicit move marks.
+		const std::vector<double> expected = {
+			CAIRO_PATH_MOVE_TO, 1, 1,
+			CAIRO_PATH_LINE_TO, 3, 1,
+			CAIRO_PATH_CLOSE_PATH,
+			CAIRO_PATH_MOVE_TO, 1, 1,
+			CAIRO_PATH_LINE_TO, 1, 4,
+			CAIRO_PATH_CURVE_TO, 1, 4, 2, 5, 3, 5,
+			CAIRO_PATH_CURVE_TO, 4, 5, 5, 4, 5, 3,
+		};
+		return path_values("M1 1h2zl0 3c0 0 1 1 2 1s2 -1 2 -2") == expected;
+	}
+
+	// Random premultiplied pixels, with a transparent border so that the bounds
+	// are inside the image. The size is odd so the kernels' tails get used.
+	KRE::SVG::filter_image random_image(uint32_t seed)
+	{
+		KRE::SVG::filter_image img(131, 67);
+		for(int y = 2; y < img.height - 3; ++y) {
+			for(int x = 3; x < img.width - 2; ++x) {
+				seed = seed * 1664525 + 1013904223;
+				const uint32_t a = seed >> 24;
+				img.row(y)[x] = (a << 24) | (((seed >> 16) & 0xff) * a / 255 << 16) | (((seed >> 8) & 0xff) * a / 255 << 8) | ((seed & 0xff) * a / 255);
+			}
+		}
+		return img;
+	}
+
+	bool filter_kernels_match_scalar()
+	{
+		using namespace KRE::SVG;
+		const filter_image src = random_image(1), other = random_image(2);
+		bool ok = true;
+		auto compare = [&](const char* what, const filter_image& a, const filter_image& b) {
+			if(a.pixels != b.pixels) {
+				std::cerr << what << " differs from the scalar version" << std::endl;
+				ok = false;
+			}
+		};
+
+		const double k[4] = { 0.5, 0.5, 0.5, 0 };
+		const CompositeOperator ops[] = { CompositeOperator::OVER, CompositeOperator::IN, CompositeOperator::OUT, 
+			CompositeOperator::ATOP, CompositeOperator::XOR, CompositeOperator::ARITHMETIC };
+		for(auto op : ops) {
+			filter_image a = src, b = src;
+			composite_images(a, other, op, k, 1);
+			scalar::composite_images(b, other, op, k, 1);
+			compare("composite", a, b);
+		}
+		const BlendMode modes[] = { BlendMode::NORMAL, BlendMode::MULTIPLY, BlendMode::SCREEN, BlendMode::DARKEN, BlendMode::LIGHTEN };
+		for(auto mode : modes) {
+			filter_image a = src, b = src;
+			blend_images(a, other, mode, 1);
+			scalar::blend_images(b, other, mode, 1);
+			compare("blend", a, b);
+		}
+
+		const float saturate[20] = {
+			0.6065f, 0.3575f, 0.036f, 0, 0,
+			0.1065f, 0.8575f, 0.036f, 0, 0,
+			0.1065f, 0.3575f, 0.536f, 0, 0,
+			0, 0, 0, 0.8f, 0.1f,
+		};
+		filter_image a = src, b = src;
+		color_matrix(a, saturate, 1);
+		scalar::color_matrix(b, saturate, 1);
+		compare("color_matrix", a, b);
+
+		a = src;
+		b = src;
+		box_blur_horizontal(a, 3, 2, 1);
+		scalar::box_blur_horizontal(b, 3, 2, 1);
+		box_blur_vertical(a, 2, 3, 1);
+		scalar::box_blur_vertical(b, 2, 3, 1);
+		compare("box blur", a, b);
+
+		std::vector<uint8_t> la(src.width * src.height), lb(la.size());
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&src.pixels[0]);
+		luminance_to_alpha(bytes, src.width * 4, &la[0], src.width, src.width, src.height);
+		scalar::luminance_to_alpha(bytes, src.width * 4, &lb[0], src.width, src.width, src.height);
+		if(la != lb) {
+			std::cerr << "luminance_to_alpha differs from the scalar version" << std::endl;
+			ok = false;
+		}
+
+		int ra[4] = {}, rb[4] = {};
+		const bool fa = opaque_bounds(bytes, src.width, src.height, src.width * 4, &ra[0], &ra[1], &ra[2], &ra[3]);
+		const bool fb = scalar::opaque_bounds(bytes, src.width, src.height, src.width * 4, &rb[0], &rb[1], &rb[2], &rb[3]);
+		if(fa != fb || !std::equal(ra, ra + 4, rb)) {
+			std::cerr << "opaque_bounds differs from the scalar version" << std::endl;
+			ok = false;
+		}
+		return ok;
+	}
+
+	// Keeps the path data of every fill, stroke and clip, as the header type and
+	// length followed by the points of each element.
+	class path_recorder : public KRE::SVG::render_recorder
+	{
+	public:
+		void save() override {}
+		void restore() override {}
+		void push_group() override {}
+		void pop_group(bool paint, double alpha) override {}
+		void fill(cairo_t* cairo) override { add(cairo); }
+		void stroke(cairo_t* cairo) override { add(cairo); }
+		void clip(cairo_t* cairo) override { add(cairo); }
+		void begin_element(const std::string& id) override {}
+		void end_element(const std::string& id) override {}
+		void unsupported(const std::string& what) override {}
+
+		std::vector<double> values;
+	private:
+		void add(cairo_t* cairo) {
+			cairo_path_t* path = cairo_copy_path(cairo);
+			for(int n = 0; n < path->num_data; n += path->data[n].header.length) {
+				values.push_back(path->data[n].header.type);
+				values.push_back(path->data[n].header.length);
+				for(int i = 1; i < path->data[n].header.length; ++i) {
+					values.push_back(path->data[n+i].point.x);
+					values.push_back(path->data[n+i].point.y);
+				}
+			}
+			cairo_path_destroy(path);
+		}
+	};
+
+	std::vector<double> recorded_paths(const std::function<void(KRE::SVG::render_context&)>& draw)
+	{
+		cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 16, 16);
+		cairo_t* cairo = cairo_create(surface);
+		path_recorder recorder;
+		{
+			KRE::SVG::render_context ctx(cairo, 16, 16);
+			ctx.set_quality(KRE::SVG::RenderQuality::NORMAL);
+			ctx.set_use_level_of_detail(false);
+			ctx.set_recorder(&recorder);
+			draw(ctx);
+		}
+		cairo_destroy(cairo);
+		cairo_surface_destroy(surface);
+		return recorder.values;
+	}
+
+	bool binary_round_trip_keeps_paths()
+	{
+		auto doc = parse_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<clipPath id='c'><rect width='12' height='12'/></clipPath>"
+			"<g clip-path='url(#c)'>"
+			"<path d='M1 1h2zl0 3c0 0 1 1 2 1s2 -1 2 -2' fill='red' stroke='blue'/>"
+			"<circle cx='8' cy='8' r='3.25'/>"
+			"</g>"
+			"<polyline points='1,15 4,12 7,15' fill='none' stroke='black'/>"
+			"</svg>");
+		temp_file f("");
+		if(!KRE::SVG::write_binary(f.path.string(), KRE::SVG::compile_binary(*doc))) {
+			return false;
+		}
+		auto compiled = KRE::SVG::binary_document::load(f.path.string());
+		if(!compiled) {
+			return false;
+		}
+		const auto expected = recorded_paths([&doc](KRE::SVG::render_context& ctx) { doc->render(ctx); });
+		const auto actual = recorded_paths([&compiled](KRE::SVG::render_context& ctx) { compiled->render(ctx); });
+		// Both went through cairo's fixed point, replaying only rounds again.
+		return !expected.empty() && expected.size() == actual.size() 
+			&& std::equal(expected.begin(), expected.end(), actual.begin(), [](double a, double b) { 
+				return std::abs(a - b) < 1e-6; 
+			});
+	}
+
+	bool optimise_keeps_mixed_text_in_order()
+	{
+		auto out = optimise_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<text x='1' y='8'>a<tspan>b</tspan>c</text>"
+			"</svg>");
+		return contains(out, ">a<tspan>b</tspan>c</text>");
+	}
+
+	bool optimise_leaves_used_paths_untransformed()
+	{
+		auto out = optimise_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' xmlns:xlink='http://www.w3.org/1999/xlink' width='16' height='16'>"
+			"<path id='p' transform='scale(2)' d='M1 1L4 4' stroke='red' stroke-width='1'/>"
+			"<use xlink:href='#p' stroke-width='3'/>"
+			"</svg>");
+		return contains(out, "transform=\"scale(2)\"") && !contains(out, "stroke-width=\"2\"");
+	}
+
+	bool optimise_keeps_groups_and_defaults_with_style_sheet()
+	{
+		auto out = optimise_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<style>g > rect { fill: red }</style>"
+			"<g><rect width='8' height='8' fill-opacity='1'/></g>"
+			"</svg>");
+		return contains(out, "<g>") && contains(out, "fill-opacity");
+	}
+
+	bool optimise_keeps_switch_children()
+	{
+		auto out = optimise_string(
+			"<svg xmlns='http://www.w3.org/2000/svg' width='16' height='16'>"
+			"<switch><g><rect width='8' height='8'/><rect x='8' width='8' height='8'/></g><rect width='16' height='16'/></switch>"
+			"</svg>");
+		return contains(out, "<switch><g>");
+	}
+
+	const check checks[] = {
+		{ "filter_reference_resolves", filter_reference_resolves },
+		{ "marker_references_resolve", marker_references_resolve },
+		{ "path_geometry_keeps_full_precision", path_geometry_keeps_full_precision },
+		{ "path_geometry_resolves_relative_and_close", path_geometry_resolves_relative_and_close },
+		{ "filter_kernels_match_scalar", filter_kernels_match_scalar },
+		{ "binary_round_trip_keeps_paths", binary_round_trip_keeps_paths },
+		{ "optimise_keeps_mixed_text_in_order", optimise_keeps_mixed_text_in_order },
+		{ "optimise_leaves_used_paths_untransformed", optimise_leaves_used_paths_untransformed },
+		{ "optimise_keeps_groups_and_defaults_with_style_sheet", optimise_keeps_groups_and_defaults_with_style_sheet },
+		{ "optimise_keeps_switch_children", optimise_keeps_switch_children },
+	};
+}
+
+int main(int argc, char* argv[])
+{
+	int failed = 0;
+	for(auto& c : checks) {
+		bool ok = false;
+		try {
+			ok = c.fn();
+		} catch(std::exception& e) {
+			std::cerr << c.name << ": " << e.what() << std::endl;
+		}
+		std::cout << (ok ? "PASS " : "FAIL ") << c.name << std::endl;
+		if(!ok) {
+			++failed;
+		}
+	}
+	return failed;
+}
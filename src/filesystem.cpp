@@ -35,6 +35,8 @@
 #endif
 
 #include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
@@ -176,6 +178,58 @@ namespace sys
 		}
 	}
 
+	int64_t file_size(const std::string& fname)
+	{
+		path p(fname);
+		boost::system::error_code ec;
+		if(is_regular_file(p, ec)) {
+			auto size = boost::filesystem::file_size(p, ec);
+			if(!ec) {
+				return static_cast<int64_t>(size);
+			}
+		}
+		return 0;
+	}
+
+	struct mapped_file::impl
+	{
+		boost::interprocess::file_mapping mapping;
+		boost::interprocess::mapped_region region;
+	};
+
+	mapped_file::mapped_file()
+		: impl_(new impl)
+	{
+	}
+
+	mapped_file::~mapped_file()
+	{
+	}
+
+	std::shared_ptr<mapped_file> mapped_file::open(const std::string& fname, bool copy_on_write)
+	{
+		using namespace boost::interprocess;
+		try {
+			std::shared_ptr<mapped_file> mf(new mapped_file());
+			file_mapping(fname.c_str(), read_only).swap(mf->impl_->mapping);
+			mapped_region(mf->impl_->mapping, copy_on_write ? boost::interprocess::copy_on_write : read_only).swap(mf->impl_->region);
+			return mf;
+		} catch(interprocess_exception& e) {
+			LOG_ERROR("Unable to map file '" << fname << "': " << e.what());
+		}
+		return std::shared_ptr<mapped_file>();
+	}
+
+	void* mapped_file::data() const
+	{
+		return impl_->region.get_address();
+	}
+
+	size_t mapped_file::size() const
+	{
+		return impl_->region.get_size();
+	}
+
 	void move_file(const std::string& from, const std::string& to)
 	{
 		rename(path(from), path(to));
@@ -26,6 +26,7 @@
 #include <boost/function.hpp>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -70,6 +71,8 @@ bool file_exists(const std::string& fname);
 std::string find_file(const std::string& name);
 
 int64_t file_mod_time(const std::string& fname);
+//returns the size of the file in bytes, or zero if it isn't a regular file.
+int64_t file_size(const std::string& fname);
 
 #if defined(__ANDROID__)
 SDL_RWops* read_sdl_rw_from_asset(const std::string& name);
@@ -86,4 +89,25 @@ bool is_path_absolute(const std::string& path);
 std::string make_conformal_path(const std::string& path);
 std::string compute_relative_path(const std::string& source, const std::string& target);
 
+//! A file mapped into memory. Unless copy_on_write is set the memory is
+//! read-only, with copy_on_write changes are private and never reach the file.
+class mapped_file
+{
+public:
+	//! Returns nullptr, after logging why, if the file can't be mapped.
+	static std::shared_ptr<mapped_file> open(const std::string& fname, bool copy_on_write=false);
+	~mapped_file();
+
+	void* data() const;
+	size_t size() const;
+private:
+	mapped_file();
+	mapped_file(const mapped_file&);
+	void operator=(const mapped_file&);
+
+	struct impl;
+	std::unique_ptr<impl> impl_;
+};
+typedef std::shared_ptr<mapped_file> mapped_file_ptr;
+
 }
@@ -22,6 +22,7 @@
 */
 
 #include <map>
+#include <mutex>
 
 #include "asserts.hpp"
 #include "ft_iface.hpp"
@@ -38,6 +39,14 @@ namespace KRE
 		{
 			const char* fallback_font_name = "FreeSans.ttf";
 
+			// Guards the freetype library handle and the font map, since documents
+			// may be rendered from several threads at once.
+			std::mutex& get_font_mutex()
+			{
+				static std::mutex font_mutex;
+				return font_mutex;
+			}
+
 			FT_Library& get_freetype_library()
 			{
 				static FT_Library library = NULL;
@@ -51,6 +60,7 @@ namespace KRE
 
 		FT_Face get_font_face(const std::string& font_file, int index)
 		{
+			std::lock_guard<std::mutex> lock(get_font_mutex());
 			FT_Library& library = get_freetype_library();
 			static std::map<std::string,FT_Face> font_map;
 			auto it = font_map.find(font_file);
@@ -411,4 +411,9 @@ namespace json
 			throw parse_error(formatter() << "File \"" <<  fname << "\" doesn't exist");
 		}
 	}
+
+	void write(std::ostream& os, const variant& n, bool pretty)
+	{
+		n.write_json(os, pretty);
+	}
 }
@@ -1,19 +1,546 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <map>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
 #include <cairo.h>
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
+#include "memory_tracker.hpp"
 #include "profile_timer.hpp"
+#include "svg/svg_atlas.hpp"
+#include "svg/svg_binary.hpp"
+#include "svg/svg_bitmap.hpp"
+#include "svg/svg_cache.hpp"
+#include "svg/svg_image.hpp"
+#include "svg/svg_optimise.hpp"
 #include "svg/svg_parse.hpp"
+#include "svg/svg_path_parse.hpp"
+#include "svg/svg_stream.hpp"
 #include "SDLWrapper.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "svg/utils.hpp"
 
 namespace 
 {
 	const int width = 512;//1200;
 	const int height = 512;//400;
+
+	// Simple shell style wildcard match, supporting '*' and '?'.
+	bool wildcard_match(const char* pattern, const char* str)
+	{
+		if(*pattern == '\0') {
+			return *str == '\0';
+		}
+		if(*pattern == '*') {
+			for(const char* s = str; ; ++s) {
+				if(wildcard_match(pattern+1, s)) {
+					return true;
+				}
+				if(*s == '\0') {
+					return false;
+				}
+			}
+		}
+		if(*str == '\0') {
+			return false;
+		}
+		if(*pattern == '?' || *pattern == *str) {
+			return wildcard_match(pattern+1, str+1);
+		}
+		return false;
+	}
+
+	bool has_svg_extension(const boost::filesystem::path& p)
+	{
+		return p.has_extension() && p.extension().string() == ".svg";
+	}
+
+	// Expands an argument that may be a file, a directory (all the .svg files
+	// directly inside it) or a glob pattern in the filename part of the path.
+	void expand_input(const std::string& arg, std::vector<std::string>* files)
+	{
+		using namespace boost::filesystem;
+		if(sys::is_directory(arg)) {
+			std::vector<std::string> names;
+			sys::get_files_in_dir(arg, &names);
+			for(auto& name : names) {
+				path p = path(arg) / name;
+				if(has_svg_extension(p)) {
+					files->emplace_back(p.generic_string());
+				}
+			}
+			return;
+		}
+		path p(arg);
+		const std::string pattern = p.filename().string();
+		if(pattern.find_first_of("*?") == std::string::npos) {
+			files->emplace_back(arg);
+			return;
+		}
+		const std::string dir = p.has_parent_path() ? p.parent_path().string() : ".";
+		std::vector<std::string> names;
+		sys::get_files_in_dir(dir, &names);
+		for(auto& name : names) {
+			if(wildcard_match(pattern.c_str(), name.c_str())) {
+				files->emplace_back(p.has_parent_path() ? (path(dir) / name).generic_string() : name);
+			}
+		}
+	}
+
+	std::string output_filename(const std::string& filename, const std::string& output_dir, int size, bool multiple_sizes)
+	{
+		using namespace boost::filesystem;
+		path npath(filename);
+		std::string stem = npath.stem().string();
+		if(multiple_sizes) {
+			stem += "_" + boost::lexical_cast<std::string>(size);
+		}
+		path out = output_dir.empty() ? npath.parent_path() : path(output_dir);
+		return (out / (stem + ".png")).generic_string();
+	}
+
+	void clear_surface(cairo_t* cairo)
+	{
+		cairo_save(cairo);
+		cairo_set_operator(cairo, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cairo);
+		cairo_restore(cairo);
+	}
+
+	// Headless rendering of many files at many sizes. Every file is a job run
+	// on the thread pool: parse once, then render and encode each size into a
+	// surface owned by the worker thread.
+	int run_batch(const std::vector<std::string>& args, const std::vector<int>& sizes, const std::string& output_dir, int nthreads, bool write_image, const KRE::SVG::parse_options& popts, KRE::SVG::RenderQuality quality, KRE::SVG::raster_cache* cache)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+		if(files.empty()) {
+			std::cerr << "No input files found." << std::endl;
+			return 1;
+		}
+		if(!output_dir.empty()) {
+			boost::system::error_code ec;
+			boost::filesystem::create_directories(output_dir, ec);
+			ASSERT_LOG(!ec, "Unable to create output directory: " << output_dir << " : " << ec.message());
+		}
+
+		// Largest files first, since they're likely to take the longest to render,
+		// which leaves the small ones to fill in the gaps at the end.
+		std::vector<std::pair<int64_t, std::string>> jobs;
+		for(auto& f : files) {
+			jobs.emplace_back(sys::file_size(f), f);
+		}
+		std::stable_sort(jobs.begin(), jobs.end(), [](const std::pair<int64_t, std::string>& a, const std::pair<int64_t, std::string>& b) {
+			return a.first > b.first;
+		});
+
+		threading::thread_pool pool(nthreads);
+		// Per worker surfaces, keyed on size. Only ever touched by the owning worker.
+		std::vector<std::map<int, cairo_surface_t*>> surfaces(pool.size());
+		std::atomic<int> failures(0);
+		const bool multiple_sizes = sizes.size() > 1;
+
+		auto start_time = std::chrono::steady_clock::now();
+		for(auto& job : jobs) {
+			const std::string filename = job.second;
+			pool.submit([&, filename](int worker) {
+				try {
+					// Anything already in the cache doesn't need the file parsing at all.
+					// These change the output, so keep them apart in the cache.
+					KRE::SVG::render_params params;
+					params.quality = quality;
+					params.level_of_detail = popts.level_of_detail;
+					params.lod_pixel_tolerance = popts.lod_pixel_tolerance;
+					params.optimise_tree = popts.optimise_tree;
+					std::vector<int> todo;
+					for(auto size : sizes) {
+						auto bmp = cache ? cache->find(filename, size, size, params) : KRE::SVG::bitmap_ptr();
+						if(bmp == nullptr) {
+							todo.emplace_back(size);
+						} else if(write_image && !bmp->write_png(output_filename(filename, output_dir, size, multiple_sizes))) {
+							++failures;
+						}
+					}
+					if(todo.empty()) {
+						return;
+					}
+
+					KRE::SVG::parse p(filename, popts);
+					for(auto size : todo) {
+						cairo_surface_t*& surface = surfaces[worker][size];
+						if(surface == nullptr) {
+							surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, size, size);
+						}
+						cairo_t* cairo = cairo_create(surface);
+						clear_surface(cairo);
+						{
+							KRE::SVG::render_context ctx(cairo, size, size);
+							ctx.set_quality(params.quality);
+							ctx.set_filter_threads(1);
+							p.render(ctx);
+						}
+						auto status = cairo_status(cairo);
+						cairo_destroy(cairo);
+						if(status != CAIRO_STATUS_SUCCESS) {
+							LOG_ERROR("Cairo error rendering " << filename << " : " << cairo_status_to_string(status));
+							++failures;
+							continue;
+						}
+						cairo_surface_flush(surface);
+						if(cache) {
+							KRE::SVG::bitmap bmp(size, size, cairo_image_surface_get_stride(surface), cairo_image_surface_get_data(surface), nullptr);
+							cache->store(filename, params, bmp);
+						}
+						if(write_image) {
+							TRACE_ZONE("write_png");
+							status = cairo_surface_write_to_png(surface, output_filename(filename, output_dir, size, multiple_sizes).c_str());
+							if(status != CAIRO_STATUS_SUCCESS) {
+								LOG_ERROR("Unable to write png for " << filename << " : " << cairo_status_to_string(status));
+								++failures;
+							}
+						}
+					}
+				} catch(std::exception& e) {
+					LOG_ERROR("Failed to render " << filename << " : " << e.what());
+					++failures;
+				} catch(KRE::SVG::parsing_exception& e) {
+					LOG_ERROR("Failed to parse path data in " << filename << " : " << e.what());
+					++failures;
+				}
+			});
+		}
+		pool.wait_idle();
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		for(auto& worker_surfaces : surfaces) {
+			for(auto& s : worker_surfaces) {
+				cairo_surface_destroy(s.second);
+			}
+		}
+
+		std::cerr << "Rendered " << jobs.size() << " files at " << sizes.size() << " size(s) using " 
+			<< pool.size() << " threads in " << elapsed << " seconds: "
+			<< (elapsed > 0 ? jobs.size() / elapsed : 0) << " files/second";
+		if(failures > 0) {
+			std::cerr << ", " << failures << " failure(s)";
+		}
+		std::cerr << std::endl;
+		if(cache) {
+			auto stats = cache->get_stats();
+			std::cerr << "Raster cache: " << stats.hits << " hits, " << stats.misses << " misses, " 
+				<< stats.evictions << " evictions, " << stats.files_hashed << " files hashed, " 
+				<< stats.bytes << " bytes" << std::endl;
+		}
+		return failures > 0 ? 1 : 0;
+	}
+
+	// Renders everything with and without the simplified paths, reporting the
+	// time taken each way and the largest difference in any pixel channel.
+	int run_lod_check(const std::vector<std::string>& args, const std::vector<int>& sizes, const KRE::SVG::parse_options& popts, int max_error)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+		for(auto size : sizes) {
+			double full_time = 0, lod_time = 0;
+			int worst_error = 0;
+			std::string worst_file;
+			for(auto& filename : files) {
+				KRE::SVG::parse p(filename, popts);
+				KRE::SVG::bitmap full(size, size);
+				KRE::SVG::bitmap lod(size, size);
+				for(int pass = 0; pass != 2; ++pass) {
+					KRE::SVG::bitmap& bmp = pass == 0 ? full : lod;
+					cairo_surface_t* surface = bmp.create_surface();
+					cairo_t* cairo = cairo_create(surface);
+					auto start_time = std::chrono::steady_clock::now();
+					{
+						KRE::SVG::render_context ctx(cairo, size, size);
+						ctx.set_use_level_of_detail(pass != 0);
+						p.render(ctx);
+					}
+					cairo_surface_flush(surface);
+					const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+					(pass == 0 ? full_time : lod_time) += elapsed;
+					cairo_destroy(cairo);
+					cairo_surface_destroy(surface);
+				}
+				int error = 0;
+				for(size_t n = 0; n != full.size_in_bytes(); ++n) {
+					error = std::max(error, std::abs(int(full.data()[n]) - int(lod.data()[n])));
+				}
+				if(error > worst_error) {
+					worst_error = error;
+					worst_file = filename;
+				}
+			}
+			std::cerr << size << "px: full " << full_time << "s, lod " << lod_time << "s, speedup " 
+				<< (lod_time > 0 ? full_time / lod_time : 0) << "x, max channel error " << worst_error;
+			if(!worst_file.empty()) {
+				std::cerr << " (" << worst_file << ")";
+			}
+			std::cerr << std::endl;
+			if(worst_error > max_error) {
+				std::cerr << "Error exceeds limit of " << max_error << std::endl;
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	std::string archive_name(const std::string& filename)
+	{
+		return boost::filesystem::path(filename).stem().string();
+	}
+
+	// Compile every input and pack them into one archive, named by file stem.
+	int run_pack(const std::vector<std::string>& args, const std::string& archive_file)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+		std::map<std::string, std::vector<uint8_t>> documents;
+		size_t xml_bytes = 0;
+		for(auto& filename : files) {
+			const std::string name = archive_name(filename);
+			if(documents.find(name) != documents.end()) {
+				LOG_WARN("Skipping " << filename << ", already have a document named '" << name << "'");
+				continue;
+			}
+			KRE::SVG::parse p(filename);
+			auto blob = KRE::SVG::compile_binary(p);
+			if(blob.empty()) {
+				LOG_WARN("Skipping " << filename << ", it can't be compiled");
+				continue;
+			}
+			documents[name] = blob;
+			xml_bytes += static_cast<size_t>(sys::file_size(filename));
+		}
+		std::vector<std::pair<std::string, std::vector<uint8_t>>> docs(documents.begin(), documents.end());
+		if(!KRE::SVG::write_archive(archive_file, docs)) {
+			return 1;
+		}
+		std::cerr << "Packed " << docs.size() << " documents (" << xml_bytes << " bytes of XML) into " 
+			<< archive_file << " (" << sys::file_size(archive_file) << " bytes)" << std::endl;
+		return 0;
+	}
+
+	// Compare loading every input from XML with looking them all up in an archive.
+	int run_load_bench(const std::vector<std::string>& args, const std::string& archive_file)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+
+		auto start_time = std::chrono::steady_clock::now();
+		for(auto& filename : files) {
+			KRE::SVG::parse p(filename);
+		}
+		const double xml_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		start_time = std::chrono::steady_clock::now();
+		auto archive = KRE::SVG::binary_archive::open(archive_file);
+		if(archive == nullptr) {
+			return 1;
+		}
+		size_t missing = 0;
+		for(auto& filename : files) {
+			if(archive->find(archive_name(filename)) == nullptr) {
+				++missing;
+			}
+		}
+		const double binary_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+		std::cerr << "Loaded " << files.size() << " documents: XML " << xml_time << "s, binary " << binary_time << "s";
+		if(binary_time > 0) {
+			std::cerr << " (" << xml_time / binary_time << "x)";
+		}
+		if(missing > 0) {
+			std::cerr << ", " << missing << " not in archive";
+		}
+		std::cerr << std::endl;
+		return 0;
+	}
+
+	void print_stats(const KRE::SVG::render_stats& stats)
+	{
+		std::cerr << "  elements visited: " << stats.elements_visited << std::endl
+			<< "  elements culled: " << stats.elements_culled << std::endl
+			<< "  groups pushed: " << stats.groups_pushed << std::endl
+			<< "  saves: " << stats.saves << std::endl
+			<< "  path segments: " << stats.path_segments << std::endl
+			<< "  fills: " << stats.fills << std::endl
+			<< "  fills batched: " << stats.fills_batched << std::endl
+			<< "  strokes: " << stats.strokes << std::endl
+			<< "  glyphs: " << stats.glyphs << std::endl
+			<< "  group surface bytes: " << stats.surface_bytes << std::endl
+			<< "  filters: " << stats.filters << " covering " << stats.filter_pixels << " pixels" << std::endl
+			<< "  rectangle clips: " << stats.rectangle_clips << std::endl
+			<< "  clip masks: " << stats.clip_masks_built << " built, " << stats.clip_masks_reused << " reused" << std::endl
+			<< "  markers: " << stats.markers << " drawn, " << stats.marker_images << " images built" << std::endl;
+	}
+
+	void print_image_stats(const KRE::SVG::image_cache::stats& stats)
+	{
+		std::cerr << "Embedded images: " << stats.misses << " decoded, " << stats.hits << " shared, " 
+			<< stats.failures << " failed, " << stats.bytes << " bytes cached" << std::endl;
+		if(stats.base64_seconds > 0) {
+			std::cerr << "  base64: " << (stats.encoded_bytes / stats.base64_seconds / 1e6) << " MB/s" << std::endl;
+		}
+		if(stats.png_seconds > 0) {
+			std::cerr << "  png: " << (stats.compressed_bytes / stats.png_seconds / 1e6) << " MB/s" << std::endl;
+		}
+	}
+
+	// tracked_bytes is what operator new says the parse kept hold of, only
+	// meaningful in builds with TRACK_ALLOCATIONS.
+	void print_memory(const KRE::SVG::memory_report& mr, int64_t tracked_bytes)
+	{
+		std::cerr << "  elements: " << mr.elements << std::endl
+			<< "  element nodes: " << mr.element_nodes << " bytes" << std::endl
+			<< "  attributes: " << mr.attributes << " bytes" << std::endl
+			<< "  path geometry: " << mr.path_geometry << " bytes" << std::endl
+			<< "  paints: " << mr.paints << " bytes" << std::endl
+			<< "  strings: " << mr.strings << " bytes" << std::endl
+			<< "  text: " << mr.text << " bytes" << std::endl
+			<< "  total: " << mr.total() << " bytes" << std::endl
+			<< "  images and clip masks: " << mr.images << " bytes" << std::endl;
+		if(memory_tracker::enabled()) {
+			std::cerr << "  allocated (tracked): " << tracked_bytes << " bytes";
+			if(tracked_bytes > 0) {
+				std::cerr << ", report covers " << (100.0 * mr.total() / tracked_bytes) << "%";
+			}
+			std::cerr << std::endl;
+		}
+	}
+
+	// Writes out whatever was traced when main() returns.
+	struct trace_writer
+	{
+		explicit trace_writer(const std::string& f) : filename(f) {
+			if(!filename.empty()) {
+#ifndef ENABLE_TRACING
+				LOG_WARN("Built without ENABLE_TRACING, the trace written to " << filename << " will be empty");
+#endif
+				trace::set_enabled(true);
+			}
+		}
+		~trace_writer() {
+			if(!filename.empty()) {
+				trace::write_chrome_trace(filename);
+			}
+		}
+		std::string filename;
+	};
+
+	// Render every input and pack the results into texture atlas pages.
+	int run_atlas(const std::vector<std::string>& args, const std::vector<int>& sizes, const std::string& atlas_dir, int nthreads, const KRE::SVG::atlas_options& aopts)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+		if(files.empty()) {
+			std::cerr << "No input files found." << std::endl;
+			return 1;
+		}
+		std::sort(files.begin(), files.end());
+		files.erase(std::unique(files.begin(), files.end()), files.end());
+
+		std::vector<KRE::SVG::bitmap_size> bsizes;
+		for(auto sz : sizes) {
+			bsizes.emplace_back(sz, sz);
+		}
+
+		auto start_time = std::chrono::steady_clock::now();
+		KRE::SVG::texture_atlas atlas(aopts);
+		{
+			threading::thread_pool pool(nthreads);
+			KRE::SVG::build_atlas(&atlas, files, bsizes, &pool);
+		}
+		if(!atlas.write(atlas_dir, "atlas")) {
+			return 1;
+		}
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		std::cerr << "Packed " << atlas.entries().size() << " images from " << files.size() << " files into " 
+			<< atlas.pages().size() << " " << aopts.page_width << "x" << aopts.page_height << " pages in " << elapsed << "s" << std::endl;
+		return 0;
+	}
+
+	double parse_time(const std::vector<std::string>& files)
+	{
+		auto start_time = std::chrono::steady_clock::now();
+		for(auto& filename : files) {
+			KRE::SVG::parse p(filename);
+		}
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+	}
+
+	// Write a minified copy of every input to optimise_dir, then compare how 
+	// long the originals and the copies take to parse.
+	int run_optimise(const std::vector<std::string>& args, const std::string& optimise_dir, const KRE::SVG::optimise_options& oopts)
+	{
+		std::vector<std::string> files;
+		for(auto& arg : args) {
+			expand_input(arg, &files);
+		}
+		boost::system::error_code ec;
+		boost::filesystem::create_directories(optimise_dir, ec);
+		ASSERT_LOG(!ec, "Unable to create output directory: " << optimise_dir << " : " << ec.message());
+
+		std::vector<std::string> outputs;
+		KRE::SVG::optimise_result total;
+		for(auto& filename : files) {
+			const std::string out = (boost::filesystem::path(optimise_dir) / boost::filesystem::path(filename).filename()).generic_string();
+			std::ofstream os(out.c_str(), std::ios::binary);
+			ASSERT_LOG(os.is_open(), "Unable to open " << out << " for writing");
+			auto res = KRE::SVG::optimise(filename, os, oopts);
+			total.input_bytes += res.input_bytes;
+			total.output_bytes += res.output_bytes;
+			total.paths_rewritten += res.paths_rewritten;
+			total.transforms_baked += res.transforms_baked;
+			total.groups_collapsed += res.groups_collapsed;
+			total.subtrees_deduplicated += res.subtrees_deduplicated;
+			total.attributes_removed += res.attributes_removed;
+			total.elements_removed += res.elements_removed;
+			outputs.emplace_back(out);
+		}
+		if(files.empty() || total.input_bytes == 0) {
+			std::cerr << "No input files found." << std::endl;
+			return 1;
+		}
+
+		std::cerr << "Optimised " << files.size() << " files: " << total.input_bytes << " -> " << total.output_bytes << " bytes ("
+			<< (100.0 - 100.0 * total.output_bytes / total.input_bytes) << "% smaller)" << std::endl
+			<< "  paths rewritten: " << total.paths_rewritten << std::endl
+			<< "  transforms baked: " << total.transforms_baked << std::endl
+			<< "  groups collapsed: " << total.groups_collapsed << std::endl
+			<< "  subtrees deduplicated: " << total.subtrees_deduplicated << std::endl
+			<< "  attributes removed: " << total.attributes_removed << std::endl
+			<< "  elements removed: " << total.elements_removed << std::endl;
+
+		const double original_time = parse_time(files);
+		const double optimised_time = parse_time(outputs);
+		std::cerr << "Parse: original " << original_time << "s, optimised " << optimised_time << "s";
+		if(optimised_time > 0) {
+			std::cerr << " (" << original_time / optimised_time << "x)";
+		}
+		std::cerr << std::endl;
+		return 0;
+	}
 }
 
 int main(int argc, char* argv[])
@@ -29,18 +556,150 @@ int main(int argc, char* argv[])
 		}
 	}
 	if(args.size() < 1) {
-		std::cerr << "Usage: " << argv[0] << " [--no-display] [--no-write] <filename> [<filename2> ...]" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " [--no-display] [--no-write] [--stats] [--memory] [--stream] [--lazy-paths] [--keep-unused-defs] [--optimise-tree] [--batch-fills] [--quality=preview|normal|best] [--trace=FILE] <filename> [<filename2> ...]" << std::endl;
+		std::cerr << "       " << argv[0] << " --batch [--threads=N] [--sizes=16,32,...] [--output-dir=DIR] [--no-write] [--lod] [--quality=preview|normal|best] [--lazy-paths] [--optimise-tree] [--cache-dir=DIR] [--cache-size=MB] <file|dir|glob> ..." << std::endl;
+		std::cerr << "       " << argv[0] << " --atlas=DIR [--threads=N] [--sizes=16,32,...] [--page-size=N] [--padding=N] [--no-trim] <file|dir|glob> ..." << std::endl;
+		std::cerr << "       " << argv[0] << " --optimise=DIR [--precision=N] <file|dir|glob> ..." << std::endl;
+		std::cerr << "       " << argv[0] << " --pack=ARCHIVE <file|dir|glob> ..." << std::endl;
+		std::cerr << "       " << argv[0] << " --load-bench=ARCHIVE <file|dir|glob> ..." << std::endl;
+		std::cerr << "       " << argv[0] << " --lod-check [--sizes=16,32,...] [--lod-tolerance=PX] [--max-error=N] <file|dir|glob> ..." << std::endl;
 		return 1;
 	}
 
 	bool display_image = true;
 	bool write_image = true;
+	bool batch = false;
+	bool lod_check = false;
+	// A straight edge moved by the LOD tolerance (0.25px by default) changes a
+	// pixel's coverage by at most 255 * 0.25 = 64, allow half of that.
+	int max_error = 32;
+	KRE::SVG::parse_options popts;
+	int nthreads = 0;
+	std::vector<int> sizes;
+	std::string output_dir;
+	std::string pack_file;
+	std::string cache_dir;
+	uint64_t cache_size_mb = 256;
+	std::string load_bench_file;
+	std::string atlas_dir;
+	KRE::SVG::atlas_options aopts;
+	std::string optimise_dir;
+	KRE::SVG::optimise_options oopts;
+	std::string trace_file;
+	bool show_stats = false;
+	bool show_memory = false;
+	bool stream = false;
+	bool batch_fills = false;
+	KRE::SVG::RenderQuality quality = KRE::SVG::RenderQuality::NORMAL;
+	bool quality_set = false;
 	for(auto& arg : opts) {
 		if(arg == "--no-display") {
 			display_image = false;
 		} else if(arg == "--no-write") {
 			write_image = false;
+		} else if(arg == "--batch") {
+			batch = true;
+		} else if(arg.substr(0, 10) == "--threads=") {
+			nthreads = boost::lexical_cast<int>(arg.substr(10));
+		} else if(arg.substr(0, 8) == "--sizes=") {
+			for(auto& sz : utils::split(arg.substr(8), ",")) {
+				sizes.emplace_back(boost::lexical_cast<int>(sz));
+				ASSERT_LOG(sizes.back() > 0, "Sizes must be positive: " << sz);
+			}
+		} else if(arg.substr(0, 13) == "--output-dir=") {
+			output_dir = arg.substr(13);
+		} else if(arg.substr(0, 7) == "--pack=") {
+			pack_file = arg.substr(7);
+		} else if(arg.substr(0, 13) == "--load-bench=") {
+			load_bench_file = arg.substr(13);
+		} else if(arg.substr(0, 12) == "--cache-dir=") {
+			cache_dir = arg.substr(12);
+		} else if(arg.substr(0, 13) == "--cache-size=") {
+			cache_size_mb = boost::lexical_cast<uint64_t>(arg.substr(13));
+		} else if(arg.substr(0, 8) == "--atlas=") {
+			atlas_dir = arg.substr(8);
+		} else if(arg.substr(0, 11) == "--optimise=") {
+			optimise_dir = arg.substr(11);
+		} else if(arg.substr(0, 12) == "--precision=") {
+			oopts.precision = boost::lexical_cast<int>(arg.substr(12));
+		} else if(arg.substr(0, 12) == "--page-size=") {
+			aopts.page_width = aopts.page_height = boost::lexical_cast<unsigned>(arg.substr(12));
+		} else if(arg.substr(0, 10) == "--padding=") {
+			aopts.padding = boost::lexical_cast<unsigned>(arg.substr(10));
+		} else if(arg == "--memory") {
+			show_memory = true;
+		} else if(arg == "--stream") {
+			stream = true;
+		} else if(arg == "--stats") {
+			show_stats = true;
+		} else if(arg.substr(0, 8) == "--trace=") {
+			trace_file = arg.substr(8);
+		} else if(arg == "--no-trim") {
+			aopts.trim = false;
+		} else if(arg == "--keep-unused-defs") {
+			popts.prune_definitions = false;
+		} else if(arg == "--lazy-paths") {
+			popts.lazy_paths = true;
+		} else if(arg == "--optimise-tree") {
+			popts.optimise_tree = true;
+		} else if(arg == "--batch-fills") {
+			batch_fills = true;
+		} else if(arg.substr(0, 10) == "--quality=") {
+			quality_set = KRE::SVG::parse_render_quality(arg.substr(10), &quality);
+			ASSERT_LOG(quality_set, "Unknown quality, expected preview, normal or best: " << arg.substr(10));
+		} else if(arg == "--lod") {
+			popts.level_of_detail = true;
+		} else if(arg == "--lod-check") {
+			lod_check = true;
+			popts.level_of_detail = true;
+		} else if(arg.substr(0, 16) == "--lod-tolerance=") {
+			popts.lod_pixel_tolerance = boost::lexical_cast<double>(arg.substr(16));
+		} else if(arg.substr(0, 12) == "--max-error=") {
+			max_error = boost::lexical_cast<int>(arg.substr(12));
+		}
+	}
+
+	trace_writer tracer(trace_file);
+
+	if(!pack_file.empty()) {
+		return run_pack(args, pack_file);
+	}
+	if(!load_bench_file.empty()) {
+		return run_load_bench(args, load_bench_file);
+	}
+	if(!optimise_dir.empty()) {
+		return run_optimise(args, optimise_dir, oopts);
+	}
+
+	if(!atlas_dir.empty()) {
+		if(sizes.empty()) {
+			sizes.emplace_back(64);
+		}
+		aopts.popts = popts;
+		return run_atlas(args, sizes, atlas_dir, nthreads, aopts);
+	}
+
+	if(lod_check) {
+		if(sizes.empty()) {
+			sizes.emplace_back(16);
+			sizes.emplace_back(32);
+		}
+		return run_lod_check(args, sizes, popts, max_error);
+	}
+
+	if(batch) {
+		if(sizes.empty()) {
+			sizes.emplace_back(width);
+		}
+		std::unique_ptr<KRE::SVG::raster_cache> cache;
+		if(!cache_dir.empty()) {
+			cache.reset(new KRE::SVG::raster_cache(cache_dir, cache_size_mb * 1024 * 1024));
 		}
+		// Simplified paths are only worth having for previews.
+		if(!quality_set && popts.level_of_detail) {
+			quality = KRE::SVG::RenderQuality::PREVIEW;
+		}
+		return run_batch(args, sizes, output_dir, nthreads, write_image, popts, quality, cache.get());
 	}
 
 	cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
@@ -53,16 +712,52 @@ int main(int argc, char* argv[])
 			ASSERT_LOG(false, "File has non-svg extension are you sure you have the correct file? " << filename);
 		}
 
-		KRE::SVG::parse p(filename);
+		// The surface is shared between files, so wipe the previous image.
+		clear_surface(cairo);
+		KRE::SVG::render_stats stats;
+		if(stream) {
+			std::cerr << "File: " << filename << std::endl;
+			profile::manager pman("stream_render");
+			KRE::SVG::render_context ctx(cairo, width, height);
+			ctx.enable_stats(show_stats);
+			ctx.set_batch_fills(batch_fills);
+			ctx.set_quality(quality);
+			auto res = KRE::SVG::render_stream(filename, ctx);
+			stats = ctx.stats();
+			std::cerr << "  passes: " << res.passes << ", elements rendered: " << res.elements_rendered
+				<< ", definitions kept: " << res.definitions_retained << ", max depth: " << res.max_depth
+				<< ", largest subtree: " << res.largest_subtree << std::endl;
+		} else {
+			const int64_t live_before = memory_tracker::live_bytes();
+			KRE::SVG::memory_report pruned;
+			KRE::SVG::tree_report optimised;
+			KRE::SVG::parse_options file_opts = popts;
+			file_opts.pruned = &pruned;
+			file_opts.optimised = &optimised;
+			KRE::SVG::parse p(filename, file_opts);
+			if(show_memory) {
+				print_memory(p.memory_usage(), memory_tracker::live_bytes() - live_before);
+				std::cerr << "  unused definitions pruned: " << pruned.elements << " elements, " << pruned.total() << " bytes" << std::endl;
+			}
+			if(show_stats && popts.optimise_tree) {
+				std::cerr << "  groups flattened: " << optimised.groups_flattened << ", removed: " << optimised.groups_removed
+					<< ", empty removed: " << optimised.containers_removed << ", transforms baked: " << optimised.transforms_baked << std::endl;
+			}
 
-		{
 			std::cerr << "File: " << filename << std::endl;
 			profile::manager pman("cairo_render");
 			KRE::SVG::render_context ctx(cairo, width, height);
-			p.render(ctx);
+			ctx.enable_stats(show_stats);
+			ctx.set_batch_fills(batch_fills);
+			ctx.set_quality(quality);
+			stats = p.render(ctx);
+		}
+		if(show_stats) {
+			print_stats(stats);
 		}
 
 		if(write_image) {
+			TRACE_ZONE("write_png");
 			npath.replace_extension("png");
 			cairo_surface_write_to_png(surface, npath.generic_string().c_str());
 			auto status = cairo_status(cairo);
@@ -70,6 +765,10 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	if(show_stats) {
+		print_image_stats(KRE::SVG::image_cache::instance().get_stats());
+	}
+
 	// Early return if writing image to file only.
 	if(display_image == false) {
 		return 0;
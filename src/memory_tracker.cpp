@@ -0,0 +1,129 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include "memory_tracker.hpp"
+
+namespace memory_tracker
+{
+	namespace
+	{
+		std::atomic<int64_t> live(0);
+		std::atomic<uint64_t> count(0);
+	}
+
+#ifdef TRACK_ALLOCATIONS
+	bool enabled() { return true; }
+#else
+	bool enabled() { return false; }
+#endif
+
+	int64_t live_bytes() 
+	{ 
+		return live; 
+	}
+
+	uint64_t allocation_count() 
+	{ 
+		return count; 
+	}
+
+#ifdef TRACK_ALLOCATIONS
+	namespace
+	{
+		// Keeps the memory handed out aligned for any type.
+		const size_t header_size = 16;
+
+		void* tracked_alloc(size_t size)
+		{
+			void* p = std::malloc(size + header_size);
+			if(p == nullptr) {
+				return nullptr;
+			}
+			*static_cast<size_t*>(p) = size;
+			live += static_cast<int64_t>(size);
+			++count;
+			return static_cast<char*>(p) + header_size;
+		}
+
+		void tracked_free(void* p)
+		{
+			if(p == nullptr) {
+				return;
+			}
+			char* block = static_cast<char*>(p) - header_size;
+			live -= static_cast<int64_t>(*reinterpret_cast<size_t*>(block));
+			std::free(block);
+		}
+	}
+#endif
+}
+
+#ifdef TRACK_ALLOCATIONS
+void* operator new(size_t size)
+{
+	void* p = memory_tracker::tracked_alloc(size);
+	if(p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) throw()
+{
+	return memory_tracker::tracked_alloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) throw()
+{
+	return memory_tracker::tracked_alloc(size);
+}
+
+void operator delete(void* p) throw()
+{
+	memory_tracker::tracked_free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	memory_tracker::tracked_free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+	memory_tracker::tracked_free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+	memory_tracker::tracked_free(p);
+}
+#endif
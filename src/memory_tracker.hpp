@@ -0,0 +1,41 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+// Counts the bytes allocated through the global operator new, to check the
+// figures from parse::memory_usage() against. Only compiled in when
+// TRACK_ALLOCATIONS is defined, since it puts a header on every allocation.
+// Memory allocated with malloc, e.g. by cairo or freetype, isn't seen.
+
+namespace memory_tracker
+{
+	// Whether operator new is being tracked in this build.
+	bool enabled();
+
+	// Bytes currently allocated, and allocations made since startup.
+	int64_t live_bytes();
+	uint64_t allocation_count();
+}
@@ -0,0 +1,228 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <mutex>
+#include <queue>
+#include <vector>
+
+#include "asserts.hpp"
+#include "svg_async.hpp"
+#include "svg_path_parse.hpp"
+#include "thread_pool.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// Converts anything thrown while parsing into an exception_ptr, since our
+			// path parser throws a type that doesn't derive from std::exception.
+			std::exception_ptr current_error()
+			{
+				try {
+					throw;
+				} catch(parsing_exception& e) {
+					return std::make_exception_ptr(std::runtime_error(e.what()));
+				} catch(...) {
+					return std::current_exception();
+				}
+			}
+		}
+
+		struct async_loader::request_queue
+		{
+			struct request
+			{
+				int priority;
+				uint64_t sequence;
+				cancel_token token;
+				// Argument is true if the request should be abandoned.
+				std::function<void(bool)> fn;
+			};
+			struct compare_request
+			{
+				bool operator()(const request& a, const request& b) const {
+					if(a.priority != b.priority) {
+						return a.priority < b.priority;
+					}
+					return a.sequence > b.sequence;
+				}
+			};
+
+			request_queue() : sequence(0), cancelled(false) {}
+
+			// Runs the most important request that is still waiting.
+			void run_one() {
+				request r;
+				bool abandon;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if(requests.empty()) {
+						return;
+					}
+					r = requests.top();
+					requests.pop();
+					abandon = cancelled || r.token.is_cancelled();
+				}
+				r.fn(abandon);
+			}
+
+			mutable std::mutex mutex;
+			std::priority_queue<request, std::vector<request>, compare_request> requests;
+			uint64_t sequence;
+			// Set when the loader is destroyed, anything left over gets cancelled.
+			bool cancelled;
+		};
+
+		async_loader::async_loader(int nthreads)
+			: pool_(new threading::thread_pool(nthreads)),
+			  queue_(std::make_shared<request_queue>())
+		{
+			threading::thread_pool* pool = pool_.get();
+			executor_ = [pool](const std::function<void()>& fn) {
+				pool->submit([fn](int) { fn(); });
+			};
+		}
+
+		async_loader::async_loader(const executor& exec)
+			: executor_(exec),
+			  queue_(std::make_shared<request_queue>())
+		{
+			ASSERT_LOG(executor_, "async_loader requires a valid executor");
+		}
+
+		async_loader::~async_loader()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queue_->mutex);
+				queue_->cancelled = true;
+			}
+			// Destroying the pool runs whatever is still queued, which now only
+			// reports cancellation, and joins the threads.
+			pool_.reset();
+		}
+
+		void async_loader::enqueue(int priority, const cancel_token& token, const std::function<void(bool)>& fn)
+		{
+			{
+				std::lock_guard<std::mutex> lock(queue_->mutex);
+				request_queue::request r;
+				r.priority = priority;
+				r.sequence = queue_->sequence++;
+				r.token = token;
+				r.fn = fn;
+				queue_->requests.push(r);
+			}
+			// The work item holds a reference to the queue, so it stays valid even if
+			// a caller supplied executor runs it after we've been destroyed.
+			std::shared_ptr<request_queue> q = queue_;
+			executor_([q]() { q->run_one(); });
+		}
+
+		void async_loader::cancel_all()
+		{
+			std::vector<std::function<void(bool)>> abandoned;
+			{
+				std::lock_guard<std::mutex> lock(queue_->mutex);
+				while(!queue_->requests.empty()) {
+					abandoned.emplace_back(queue_->requests.top().fn);
+					queue_->requests.pop();
+				}
+			}
+			// Report the cancellations outside the lock, callbacks may queue more work.
+			for(auto& fn : abandoned) {
+				fn(true);
+			}
+		}
+
+		size_t async_loader::pending() const
+		{
+			std::lock_guard<std::mutex> lock(queue_->mutex);
+			return queue_->requests.size();
+		}
+
+		void async_loader::parse_async(const std::string& filename, const parse_callback& cb, int priority, const cancel_token& token)
+		{
+			enqueue(priority, token, [filename, cb](bool abandon) {
+				if(abandon) {
+					cb(parse_ptr(), std::make_exception_ptr(cancelled_error()));
+					return;
+				}
+				parse_ptr doc;
+				std::exception_ptr err;
+				try {
+					doc = std::make_shared<parse>(filename);
+				} catch(...) {
+					err = current_error();
+				}
+				cb(doc, err);
+			});
+		}
+
+		std::future<parse_ptr> async_loader::parse_async(const std::string& filename, int priority, const cancel_token& token)
+		{
+			auto promise = std::make_shared<std::promise<parse_ptr>>();
+			parse_async(filename, [promise](parse_ptr doc, std::exception_ptr err) {
+				if(err) {
+					promise->set_exception(err);
+				} else {
+					promise->set_value(doc);
+				}
+			}, priority, token);
+			return promise->get_future();
+		}
+
+		void async_loader::render_async(const parse_ptr& doc, unsigned width, unsigned height, const render_callback& cb, int priority, const cancel_token& token)
+		{
+			ASSERT_LOG(doc != nullptr, "render_async called without a document");
+			enqueue(priority, token, [doc, width, height, cb](bool abandon) {
+				if(abandon) {
+					cb(bitmap_ptr(), std::make_exception_ptr(cancelled_error()));
+					return;
+				}
+				bitmap_ptr bmp;
+				std::exception_ptr err;
+				try {
+					bmp = render_bitmap(*doc, width, height);
+				} catch(...) {
+					err = current_error();
+				}
+				cb(bmp, err);
+			});
+		}
+
+		std::future<bitmap_ptr> async_loader::render_async(const parse_ptr& doc, unsigned width, unsigned height, int priority, const cancel_token& token)
+		{
+			auto promise = std::make_shared<std::promise<bitmap_ptr>>();
+			render_async(doc, width, height, [promise](bitmap_ptr bmp, std::exception_ptr err) {
+				if(err) {
+					promise->set_exception(err);
+				} else {
+					promise->set_value(bmp);
+				}
+			}, priority, token);
+			return promise->get_future();
+		}
+	}
+}
@@ -0,0 +1,115 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "svg_bitmap.hpp"
+#include "svg_parse.hpp"
+
+namespace threading
+{
+	class thread_pool;
+}
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Thrown through a future (or handed to a callback) when the request was
+		// cancelled before it got to run.
+		class cancelled_error : public std::runtime_error
+		{
+		public:
+			cancelled_error() : std::runtime_error("SVG request cancelled") {}
+		};
+
+		// Shared flag used to cancel outstanding requests. Copies refer to the
+		// same flag, so one token can be used to cancel a whole batch of requests.
+		class cancel_token
+		{
+		public:
+			cancel_token() : flag_(std::make_shared<std::atomic<bool>>(false)) {}
+			void cancel() { *flag_ = true; }
+			bool is_cancelled() const { return *flag_; }
+		private:
+			std::shared_ptr<std::atomic<bool>> flag_;
+		};
+
+		// Something that will run a unit of work at some point, on some thread.
+		typedef std::function<void(const std::function<void()>&)> executor;
+
+		typedef std::function<void(parse_ptr, std::exception_ptr)> parse_callback;
+		typedef std::function<void(bitmap_ptr, std::exception_ptr)> render_callback;
+
+		// Loads and renders documents off the calling thread. Requests are kept in a
+		// queue ordered by priority (higher values first, then first come first
+		// served) and each time the executor runs a unit of work the most important
+		// outstanding request is taken off the queue. So priorities take effect for
+		// everything that hasn't started yet.
+		//
+		// Results are available either as a future or through a callback; the
+		// callback runs on whichever thread executed the request.
+		class async_loader
+		{
+		public:
+			// Use an internal thread pool. nthreads <= 0 means one per hardware thread.
+			explicit async_loader(int nthreads=0);
+			// Use the callers executor. The executor must remain usable for as long
+			// as there are requests outstanding.
+			explicit async_loader(const executor& exec);
+			// Cancels every request that hasn't started yet and waits for the running
+			// ones if we own the threads.
+			~async_loader();
+
+			std::future<parse_ptr> parse_async(const std::string& filename, int priority=0, const cancel_token& token=cancel_token());
+			void parse_async(const std::string& filename, const parse_callback& cb, int priority=0, const cancel_token& token=cancel_token());
+
+			std::future<bitmap_ptr> render_async(const parse_ptr& doc, unsigned width, unsigned height, int priority=0, const cancel_token& token=cancel_token());
+			void render_async(const parse_ptr& doc, unsigned width, unsigned height, const render_callback& cb, int priority=0, const cancel_token& token=cancel_token());
+
+			// Cancel every request that hasn't started yet.
+			void cancel_all();
+
+			// Number of requests that haven't started yet.
+			size_t pending() const;
+		private:
+			async_loader(const async_loader&);
+			void operator=(const async_loader&);
+
+			struct request_queue;
+			void enqueue(int priority, const cancel_token& token, const std::function<void(bool)>& fn);
+
+			std::unique_ptr<threading::thread_pool> pool_;
+			executor executor_;
+			std::shared_ptr<request_queue> queue_;
+		};
+	}
+}
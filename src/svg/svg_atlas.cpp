@@ -0,0 +1,363 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "asserts.hpp"
+#include "json.hpp"
+#include "svg_atlas.hpp"
+#include "thread_pool.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// The top edge of everything packed so far, as a list of horizontal
+			// segments ordered left to right and covering the whole page width.
+			class skyline
+			{
+			public:
+				skyline(unsigned width, unsigned height) : width_(width), height_(height) {
+					segments_.push_back(segment(0, 0, width));
+				}
+
+				// Finds the position that leaves the lowest top edge, leftmost on ties.
+				bool insert(unsigned w, unsigned h, unsigned* x, unsigned* y) {
+					size_t best = segments_.size();
+					unsigned best_top = 0;
+					unsigned best_y = 0;
+					for(size_t n = 0; n != segments_.size(); ++n) {
+						unsigned top;
+						if(!fits(n, w, h, &top)) {
+							continue;
+						}
+						if(best == segments_.size() || top + h < best_top) {
+							best = n;
+							best_top = top + h;
+							best_y = top;
+						}
+					}
+					if(best == segments_.size()) {
+						return false;
+					}
+					*x = segments_[best].x;
+					*y = best_y;
+					add(best, w, best_y + h);
+					return true;
+				}
+			private:
+				struct segment
+				{
+					segment(unsigned xx, unsigned yy, unsigned ww) : x(xx), y(yy), width(ww) {}
+					unsigned x, y, width;
+				};
+
+				// Placing at the left edge of segment n sits on the highest segment the
+				// rectangle spans.
+				bool fits(size_t n, unsigned w, unsigned h, unsigned* top) const {
+					if(segments_[n].x + w > width_) {
+						return false;
+					}
+					unsigned y = 0;
+					unsigned remaining = w;
+					for(size_t i = n; remaining > 0; ++i) {
+						ASSERT_LOG(i < segments_.size(), "Skyline does not cover the page width");
+						y = std::max(y, segments_[i].y);
+						if(y + h > height_) {
+							return false;
+						}
+						remaining -= std::min(remaining, segments_[i].width);
+					}
+					*top = y;
+					return true;
+				}
+
+				void add(size_t n, unsigned w, unsigned top) {
+					const unsigned x = segments_[n].x;
+					segments_.insert(segments_.begin() + n, segment(x, top, w));
+					// Shrink or remove the segments now underneath the new one.
+					const unsigned right = x + w;
+					size_t i = n + 1;
+					while(i < segments_.size() && segments_[i].x < right) {
+						const unsigned end = segments_[i].x + segments_[i].width;
+						if(end <= right) {
+							segments_.erase(segments_.begin() + i);
+						} else {
+							segments_[i].width = end - right;
+							segments_[i].x = right;
+							break;
+						}
+					}
+					// Merge neighbours of equal height.
+					for(size_t j = 0; j + 1 < segments_.size(); ) {
+						if(segments_[j].y == segments_[j+1].y) {
+							segments_[j].width += segments_[j+1].width;
+							segments_.erase(segments_.begin() + j + 1);
+						} else {
+							++j;
+						}
+					}
+				}
+
+				unsigned width_;
+				unsigned height_;
+				std::vector<segment> segments_;
+			};
+		}
+
+		void content_bounds(const bitmap& bmp, unsigned* x, unsigned* y, unsigned* width, unsigned* height)
+		{
+			unsigned x0 = bmp.width(), y0 = bmp.height(), x1 = 0, y1 = 0;
+			for(unsigned row = 0; row != bmp.height(); ++row) {
+				const uint32_t* px = reinterpret_cast<const uint32_t*>(bmp.data() + static_cast<size_t>(row) * bmp.stride());
+				for(unsigned col = 0; col != bmp.width(); ++col) {
+					if((px[col] >> 24) != 0) {
+						x0 = std::min(x0, col);
+						x1 = std::max(x1, col + 1);
+						y0 = std::min(y0, row);
+						y1 = row + 1;
+					}
+				}
+			}
+			if(x1 <= x0 || y1 <= y0) {
+				*x = *y = 0;
+				*width = *height = 1;
+				return;
+			}
+			*x = x0;
+			*y = y0;
+			*width = x1 - x0;
+			*height = y1 - y0;
+		}
+
+		texture_atlas::texture_atlas(const atlas_options& opts)
+			: opts_(opts)
+		{
+			ASSERT_LOG(opts_.page_width > 0 && opts_.page_height > 0, "Atlas page size must be non-zero: " << opts_.page_width << "x" << opts_.page_height);
+		}
+
+		texture_atlas::~texture_atlas()
+		{
+		}
+
+		void texture_atlas::add(const std::string& name, const const_bitmap_ptr& bmp)
+		{
+			ASSERT_LOG(bmp != nullptr, "No bitmap given for atlas image: " << name);
+			item it;
+			it.name = name;
+			it.bmp = bmp;
+			if(opts_.trim) {
+				content_bounds(*bmp, &it.trim_x, &it.trim_y, &it.width, &it.height);
+			} else {
+				it.trim_x = it.trim_y = 0;
+				it.width = bmp->width();
+				it.height = bmp->height();
+			}
+			std::lock_guard<std::mutex> lock(mutex_);
+			items_.emplace_back(it);
+		}
+
+		void texture_atlas::build()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			std::sort(items_.begin(), items_.end(), [](const item& a, const item& b) {
+				if(a.height != b.height) {
+					return a.height > b.height;
+				}
+				if(a.width != b.width) {
+					return a.width > b.width;
+				}
+				return a.name < b.name;
+			});
+
+			// Padding goes on the right and bottom of every image, the page is
+			// allowed to clip the padding of the last row and column.
+			const unsigned pad = opts_.padding;
+			std::vector<skyline> skylines;
+			entries_.clear();
+			for(auto& it : items_) {
+				const unsigned w = it.width + pad;
+				const unsigned h = it.height + pad;
+				ASSERT_LOG(it.width <= opts_.page_width && it.height <= opts_.page_height,
+					"Image '" << it.name << "' (" << it.width << "x" << it.height << ") is larger than the atlas page " << opts_.page_width << "x" << opts_.page_height);
+				atlas_entry e;
+				size_t page = 0;
+				for(; page != skylines.size(); ++page) {
+					if(skylines[page].insert(w, h, &e.x, &e.y)) {
+						break;
+					}
+				}
+				if(page == skylines.size()) {
+					skylines.push_back(skyline(opts_.page_width + pad, opts_.page_height + pad));
+					bool ok = skylines.back().insert(w, h, &e.x, &e.y);
+					ASSERT_LOG(ok, "Image '" << it.name << "' does not fit on an empty atlas page");
+				}
+				e.name = it.name;
+				e.page = static_cast<unsigned>(page);
+				e.width = it.width;
+				e.height = it.height;
+				e.trim_x = it.trim_x;
+				e.trim_y = it.trim_y;
+				e.source_width = it.bmp->width();
+				e.source_height = it.bmp->height();
+				entries_.emplace_back(e);
+			}
+
+			pages_.clear();
+			for(size_t n = 0; n != skylines.size(); ++n) {
+				pages_.emplace_back(new bitmap(opts_.page_width, opts_.page_height));
+			}
+			for(size_t n = 0; n != entries_.size(); ++n) {
+				const atlas_entry& e = entries_[n];
+				const bitmap& src = *items_[n].bmp;
+				bitmap& dst = *pages_[e.page];
+				for(unsigned row = 0; row != e.height; ++row) {
+					const uint8_t* s = src.data() + static_cast<size_t>(e.trim_y + row) * src.stride() + e.trim_x * 4;
+					uint8_t* d = dst.data() + static_cast<size_t>(e.y + row) * dst.stride() + e.x * 4;
+					std::memcpy(d, s, e.width * 4);
+				}
+			}
+		}
+
+		variant texture_atlas::manifest(const std::vector<std::string>& page_names) const
+		{
+			ASSERT_LOG(page_names.size() == pages_.size(), "Expected a name for each of the " << pages_.size() << " atlas pages, got " << page_names.size());
+			variant_map res;
+			res[variant("page_width")] = variant(static_cast<int>(opts_.page_width));
+			res[variant("page_height")] = variant(static_cast<int>(opts_.page_height));
+			variant_list pages;
+			for(auto& name : page_names) {
+				pages.emplace_back(name);
+			}
+			res[variant("pages")] = variant(pages);
+
+			const double pw = opts_.page_width;
+			const double ph = opts_.page_height;
+			variant_map sprites;
+			for(auto& e : entries_) {
+				variant_map m;
+				m[variant("page")] = variant(static_cast<int>(e.page));
+				m[variant("x")] = variant(static_cast<int>(e.x));
+				m[variant("y")] = variant(static_cast<int>(e.y));
+				m[variant("w")] = variant(static_cast<int>(e.width));
+				m[variant("h")] = variant(static_cast<int>(e.height));
+				m[variant("u0")] = variant(e.x / pw);
+				m[variant("v0")] = variant(e.y / ph);
+				m[variant("u1")] = variant((e.x + e.width) / pw);
+				m[variant("v1")] = variant((e.y + e.height) / ph);
+				m[variant("trim_x")] = variant(static_cast<int>(e.trim_x));
+				m[variant("trim_y")] = variant(static_cast<int>(e.trim_y));
+				m[variant("source_w")] = variant(static_cast<int>(e.source_width));
+				m[variant("source_h")] = variant(static_cast<int>(e.source_height));
+				sprites[variant(e.name)] = variant(m);
+			}
+			res[variant("sprites")] = variant(sprites);
+			return variant(res);
+		}
+
+		bool texture_atlas::write(const std::string& dir, const std::string& basename) const
+		{
+			using namespace boost::filesystem;
+			boost::system::error_code ec;
+			create_directories(dir, ec);
+			if(ec) {
+				LOG_ERROR("Unable to create atlas directory '" << dir << "': " << ec.message());
+				return false;
+			}
+			std::vector<std::string> names;
+			for(size_t n = 0; n != pages_.size(); ++n) {
+				names.emplace_back(basename + "_" + boost::lexical_cast<std::string>(n) + ".png");
+				if(!pages_[n]->write_png((path(dir) / names.back()).generic_string())) {
+					return false;
+				}
+			}
+			const std::string manifest_file = (path(dir) / (basename + ".json")).generic_string();
+			std::ofstream os(manifest_file.c_str());
+			if(!os) {
+				LOG_ERROR("Unable to write atlas manifest '" << manifest_file << "'");
+				return false;
+			}
+			json::write(os, manifest(names));
+			return os.good();
+		}
+
+		void build_atlas(texture_atlas* atlas, const std::vector<std::string>& files, const std::vector<bitmap_size>& sizes, threading::thread_pool* pool)
+		{
+			ASSERT_LOG(!sizes.empty(), "No sizes given to render the atlas images at");
+			const atlas_options& opts = atlas->options();
+			auto render_one = [&](const std::string& filename) {
+				parse doc(filename, opts.popts);
+				const std::string stem = boost::filesystem::path(filename).replace_extension().generic_string();
+				for(auto& sz : sizes) {
+					std::string name = stem;
+					if(sizes.size() > 1) {
+						name += "@" + boost::lexical_cast<std::string>(sz.first) + "x" + boost::lexical_cast<std::string>(sz.second);
+					}
+					atlas->add(name, render_bitmap(doc, sz.first, sz.second, opts.params));
+				}
+			};
+
+			if(pool == nullptr) {
+				for(auto& f : files) {
+					render_one(f);
+				}
+			} else {
+				std::mutex mutex;
+				std::condition_variable cv;
+				size_t remaining = files.size();
+				std::exception_ptr error;
+				for(auto& f : files) {
+					pool->submit([&](int) {
+						std::exception_ptr err;
+						try {
+							render_one(f);
+						} catch(...) {
+							err = std::current_exception();
+						}
+						std::lock_guard<std::mutex> lock(mutex);
+						if(err && !error) {
+							error = err;
+						}
+						if(--remaining == 0) {
+							cv.notify_all();
+						}
+					});
+				}
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&remaining]() { return remaining == 0; });
+				if(error) {
+					std::rethrow_exception(error);
+				}
+			}
+			atlas->build();
+		}
+	}
+}
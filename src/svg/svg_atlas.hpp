@@ -0,0 +1,128 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "svg_bitmap.hpp"
+#include "svg_parse.hpp"
+#include "variant.hpp"
+
+namespace threading
+{
+	class thread_pool;
+}
+
+namespace KRE
+{
+	namespace SVG
+	{
+		struct atlas_options
+		{
+			atlas_options() : page_width(1024), page_height(1024), padding(1), trim(true) {}
+			unsigned page_width;
+			unsigned page_height;
+			// Empty pixels left between neighbouring images to stop bleeding when
+			// sampled with filtering.
+			unsigned padding;
+			// Cut away fully transparent borders before packing.
+			bool trim;
+			render_params params;
+			parse_options popts;
+		};
+
+		// Where an image ended up. x/y/width/height are the trimmed rectangle in
+		// page pixels, trim_x/trim_y the offset of that rectangle inside the
+		// untrimmed source_width x source_height image.
+		struct atlas_entry
+		{
+			std::string name;
+			unsigned page;
+			unsigned x;
+			unsigned y;
+			unsigned width;
+			unsigned height;
+			unsigned trim_x;
+			unsigned trim_y;
+			unsigned source_width;
+			unsigned source_height;
+		};
+
+		// Packs bitmaps into fixed-size pages using a bottom-left skyline packer.
+		// Images are packed tallest first with ties broken on width and then name
+		// so the output only depends on the set of images added, not on the order
+		// they were added in, which may vary when they're rendered in parallel.
+		class texture_atlas
+		{
+		public:
+			explicit texture_atlas(const atlas_options& opts=atlas_options());
+			~texture_atlas();
+
+			// Thread safe with respect to other calls to add().
+			void add(const std::string& name, const const_bitmap_ptr& bmp);
+
+			// Pack everything added so far and compose the pages.
+			void build();
+
+			const atlas_options& options() const { return opts_; }
+			const std::vector<atlas_entry>& entries() const { return entries_; }
+			const std::vector<bitmap_ptr>& pages() const { return pages_; }
+
+			// { "page_width", "page_height", "pages": [...], "sprites": { name: {...} } }
+			variant manifest(const std::vector<std::string>& page_names) const;
+
+			// Writes <basename>_<n>.png for each page and <basename>.json into dir.
+			bool write(const std::string& dir, const std::string& basename) const;
+		private:
+			texture_atlas(const texture_atlas&);
+			void operator=(const texture_atlas&);
+
+			struct item
+			{
+				std::string name;
+				const_bitmap_ptr bmp;
+				unsigned trim_x;
+				unsigned trim_y;
+				unsigned width;
+				unsigned height;
+			};
+
+			atlas_options opts_;
+			std::mutex mutex_;
+			std::vector<item> items_;
+			std::vector<atlas_entry> entries_;
+			std::vector<bitmap_ptr> pages_;
+		};
+
+		// Smallest rectangle containing every pixel with non-zero alpha. An empty
+		// image gives a 1x1 rectangle at the origin so it still has a place.
+		void content_bounds(const bitmap& bmp, unsigned* x, unsigned* y, unsigned* width, unsigned* height);
+
+		// Render each file at each size, in parallel if a pool is given, and pack the
+		// results. With more than one size the sprites are named "<file>@<size>".
+		void build_atlas(texture_atlas* atlas, const std::vector<std::string>& files, const std::vector<bitmap_size>& sizes, threading::thread_pool* pool=nullptr);
+	}
+}
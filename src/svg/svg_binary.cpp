@@ -0,0 +1,701 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "svg_binary.hpp"
+#include "svg_element.hpp"
+#include "svg_parse.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// Size used for documents without a viewBox, which don't scale anyway.
+			const unsigned default_record_size = 512;
+
+			size_t align8(size_t n)
+			{
+				return (n + 7) & ~size_t(7);
+			}
+
+			// Records the drawing operations of a render into the tables of a blob.
+			class binary_writer : public render_recorder
+			{
+			public:
+				binary_writer() {}
+
+				void save() override { add_op(svgb::OpType::SAVE); }
+				void restore() override { add_op(svgb::OpType::RESTORE); }
+				void push_group() override { add_op(svgb::OpType::PUSH_GROUP); }
+				void pop_group(bool paint, double alpha) override {
+					if(paint) {
+						add_op(svgb::OpType::POP_GROUP_PAINT).value = alpha;
+					} else {
+						add_op(svgb::OpType::POP_GROUP_DISCARD);
+					}
+				}
+				void fill(cairo_t* cairo) override {
+					svgb::op& o = add_op(svgb::OpType::FILL);
+					o.path = add_path(cairo);
+					o.paint = add_paint(cairo);
+					o.matrix = add_matrix(cairo);
+					o.hint = hint_of(cairo);
+					o.extra = cairo_get_fill_rule(cairo);
+				}
+				void stroke(cairo_t* cairo) override {
+					svgb::op& o = add_op(svgb::OpType::STROKE);
+					o.path = add_path(cairo);
+					o.paint = add_paint(cairo);
+					o.matrix = add_matrix(cairo);
+					o.hint = hint_of(cairo);
+					o.extra = add_stroke_style(cairo);
+				}
+				void clip(cairo_t* cairo) override {
+					svgb::op& o = add_op(svgb::OpType::CLIP);
+					o.path = add_path(cairo);
+					o.matrix = add_matrix(cairo);
+					o.hint = hint_of(cairo);
+					o.extra = cairo_get_fill_rule(cairo);
+				}
+				void begin_element(const std::string& id) override {
+					open_elements_.emplace_back(id, static_cast<uint32_t>(ops_.size()));
+				}
+				void end_element(const std::string& id) override {
+					ASSERT_LOG(!open_elements_.empty() && open_elements_.back().first == id, "Unbalanced element begin/end for: " << id);
+					const uint32_t first = open_elements_.back().second;
+					open_elements_.pop_back();
+					// First one wins if an id is reused.
+					if(ids_.find(id) == ids_.end()) {
+						ids_[id] = std::make_pair(first, static_cast<uint32_t>(ops_.size()) - first);
+					}
+				}
+				void unsupported(const std::string& what) override {
+					unsupported_.insert(what);
+				}
+
+				const std::set<std::string>& unsupported_features() const { return unsupported_; }
+
+				std::vector<uint8_t> finish(uint32_t flags, double width, double height) const {
+					std::vector<uint8_t> blob(align8(sizeof(svgb::header)));
+					svgb::header hdr;
+					memset(&hdr, 0, sizeof(hdr));
+					memcpy(hdr.magic, "SVGB", 4);
+					hdr.version = svgb::version;
+					hdr.byte_order = svgb::byte_order_mark;
+					hdr.flags = flags;
+					hdr.width = width;
+					hdr.height = height;
+
+					std::vector<svgb::id_entry> ids;
+					std::vector<char> strings;
+					for(auto& id : ids_) {
+						svgb::id_entry entry;
+						entry.name_offset = static_cast<uint32_t>(strings.size());
+						entry.name_length = static_cast<uint32_t>(id.first.size());
+						entry.first_op = id.second.first;
+						entry.op_count = id.second.second;
+						strings.insert(strings.end(), id.first.begin(), id.first.end());
+						ids.push_back(entry);
+					}
+
+					hdr.ops = put(blob, ops_);
+					hdr.matrices = put(blob, matrices_);
+					hdr.paths = put(blob, paths_);
+					hdr.path_data = put(blob, path_data_);
+					hdr.paints = put(blob, paints_);
+					hdr.stops = put(blob, stops_);
+					hdr.strokes = put(blob, strokes_);
+					hdr.dashes = put(blob, dashes_);
+					hdr.ids = put(blob, ids);
+					hdr.strings = put(blob, strings);
+					memcpy(&blob[0], &hdr, sizeof(hdr));
+					return blob;
+				}
+			private:
+				template<typename T>
+				static svgb::table put(std::vector<uint8_t>& blob, const std::vector<T>& v) {
+					svgb::table t;
+					t.offset = static_cast<uint32_t>(blob.size());
+					t.count = static_cast<uint32_t>(v.size());
+					if(!v.empty()) {
+						const uint8_t* p = reinterpret_cast<const uint8_t*>(&v[0]);
+						blob.insert(blob.end(), p, p + v.size() * sizeof(T));
+					}
+					blob.resize(align8(blob.size()));
+					return t;
+				}
+
+				svgb::op& add_op(svgb::OpType type) {
+					svgb::op o;
+					memset(&o, 0, sizeof(o));
+					o.type = type;
+					ops_.push_back(o);
+					return ops_.back();
+				}
+
+				// Documents are recorded at normal quality, where each hint sets a 
+				// different antialias mode, see render_context::apply_hint().
+				static uint32_t hint_of(cairo_t* cairo) {
+					RenderingHint hint = RenderingHint::AUTO;
+					switch(cairo_get_antialias(cairo)) {
+						case CAIRO_ANTIALIAS_FAST: hint = RenderingHint::SPEED; break;
+						case CAIRO_ANTIALIAS_NONE: hint = RenderingHint::CRISP_EDGES; break;
+						case CAIRO_ANTIALIAS_BEST: hint = RenderingHint::PRECISION; break;
+						default: break;
+					}
+					return static_cast<uint32_t>(hint);
+				}
+
+				uint32_t add_path(cairo_t* cairo) {
+					cairo_path_t* path = cairo_copy_path(cairo);
+					ASSERT_LOG(path->status == CAIRO_STATUS_SUCCESS, "Cairo error copying path: " << cairo_status_to_string(path->status));
+					// Strokes usually follow a fill of the same path.
+					if(!paths_.empty()) {
+						const svgb::path& last = paths_.back();
+						if(last.count == static_cast<uint32_t>(path->num_data) 
+							&& (last.count == 0 || memcmp(&path_data_[last.first], path->data, last.count * sizeof(cairo_path_data_t)) == 0)) {
+							cairo_path_destroy(path);
+							return static_cast<uint32_t>(paths_.size() - 1);
+						}
+					}
+					svgb::path p;
+					p.first = static_cast<uint32_t>(path_data_.size());
+					p.count = static_cast<uint32_t>(path->num_data);
+					path_data_.insert(path_data_.end(), path->data, path->data + path->num_data);
+					paths_.push_back(p);
+					cairo_path_destroy(path);
+					return static_cast<uint32_t>(paths_.size() - 1);
+				}
+
+				uint32_t add_matrix(cairo_t* cairo) {
+					cairo_matrix_t mat;
+					cairo_get_matrix(cairo, &mat);
+					if(!matrices_.empty() && memcmp(&matrices_.back(), &mat, sizeof(mat)) == 0) {
+						return static_cast<uint32_t>(matrices_.size() - 1);
+					}
+					matrices_.push_back(mat);
+					return static_cast<uint32_t>(matrices_.size() - 1);
+				}
+
+				uint32_t add_paint(cairo_t* cairo) {
+					cairo_pattern_t* pattern = cairo_get_source(cairo);
+					svgb::paint p;
+					memset(&p, 0, sizeof(p));
+					cairo_matrix_init_identity(&p.matrix);
+					std::vector<svgb::color_stop> stops;
+					switch(cairo_pattern_get_type(pattern)) {
+						case CAIRO_PATTERN_TYPE_SOLID:
+							p.type = svgb::PaintType::SOLID;
+							cairo_pattern_get_rgba(pattern, &p.values[0], &p.values[1], &p.values[2], &p.values[3]);
+							break;
+						case CAIRO_PATTERN_TYPE_LINEAR:
+						case CAIRO_PATTERN_TYPE_RADIAL: {
+							if(cairo_pattern_get_type(pattern) == CAIRO_PATTERN_TYPE_LINEAR) {
+								p.type = svgb::PaintType::LINEAR;
+								cairo_pattern_get_linear_points(pattern, &p.values[0], &p.values[1], &p.values[2], &p.values[3]);
+							} else {
+								p.type = svgb::PaintType::RADIAL;
+								cairo_pattern_get_radial_circles(pattern, &p.values[0], &p.values[1], &p.values[2], &p.values[3], &p.values[4], &p.values[5]);
+							}
+							p.extend = cairo_pattern_get_extend(pattern);
+							cairo_pattern_get_matrix(pattern, &p.matrix);
+							int count = 0;
+							cairo_pattern_get_color_stop_count(pattern, &count);
+							for(int n = 0; n != count; ++n) {
+								svgb::color_stop cs;
+								cairo_pattern_get_color_stop_rgba(pattern, n, &cs.offset, &cs.r, &cs.g, &cs.b, &cs.a);
+								stops.push_back(cs);
+							}
+							break;
+						}
+						default:
+							LOG_ERROR("Unsupported source pattern type when compiling document, using transparent instead.");
+							p.type = svgb::PaintType::SOLID;
+							break;
+					}
+					p.stop_count = static_cast<uint32_t>(stops.size());
+
+					std::string key(reinterpret_cast<const char*>(&p), sizeof(p));
+					if(!stops.empty()) {
+						key.append(reinterpret_cast<const char*>(&stops[0]), stops.size() * sizeof(svgb::color_stop));
+					}
+					auto it = paint_index_.find(key);
+					if(it != paint_index_.end()) {
+						return it->second;
+					}
+					p.first_stop = static_cast<uint32_t>(stops_.size());
+					stops_.insert(stops_.end(), stops.begin(), stops.end());
+					paints_.push_back(p);
+					const uint32_t index = static_cast<uint32_t>(paints_.size() - 1);
+					paint_index_[key] = index;
+					return index;
+				}
+
+				uint32_t add_stroke_style(cairo_t* cairo) {
+					svgb::stroke_style s;
+					memset(&s, 0, sizeof(s));
+					s.line_width = cairo_get_line_width(cairo);
+					s.miter_limit = cairo_get_miter_limit(cairo);
+					s.line_cap = cairo_get_line_cap(cairo);
+					s.line_join = cairo_get_line_join(cairo);
+					std::vector<double> dashes(cairo_get_dash_count(cairo));
+					cairo_get_dash(cairo, dashes.empty() ? nullptr : &dashes[0], &s.dash_offset);
+					s.dash_count = static_cast<uint32_t>(dashes.size());
+
+					std::string key(reinterpret_cast<const char*>(&s), sizeof(s));
+					if(!dashes.empty()) {
+						key.append(reinterpret_cast<const char*>(&dashes[0]), dashes.size() * sizeof(double));
+					}
+					auto it = stroke_index_.find(key);
+					if(it != stroke_index_.end()) {
+						return it->second;
+					}
+					s.first_dash = static_cast<uint32_t>(dashes_.size());
+					dashes_.insert(dashes_.end(), dashes.begin(), dashes.end());
+					strokes_.push_back(s);
+					const uint32_t index = static_cast<uint32_t>(strokes_.size() - 1);
+					stroke_index_[key] = index;
+					return index;
+				}
+
+				std::vector<svgb::op> ops_;
+				std::vector<cairo_matrix_t> matrices_;
+				std::vector<svgb::path> paths_;
+				std::vector<cairo_path_data_t> path_data_;
+				std::vector<svgb::paint> paints_;
+				std::vector<svgb::color_stop> stops_;
+				std::vector<svgb::stroke_style> strokes_;
+				std::vector<double> dashes_;
+				std::map<std::string, uint32_t> paint_index_;
+				std::map<std::string, uint32_t> stroke_index_;
+				std::vector<std::pair<std::string, uint32_t>> open_elements_;
+				// sorted by name, which is the order they're written in.
+				std::map<std::string, std::pair<uint32_t, uint32_t>> ids_;
+				std::set<std::string> unsupported_;
+			};
+		}
+
+		std::vector<uint8_t> compile_binary(const parse& doc)
+		{
+			uint32_t flags = 0;
+			unsigned width = default_record_size;
+			unsigned height = default_record_size;
+			if(!doc.elements().empty()) {
+				auto& vb = doc.elements().front()->view_box();
+				if(vb.w() > 0 && vb.h() > 0) {
+					// Record at the natural size so the stored transforms are unscaled.
+					flags |= svgb::FLAG_SCALE_TO_VIEWPORT;
+					width = std::max(1U, static_cast<unsigned>(std::ceil(vb.w())));
+					height = std::max(1U, static_cast<unsigned>(std::ceil(vb.h())));
+				}
+			}
+
+			// What gets drawn doesn't matter, only what is recorded.
+			cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+			cairo_t* cairo = cairo_create(surface);
+			binary_writer writer;
+			{
+				render_context ctx(cairo, width, height);
+				ctx.set_quality(RenderQuality::NORMAL);
+				ctx.set_use_level_of_detail(false);
+				ctx.set_recorder(&writer);
+				doc.render(ctx);
+			}
+			auto status = cairo_status(cairo);
+			cairo_destroy(cairo);
+			cairo_surface_destroy(surface);
+			ASSERT_LOG(status == CAIRO_STATUS_SUCCESS, "Cairo error compiling document: " << cairo_status_to_string(status));
+			if(!writer.unsupported_features().empty()) {
+				std::string features;
+				for(auto& f : writer.unsupported_features()) {
+					features += (features.empty() ? "" : ", ") + f;
+				}
+				LOG_ERROR("Document uses features compiled documents can't hold (" << features << "), not compiling it.");
+				return std::vector<uint8_t>();
+			}
+			return writer.finish(flags, width, height);
+		}
+
+		bool write_binary(const std::string& filename, const std::vector<uint8_t>& blob)
+		{
+			std::ofstream file(filename.c_str(), std::ios::binary);
+			if(!file.write(reinterpret_cast<const char*>(blob.data()), blob.size())) {
+				LOG_ERROR("Unable to write compiled document: " << filename);
+				return false;
+			}
+			return true;
+		}
+
+		binary_document::binary_document(const void* data, size_t size, const std::shared_ptr<const void>& owner)
+			: data_(static_cast<const uint8_t*>(data)),
+			  size_(size),
+			  owner_(owner)
+		{
+			ASSERT_LOG(data_ != nullptr && reinterpret_cast<uintptr_t>(data_) % 8 == 0, "Compiled document data must be 8 byte aligned");
+			ASSERT_LOG(size_ >= sizeof(svgb::header), "Compiled document is too small: " << size_ << " bytes");
+			header_ = reinterpret_cast<const svgb::header*>(data_);
+			ASSERT_LOG(memcmp(header_->magic, "SVGB", 4) == 0, "Not a compiled SVG document");
+			ASSERT_LOG(header_->byte_order == svgb::byte_order_mark, "Compiled document has the wrong byte order");
+			ASSERT_LOG(header_->version == svgb::version, "Compiled document version " << header_->version << " is not supported, expected " << svgb::version);
+			ASSERT_LOG(header_->width > 0 && header_->height > 0, "Compiled document has invalid size");
+
+			ops_ = get_table<svgb::op>(header_->ops);
+			matrices_ = get_table<cairo_matrix_t>(header_->matrices);
+			paths_ = get_table<svgb::path>(header_->paths);
+			path_data_ = get_table<cairo_path_data_t>(header_->path_data);
+			paints_ = get_table<svgb::paint>(header_->paints);
+			stops_ = get_table<svgb::color_stop>(header_->stops);
+			strokes_ = get_table<svgb::stroke_style>(header_->strokes);
+			dashes_ = get_table<double>(header_->dashes);
+			ids_ = get_table<svgb::id_entry>(header_->ids);
+			strings_ = get_table<char>(header_->strings);
+			check_paths();
+		}
+
+		binary_document::~binary_document()
+		{
+		}
+
+		template<typename T> const T* binary_document::get_table(const svgb::table& t) const
+		{
+			ASSERT_LOG(t.offset % 8 == 0 && t.offset <= size_ && t.count <= (size_ - t.offset) / sizeof(T), 
+				"Table in compiled document is out of range: offset " << t.offset << ", count " << t.count);
+			return reinterpret_cast<const T*>(data_ + t.offset);
+		}
+
+		void binary_document::check_paths() const
+		{
+			// The number of cairo_path_data_t each type of element takes up.
+			static const int lengths[] = { 2, 2, 4, 1 };
+			for(uint32_t i = 0; i != header_->paths.count; ++i) {
+				const svgb::path& p = paths_[i];
+				ASSERT_LOG(p.first <= header_->path_data.count && p.count <= header_->path_data.count - p.first, "Path data out of range: path " << i);
+				const uint32_t end = p.first + p.count;
+				for(uint32_t n = p.first; n != end; n += path_data_[n].header.length) {
+					const auto& h = path_data_[n].header;
+					ASSERT_LOG(static_cast<uint32_t>(h.type) <= CAIRO_PATH_CLOSE_PATH && h.length == lengths[h.type], 
+						"Bad path element in compiled document: path " << i << ", type " << h.type << ", length " << h.length);
+					ASSERT_LOG(static_cast<uint32_t>(h.length) <= end - n, "Path element overruns its path: path " << i);
+				}
+			}
+		}
+
+		binary_document_ptr binary_document::load(const std::string& filename)
+		{
+			auto mf = sys::mapped_file::open(filename);
+			if(mf == nullptr) {
+				return binary_document_ptr();
+			}
+			return std::make_shared<binary_document>(mf->data(), mf->size(), mf);
+		}
+
+		void binary_document::set_source(cairo_t* cairo, uint32_t index) const
+		{
+			ASSERT_LOG(index < header_->paints.count, "Paint index out of range: " << index);
+			const svgb::paint& p = paints_[index];
+			if(p.type == svgb::PaintType::SOLID) {
+				cairo_set_source_rgba(cairo, p.values[0], p.values[1], p.values[2], p.values[3]);
+				return;
+			}
+			cairo_pattern_t* pattern = p.type == svgb::PaintType::LINEAR 
+				? cairo_pattern_create_linear(p.values[0], p.values[1], p.values[2], p.values[3])
+				: cairo_pattern_create_radial(p.values[0], p.values[1], p.values[2], p.values[3], p.values[4], p.values[5]);
+			ASSERT_LOG(p.first_stop <= header_->stops.count && p.stop_count <= header_->stops.count - p.first_stop, "Color stops out of range");
+			for(uint32_t n = 0; n != p.stop_count; ++n) {
+				const svgb::color_stop& cs = stops_[p.first_stop + n];
+				cairo_pattern_add_color_stop_rgba(pattern, cs.offset, cs.r, cs.g, cs.b, cs.a);
+			}
+			cairo_pattern_set_extend(pattern, static_cast<cairo_extend_t>(p.extend));
+			cairo_pattern_set_matrix(pattern, &p.matrix);
+			cairo_set_source(cairo, pattern);
+			cairo_pattern_destroy(pattern);
+		}
+
+		void binary_document::append_path(cairo_t* cairo, uint32_t index) const
+		{
+			ASSERT_LOG(index < header_->paths.count, "Path index out of range: " << index);
+			// The path data was checked when the document was loaded.
+			const svgb::path& p = paths_[index];
+			cairo_new_path(cairo);
+			if(p.count == 0) {
+				return;
+			}
+			cairo_path_t path;
+			path.status = CAIRO_STATUS_SUCCESS;
+			// cairo only reads from the data.
+			path.data = const_cast<cairo_path_data_t*>(&path_data_[p.first]);
+			path.num_data = static_cast<int>(p.count);
+			cairo_append_path(cairo, &path);
+		}
+
+		void binary_document::play(render_context& ctx, size_t first, size_t count) const
+		{
+			cairo_t* cairo = ctx.cairo();
+			cairo_save(cairo);
+			if(header_->flags & svgb::FLAG_SCALE_TO_VIEWPORT) {
+				cairo_scale(cairo, ctx.width() / header_->width, ctx.height() / header_->height);
+			}
+			// The recorded transforms are relative to this.
+			cairo_matrix_t base;
+			cairo_get_matrix(cairo, &base);
+
+			auto set_matrix = [&](uint32_t index) {
+				ASSERT_LOG(index < header_->matrices.count, "Matrix index out of range: " << index);
+				cairo_matrix_t mat;
+				cairo_matrix_multiply(&mat, &matrices_[index], &base);
+				cairo_set_matrix(cairo, &mat);
+			};
+			auto set_hint = [&](uint32_t hint) {
+				ASSERT_LOG(hint <= static_cast<uint32_t>(RenderingHint::PRECISION), "Unknown rendering hint: " << hint);
+				ctx.apply_hint(static_cast<RenderingHint>(hint));
+			};
+
+			for(size_t n = first; n != first + count; ++n) {
+				const svgb::op& o = ops_[n];
+				switch(o.type) {
+					case svgb::OpType::SAVE:				ctx.save(); break;
+					case svgb::OpType::RESTORE:				ctx.restore(); break;
+					case svgb::OpType::PUSH_GROUP:			ctx.push_group(); break;
+					case svgb::OpType::POP_GROUP_PAINT:		ctx.pop_group_and_paint(o.value); break;
+					case svgb::OpType::POP_GROUP_DISCARD:	ctx.pop_group_and_discard(); break;
+					case svgb::OpType::FILL:
+						set_matrix(o.matrix);
+						set_source(cairo, o.paint);
+						set_hint(o.hint);
+						append_path(cairo, o.path);
+						cairo_set_fill_rule(cairo, static_cast<cairo_fill_rule_t>(o.extra));
+						ctx.fill();
+						break;
+					case svgb::OpType::STROKE: {
+						ASSERT_LOG(o.extra < header_->strokes.count, "Stroke style index out of range: " << o.extra);
+						const svgb::stroke_style& s = strokes_[o.extra];
+						set_matrix(o.matrix);
+						set_source(cairo, o.paint);
+						set_hint(o.hint);
+						append_path(cairo, o.path);
+						cairo_set_line_width(cairo, s.line_width);
+						cairo_set_miter_limit(cairo, s.miter_limit);
+						cairo_set_line_cap(cairo, static_cast<cairo_line_cap_t>(s.line_cap));
+						cairo_set_line_join(cairo, static_cast<cairo_line_join_t>(s.line_join));
+						ASSERT_LOG(s.first_dash <= header_->dashes.count && s.dash_count <= header_->dashes.count - s.first_dash, "Dashes out of range");
+						cairo_set_dash(cairo, s.dash_count ? &dashes_[s.first_dash] : nullptr, static_cast<int>(s.dash_count), s.dash_offset);
+						ctx.stroke();
+						break;
+					}
+					case svgb::OpType::CLIP:
+						set_matrix(o.matrix);
+						set_hint(o.hint);
+						append_path(cairo, o.path);
+						cairo_set_fill_rule(cairo, static_cast<cairo_fill_rule_t>(o.extra));
+						ctx.clip();
+						break;
+					default:
+						ASSERT_LOG(false, "Unknown operation in compiled document: " << static_cast<uint32_t>(o.type));
+				}
+			}
+			ctx.flush();
+			cairo_restore(cairo);
+		}
+
+		void binary_document::render(render_context& ctx) const
+		{
+			play(ctx, 0, header_->ops.count);
+		}
+
+		bool binary_document::render_element(render_context& ctx, const std::string& id) const
+		{
+			const svgb::id_entry* begin = ids_;
+			const svgb::id_entry* end = ids_ + header_->ids.count;
+			auto name_of = [this](const svgb::id_entry& e) {
+				ASSERT_LOG(e.name_offset <= header_->strings.count && e.name_length <= header_->strings.count - e.name_offset, "Id name out of range");
+				return std::string(strings_ + e.name_offset, e.name_length);
+			};
+			auto it = std::lower_bound(begin, end, id, [&name_of](const svgb::id_entry& e, const std::string& s) {
+				return name_of(e) < s;
+			});
+			if(it == end || name_of(*it) != id) {
+				return false;
+			}
+			ASSERT_LOG(it->first_op <= header_->ops.count && it->op_count <= header_->ops.count - it->first_op, "Id op range out of range: " << id);
+			play(ctx, it->first_op, it->op_count);
+			return true;
+		}
+
+		namespace
+		{
+			const uint32_t archive_version = 1;
+
+			struct archive_header
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t byte_order;
+				uint32_t count;
+				// Offsets from the start of the file.
+				uint64_t index_offset;
+				uint64_t strings_offset;
+			};
+
+			struct archive_entry
+			{
+				uint64_t name_offset;
+				uint64_t name_length;
+				uint64_t offset;
+				uint64_t size;
+			};
+
+			// Documents are aligned to this within the archive.
+			const size_t archive_alignment = 16;
+		}
+
+		struct binary_archive::impl
+		{
+			sys::mapped_file_ptr file;
+			const uint8_t* data;
+			size_t size;
+			const archive_header* header;
+			const archive_entry* entries;
+			const char* strings;
+			size_t strings_size;
+
+			std::string name(const archive_entry& e) const {
+				ASSERT_LOG(e.name_offset <= strings_size && e.name_length <= strings_size - e.name_offset, "Archive name out of range");
+				return std::string(strings + e.name_offset, static_cast<size_t>(e.name_length));
+			}
+		};
+
+		binary_archive::binary_archive()
+		{
+		}
+
+		binary_archive::~binary_archive()
+		{
+		}
+
+		binary_archive_ptr binary_archive::open(const std::string& filename)
+		{
+			auto mf = sys::mapped_file::open(filename);
+			if(mf == nullptr) {
+				return binary_archive_ptr();
+			}
+			auto p = std::make_shared<impl>();
+			p->file = mf;
+			p->data = static_cast<const uint8_t*>(mf->data());
+			p->size = mf->size();
+			ASSERT_LOG(p->size >= sizeof(archive_header), "Archive is too small: " << filename);
+			p->header = reinterpret_cast<const archive_header*>(p->data);
+			ASSERT_LOG(memcmp(p->header->magic, "SVGA", 4) == 0, "Not an SVG archive: " << filename);
+			ASSERT_LOG(p->header->byte_order == svgb::byte_order_mark, "Archive has the wrong byte order: " << filename);
+			ASSERT_LOG(p->header->version == archive_version, "Archive version " << p->header->version << " not supported: " << filename);
+			ASSERT_LOG(p->header->index_offset <= p->size && p->header->count <= (p->size - p->header->index_offset) / sizeof(archive_entry), "Archive index out of range: " << filename);
+			ASSERT_LOG(p->header->strings_offset <= p->size, "Archive strings out of range: " << filename);
+			p->entries = reinterpret_cast<const archive_entry*>(p->data + p->header->index_offset);
+			p->strings = reinterpret_cast<const char*>(p->data + p->header->strings_offset);
+			p->strings_size = p->size - static_cast<size_t>(p->header->strings_offset);
+
+			std::shared_ptr<binary_archive> archive(new binary_archive());
+			archive->impl_ = p;
+			return archive;
+		}
+
+		size_t binary_archive::size() const
+		{
+			return impl_->header->count;
+		}
+
+		std::string binary_archive::name(size_t n) const
+		{
+			ASSERT_LOG(n < size(), "Archive entry out of range: " << n);
+			return impl_->name(impl_->entries[n]);
+		}
+
+		binary_document_ptr binary_archive::find(const std::string& name) const
+		{
+			const archive_entry* begin = impl_->entries;
+			const archive_entry* end = begin + impl_->header->count;
+			const impl& arc = *impl_;
+			auto it = std::lower_bound(begin, end, name, [&arc](const archive_entry& e, const std::string& s) {
+				return arc.name(e) < s;
+			});
+			if(it == end || arc.name(*it) != name) {
+				return binary_document_ptr();
+			}
+			ASSERT_LOG(it->offset <= arc.size && it->size <= arc.size - it->offset, "Archive entry out of range: " << name);
+			// The document keeps the whole archive mapped.
+			return std::make_shared<binary_document>(arc.data + it->offset, static_cast<size_t>(it->size), impl_);
+		}
+
+		bool write_archive(const std::string& filename, const std::vector<std::pair<std::string, std::vector<uint8_t>>>& documents)
+		{
+			std::vector<const std::pair<std::string, std::vector<uint8_t>>*> sorted;
+			for(auto& doc : documents) {
+				sorted.push_back(&doc);
+			}
+			std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, std::vector<uint8_t>>* a, const std::pair<std::string, std::vector<uint8_t>>* b) {
+				return a->first < b->first;
+			});
+			for(size_t n = 1; n < sorted.size(); ++n) {
+				ASSERT_LOG(sorted[n-1]->first != sorted[n]->first, "Duplicate name in archive: " << sorted[n]->first);
+			}
+
+			// header, index, names, then documents.
+			std::vector<uint8_t> out(sizeof(archive_header) + sorted.size() * sizeof(archive_entry));
+			archive_header hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			memcpy(hdr.magic, "SVGA", 4);
+			hdr.version = archive_version;
+			hdr.byte_order = svgb::byte_order_mark;
+			hdr.count = static_cast<uint32_t>(sorted.size());
+			hdr.index_offset = sizeof(archive_header);
+			hdr.strings_offset = out.size();
+
+			std::vector<archive_entry> entries(sorted.size());
+			for(size_t n = 0; n != sorted.size(); ++n) {
+				entries[n].name_offset = out.size() - hdr.strings_offset;
+				entries[n].name_length = sorted[n]->first.size();
+				out.insert(out.end(), sorted[n]->first.begin(), sorted[n]->first.end());
+			}
+			for(size_t n = 0; n != sorted.size(); ++n) {
+				out.resize((out.size() + archive_alignment - 1) & ~(archive_alignment - 1));
+				entries[n].offset = out.size();
+				entries[n].size = sorted[n]->second.size();
+				out.insert(out.end(), sorted[n]->second.begin(), sorted[n]->second.end());
+			}
+			memcpy(&out[0], &hdr, sizeof(hdr));
+			if(!entries.empty()) {
+				memcpy(&out[hdr.index_offset], &entries[0], entries.size() * sizeof(archive_entry));
+			}
+			return write_binary(filename, out);
+		}
+	}
+}
@@ -0,0 +1,252 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cairo.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "svg_render.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		class parse;
+
+		// Compiled documents ("SVGB").
+		//
+		// A document is compiled by rendering it once with a recorder attached,
+		// which captures every fill, stroke, clip, group and save/restore along
+		// with the path, transform, paint, stroke style and rendering hint in 
+		// effect. The result is a flat, versioned blob of fixed size records that
+		// reference each other by index, so it can be used in place from a memory
+		// mapped file. Loading involves checking the header and walking the path
+		// data, which cairo would otherwise trust blindly; rendering replays the
+		// records, handing the stored path data straight to cairo.
+		//
+		// Blobs are written in native byte order, a file from a machine with
+		// different endianness is rejected rather than converted.
+		namespace svgb
+		{
+			const uint32_t version = 2;
+			const uint32_t byte_order_mark = 0x01020304;
+
+			enum {
+				// Root element had a viewBox, so the output scales with the viewport.
+				FLAG_SCALE_TO_VIEWPORT = 1,
+			};
+
+			struct table
+			{
+				// Offset from the start of the blob, always a multiple of 8.
+				uint32_t offset;
+				uint32_t count;
+			};
+
+			struct header
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t byte_order;
+				uint32_t flags;
+				// Viewport size the document was recorded at.
+				double width;
+				double height;
+				table ops;			// op
+				table matrices;		// cairo_matrix_t
+				table paths;		// path
+				table path_data;	// cairo_path_data_t
+				table paints;		// paint
+				table stops;		// color_stop
+				table strokes;		// stroke_style
+				table dashes;		// double
+				table ids;			// id_entry, sorted by name
+				table strings;		// char
+			};
+
+			enum class OpType : uint32_t {
+				SAVE,
+				RESTORE,
+				PUSH_GROUP,
+				POP_GROUP_PAINT,	// value is the alpha
+				POP_GROUP_DISCARD,
+				FILL,				// path, paint, matrix, hint, extra is the fill rule
+				STROKE,				// path, paint, matrix, hint, extra is the stroke style
+				CLIP,				// path, matrix, hint, extra is the fill rule
+			};
+
+			struct op
+			{
+				OpType type;
+				uint32_t path;
+				uint32_t paint;
+				uint32_t matrix;
+				uint32_t extra;
+				// The RenderingHint the operation was drawn with, from shape-rendering
+				// or text-rendering. Applied relative to the quality being played at.
+				uint32_t hint;
+				double value;
+			};
+
+			struct path
+			{
+				uint32_t first;
+				uint32_t count;
+			};
+
+			enum class PaintType : uint32_t {
+				SOLID,
+				LINEAR,
+				RADIAL,
+			};
+
+			struct paint
+			{
+				PaintType type;
+				uint32_t extend;
+				uint32_t first_stop;
+				uint32_t stop_count;
+				// rgba for solid, x0,y0,x1,y1 for linear, cx0,cy0,r0,cx1,cy1,r1 for radial.
+				double values[6];
+				cairo_matrix_t matrix;
+			};
+
+			struct color_stop
+			{
+				double offset;
+				double r, g, b, a;
+			};
+
+			struct stroke_style
+			{
+				double line_width;
+				double miter_limit;
+				uint32_t line_cap;
+				uint32_t line_join;
+				uint32_t first_dash;
+				uint32_t dash_count;
+				double dash_offset;
+			};
+
+			struct id_entry
+			{
+				uint32_t name_offset;
+				uint32_t name_length;
+				uint32_t first_op;
+				uint32_t op_count;
+			};
+		}
+
+		// Render the document with a recorder attached and return the compiled form.
+		// Filters, masks and embedded images can't be recorded, documents using 
+		// them give an empty blob, with an error logged.
+		std::vector<uint8_t> compile_binary(const parse& doc);
+
+		class binary_document;
+		typedef std::shared_ptr<const binary_document> binary_document_ptr;
+
+		// A compiled document, used in place. Doesn't copy the data, owner keeps
+		// whatever holds it alive for as long as the document exists.
+		class binary_document
+		{
+		public:
+			// data must be aligned to at least 8 bytes.
+			binary_document(const void* data, size_t size, const std::shared_ptr<const void>& owner);
+			~binary_document();
+
+			// Memory maps a file written by write_binary().
+			static binary_document_ptr load(const std::string& filename);
+
+			// Render in the same way parse::render() would for this viewport.
+			void render(render_context& ctx) const;
+			// Render just the element with the given id, in its position in the
+			// document. Returns false if there is no such element.
+			bool render_element(render_context& ctx, const std::string& id) const;
+
+			double width() const { return header_->width; }
+			double height() const { return header_->height; }
+			size_t size_in_bytes() const { return size_; }
+		private:
+			binary_document(const binary_document&);
+			void operator=(const binary_document&);
+
+			template<typename T> const T* get_table(const svgb::table& t) const;
+			// Every path has to be a run of whole, well formed elements.
+			void check_paths() const;
+			void play(render_context& ctx, size_t first, size_t count) const;
+			void set_source(cairo_t* cairo, uint32_t index) const;
+			void append_path(cairo_t* cairo, uint32_t index) const;
+
+			const uint8_t* data_;
+			size_t size_;
+			std::shared_ptr<const void> owner_;
+
+			const svgb::header* header_;
+			const svgb::op* ops_;
+			const cairo_matrix_t* matrices_;
+			const svgb::path* paths_;
+			const cairo_path_data_t* path_data_;
+			const svgb::paint* paints_;
+			const svgb::color_stop* stops_;
+			const svgb::stroke_style* strokes_;
+			const double* dashes_;
+			const svgb::id_entry* ids_;
+			const char* strings_;
+		};
+
+		bool write_binary(const std::string& filename, const std::vector<uint8_t>& blob);
+
+		// Many compiled documents in one file, looked up by name.
+		class binary_archive;
+		typedef std::shared_ptr<const binary_archive> binary_archive_ptr;
+
+		class binary_archive
+		{
+		public:
+			~binary_archive();
+
+			// Memory maps the archive, only the header and index are touched.
+			static binary_archive_ptr open(const std::string& filename);
+
+			size_t size() const;
+			std::string name(size_t n) const;
+			// Returns nullptr if there is no document of that name.
+			binary_document_ptr find(const std::string& name) const;
+		private:
+			binary_archive();
+			binary_archive(const binary_archive&);
+			void operator=(const binary_archive&);
+
+			struct impl;
+			std::shared_ptr<impl> impl_;
+		};
+
+		// Documents are stored in name order, names must be unique.
+		bool write_archive(const std::string& filename, const std::vector<std::pair<std::string, std::vector<uint8_t>>>& documents);
+	}
+}
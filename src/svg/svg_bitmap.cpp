@@ -0,0 +1,195 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+
+#include "asserts.hpp"
+#include "svg_bitmap.hpp"
+#include "svg_cache.hpp"
+#include "svg_parse.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		bitmap::bitmap(unsigned width, unsigned height)
+			: width_(width),
+			  height_(height),
+			  stride_(cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width))
+		{
+			ASSERT_LOG(width > 0 && height > 0, "Bitmap dimensions must be non-zero: " << width << "x" << height);
+			ASSERT_LOG(stride_ > 0, "Invalid width for bitmap: " << width);
+			pixels_.resize(static_cast<size_t>(stride_) * height_);
+			data_ = &pixels_[0];
+		}
+
+		bitmap::bitmap(unsigned width, unsigned height, int stride, uint8_t* data, const std::shared_ptr<void>& owner)
+			: width_(width),
+			  height_(height),
+			  stride_(stride),
+			  data_(data),
+			  owner_(owner)
+		{
+			ASSERT_LOG(width > 0 && height > 0, "Bitmap dimensions must be non-zero: " << width << "x" << height);
+			ASSERT_LOG(stride_ >= cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width), "Stride too small for bitmap: " << stride);
+			ASSERT_LOG(data_ != nullptr, "No pixel data for bitmap");
+		}
+
+		bitmap::~bitmap()
+		{
+		}
+
+		cairo_surface_t* bitmap::create_surface()
+		{
+			return cairo_image_surface_create_for_data(data(), CAIRO_FORMAT_ARGB32, width_, height_, stride_);
+		}
+
+		bool bitmap::write_png(const std::string& filename) const
+		{
+			TRACE_ZONE_DETAIL("write_png", "file", filename);
+			// cairo wants a non-const pointer but only reads from it.
+			cairo_surface_t* surface = cairo_image_surface_create_for_data(const_cast<uint8_t*>(data()), CAIRO_FORMAT_ARGB32, width_, height_, stride_);
+			auto status = cairo_surface_write_to_png(surface, filename.c_str());
+			cairo_surface_destroy(surface);
+			if(status != CAIRO_STATUS_SUCCESS) {
+				LOG_ERROR("Unable to write png '" << filename << "': " << cairo_status_to_string(status));
+				return false;
+			}
+			return true;
+		}
+
+		bitmap_ptr render_bitmap(const parse& doc, unsigned width, unsigned height, const render_params& params)
+		{
+			TRACE_ZONE("render_bitmap");
+			if(width == 0 || height == 0) {
+				throw std::runtime_error("Bitmap dimensions must be non-zero");
+			}
+			bitmap_ptr bmp = std::make_shared<bitmap>(width, height);
+			cairo_surface_t* surface = bmp->create_surface();
+			cairo_t* cairo = cairo_create(surface);
+			if(params.background >> 24) {
+				cairo_set_source_rgba(cairo, 
+					((params.background >> 16) & 0xff) / 255.0,
+					((params.background >> 8) & 0xff) / 255.0,
+					(params.background & 0xff) / 255.0,
+					(params.background >> 24) / 255.0);
+				cairo_paint(cairo);
+			}
+			{
+				render_context ctx(cairo, width, height);
+				ctx.set_quality(params.quality);
+				ctx.set_batch_fills(params.batch_fills);
+				ctx.set_filter_threads(params.filter_threads);
+				doc.render(ctx);
+			}
+			auto status = cairo_status(cairo);
+			cairo_destroy(cairo);
+			cairo_surface_flush(surface);
+			cairo_surface_destroy(surface);
+			// Thrown rather than asserted, this runs on worker threads.
+			if(status != CAIRO_STATUS_SUCCESS) {
+				throw std::runtime_error(std::string("Cairo error: ") + cairo_status_to_string(status));
+			}
+			return bmp;
+		}
+
+		bitmap_ptr render_file(const std::string& filename, unsigned width, unsigned height, const render_params& params, raster_cache* cache)
+		{
+			if(cache) {
+				auto bmp = cache->find(filename, width, height, params);
+				if(bmp) {
+					return bmp;
+				}
+			}
+			parse_options opts;
+			opts.level_of_detail = params.level_of_detail;
+			opts.lod_pixel_tolerance = params.lod_pixel_tolerance;
+			opts.optimise_tree = params.optimise_tree;
+			parse doc(filename, opts);
+			auto bmp = render_bitmap(doc, width, height, params);
+			if(cache) {
+				cache->store(filename, params, *bmp);
+			}
+			return bmp;
+		}
+
+		std::vector<bitmap_ptr> render_bitmaps(const parse& doc, const std::vector<bitmap_size>& sizes, threading::thread_pool* pool)
+		{
+			std::vector<bitmap_ptr> result(sizes.size());
+			if(pool == nullptr || sizes.size() < 2) {
+				for(size_t n = 0; n != sizes.size(); ++n) {
+					result[n] = render_bitmap(doc, sizes[n].first, sizes[n].second);
+				}
+				return result;
+			}
+
+			// Biggest first, they take the longest.
+			std::vector<size_t> order(sizes.size());
+			for(size_t n = 0; n != order.size(); ++n) {
+				order[n] = n;
+			}
+			std::sort(order.begin(), order.end(), [&sizes](size_t a, size_t b) {
+				return sizes[a].first * sizes[a].second > sizes[b].first * sizes[b].second;
+			});
+
+			// The sizes already keep the pool busy.
+			render_params params;
+			params.filter_threads = 1;
+
+			// Wait on our own jobs only, the pool may be busy with other work.
+			std::mutex mutex;
+			std::condition_variable cv;
+			size_t remaining = sizes.size();
+			std::exception_ptr error;
+			for(auto n : order) {
+				pool->submit([&, n](int) {
+					std::exception_ptr err;
+					try {
+						result[n] = render_bitmap(doc, sizes[n].first, sizes[n].second, params);
+					} catch(...) {
+						err = std::current_exception();
+					}
+					std::lock_guard<std::mutex> lock(mutex);
+					if(err && !error) {
+						error = err;
+					}
+					if(--remaining == 0) {
+						cv.notify_all();
+					}
+				});
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&remaining]() { return remaining == 0; });
+			if(error) {
+				std::rethrow_exception(error);
+			}
+			return result;
+		}
+	}
+}
@@ -0,0 +1,125 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cairo.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "svg_render.hpp"
+
+namespace threading
+{
+	class thread_pool;
+}
+
+namespace KRE
+{
+	namespace SVG
+	{
+		class parse;
+		class raster_cache;
+
+		// A block of pixels in cairo's native ARGB32 format, i.e. premultiplied
+		// alpha, 32-bits per pixel in native endian order. Owns its memory, so can
+		// be handed between threads and kept around independently of any cairo
+		// context or surface.
+		class bitmap
+		{
+		public:
+			bitmap(unsigned width, unsigned height);
+			// Uses memory owned by something else, e.g. a mapped file, which is kept
+			// alive for as long as the bitmap is.
+			bitmap(unsigned width, unsigned height, int stride, uint8_t* data, const std::shared_ptr<void>& owner);
+			~bitmap();
+
+			unsigned width() const { return width_; }
+			unsigned height() const { return height_; }
+			int stride() const { return stride_; }
+
+			const uint8_t* data() const { return data_; }
+			uint8_t* data() { return data_; }
+			size_t size_in_bytes() const { return static_cast<size_t>(stride_) * height_; }
+
+			// Creates a cairo surface that draws directly into our pixel data. The
+			// surface must be destroyed before the bitmap is.
+			cairo_surface_t* create_surface();
+
+			bool write_png(const std::string& filename) const;
+		private:
+			bitmap(const bitmap&);
+			void operator=(const bitmap&);
+
+			unsigned width_;
+			unsigned height_;
+			int stride_;
+			std::vector<uint8_t> pixels_;
+			uint8_t* data_;
+			std::shared_ptr<void> owner_;
+		};
+		typedef std::shared_ptr<bitmap> bitmap_ptr;
+		typedef std::shared_ptr<const bitmap> const_bitmap_ptr;
+
+		struct render_params
+		{
+			render_params() 
+				: background(0), quality(RenderQuality::NORMAL), batch_fills(false), filter_threads(0),
+				  level_of_detail(false), lod_pixel_tolerance(0.25), optimise_tree(false) 
+			{}
+			// Non-premultiplied 0xAARRGGBB the bitmap is cleared to before rendering.
+			uint32_t background;
+			RenderQuality quality;
+			// See render_context::set_batch_fills(). Doesn't change the output.
+			bool batch_fills;
+			// See render_context::set_filter_threads().
+			int filter_threads;
+			// The parse_options the document is loaded with that change the output,
+			// used by render_file() and to tell cache entries apart.
+			bool level_of_detail;
+			double lod_pixel_tolerance;
+			bool optimise_tree;
+		};
+
+		// Render the document into a new bitmap of the given size. Throws 
+		// std::runtime_error if the size is empty or cairo fails.
+		bitmap_ptr render_bitmap(const parse& doc, unsigned width, unsigned height, const render_params& params=render_params());
+
+		// Load and render a file. If a cache is given it is checked before the file
+		// is parsed, and updated with the result otherwise.
+		bitmap_ptr render_file(const std::string& filename, unsigned width, unsigned height, const render_params& params=render_params(), raster_cache* cache=nullptr);
+
+		// width, height
+		typedef std::pair<unsigned, unsigned> bitmap_size;
+
+		// Render the document at each of the given sizes, the result is in the same
+		// order as sizes. Parsing, style resolution and path normalisation all
+		// happened when the document was loaded so each size is just a replay of
+		// the tree. If a pool is given the sizes are rendered on it in parallel,
+		// in which case this must not be called from a task running on that pool.
+		std::vector<bitmap_ptr> render_bitmaps(const parse& doc, const std::vector<bitmap_size>& sizes, threading::thread_pool* pool=nullptr);
+	}
+}
@@ -0,0 +1,202 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include "asserts.hpp"
+#include "svg_bitmap_cache.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			bool same_owner(const std::weak_ptr<const parse>& a, const parse_ptr& b)
+			{
+				return !a.owner_before(b) && !b.owner_before(a) && !a.expired();
+			}
+
+			// Multiply the premultiplied pixels by a non-premultiplied tint.
+			void apply_tint(bitmap& bmp, uint32_t tint)
+			{
+				const uint32_t ta = tint >> 24;
+				// Fold the tint alpha into the colour factors, since the pixels are premultiplied.
+				const uint32_t tr = ((tint >> 16) & 0xff) * ta;
+				const uint32_t tg = ((tint >> 8) & 0xff) * ta;
+				const uint32_t tb = (tint & 0xff) * ta;
+				for(unsigned y = 0; y != bmp.height(); ++y) {
+					uint32_t* row = reinterpret_cast<uint32_t*>(bmp.data() + y * bmp.stride());
+					for(unsigned x = 0; x != bmp.width(); ++x) {
+						const uint32_t p = row[x];
+						const uint32_t a = ((p >> 24) * ta + 127) / 255;
+						const uint32_t r = (((p >> 16) & 0xff) * tr + 32512) / 65025;
+						const uint32_t g = (((p >> 8) & 0xff) * tg + 32512) / 65025;
+						const uint32_t b = ((p & 0xff) * tb + 32512) / 65025;
+						row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+					}
+				}
+			}
+		}
+
+		bool bitmap_cache::key::operator<(const key& other) const
+		{
+			if(doc != other.doc) {
+				return doc < other.doc;
+			}
+			if(width != other.width) {
+				return width < other.width;
+			}
+			if(height != other.height) {
+				return height < other.height;
+			}
+			if(tint != other.tint) {
+				return tint < other.tint;
+			}
+			return quality < other.quality;
+		}
+
+		bitmap_cache::bitmap_cache(size_t max_bytes)
+			: max_bytes_(max_bytes)
+		{
+		}
+
+		bitmap_cache::~bitmap_cache()
+		{
+		}
+
+		const_bitmap_ptr bitmap_cache::lookup(const key& k, const parse_ptr& doc)
+		{
+			auto it = entries_.find(k);
+			if(it == entries_.end()) {
+				return const_bitmap_ptr();
+			}
+			if(!same_owner(it->second.doc, doc)) {
+				// A different document now lives at the same address.
+				stats_.bytes -= it->second.bmp->size_in_bytes();
+				lru_.erase(it->second.lru);
+				entries_.erase(it);
+				return const_bitmap_ptr();
+			}
+			lru_.splice(lru_.begin(), lru_, it->second.lru);
+			return it->second.bmp;
+		}
+
+		const_bitmap_ptr bitmap_cache::find(const parse_ptr& doc, unsigned width, unsigned height, uint32_t tint, RenderQuality quality)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto bmp = lookup(key(doc, width, height, tint, quality), doc);
+			if(bmp) {
+				++stats_.hits;
+			} else {
+				++stats_.misses;
+			}
+			return bmp;
+		}
+
+		const_bitmap_ptr bitmap_cache::get(const parse_ptr& doc, unsigned width, unsigned height, uint32_t tint, RenderQuality quality)
+		{
+			ASSERT_LOG(doc != nullptr, "bitmap_cache::get() called without a document");
+			const key k(doc, width, height, tint, quality);
+			std::shared_ptr<std::promise<const_bitmap_ptr>> promise;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				auto bmp = lookup(k, doc);
+				if(bmp) {
+					++stats_.hits;
+					return bmp;
+				}
+				++stats_.misses;
+				auto it = pending_.find(k);
+				if(it != pending_.end()) {
+					// Somebody else is already rendering it.
+					auto fut = it->second;
+					lock.unlock();
+					return fut.get();
+				}
+				promise = std::make_shared<std::promise<const_bitmap_ptr>>();
+				pending_[k] = promise->get_future().share();
+			}
+
+			bitmap_ptr bmp;
+			try {
+				render_params params;
+				params.quality = quality;
+				bmp = render_bitmap(*doc, width, height, params);
+				if(tint != 0xffffffff) {
+					apply_tint(*bmp, tint);
+				}
+			} catch(...) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				promise->set_exception(std::current_exception());
+				pending_.erase(k);
+				throw;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_.erase(k);
+			promise->set_value(bmp);
+			lru_.push_front(k);
+			entry& e = entries_[k];
+			e.doc = doc;
+			e.bmp = bmp;
+			e.lru = lru_.begin();
+			stats_.bytes += bmp->size_in_bytes();
+			evict();
+			return bmp;
+		}
+
+		void bitmap_cache::evict()
+		{
+			while(stats_.bytes > max_bytes_ && !lru_.empty()) {
+				auto it = entries_.find(lru_.back());
+				ASSERT_LOG(it != entries_.end(), "bitmap_cache LRU list out of step with entries");
+				stats_.bytes -= it->second.bmp->size_in_bytes();
+				entries_.erase(it);
+				lru_.pop_back();
+				++stats_.evictions;
+			}
+		}
+
+		void bitmap_cache::set_max_bytes(size_t max_bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			max_bytes_ = max_bytes;
+			evict();
+		}
+
+		void bitmap_cache::clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_.clear();
+			lru_.clear();
+			stats_.bytes = 0;
+		}
+
+		bitmap_cache::stats bitmap_cache::get_stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stats s = stats_;
+			s.entries = entries_.size();
+			return s;
+		}
+	}
+}
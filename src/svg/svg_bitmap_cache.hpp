@@ -0,0 +1,116 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "svg_bitmap.hpp"
+#include "svg_parse.hpp"
+#include "svg_render.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// In memory cache of rendered documents, for when the same thing is asked
+		// for over and over. Keyed on the document, size, tint and quality. The
+		// bitmaps handed out are shared so must not be modified.
+		//
+		// The tint is a non-premultiplied 0xAARRGGBB colour multiplied into every
+		// pixel, 0xffffffff leaves the output alone.
+		//
+		// Documents are only weakly referenced, entries for documents that have
+		// been destroyed are never returned and get evicted in time. When the
+		// pixels held exceed the byte budget the least recently used entries are
+		// dropped, though bitmaps already handed out remain valid.
+		//
+		// Thread-safe. If several threads ask for the same missing entry at once
+		// only one of them renders it, the others wait for the result.
+		class bitmap_cache
+		{
+		public:
+			explicit bitmap_cache(size_t max_bytes);
+			~bitmap_cache();
+
+			// Returns the cached bitmap, rendering it first if need be.
+			const_bitmap_ptr get(const parse_ptr& doc, unsigned width, unsigned height, uint32_t tint=0xffffffff, RenderQuality quality=RenderQuality::NORMAL);
+			// Only returns a bitmap if it's already cached.
+			const_bitmap_ptr find(const parse_ptr& doc, unsigned width, unsigned height, uint32_t tint=0xffffffff, RenderQuality quality=RenderQuality::NORMAL);
+
+			void set_max_bytes(size_t max_bytes);
+			void clear();
+
+			struct stats
+			{
+				stats() : hits(0), misses(0), evictions(0), entries(0), bytes(0) {}
+				uint64_t hits;
+				uint64_t misses;
+				uint64_t evictions;
+				size_t entries;
+				size_t bytes;
+			};
+			stats get_stats() const;
+		private:
+			bitmap_cache(const bitmap_cache&);
+			void operator=(const bitmap_cache&);
+
+			struct key
+			{
+				key(const parse_ptr& d, unsigned w, unsigned h, uint32_t t, RenderQuality q) 
+					: doc(d.get()), width(w), height(h), tint(t), quality(q) {}
+				bool operator<(const key& other) const;
+				const parse* doc;
+				unsigned width;
+				unsigned height;
+				uint32_t tint;
+				RenderQuality quality;
+			};
+
+			struct entry
+			{
+				// Used to tell if doc is still the document we rendered.
+				std::weak_ptr<const parse> doc;
+				const_bitmap_ptr bmp;
+				std::list<key>::iterator lru;
+			};
+
+			// Caller must hold the lock.
+			const_bitmap_ptr lookup(const key& k, const parse_ptr& doc);
+			void evict();
+
+			mutable std::mutex mutex_;
+			size_t max_bytes_;
+			std::map<key, entry> entries_;
+			// Most recently used at the front.
+			std::list<key> lru_;
+			std::map<key, std::shared_future<const_bitmap_ptr>> pending_;
+			stats stats_;
+		};
+	}
+}
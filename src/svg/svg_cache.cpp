@@ -0,0 +1,344 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#if defined(__linux__)
+//Avoid link error on Linux when compiling with -std=c++0x and linking with
+//a Boost lib not compiled with these flags.
+#define BOOST_NO_SCOPED_ENUMS
+#define BOOST_NO_CXX11_SCOPED_ENUMS
+#endif
+
+#include <boost/filesystem.hpp>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "svg_cache.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// Bump this whenever a change to the renderer changes its output, so that
+			// entries from older versions are no longer used.
+			const uint32_t renderer_version = 11;
+
+			const uint32_t entry_format_version = 1;
+			const char* const entry_extension = ".argb";
+			const char* const sources_filename = "sources.txt";
+
+			// Entries are this header followed by the pixels, in cairo's native
+			// premultiplied ARGB32 format.
+			struct entry_header
+			{
+				char magic[4];
+				uint32_t version;
+				uint32_t width;
+				uint32_t height;
+				int32_t stride;
+				uint32_t reserved[11];
+			};
+
+			// 64-bit FNV-1a
+			uint64_t hash_bytes(const std::string& s)
+			{
+				uint64_t h = 14695981039346656037ULL;
+				for(unsigned char c : s) {
+					h ^= c;
+					h *= 1099511628211ULL;
+				}
+				return h;
+			}
+
+			std::string entry_name(const std::string& hash, unsigned width, unsigned height, const render_params& params)
+			{
+				std::stringstream ss;
+				ss << hash << "_" << width << "x" << height 
+					<< "_" << std::hex << std::setw(8) << std::setfill('0') << params.background << std::dec
+					<< "_q" << static_cast<int>(params.quality)
+					<< "_l" << (params.level_of_detail ? params.lod_pixel_tolerance : 0.0)
+					<< "_o" << (params.optimise_tree ? 1 : 0)
+					<< "_v" << renderer_version
+					<< entry_extension;
+				return ss.str();
+			}
+
+			std::string absolute_name(const std::string& filename)
+			{
+				return boost::filesystem::absolute(filename).generic_string();
+			}
+		}
+
+		raster_cache::raster_cache(const std::string& dir, uint64_t max_bytes)
+			: dir_(dir),
+			  max_bytes_(max_bytes),
+			  sources_dirty_(false),
+			  tick_(0)
+		{
+			using namespace boost::filesystem;
+			boost::system::error_code ec;
+			create_directories(dir_, ec);
+			ASSERT_LOG(!ec, "Unable to create raster cache directory: " << dir_ << " : " << ec.message());
+
+			// Existing entries, oldest first gives the initial LRU order.
+			std::vector<std::pair<std::time_t, std::string>> found;
+			for(directory_iterator it(dir_, ec), end; !ec && it != end; it.increment(ec)) {
+				const path& p = it->path();
+				if(p.extension().string() != entry_extension || !is_regular_file(p)) {
+					continue;
+				}
+				found.emplace_back(last_write_time(p), p.filename().string());
+			}
+			std::sort(found.begin(), found.end());
+			for(auto& f : found) {
+				entry e;
+				e.size = static_cast<uint64_t>(sys::file_size(entry_path(f.second)));
+				e.last_used = ++tick_;
+				entries_[f.second] = e;
+				stats_.bytes += e.size;
+			}
+			load_sources();
+		}
+
+		raster_cache::~raster_cache()
+		{
+			flush();
+		}
+
+		std::string raster_cache::entry_path(const std::string& name) const
+		{
+			return (boost::filesystem::path(dir_) / name).generic_string();
+		}
+
+		void raster_cache::load_sources()
+		{
+			std::ifstream file(entry_path(sources_filename).c_str());
+			std::string line;
+			while(std::getline(file, line)) {
+				// hash mod_time size filename, the filename may contain spaces.
+				std::istringstream ss(line);
+				source_info info;
+				if(!(ss >> info.hash >> info.mod_time >> info.size)) {
+					continue;
+				}
+				std::string name;
+				std::getline(ss >> std::ws, name);
+				if(!name.empty()) {
+					sources_[name] = info;
+				}
+			}
+		}
+
+		void raster_cache::flush()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if(!sources_dirty_) {
+				return;
+			}
+			std::stringstream ss;
+			for(auto& s : sources_) {
+				ss << s.second.hash << " " << s.second.mod_time << " " << s.second.size << " " << s.first << "\n";
+			}
+			sys::write_file(entry_path(sources_filename), ss.str());
+			sources_dirty_ = false;
+		}
+
+		std::string raster_cache::content_hash(const std::string& filename)
+		{
+			const std::string name = absolute_name(filename);
+			const int64_t mod_time = sys::file_mod_time(filename);
+			const int64_t size = sys::file_size(filename);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				auto it = sources_.find(name);
+				if(it != sources_.end() && it->second.mod_time == mod_time && it->second.size == size) {
+					return it->second.hash;
+				}
+			}
+
+			// Changed or never seen, hash the contents. Done without the lock held,
+			// if two threads race on the same file they'll get the same answer.
+			if(!sys::file_exists(filename)) {
+				return std::string();
+			}
+			std::stringstream ss;
+			ss << std::hex << std::setw(16) << std::setfill('0') << hash_bytes(sys::read_file(filename));
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			source_info& info = sources_[name];
+			info.mod_time = mod_time;
+			info.size = size;
+			info.hash = ss.str();
+			sources_dirty_ = true;
+			++stats_.files_hashed;
+			return info.hash;
+		}
+
+		bitmap_ptr raster_cache::find(const std::string& filename, unsigned width, unsigned height, const render_params& params)
+		{
+			const std::string hash = content_hash(filename);
+			if(hash.empty()) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				++stats_.misses;
+				return bitmap_ptr();
+			}
+			const std::string name = entry_name(hash, width, height, params);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if(entries_.find(name) == entries_.end()) {
+					++stats_.misses;
+					return bitmap_ptr();
+				}
+			}
+
+			// Copy on write, callers are allowed to draw on the bitmap.
+			const std::string fname = entry_path(name);
+			auto mf = sys::mapped_file::open(fname, true);
+			bool valid = false;
+			if(mf && mf->size() >= sizeof(entry_header)) {
+				const entry_header* hdr = static_cast<const entry_header*>(mf->data());
+				valid = memcmp(hdr->magic, "SVGR", 4) == 0
+					&& hdr->version == entry_format_version
+					&& hdr->width == width
+					&& hdr->height == height
+					&& hdr->stride >= cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width)
+					&& mf->size() >= sizeof(entry_header) + static_cast<size_t>(hdr->stride) * height;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = entries_.find(name);
+			if(!valid) {
+				LOG_WARN("Removing invalid raster cache entry: " << fname);
+				mf.reset();
+				if(it != entries_.end()) {
+					stats_.bytes -= it->second.size;
+					entries_.erase(it);
+				}
+				boost::system::error_code ec;
+				boost::filesystem::remove(fname, ec);
+				++stats_.misses;
+				return bitmap_ptr();
+			}
+			if(it != entries_.end()) {
+				it->second.last_used = ++tick_;
+			}
+			// So the LRU order survives to the next run.
+			boost::system::error_code ec;
+			boost::filesystem::last_write_time(fname, std::time(nullptr), ec);
+			++stats_.hits;
+
+			const entry_header* hdr = static_cast<const entry_header*>(mf->data());
+			uint8_t* pixels = static_cast<uint8_t*>(mf->data()) + sizeof(entry_header);
+			return std::make_shared<bitmap>(width, height, hdr->stride, pixels, mf);
+		}
+
+		void raster_cache::store(const std::string& filename, const render_params& params, const bitmap& bmp)
+		{
+			const std::string hash = content_hash(filename);
+			if(hash.empty()) {
+				return;
+			}
+			const std::string name = entry_name(hash, bmp.width(), bmp.height(), params);
+
+			entry_header hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			memcpy(hdr.magic, "SVGR", 4);
+			hdr.version = entry_format_version;
+			hdr.width = bmp.width();
+			hdr.height = bmp.height();
+			hdr.stride = bmp.stride();
+
+			// Write to a temporary then rename, so nobody sees a partial entry.
+			const std::string fname = entry_path(name);
+			const std::string tmp_name = entry_path(boost::filesystem::unique_path("%%%%-%%%%-%%%%-%%%%.tmp").string());
+			{
+				std::ofstream file(tmp_name.c_str(), std::ios::binary);
+				file.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+				file.write(reinterpret_cast<const char*>(bmp.data()), bmp.size_in_bytes());
+				if(!file) {
+					LOG_ERROR("Unable to write raster cache entry: " << tmp_name);
+					file.close();
+					boost::system::error_code ec;
+					boost::filesystem::remove(tmp_name, ec);
+					return;
+				}
+			}
+			boost::system::error_code ec;
+			boost::filesystem::rename(tmp_name, fname, ec);
+			if(ec) {
+				LOG_ERROR("Unable to write raster cache entry: " << fname << " : " << ec.message());
+				boost::filesystem::remove(tmp_name, ec);
+				return;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			entry& e = entries_[name];
+			stats_.bytes -= e.size;
+			e.size = sizeof(hdr) + bmp.size_in_bytes();
+			e.last_used = ++tick_;
+			stats_.bytes += e.size;
+			++stats_.stores;
+			evict(name);
+		}
+
+		void raster_cache::evict(const std::string& keep)
+		{
+			if(max_bytes_ == 0 || stats_.bytes <= max_bytes_) {
+				return;
+			}
+			std::vector<std::pair<uint64_t, std::string>> order;
+			for(auto& e : entries_) {
+				if(e.first != keep) {
+					order.emplace_back(e.second.last_used, e.first);
+				}
+			}
+			std::sort(order.begin(), order.end());
+			for(auto& o : order) {
+				if(stats_.bytes <= max_bytes_) {
+					break;
+				}
+				// Anyone who has the entry mapped keeps their copy.
+				boost::system::error_code ec;
+				boost::filesystem::remove(entry_path(o.second), ec);
+				stats_.bytes -= entries_[o.second].size;
+				entries_.erase(o.second);
+				++stats_.evictions;
+			}
+		}
+
+		raster_cache::stats raster_cache::get_stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			return stats_;
+		}
+	}
+}
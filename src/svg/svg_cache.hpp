@@ -0,0 +1,113 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "svg_bitmap.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Persistent cache of rendered bitmaps, stored in a directory.
+		//
+		// Entries are addressed by a hash of the source file's contents along with
+		// the render parameters (size, background, quality, level of detail, tree
+		// optimisation and renderer version),
+		// so edits to a file or to the renderer simply stop matching old entries.
+		// Each entry is a raw ARGB32 file which is memory mapped on a hit. To avoid
+		// re-hashing unchanged files the modification time and size of every file
+		// hashed are remembered between runs.
+		//
+		// When the directory grows past max_bytes the least recently used entries
+		// are removed. Safe to use from several threads at once.
+		class raster_cache
+		{
+		public:
+			// max_bytes of zero means there is no limit.
+			raster_cache(const std::string& dir, uint64_t max_bytes);
+			// Calls flush()
+			~raster_cache();
+
+			// nullptr if there is no entry for this file, size and parameters.
+			bitmap_ptr find(const std::string& filename, unsigned width, unsigned height, const render_params& params);
+			void store(const std::string& filename, const render_params& params, const bitmap& bmp);
+
+			// Write out the remembered file hashes.
+			void flush();
+
+			struct stats
+			{
+				stats() : hits(0), misses(0), stores(0), evictions(0), files_hashed(0), bytes(0) {}
+				uint64_t hits;
+				uint64_t misses;
+				uint64_t stores;
+				uint64_t evictions;
+				// Number of times a file had to be read and hashed.
+				uint64_t files_hashed;
+				// Current size of the cache directory contents.
+				uint64_t bytes;
+			};
+			stats get_stats() const;
+		private:
+			raster_cache(const raster_cache&);
+			void operator=(const raster_cache&);
+
+			// Empty if the file couldn't be read.
+			std::string content_hash(const std::string& filename);
+			std::string entry_path(const std::string& name) const;
+			void evict(const std::string& keep);
+			void load_sources();
+
+			mutable std::mutex mutex_;
+			std::string dir_;
+			uint64_t max_bytes_;
+
+			struct source_info
+			{
+				int64_t mod_time;
+				int64_t size;
+				std::string hash;
+			};
+			// Keyed on absolute filename.
+			std::map<std::string, source_info> sources_;
+			bool sources_dirty_;
+
+			struct entry
+			{
+				uint64_t size;
+				uint64_t last_used;
+			};
+			std::map<std::string, entry> entries_;
+			uint64_t tick_;
+			stats stats_;
+		};
+		typedef std::shared_ptr<raster_cache> raster_cache_ptr;
+	}
+}
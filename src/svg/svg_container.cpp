@@ -22,8 +22,16 @@
 */
 
 #include <boost/tokenizer.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #include "svg_container.hpp"
+#include "svg_filter.hpp"
+#include "svg_marker.hpp"
+#include "svg_mask.hpp"
+#include "svg_image.hpp"
+#include "svg_parse.hpp"
 #include "svg_shapes.hpp"
 
 namespace KRE
@@ -44,46 +52,63 @@ namespace KRE
 
             //auto attributes = pt.get_child_optional("<xmlattr>");
 			for(auto& v : pt) {
-				if(v.first == "path") {
-					elements_.emplace_back(new shape(parent, v.second));
-				} else if(v.first == "g") {
-					elements_.emplace_back(new group(parent, v.second));
-				} else if(v.first == "rect") {
-					elements_.emplace_back(new rectangle(parent, v.second));
-				} else if(v.first == "text") {
-					elements_.emplace_back(new text(parent, v.second));
-				} else if(v.first == "tspan") {
-					elements_.emplace_back(new text(parent, v.second, true));
-				} else if(v.first == "line") {
-					elements_.emplace_back(new line(parent,v.second));
-				} else if(v.first == "circle") {
-					elements_.emplace_back(new circle(parent,v.second));
-				} else if(v.first == "polygon") {
-					elements_.emplace_back(new polygon(parent,v.second));
-				} else if(v.first == "polyline") {
-					elements_.emplace_back(new polyline(parent,v.second));
-				} else if(v.first == "ellipse") {
-					elements_.emplace_back(new ellipse(parent,v.second));
-				} else if(v.first == "desc") {
-					// ignore
-				} else if(v.first == "title") {
-					// ignore
-				} else if(v.first == "use") {
-					elements_.emplace_back(new use_element(parent,v.second));
-				} else if(v.first == "defs") {
-					elements_.emplace_back(new defs(parent,v.second));
-				} else if(v.first == "clipPath") {
-					elements_.emplace_back(new clip_path(parent,v.second));
-				} else if(v.first == "<xmlattr>") {
-					// ignore
-				} else if(v.first == "<xmlcomment>") {
-					// ignore
-				} else {
-					LOG_ERROR("SVG: svg unhandled child element: " << v.first << " : " << v.second.data());
+				auto e = create_child(parent, v.first, v.second);
+				if(e) {
+					elements_.emplace_back(e);
 				}
 			}
 		}
 
+		element_ptr container::create_child(element* parent, const std::string& name, const ptree& pt)
+		{
+			if(name == "path") {
+				return element_ptr(new shape(parent, pt));
+			} else if(name == "g") {
+				return element_ptr(new group(parent, pt));
+			} else if(name == "rect") {
+				return element_ptr(new rectangle(parent, pt));
+			} else if(name == "text") {
+				return element_ptr(new text(parent, pt));
+			} else if(name == "tspan") {
+				return element_ptr(new text(parent, pt, true));
+			} else if(name == "line") {
+				return element_ptr(new line(parent,pt));
+			} else if(name == "circle") {
+				return element_ptr(new circle(parent,pt));
+			} else if(name == "polygon") {
+				return element_ptr(new polygon(parent,pt));
+			} else if(name == "polyline") {
+				return element_ptr(new polyline(parent,pt));
+			} else if(name == "ellipse") {
+				return element_ptr(new ellipse(parent,pt));
+			} else if(name == "desc") {
+				// ignore
+			} else if(name == "title") {
+				// ignore
+			} else if(name == "use") {
+				return element_ptr(new use_element(parent,pt));
+			} else if(name == "image") {
+				return element_ptr(new image_element(parent,pt));
+			} else if(name == "defs") {
+				return element_ptr(new defs(parent,pt));
+			} else if(name == "marker") {
+				return element_ptr(new marker_element(parent,pt));
+			} else if(name == "mask") {
+				return element_ptr(new mask_element(parent,pt));
+			} else if(name == "filter") {
+				return element_ptr(new filter_element(parent,pt));
+			} else if(name == "clipPath") {
+				return element_ptr(new clip_path(parent,pt));
+			} else if(name == "<xmlattr>") {
+				// ignore
+			} else if(name == "<xmlcomment>") {
+				// ignore
+			} else {
+				LOG_ERROR("SVG: svg unhandled child element: " << name << " : " << pt.data());
+			}
+			return element_ptr();
+		}
+
 		container::~container()
 		{
 		}
@@ -95,14 +120,119 @@ namespace KRE
 			}
 		}
 
+		void container::handle_memory_usage(memory_report* mr) const
+		{
+			mr->element_nodes += vector_heap_bytes(elements_);
+			for(auto& e : elements_) {
+				e->add_memory_usage(mr);
+			}
+		}
+
+		void container::handle_build_level_of_detail(double pixel_tolerance)
+		{
+			for(auto e : elements_) {
+				e->build_level_of_detail(pixel_tolerance);
+			}
+		}
+
+		void container::handle_decode_geometry() const
+		{
+			for(auto e : elements_) {
+				e->decode_geometry();
+			}
+		}
+
+		void container::handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const
+		{
+			for(auto& e : elements_) {
+				e->collect_references(ids, skip_definitions);
+			}
+		}
+
+		void container::handle_prune_definitions(const std::set<std::string>& keep, memory_report* freed)
+		{
+			prune_children(keep, freed, false);
+		}
+
+		bool container::has_kept_id(const element_ptr& e, const std::set<std::string>& keep)
+		{
+			if(!e->id().empty() && keep.find(e->id()) != keep.end()) {
+				return true;
+			}
+			auto c = dynamic_cast<const container*>(e.get());
+			if(c != nullptr) {
+				for(auto& child : c->elements_) {
+					if(has_kept_id(child, keep)) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+
+		void container::prune_children(const std::set<std::string>& keep, memory_report* freed, bool children_are_definitions)
+		{
+			auto it = std::remove_if(elements_.begin(), elements_.end(), [&](const element_ptr& e) {
+				if((children_are_definitions || e->is_definition()) && !has_kept_id(e, keep)) {
+					e->add_memory_usage(freed);
+					return true;
+				}
+				return false;
+			});
+			elements_.erase(it, elements_.end());
+			elements_.shrink_to_fit();
+			for(auto& e : elements_) {
+				e->prune_definitions(keep, freed);
+			}
+		}
+
+		void container::handle_optimise_tree(tree_report* report)
+		{
+			std::vector<element_ptr> kept;
+			kept.reserve(elements_.size());
+			for(auto& e : elements_) {
+				if(e->is_definition()) {
+					kept.emplace_back(e);
+					continue;
+				}
+				e->optimise_tree(report);
+				// Groups draw nothing of their own, so if one has nothing to draw or
+				// nothing to do besides drawing its children it can go. Anything with an
+				// id has to stay for references to find.
+				auto children = e->render_children_list();
+				if(children != nullptr && e->id().empty() && e->view_box().w() == 0 && e->view_box().h() == 0) {
+					if(children->empty()) {
+						++report->containers_removed;
+						continue;
+					}
+					if(e->is_style_free() && !e->has_transforms()) {
+						kept.insert(kept.end(), children->begin(), children->end());
+						++report->groups_removed;
+						continue;
+					}
+				}
+				kept.emplace_back(e);
+			}
+			elements_.swap(kept);
+		}
+
 		void container::render_children(render_context& ctx) const
 		{
-			cairo_push_group(ctx.cairo());
+			handle_children_enter(ctx);
 			for(auto s : elements_) {
 				s->render(ctx);
 			}
-			cairo_pop_group_to_source(ctx.cairo());
-			cairo_paint_with_alpha(ctx.cairo(), ctx.opacity_top());
+			handle_children_leave(ctx);
+		}
+
+		void container::handle_children_enter(render_context& ctx) const
+		{
+			ctx.push_group();
+		}
+
+		void container::handle_children_leave(render_context& ctx) const
+		{
+			ctx.pop_group_and_paint(ctx.opacity_top());
 		}
 
 		void container::clip_render_children(render_context& ctx) const
@@ -183,6 +313,14 @@ namespace KRE
 		{
 		}
 
+		void svg::handle_memory_usage(memory_report* mr) const
+		{
+			container::handle_memory_usage(mr);
+			mr->strings += string_heap_bytes(version_) + string_heap_bytes(base_profile_) 
+				+ string_heap_bytes(content_script_type_) + string_heap_bytes(content_style_type_) 
+				+ string_heap_bytes(xmlns_);
+		}
+
 		void svg::handle_render(render_context& ctx) const
 		{
 			render_children(ctx);
@@ -212,6 +350,30 @@ namespace KRE
 			clip_render_children(ctx);
 		}
 
+		void group::handle_optimise_tree(tree_report* report)
+		{
+			// A transform is all the group does, so its children can do it instead.
+			// Not for children with ids, which are drawn without it when used
+			// elsewhere, or children with a viewBox, which we apply first.
+			if(is_style_free() && has_transforms() && !elements().empty()) {
+				bool movable = true;
+				for(auto& e : elements()) {
+					if(!e->id().empty() || e->view_box().w() != 0 || e->view_box().h() != 0) {
+						movable = false;
+						break;
+					}
+				}
+				if(movable) {
+					for(auto& e : elements()) {
+						e->prepend_transforms(transforms());
+					}
+					clear_transforms();
+					++report->groups_flattened;
+				}
+			}
+			container::handle_optimise_tree(report);
+		}
+
 		defs::defs(element* parent, const ptree& pt)
 			: container(parent, pt)
 		{
@@ -233,13 +395,159 @@ namespace KRE
 			// nothing to be done
 		}
 
+		void defs::handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const
+		{
+			// Everything in here is a definition.
+			if(!skip_definitions) {
+				container::handle_collect_references(ids, skip_definitions);
+			}
+		}
+
+		void defs::handle_prune_definitions(const std::set<std::string>& keep, memory_report* freed)
+		{
+			prune_children(keep, freed, true);
+		}
+
+		namespace
+		{
+			// A clip path is drawn into a mask once it has at least this many users
+			// and path segments, below that cairo clipping to the path each time 
+			// is cheaper than the extra group.
+			const int clip_mask_min_users = 3;
+			const int clip_mask_min_complexity = 64;
+			// Masks kept per clip path, for different transforms.
+			const size_t clip_mask_cache_size = 4;
+		}
+
 		clip_path::clip_path(element* parent, const ptree& pt)
-			: container(parent, pt)
+			: container(parent, pt),
+			  is_rectangle_(false),
+			  users_(0),
+			  complexity_(-1)
 		{
 		}
 
 		clip_path::~clip_path()
 		{
+			for(auto& m : masks_) {
+				cairo_surface_destroy(m.surface);
+			}
+		}
+
+		void clip_path::handle_resolve()
+		{
+			container::handle_resolve();
+			is_rectangle_ = elements().size() == 1 
+				&& elements().front()->clip_rectangle(&rect_[0], &rect_[1], &rect_[2], &rect_[3]);
+		}
+
+		bool clip_path::clips_with_mask(const render_context& ctx) const
+		{
+			// Recordings have no way to hold the mask.
+			if(is_rectangle_ || users_ < clip_mask_min_users || ctx.recorder() != nullptr) {
+				return false;
+			}
+			std::call_once(complexity_computed_, [this]() {
+				int total = 0;
+				for(auto& e : elements()) {
+					const int n = e->clip_complexity();
+					if(n < 0) {
+						total = -1;
+						break;
+					}
+					total += n;
+				}
+				complexity_ = total;
+			});
+			return complexity_ >= clip_mask_min_complexity;
+		}
+
+		cairo_surface_t* clip_path::build_mask(const render_context& ctx, const cairo_matrix_t& m, int* x, int* y) const
+		{
+			// The canvas bounds device space, whatever group is being drawn to.
+			cairo_surface_t* full = cairo_image_surface_create(CAIRO_FORMAT_A8, ctx.width(), ctx.height());
+			cairo_t* cairo = cairo_create(full);
+			{
+				render_context mask_ctx(cairo, ctx.width(), ctx.height());
+				mask_ctx.set_quality(ctx.quality());
+				cairo_set_matrix(cairo, &m);
+				clip(mask_ctx);
+			}
+			cairo_identity_matrix(cairo);
+			double x1, y1, x2, y2;
+			cairo_clip_extents(cairo, &x1, &y1, &x2, &y2);
+			cairo_paint(cairo);
+			cairo_destroy(cairo);
+
+			const int ix1 = static_cast<int>(std::floor(x1));
+			const int iy1 = static_cast<int>(std::floor(y1));
+			const int w = std::max(1, static_cast<int>(std::ceil(x2)) - ix1);
+			const int h = std::max(1, static_cast<int>(std::ceil(y2)) - iy1);
+			cairo_surface_t* mask = cairo_image_surface_create(CAIRO_FORMAT_A8, w, h);
+			cairo = cairo_create(mask);
+			cairo_set_operator(cairo, CAIRO_OPERATOR_SOURCE);
+			cairo_set_source_surface(cairo, full, -ix1, -iy1);
+			cairo_paint(cairo);
+			cairo_destroy(cairo);
+			cairo_surface_destroy(full);
+			*x = ix1;
+			*y = iy1;
+			return mask;
+		}
+
+		void clip_path::apply_clip_mask(render_context& ctx, cairo_pattern_t* content) const
+		{
+			cairo_matrix_t m;
+			cairo_get_matrix(ctx.cairo(), &m);
+
+			cairo_surface_t* mask = nullptr;
+			int x = 0, y = 0;
+			{
+				std::lock_guard<std::mutex> lock(masks_mutex_);
+				for(auto it = masks_.begin(); it != masks_.end(); ++it) {
+					if(memcmp(&it->matrix, &m, sizeof(m)) == 0 && it->width == ctx.width() 
+						&& it->height == ctx.height() && it->quality == ctx.quality()) {
+						masks_.splice(masks_.begin(), masks_, it);
+						mask = cairo_surface_reference(it->surface);
+						x = it->x;
+						y = it->y;
+						break;
+					}
+				}
+			}
+			if(mask) {
+				ctx.count_clip_mask(true);
+			} else {
+				// Built outside the lock, if another thread builds the same one the
+				// first to finish is kept.
+				mask = build_mask(ctx, m, &x, &y);
+				ctx.count_clip_mask(false);
+				std::lock_guard<std::mutex> lock(masks_mutex_);
+				cached_mask cm = { m, ctx.width(), ctx.height(), ctx.quality(), x, y, cairo_surface_reference(mask) };
+				masks_.push_front(cm);
+				while(masks_.size() > clip_mask_cache_size) {
+					cairo_surface_destroy(masks_.back().surface);
+					masks_.pop_back();
+				}
+			}
+
+			cairo_t* cairo = ctx.cairo();
+			cairo_save(cairo);
+			cairo_set_source(cairo, content);
+			cairo_identity_matrix(cairo);
+			cairo_mask_surface(cairo, mask, x, y);
+			cairo_restore(cairo);
+			cairo_surface_destroy(mask);
+			cairo_pattern_destroy(content);
+		}
+
+		void clip_path::handle_memory_usage(memory_report* mr) const
+		{
+			container::handle_memory_usage(mr);
+			std::lock_guard<std::mutex> lock(masks_mutex_);
+			for(auto& m : masks_) {
+				mr->images += cairo_image_surface_get_stride(m.surface) * cairo_image_surface_get_height(m.surface);
+			}
 		}
 
 		void clip_path::handle_render(render_context& ctx) const
@@ -251,8 +559,18 @@ namespace KRE
 
 		void clip_path::handle_clip(render_context& ctx) const
 		{
-			// The only class that can handle this case.
+			if(is_rectangle_) {
+				cairo_rectangle(ctx.cairo(), rect_[0], rect_[1], rect_[2], rect_[3]);
+				ctx.clip();
+				ctx.count_rectangle_clip();
+				return;
+			}
+			// The only class that can handle this case. The clip-rule set here is
+			// inherited by the children.
+			const cairo_fill_rule_t rule = cairo_get_fill_rule(ctx.cairo());
+			ca()->apply_clip_rule(ctx);
 			clip_render_children(ctx);
+			cairo_set_fill_rule(ctx.cairo(), rule);
 		}
 
 		void clip_path::handle_clip_render(render_context& ctx) const
@@ -24,6 +24,9 @@
 #pragma once
 
 #include <boost/property_tree/ptree.hpp>
+#include <list>
+#include <mutex>
+#include <set>
 #include "svg_attribs.hpp"
 #include "svg_fwd.hpp"
 #include "svg_gradient.hpp"
@@ -44,14 +47,35 @@ namespace KRE
 		public:
 			container(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~container();
+
+			// Creates the element for a child node called name, or returns null if
+			// it's something that isn't drawn, e.g. a comment or title.
+			static element_ptr create_child(element* parent, const std::string& name, const boost::property_tree::ptree& pt);
 		protected:
 			void render_children(render_context& ctx) const;
 			void clip_render_children(render_context& ctx) const;
+			const std::vector<element_ptr>& elements() const { return elements_; }
+			// Removes children that have none of the ids in keep anywhere in their 
+			// subtree, if they are definitions or if children_are_definitions is set.
+			// Recurses into the rest.
+			void prune_children(const std::set<std::string>& keep, memory_report* freed, bool children_are_definitions);
+		protected:
+			void handle_resolve() override;
+			void handle_build_level_of_detail(double pixel_tolerance) override;
+			void handle_decode_geometry() const override;
+			void handle_memory_usage(memory_report* mr) const override;
+			void handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const override;
+			void handle_optimise_tree(tree_report* report) override;
 		private:
-			virtual void handle_resolve();
+			void handle_prune_definitions(const std::set<std::string>& keep, memory_report* freed) override;
+			void handle_children_enter(render_context& ctx) const override;
+			void handle_children_leave(render_context& ctx) const override;
 			virtual void handle_render(render_context& ctx) const override;
 			virtual void handle_clip_render(render_context& ctx) const override;
 			element_ptr handle_find_child(const std::string& id) const override;
+			// Whether e or anything find_child() can reach under it has an id in 
+			// keep. One walk of the subtree rather than a find_child() per id.
+			static bool has_kept_id(const element_ptr& e, const std::set<std::string>& keep);
 
 			// Shape/Structural/Gradient elements
 			std::vector<element_ptr> elements_;
@@ -63,8 +87,11 @@ namespace KRE
 			svg(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~svg();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void handle_render(render_context& ctx) const override;
+			const std::vector<element_ptr>* handle_render_children_list() const override { return &elements(); }
 			void handle_clip_render(render_context& ctx) const override;
+			void handle_memory_usage(memory_report* mr) const override;
 
 			std::string version_;
 			std::string base_profile_;
@@ -82,6 +109,7 @@ namespace KRE
 			symbol(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~symbol();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
 		};
@@ -92,19 +120,68 @@ namespace KRE
 			group(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~group();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void handle_render(render_context& ctx) const override;
+			const std::vector<element_ptr>* handle_render_children_list() const override { return &elements(); }
 			void handle_clip_render(render_context& ctx) const override;
+			void handle_optimise_tree(tree_report* report) override;
 		};
 
+		// A clip path that's a single axis-aligned rectangle is applied as one, without visiting the children.
+		// A complex one used by several elements is drawn once per device 
+		// transform into an A8 mask, which the elements are then painted through,
+		// rather than having cairo rasterise the path for each of them.
 		class clip_path : public container
 		{
 		public:
 			clip_path(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~clip_path();
+
+			// Called once for each element referring to the clip path, while resolving.
+			void add_user() { ++users_; }
+			// Whether an element clipped by this should be drawn into a group and 
+			// passed to apply_clip_mask(), rather than calling clip().
+			bool clips_with_mask(const render_context& ctx) const;
+			// Paints content, as returned by render_context::pop_group(), through 
+			// the clip mask for the current transform.
+			void apply_clip_mask(render_context& ctx, cairo_pattern_t* content) const;
 		private:
+			DISALLOW_COPY_ASSIGN_AND_DEFAULT(clip_path);
+			size_t handle_node_size() const override { return sizeof(*this); }
+			bool handle_is_definition() const override { return true; }
+			void handle_resolve() override;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			void handle_memory_usage(memory_report* mr) const override;
+
+			// Draws the clip into an A8 surface the size of the canvas, cropped to
+			// what it covers, whose top left is at (*x, *y) in device space.
+			cairo_surface_t* build_mask(const render_context& ctx, const cairo_matrix_t& m, int* x, int* y) const;
+
+			bool is_rectangle_;
+			double rect_[4];
+			int users_;
+			// Sum of the children's clip_complexity(), -1 if any can't be cached, 
+			// computed on first use as it needs the paths decoded.
+			mutable int complexity_;
+			mutable std::once_flag complexity_computed_;
+
+			// Masks are drawn over the canvas at the render's quality, so those are
+			// part of the key along with the transform.
+			struct cached_mask
+			{
+				cairo_matrix_t matrix;
+				unsigned width;
+				unsigned height;
+				RenderQuality quality;
+				int x;
+				int y;
+				cairo_surface_t* surface;
+			};
+			mutable std::mutex masks_mutex_;
+			// Most recently used first.
+			mutable std::list<cached_mask> masks_;
 		};
 
 		// Used only for looking up child elements. Not rendered directly.
@@ -114,6 +191,11 @@ namespace KRE
 			defs(element* parent, const boost::property_tree::ptree& pt);
 			virtual ~defs();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
+			bool handle_is_definition() const override { return true; }
+			void handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const override;
+			void handle_prune_definitions(const std::set<std::string>& keep, memory_report* freed) override;
+			void handle_optimise_tree(tree_report* report) override {}
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
 		};
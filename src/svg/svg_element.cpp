@@ -21,9 +21,14 @@
 	   distribution.
 */
 
+#include <exception>
+#include <typeinfo>
+
 #include "svg_container.hpp"
 #include "svg_element.hpp"
 #include "svg_shapes.hpp"
+#include "svg_transform.hpp"
+#include "trace.hpp"
 
 namespace KRE
 {
@@ -31,6 +36,26 @@ namespace KRE
 	{
 		using namespace boost::property_tree;
 
+		namespace
+		{
+			// Clears attribs[n-1] down to attribs[0], carrying on past any that throw
+			// so nothing is left pushed on the context. Returns the first exception.
+			std::exception_ptr clear_attribs(const base_attrib* const* attribs, size_t n, render_context& ctx)
+			{
+				std::exception_ptr error;
+				while(n != 0) {
+					try {
+						attribs[--n]->clear(ctx);
+					} catch(...) {
+						if(!error) {
+							error = std::current_exception();
+						}
+					}
+				}
+				return error;
+			}
+		}
+
 		element::element(element* parent, const ptree& pt) 
 			: core_attribs(pt), 
 			  visual_attribs_(pt),
@@ -42,6 +67,7 @@ namespace KRE
 			  text_attribs_(pt),
               parent_(parent == nullptr ? this : parent),
               external_resources_required_(false),
+			  style_free_(true),
 			  x_(0,svg_length::SVG_LENGTHTYPE_NUMBER),
 			  y_(0,svg_length::SVG_LENGTHTYPE_NUMBER),
 			  width_(100,svg_length::SVG_LENGTHTYPE_PERCENTAGE),
@@ -50,6 +76,16 @@ namespace KRE
 		{
 			auto attributes = pt.get_child_optional("<xmlattr>");
 			if(attributes) {
+				for(auto& attr : *attributes) {
+					const std::string& name = attr.first;
+					// Anything in a namespace is editor data or xlink:href, which
+					// nothing style-free uses.
+					if(name != "id" && name != "transform" && name != "style" && name != "class" 
+						&& name.find(':') == std::string::npos) {
+						style_free_ = false;
+					}
+				}
+
 				auto exts = attributes->get_child_optional("externalResourcesRequired");
 				if(exts) {
 					const std::string& s = exts->data();
@@ -99,34 +135,110 @@ namespace KRE
 		{
 		}
 
-		struct context_save
+		void element::render(render_context& ctx) const 
 		{
-			context_save(cairo_t* ctx) : ctx_(ctx) {cairo_save(ctx);}
-			~context_save() {cairo_restore(ctx_);}
-			cairo_t* ctx_;
-		};
+			TRACE_ZONE_DETAIL("render", typeid(*this).name(), id());
+			render_enter(ctx);
+			try {
+				handle_render(ctx);
+			} catch(...) {
+				render_leave(ctx);
+				throw;
+			}
+			render_leave(ctx);
+		}
 
-		void element::render(render_context& ctx) const 
+		void element::render_enter(render_context& ctx) const
 		{
 			// XXX Need to do some normalising of co-ordinates to the viewBox.
 			// XXX need to translate if x/y specified and use width/height from svg element if
 			// overriding -- well map them to ctx.width()/ctx.height()
 			// XXX also need to process preserveAspectRatio value.
 			
-			context_save cs(ctx.cairo());
-			if(view_box_.w() != 0 && view_box_.h() != 0) {
-				cairo_scale(ctx.cairo(), ctx.width()/view_box_.w(), ctx.height()/view_box_.h());
+			const base_attrib* attribs[] = { pp(), ma(), ca(), fea(), va() };
+			size_t applied = 0;
+			ctx.count_element();
+			ctx.begin_element(id());
+			ctx.save();
+			try {
+				if(view_box_.w() != 0 && view_box_.h() != 0) {
+					cairo_scale(ctx.cairo(), ctx.width()/view_box_.w(), ctx.height()/view_box_.h());
+				}
+				if(view_box_.x() != 0 || view_box_.y() != 0) {
+					cairo_translate(ctx.cairo(), -view_box_.x(), -view_box_.y());
+				}
+				for(auto trf : transforms_) {
+					trf->apply(ctx);
+				}
+				for(auto a : attribs) {
+					a->apply(ctx);
+					++applied;
+				}
+			} catch(...) {
+				// Undo what was applied, the caller won't call render_leave().
+				clear_attribs(attribs, applied, ctx);
+				ctx.restore();
+				ctx.end_element(id());
+				throw;
+			}
+		}
+
+		void element::render_leave(render_context& ctx) const
+		{
+			// Same order as render_enter(), clear_attribs() goes in reverse.
+			const base_attrib* attribs[] = { pp(), ma(), ca(), fea(), va() };
+			auto error = clear_attribs(attribs, sizeof(attribs)/sizeof(attribs[0]), ctx);
+			ctx.restore();
+			ctx.end_element(id());
+			if(error) {
+				std::rethrow_exception(error);
 			}
-			if(view_box_.x() != 0 || view_box_.y() != 0) {
-				cairo_translate(ctx.cairo(), -view_box_.x(), -view_box_.y());
+		}
+
+		void element::add_memory_usage(memory_report* mr) const
+		{
+			const size_t attribute_blocks = sizeof(visual_attribs_) + sizeof(clipping_attribs_) 
+				+ sizeof(filter_effect_attribs_) + sizeof(painting_properties_) 
+				+ sizeof(marker_attribs_) + sizeof(font_attribs_) + sizeof(text_attribs_);
+			++mr->elements;
+			mr->element_nodes += handle_node_size() - attribute_blocks + shared_count_bytes;
+			mr->attributes += attribute_blocks;
+
+			mr->strings += string_heap_bytes(id()) + string_heap_bytes(base()) 
+				+ string_heap_bytes(lang()) + string_heap_bytes(space());
+			mr->element_nodes += vector_heap_bytes(transforms_);
+			for(auto& trf : transforms_) {
+				// The transform classes hold at most an angle and a matrix.
+				if(mr->first_visit(trf.get())) {
+					mr->element_nodes += sizeof(transform) + sizeof(double) + sizeof(cairo_matrix_t) + shared_count_bytes;
+				}
 			}
-			for(auto trf : transforms_) {
-				trf->apply(ctx);
+
+			visual_attribs_.add_memory_usage(mr);
+			clipping_attribs_.add_memory_usage(mr);
+			filter_effect_attribs_.add_memory_usage(mr);
+			painting_properties_.add_memory_usage(mr);
+			marker_attribs_.add_memory_usage(mr);
+			font_attribs_.add_memory_usage(mr);
+			text_attribs_.add_memory_usage(mr);
+
+			handle_memory_usage(mr);
+		}
+
+		void element::collect_references(std::vector<std::string>* ids, bool skip_definitions) const
+		{
+			if(skip_definitions && is_definition()) {
+				return;
 			}
-			attribute_manager pp1(pp(), ctx);
-			attribute_manager ca1(ca(), ctx);
-			attribute_manager va1(va(), ctx);
-			handle_render(ctx);
+			visual_attribs_.add_references(ids);
+			clipping_attribs_.add_references(ids);
+			filter_effect_attribs_.add_references(ids);
+			painting_properties_.add_references(ids);
+			marker_attribs_.add_references(ids);
+			font_attribs_.add_references(ids);
+			text_attribs_.add_references(ids);
+
+			handle_collect_references(ids, skip_definitions);
 		}
 
 		void element::resolve()
@@ -163,7 +275,31 @@ namespace KRE
 		
 		void element::clip_render(render_context& ctx) const
 		{
+			// clip-rule only changes how this element adds to the clip.
+			const cairo_fill_rule_t rule = cairo_get_fill_rule(ctx.cairo());
+			ca()->apply_clip_rule(ctx);
 			handle_clip_render(ctx);
+			cairo_set_fill_rule(ctx.cairo(), rule);
+		}
+
+		void element::prepend_transforms(const std::vector<transform_ptr>& trfs)
+		{
+			std::vector<transform_ptr> all(trfs);
+			all.insert(all.end(), transforms_.begin(), transforms_.end());
+			const cairo_matrix_t mat = transform::to_matrix(all);
+			std::vector<double> params;
+			params.push_back(mat.xx);
+			params.push_back(mat.yx);
+			params.push_back(mat.xy);
+			params.push_back(mat.yy);
+			params.push_back(mat.x0);
+			params.push_back(mat.y0);
+			transforms_.assign(1, transform::factory(TransformType::MATRIX, params));
+		}
+
+		bool element::has_user_space_effects() const
+		{
+			return ca()->clips() || fea()->has_filter() || ma()->has_markers();
 		}
 
         void element::apply_transforms(render_context& ctx) const
@@ -206,6 +342,18 @@ namespace KRE
 		{
 		}
 
+		void use_element::handle_memory_usage(memory_report* mr) const
+		{
+			mr->strings += string_heap_bytes(xlink_href_);
+		}
+
+		void use_element::handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const
+		{
+			if(!xlink_href_.empty()) {
+				ids->emplace_back(xlink_href_);
+			}
+		}
+
 		void use_element::handle_resolve()
 		{
 			if(xlink_href_.empty()) {
@@ -23,8 +23,11 @@
 
 #pragma once
 
+#include <set>
+
 #include "geometry.hpp"
 #include "svg_fwd.hpp"
+#include "svg_memory.hpp"
 #include "svg_render.hpp"
 #include "svg_style.hpp"
 #include "utils.hpp"
@@ -59,6 +62,18 @@ namespace KRE
 
 			void render(render_context& ctx) const;
 
+			// Pieces of render() for callers which walk the tree themselves, e.g.
+			// progressive_renderer. render() is render_enter(), handle_render(),
+			// render_leave(). Elements whose rendering is nothing more than drawing
+			// their children return them from render_children_list(), the caller may
+			// then draw the children one at a time between children_enter() and
+			// children_leave() instead of calling handle_render().
+			void render_enter(render_context& ctx) const;
+			void render_leave(render_context& ctx) const;
+			const std::vector<element_ptr>* render_children_list() const { return handle_render_children_list(); }
+			void children_enter(render_context& ctx) const { handle_children_enter(ctx); }
+			void children_leave(render_context& ctx) const { handle_children_leave(ctx); }
+
 			void apply_transforms(render_context& ctx) const;
 
 			element_ptr find_child(const std::string& id) const {
@@ -69,14 +84,60 @@ namespace KRE
 			const svg_length& y() const { return y_; }
 			const svg_length& width() const { return width_; }
 			const svg_length& height() const { return height_; }
+			const view_box_rect& view_box() const { return view_box_; }
 
 			static element_ptr factory(element* parent, const boost::property_tree::ptree& svg_data);
 
 			void resolve();
+			// See path_geometry::build_level_of_detail()
+			void build_level_of_detail(double pixel_tolerance) { handle_build_level_of_detail(pixel_tolerance); }
+			// Decode any geometry that's being kept undecoded, see parse_options::lazy_paths
+			void decode_geometry() const { handle_decode_geometry(); }
 			void clip(render_context& ctx) const;
 			void clip_render(render_context& ctx) const;
+			// If clip_render() clips to nothing more than an axis-aligned rectangle
+			// in user space, gets it, so a clip path can skip building the path.
+			bool clip_rectangle(double* x, double* y, double* w, double* h) const { return handle_clip_rectangle(x, y, w, h); }
+			// Roughly how many path segments clip_render() adds, or -1 if it can't 
+			// be replayed outside of rendering the element, e.g. text, which needs
+			// the font state.
+			int clip_complexity() const { return handle_clip_complexity(); }
 
 			const element* parent() const { return parent_; }
+
+			// Adds the memory used by this element, and any children, to mr.
+			void add_memory_usage(memory_report* mr) const;
+
+			// Adds the ids of the elements this one and its children refer to, through
+			// attributes like clip-path or xlink:href, to ids. Children that are 
+			// definitions are left out if skip_definitions is set.
+			void collect_references(std::vector<std::string>* ids, bool skip_definitions) const;
+			// Whether this is only ever drawn through a reference to it, e.g. clipPath.
+			bool is_definition() const { return handle_is_definition(); }
+			// Removes any definitions below this whose subtree has none of the ids in
+			// keep, adding the memory they used to freed.
+			void prune_definitions(const std::set<std::string>& keep, memory_report* freed) { handle_prune_definitions(keep, freed); }
+
+			// Simplifies what's below this without changing what gets drawn. Groups
+			// that only have a transform pass it on to their children and are then
+			// removed, as are empty groups, and paths have their transform applied
+			// to their co-ordinates. Definitions are left alone. Call after resolve(),
+			// before the tree is shared between renders.
+			void optimise_tree(tree_report* report) { handle_optimise_tree(report); }
+
+			// Whether the element has no attributes beyond an id, a transform and 
+			// ones we don't draw anything differently for, e.g. style or editor data.
+			bool is_style_free() const { return style_free_; }
+			bool has_transforms() const { return !transforms_.empty(); }
+			// Whether the element is drawn through a filter, false if the filter 
+			// reference didn't resolve.
+			bool has_filter() const { return filter_effect_attribs_.has_filter(); }
+			// Whether the element sets any markers of its own, false if none of the
+			// marker references resolved.
+			bool has_markers() const { return marker_attribs_.has_markers(); }
+			// Makes trfs apply before the element's own transforms, combining them 
+			// into a single matrix.
+			void prepend_transforms(const std::vector<transform_ptr>& trfs);
 		protected:
 			const visual_attribs* va() const { return &visual_attribs_; }
 			const clipping_attribs* ca() const { return &clipping_attribs_; }
@@ -85,6 +146,12 @@ namespace KRE
 			const marker_attribs* ma() const { return &marker_attribs_; }
 			const font_attribs* fa() const { return &font_attribs_; }
 			const text_attribs* ta() const { return &text_attribs_; }
+
+			const std::vector<transform_ptr>& transforms() const { return transforms_; }
+			void clear_transforms() { transforms_.clear(); }
+			// Whether anything besides the element's own geometry is drawn using the
+			// user space it sets up: clip paths, masks, filters or markers.
+			bool has_user_space_effects() const;
 		private:
 			DISALLOW_COPY_ASSIGN_AND_DEFAULT(element);
 
@@ -92,8 +159,23 @@ namespace KRE
 			//virtual void handle_clip(render_context& ctx) const = 0;
 			virtual element_ptr handle_find_child(const std::string& id) const { return element_ptr(); }
 			virtual void handle_resolve();
+			virtual void handle_build_level_of_detail(double pixel_tolerance) {}
+			virtual void handle_decode_geometry() const {}
+			virtual void handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const {}
+			virtual bool handle_is_definition() const { return false; }
+			virtual void handle_prune_definitions(const std::set<std::string>& keep, memory_report* freed) {}
+			virtual void handle_optimise_tree(tree_report* report) {}
 			virtual void handle_clip(render_context& ctx) const;
 			virtual void handle_clip_render(render_context& ctx) const = 0;
+			virtual bool handle_clip_rectangle(double* x, double* y, double* w, double* h) const { return false; }
+			virtual int handle_clip_complexity() const { return -1; }
+			virtual const std::vector<element_ptr>* handle_render_children_list() const { return nullptr; }
+			virtual void handle_children_enter(render_context& ctx) const {}
+			virtual void handle_children_leave(render_context& ctx) const {}
+			// sizeof() the most derived class.
+			virtual size_t handle_node_size() const = 0;
+			// Memory owned by derived classes, beyond their node size.
+			virtual void handle_memory_usage(memory_report* mr) const {}
 
 			// top level parent element. if nullptr then this is the top level element.
 			element* parent_;
@@ -112,6 +194,7 @@ namespace KRE
 			// std::string class_;
 			// std::string style_;
 			bool external_resources_required_;
+			bool style_free_;
 
 			svg_length x_;
 			svg_length y_;
@@ -132,6 +215,9 @@ namespace KRE
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
 			void handle_resolve() override;
+			size_t handle_node_size() const override { return sizeof(*this); }
+			void handle_memory_usage(memory_report* mr) const override;
+			void handle_collect_references(std::vector<std::string>* ids, bool skip_definitions) const override;
 			std::string xlink_href_;
 			element_ptr xlink_ref_;
 		};
@@ -0,0 +1,159 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+
+#include "svg_fill_batch.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// Checking for overlap is linear in the number held, so don't let it grow
+			// without bound.
+			const size_t max_batch_size = 64;
+		}
+
+		fill_batch::fill_batch()
+			: red_(0), 
+			  green_(0), 
+			  blue_(0), 
+			  alpha_(0), 
+			  fill_rule_(CAIRO_FILL_RULE_WINDING), 
+			  antialias_(CAIRO_ANTIALIAS_DEFAULT), 
+			  tolerance_(0)
+		{
+		}
+
+		fill_batch::~fill_batch()
+		{
+		}
+
+		bool fill_batch::same_settings(double r, double g, double b, double a, cairo_t* cairo) const
+		{
+			return r == red_ && g == green_ && b == blue_ && a == alpha_
+				&& cairo_get_fill_rule(cairo) == fill_rule_
+				&& cairo_get_antialias(cairo) == antialias_
+				&& cairo_get_tolerance(cairo) == tolerance_;
+		}
+
+		bool fill_batch::add(cairo_t* cairo, bool* merged)
+		{
+			*merged = false;
+			double r, g, b, a;
+			cairo_pattern_t* source = cairo_get_source(cairo);
+			if(cairo_get_operator(cairo) != CAIRO_OPERATOR_OVER 
+				|| cairo_pattern_get_type(source) != CAIRO_PATTERN_TYPE_SOLID
+				|| cairo_pattern_get_rgba(source, &r, &g, &b, &a) != CAIRO_STATUS_SUCCESS) {
+				flush(cairo);
+				return false;
+			}
+
+			// Device space box of the path, grown by a pixel so that paths in 
+			// different boxes can't both have coverage in the same pixel.
+			double x1, y1, x2, y2;
+			cairo_path_extents(cairo, &x1, &y1, &x2, &y2);
+			double xs[4] = { x1, x2, x1, x2 };
+			double ys[4] = { y1, y1, y2, y2 };
+			for(int n = 0; n != 4; ++n) {
+				cairo_user_to_device(cairo, &xs[n], &ys[n]);
+			}
+			device_box box;
+			box.x1 = *std::min_element(xs, xs + 4) - 1.0;
+			box.y1 = *std::min_element(ys, ys + 4) - 1.0;
+			box.x2 = *std::max_element(xs, xs + 4) + 1.0;
+			box.y2 = *std::max_element(ys, ys + 4) + 1.0;
+
+			if(!path_.empty()) {
+				bool compatible = boxes_.size() < max_batch_size && same_settings(r, g, b, a, cairo);
+				for(auto it = boxes_.begin(); compatible && it != boxes_.end(); ++it) {
+					if(box.x1 < it->x2 && it->x1 < box.x2 && box.y1 < it->y2 && it->y1 < box.y2) {
+						compatible = false;
+					}
+				}
+				if(compatible) {
+					*merged = true;
+				} else {
+					flush(cairo);
+				}
+			}
+			if(path_.empty()) {
+				red_ = r;
+				green_ = g;
+				blue_ = b;
+				alpha_ = a;
+				fill_rule_ = cairo_get_fill_rule(cairo);
+				antialias_ = cairo_get_antialias(cairo);
+				tolerance_ = cairo_get_tolerance(cairo);
+			}
+
+			// Copy the path out in device space, the batch may be drawn under a
+			// different transform.
+			cairo_matrix_t mat;
+			cairo_get_matrix(cairo, &mat);
+			cairo_identity_matrix(cairo);
+			cairo_path_t* path = cairo_copy_path(cairo);
+			cairo_set_matrix(cairo, &mat);
+			if(path->status == CAIRO_STATUS_SUCCESS) {
+				path_.insert(path_.end(), path->data, path->data + path->num_data);
+			}
+			cairo_path_destroy(path);
+			cairo_new_path(cairo);
+			boxes_.emplace_back(box);
+			return true;
+		}
+
+		void fill_batch::flush(cairo_t* cairo)
+		{
+			if(path_.empty()) {
+				return;
+			}
+			cairo_path_t* current = cairo_copy_path(cairo);
+
+			cairo_save(cairo);
+			cairo_identity_matrix(cairo);
+			cairo_new_path(cairo);
+			cairo_path_t path;
+			path.status = CAIRO_STATUS_SUCCESS;
+			path.data = &path_[0];
+			path.num_data = static_cast<int>(path_.size());
+			cairo_append_path(cairo, &path);
+			cairo_set_source_rgba(cairo, red_, green_, blue_, alpha_);
+			cairo_set_operator(cairo, CAIRO_OPERATOR_OVER);
+			cairo_set_fill_rule(cairo, fill_rule_);
+			cairo_set_antialias(cairo, antialias_);
+			cairo_set_tolerance(cairo, tolerance_);
+			cairo_fill(cairo);
+			cairo_restore(cairo);
+
+			if(current->status == CAIRO_STATUS_SUCCESS && current->num_data > 0) {
+				cairo_append_path(cairo, current);
+			}
+			cairo_path_destroy(current);
+			path_.clear();
+			boxes_.clear();
+		}
+	}
+}
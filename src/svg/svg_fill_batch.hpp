@@ -0,0 +1,73 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cairo.h>
+#include <vector>
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Holds back fills so that a run of them can be done with one call to 
+		// cairo_fill(). Fills are only merged when they have the same solid colour
+		// and fill settings and the pixels they touch can't overlap, so the result
+		// is the same as filling each in turn. See render_context::fill().
+		class fill_batch
+		{
+		public:
+			fill_batch();
+			~fill_batch();
+
+			// Takes the current path of cairo to fill with the current source and 
+			// fill settings, clearing the path. merged is set if it joined a fill 
+			// already being held. Returns false if the fill can't be held back, 
+			// having drawn whatever was held, and the caller should fill as usual.
+			bool add(cairo_t* cairo, bool* merged);
+			// Draws whatever is held. The current path of cairo is left as it was.
+			void flush(cairo_t* cairo);
+			bool empty() const { return path_.empty(); }
+		private:
+			fill_batch(const fill_batch&);
+			void operator=(const fill_batch&);
+
+			struct device_box
+			{
+				double x1, y1, x2, y2;
+			};
+			bool same_settings(double r, double g, double b, double a, cairo_t* cairo) const;
+
+			// In device space.
+			std::vector<cairo_path_data_t> path_;
+			std::vector<device_box> boxes_;
+			double red_;
+			double green_;
+			double blue_;
+			double alpha_;
+			cairo_fill_rule_t fill_rule_;
+			cairo_antialias_t antialias_;
+			double tolerance_;
+		};
+	}
+}
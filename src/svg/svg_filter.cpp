@@ -0,0 +1,659 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+
+#include "asserts.hpp"
+#include "svg_filter.hpp"
+#include "svg_filter_kernels.hpp"
+#include "svg_paint.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			std::string attribute(const ptree& pt, const char* name, const std::string& def=std::string())
+			{
+				auto attributes = pt.get_child_optional("<xmlattr>");
+				if(attributes) {
+					auto value = attributes->get_child_optional(name);
+					if(value) {
+						return value->data();
+					}
+				}
+				return def;
+			}
+
+			std::vector<double> number_list(const std::string& s)
+			{
+				std::vector<double> res;
+				for(auto& tok : utils::split(s, " \t\r\n,")) {
+					try {
+						res.emplace_back(boost::lexical_cast<double>(tok));
+					} catch(boost::bad_lexical_cast&) {
+						LOG_WARN("Bad number in filter attribute: " << s);
+						break;
+					}
+				}
+				return res;
+			}
+
+			double number(const ptree& pt, const char* name, double def)
+			{
+				auto values = number_list(attribute(pt, name));
+				return values.empty() ? def : values[0];
+			}
+
+			// A filter region length, percentages are returned as fractions.
+			double region_length(const std::string& s, double def)
+			{
+				const bool percent = !s.empty() && s.back() == '%';
+				try {
+					const double value = boost::lexical_cast<double>(percent ? s.substr(0, s.size() - 1) : s);
+					return percent ? value / 100.0 : value;
+				} catch(boost::bad_lexical_cast&) {
+					LOG_WARN("Bad filter region length: " << s);
+				}
+				return def;
+			}
+
+			// Device pixels per user unit along each axis.
+			double scale_x(const cairo_matrix_t& m) { return std::sqrt(m.xx * m.xx + m.yx * m.yx); }
+			double scale_y(const cairo_matrix_t& m) { return std::sqrt(m.xy * m.xy + m.yy * m.yy); }
+		}
+
+		// The images one application of a filter works on, all the size of the
+		// region being filtered.
+		class filter_run
+		{
+		public:
+			filter_run(filter_image&& source, const cairo_matrix_t& user_to_device, int threads)
+				: source_(std::move(source)),
+				  has_last_(false),
+				  user_to_device_(user_to_device),
+				  threads_(threads)
+			{
+			}
+			// The named input, "" for the result of the previous primitive.
+			filter_image input(const std::string& name) const {
+				if(name.empty()) {
+					return has_last_ ? last_ : source_;
+				} else if(name == "SourceGraphic") {
+					return source_;
+				} else if(name == "SourceAlpha") {
+					filter_image img = source_;
+					alpha_only(img);
+					return img;
+				}
+				auto it = results_.find(name);
+				if(it != results_.end()) {
+					return it->second;
+				}
+				// BackgroundImage, FillPaint and the like.
+				return filter_image(width(), height());
+			}
+			void set_result(const std::string& name, filter_image&& img) {
+				if(!name.empty()) {
+					results_[name] = img;
+				}
+				last_ = std::move(img);
+				has_last_ = true;
+			}
+			filter_image& result() { return has_last_ ? last_ : source_; }
+
+			const cairo_matrix_t& user_to_device() const { return user_to_device_; }
+			int threads() const { return threads_; }
+			int width() const { return source_.width; }
+			int height() const { return source_.height; }
+		private:
+			filter_image source_;
+			filter_image last_;
+			bool has_last_;
+			std::map<std::string, filter_image> results_;
+			cairo_matrix_t user_to_device_;
+			int threads_;
+		};
+
+		class filter_primitive
+		{
+		public:
+			explicit filter_primitive(const ptree& pt)
+				: in_(attribute(pt, "in")),
+				  in2_(attribute(pt, "in2")),
+				  result_(attribute(pt, "result"))
+			{
+				if(in_ == "BackgroundImage" || in_ == "BackgroundAlpha" || in2_ == "BackgroundImage" || in2_ == "BackgroundAlpha") {
+					LOG_WARN("Filter background inputs aren't supported, they'll be transparent.");
+				}
+			}
+			virtual ~filter_primitive() {}
+			void apply(filter_run& run) const { run.set_result(result_, handle_apply(run)); }
+			// How far, in device pixels, the primitive can spread what it's given.
+			int margin(const cairo_matrix_t& user_to_device) const { return handle_margin(user_to_device); }
+			// Whether the primitive can draw where its inputs are transparent.
+			bool generates() const { return handle_generates(); }
+			virtual size_t heap_bytes() const { 
+				return string_heap_bytes(in_) + string_heap_bytes(in2_) + string_heap_bytes(result_); 
+			}
+		protected:
+			const std::string& in() const { return in_; }
+			const std::string& in2() const { return in2_; }
+		private:
+			virtual filter_image handle_apply(filter_run& run) const = 0;
+			virtual int handle_margin(const cairo_matrix_t& user_to_device) const { return 0; }
+			virtual bool handle_generates() const { return false; }
+
+			std::string in_;
+			std::string in2_;
+			std::string result_;
+		};
+
+		namespace
+		{
+			// For primitives we don't know how to do.
+			class passthrough_primitive : public filter_primitive
+			{
+			public:
+				explicit passthrough_primitive(const ptree& pt) : filter_primitive(pt) {}
+			private:
+				filter_image handle_apply(filter_run& run) const override { return run.input(in()); }
+			};
+
+			class blur_primitive : public filter_primitive
+			{
+			public:
+				explicit blur_primitive(const ptree& pt) 
+					: filter_primitive(pt), 
+					  dev_x_(0), 
+					  dev_y_(0) 
+				{
+					auto dev = number_list(attribute(pt, "stdDeviation"));
+					if(!dev.empty()) {
+						dev_x_ = dev[0];
+						dev_y_ = dev.size() > 1 ? dev[1] : dev[0];
+					}
+					if(dev_x_ < 0 || dev_y_ < 0) {
+						LOG_WARN("Negative stdDeviation in feGaussianBlur, not blurring.");
+						dev_x_ = dev_y_ = 0;
+					}
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img = run.input(in());
+					const cairo_matrix_t& m = run.user_to_device();
+					gaussian_blur(img, dev_x_ * scale_x(m), dev_y_ * scale_y(m), run.threads());
+					return img;
+				}
+				int handle_margin(const cairo_matrix_t& m) const override {
+					return std::max(gaussian_blur_extent(dev_x_ * scale_x(m)), gaussian_blur_extent(dev_y_ * scale_y(m)));
+				}
+				double dev_x_;
+				double dev_y_;
+			};
+
+			class offset_primitive : public filter_primitive
+			{
+			public:
+				explicit offset_primitive(const ptree& pt) 
+					: filter_primitive(pt), 
+					  dx_(number(pt, "dx", 0)), 
+					  dy_(number(pt, "dy", 0)) 
+				{
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img = run.input(in());
+					double dx = dx_, dy = dy_;
+					cairo_matrix_transform_distance(&run.user_to_device(), &dx, &dy);
+					offset_image(img, static_cast<int>(std::floor(dx + 0.5)), static_cast<int>(std::floor(dy + 0.5)));
+					return img;
+				}
+				int handle_margin(const cairo_matrix_t& m) const override {
+					double dx = dx_, dy = dy_;
+					cairo_matrix_transform_distance(&m, &dx, &dy);
+					return static_cast<int>(std::ceil(std::max(std::abs(dx), std::abs(dy))));
+				}
+				double dx_;
+				double dy_;
+			};
+
+			class flood_primitive : public filter_primitive
+			{
+			public:
+				explicit flood_primitive(const ptree& pt) 
+					: filter_primitive(pt), 
+					  color_(0xff000000)
+				{
+					double r = 0, g = 0, b = 0, a = 1.0;
+					const std::string color = attribute(pt, "flood-color");
+					if(!color.empty()) {
+						auto p = paint::from_string(color);
+						auto value = p->color_value();
+						if(value) {
+							r = value->r();
+							g = value->g();
+							b = value->b();
+							a = value->a();
+						} else {
+							LOG_WARN("Only plain colours are supported for flood-color: " << color);
+						}
+					}
+					a = clamp(a * number(pt, "flood-opacity", 1.0), 0.0, 1.0);
+					color_ = (static_cast<uint32_t>(a * 255.0 + 0.5) << 24)
+						| (static_cast<uint32_t>(r * a * 255.0 + 0.5) << 16)
+						| (static_cast<uint32_t>(g * a * 255.0 + 0.5) << 8)
+						| static_cast<uint32_t>(b * a * 255.0 + 0.5);
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img(run.width(), run.height());
+					flood_image(img, color_);
+					return img;
+				}
+				bool handle_generates() const override { return color_ != 0; }
+				// Premultiplied ARGB.
+				uint32_t color_;
+			};
+
+			class composite_primitive : public filter_primitive
+			{
+			public:
+				explicit composite_primitive(const ptree& pt) 
+					: filter_primitive(pt), 
+					  op_(CompositeOperator::OVER)
+				{
+					const std::string op = attribute(pt, "operator", "over");
+					if(op == "in") {
+						op_ = CompositeOperator::IN;
+					} else if(op == "out") {
+						op_ = CompositeOperator::OUT;
+					} else if(op == "atop") {
+						op_ = CompositeOperator::ATOP;
+					} else if(op == "xor") {
+						op_ = CompositeOperator::XOR;
+					} else if(op == "arithmetic") {
+						op_ = CompositeOperator::ARITHMETIC;
+					} else if(op != "over") {
+						LOG_WARN("Unrecognised feComposite operator: " << op);
+					}
+					k_[0] = number(pt, "k1", 0);
+					k_[1] = number(pt, "k2", 0);
+					k_[2] = number(pt, "k3", 0);
+					k_[3] = number(pt, "k4", 0);
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img = run.input(in());
+					composite_images(img, run.input(in2()), op_, k_, run.threads());
+					return img;
+				}
+				bool handle_generates() const override { return op_ == CompositeOperator::ARITHMETIC && k_[3] > 0; }
+				CompositeOperator op_;
+				double k_[4];
+			};
+
+			class merge_primitive : public filter_primitive
+			{
+			public:
+				explicit merge_primitive(const ptree& pt) 
+					: filter_primitive(pt)
+				{
+					for(auto& child : pt) {
+						if(child.first == "feMergeNode") {
+							inputs_.emplace_back(attribute(child.second, "in"));
+						}
+					}
+				}
+				size_t heap_bytes() const override {
+					size_t bytes = filter_primitive::heap_bytes() + vector_heap_bytes(inputs_);
+					for(auto& s : inputs_) {
+						bytes += string_heap_bytes(s);
+					}
+					return bytes;
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img(run.width(), run.height());
+					for(auto& name : inputs_) {
+						filter_image layer = run.input(name);
+						composite_images(layer, img, CompositeOperator::OVER, nullptr, run.threads());
+						img.pixels.swap(layer.pixels);
+					}
+					return img;
+				}
+				std::vector<std::string> inputs_;
+			};
+
+			class color_matrix_primitive : public filter_primitive
+			{
+			public:
+				explicit color_matrix_primitive(const ptree& pt) 
+					: filter_primitive(pt)
+				{
+					static const float identity[20] = {
+						1, 0, 0, 0, 0,
+						0, 1, 0, 0, 0,
+						0, 0, 1, 0, 0,
+						0, 0, 0, 1, 0,
+					};
+					std::copy(identity, identity + 20, m_);
+
+					const std::string type = attribute(pt, "type", "matrix");
+					auto values = number_list(attribute(pt, "values"));
+					if(type == "matrix") {
+						if(values.size() == 20) {
+							std::copy(values.begin(), values.end(), m_);
+						} else if(!values.empty()) {
+							LOG_WARN("feColorMatrix needs 20 values, got " << values.size());
+						}
+					} else if(type == "saturate") {
+						const float s = static_cast<float>(values.empty() ? 1.0 : values[0]);
+						const float m[20] = {
+							0.213f + 0.787f * s, 0.715f - 0.715f * s, 0.072f - 0.072f * s, 0, 0,
+							0.213f - 0.213f * s, 0.715f + 0.285f * s, 0.072f - 0.072f * s, 0, 0,
+							0.213f - 0.213f * s, 0.715f - 0.715f * s, 0.072f + 0.928f * s, 0, 0,
+							0, 0, 0, 1, 0,
+						};
+						std::copy(m, m + 20, m_);
+					} else if(type == "hueRotate") {
+						const double angle = (values.empty() ? 0.0 : values[0]) * M_PI / 180.0;
+						const float c = static_cast<float>(std::cos(angle));
+						const float s = static_cast<float>(std::sin(angle));
+						const float m[20] = {
+							0.213f + c * 0.787f - s * 0.213f, 0.715f - c * 0.715f - s * 0.715f, 0.072f - c * 0.072f + s * 0.928f, 0, 0,
+							0.213f - c * 0.213f + s * 0.143f, 0.715f + c * 0.285f + s * 0.140f, 0.072f - c * 0.072f - s * 0.283f, 0, 0,
+							0.213f - c * 0.213f - s * 0.787f, 0.715f - c * 0.715f + s * 0.715f, 0.072f + c * 0.928f + s * 0.072f, 0, 0,
+							0, 0, 0, 1, 0,
+						};
+						std::copy(m, m + 20, m_);
+					} else if(type == "luminanceToAlpha") {
+						const float m[20] = {
+							0, 0, 0, 0, 0,
+							0, 0, 0, 0, 0,
+							0, 0, 0, 0, 0,
+							0.2125f, 0.7154f, 0.0721f, 0, 0,
+						};
+						std::copy(m, m + 20, m_);
+					} else {
+						LOG_WARN("Unrecognised feColorMatrix type: " << type);
+					}
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img = run.input(in());
+					color_matrix(img, m_, run.threads());
+					return img;
+				}
+				// An alpha offset makes transparent pixels visible.
+				bool handle_generates() const override { return m_[19] > 0; }
+				float m_[20];
+			};
+
+			class blend_primitive : public filter_primitive
+			{
+			public:
+				explicit blend_primitive(const ptree& pt) 
+					: filter_primitive(pt), 
+					  mode_(BlendMode::NORMAL)
+				{
+					const std::string mode = attribute(pt, "mode", "normal");
+					if(mode == "multiply") {
+						mode_ = BlendMode::MULTIPLY;
+					} else if(mode == "screen") {
+						mode_ = BlendMode::SCREEN;
+					} else if(mode == "darken") {
+						mode_ = BlendMode::DARKEN;
+					} else if(mode == "lighten") {
+						mode_ = BlendMode::LIGHTEN;
+					} else if(mode != "normal") {
+						LOG_WARN("Unrecognised feBlend mode: " << mode);
+					}
+				}
+			private:
+				filter_image handle_apply(filter_run& run) const override {
+					filter_image img = run.input(in());
+					blend_images(img, run.input(in2()), mode_, run.threads());
+					return img;
+				}
+				BlendMode mode_;
+			};
+		}
+
+		filter_element::filter_element(element* parent, const ptree& pt)
+			: element(parent, pt),
+			  user_space_units_(false)
+		{
+			region_[0] = region_[1] = -0.1;
+			region_[2] = region_[3] = 1.2;
+			if(attribute(pt, "filterUnits") == "userSpaceOnUse") {
+				user_space_units_ = true;
+				// The defaults are relative to the viewport, which isn't known here, 
+				// so anything not given is as good as unlimited.
+				region_[0] = region_[1] = -1e6;
+				region_[2] = region_[3] = 2e6;
+			}
+			const char* names[4] = { "x", "y", "width", "height" };
+			for(int n = 0; n != 4; ++n) {
+				const std::string value = attribute(pt, names[n]);
+				if(value.empty()) {
+					continue;
+				}
+				if(user_space_units_ && value.back() == '%') {
+					LOG_WARN("Percentages in a userSpaceOnUse filter region aren't supported: " << value);
+					continue;
+				}
+				region_[n] = region_length(value, region_[n]);
+			}
+			if(attribute(pt, "primitiveUnits") == "objectBoundingBox") {
+				LOG_WARN("primitiveUnits=\"objectBoundingBox\" isn't supported, using user space.");
+			}
+
+			for(auto& child : pt) {
+				const std::string& name = child.first;
+				if(name == "feGaussianBlur") {
+					primitives_.emplace_back(new blur_primitive(child.second));
+				} else if(name == "feOffset") {
+					primitives_.emplace_back(new offset_primitive(child.second));
+				} else if(name == "feFlood") {
+					primitives_.emplace_back(new flood_primitive(child.second));
+				} else if(name == "feComposite") {
+					primitives_.emplace_back(new composite_primitive(child.second));
+				} else if(name == "feMerge") {
+					primitives_.emplace_back(new merge_primitive(child.second));
+				} else if(name == "feColorMatrix") {
+					primitives_.emplace_back(new color_matrix_primitive(child.second));
+				} else if(name == "feBlend") {
+					primitives_.emplace_back(new blend_primitive(child.second));
+				} else if(name == "<xmlattr>" || name == "<xmlcomment>" || name == "desc" || name == "title") {
+					// ignore
+				} else {
+					LOG_WARN("SVG: unsupported filter primitive, passing its input through: " << name);
+					primitives_.emplace_back(new passthrough_primitive(child.second));
+				}
+			}
+		}
+
+		filter_element::~filter_element()
+		{
+		}
+
+		bool filter_element::device_region(render_context& ctx, const double* bbox, const double* drawn, double* x1, double* y1, double* x2, double* y2) const
+		{
+			double x = region_[0], y = region_[1], w = region_[2], h = region_[3];
+			if(!user_space_units_) {
+				if(bbox == nullptr) {
+					// Without any geometry, what was drawn stands in for the bounding
+					// box.
+					if(drawn == nullptr) {
+						return false;
+					}
+					const double dw = drawn[2] - drawn[0];
+					const double dh = drawn[3] - drawn[1];
+					*x1 = drawn[0] + x * dw;
+					*y1 = drawn[1] + y * dh;
+					*x2 = *x1 + w * dw;
+					*y2 = *y1 + h * dh;
+					return w > 0 && h > 0;
+				}
+				const double bw = bbox[2] - bbox[0];
+				const double bh = bbox[3] - bbox[1];
+				x = bbox[0] + x * bw;
+				y = bbox[1] + y * bh;
+				w *= bw;
+				h *= bh;
+			}
+			if(!(w > 0 && h > 0)) {
+				return false;
+			}
+			double xs[4] = { x, x + w, x, x + w };
+			double ys[4] = { y, y, y + h, y + h };
+			*x1 = *y1 = std::numeric_limits<double>::max();
+			*x2 = *y2 = -std::numeric_limits<double>::max();
+			for(int n = 0; n != 4; ++n) {
+				cairo_user_to_device(ctx.cairo(), &xs[n], &ys[n]);
+				*x1 = std::min(*x1, xs[n]);
+				*y1 = std::min(*y1, ys[n]);
+				*x2 = std::max(*x2, xs[n]);
+				*y2 = std::max(*y2, ys[n]);
+			}
+			return true;
+		}
+
+		void filter_element::apply_filter(render_context& ctx, cairo_pattern_t* group, const double* bbox) const
+		{
+			cairo_t* cairo = ctx.cairo();
+			if(primitives_.empty()) {
+				// An empty filter leaves nothing to draw.
+				cairo_pattern_destroy(group);
+				return;
+			}
+
+			cairo_surface_t* surface = nullptr;
+			cairo_pattern_get_surface(group, &surface);
+			if(surface == nullptr 
+				|| cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE 
+				|| cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32) {
+				LOG_WARN("Filters are only applied when drawing to ARGB32 image surfaces, drawing unfiltered.");
+				cairo_set_source(cairo, group);
+				cairo_paint(cairo);
+				cairo_pattern_destroy(group);
+				return;
+			}
+			cairo_surface_flush(surface);
+			const uint8_t* data = cairo_image_surface_get_data(surface);
+			const int sw = cairo_image_surface_get_width(surface);
+			const int sh = cairo_image_surface_get_height(surface);
+			const int stride = cairo_image_surface_get_stride(surface);
+			// Pixel (x, y) of the group is at (x - ox, y - oy) in device space.
+			double ox, oy;
+			cairo_surface_get_device_offset(surface, &ox, &oy);
+
+			int bx1 = 0, by1 = 0, bx2 = 0, by2 = 0;
+			const bool drawn = opaque_bounds(data, sw, sh, stride, &bx1, &by1, &bx2, &by2);
+			const double drawn_box[4] = { bx1 - ox, by1 - oy, bx2 - ox, by2 - oy };
+			double rx1, ry1, rx2, ry2;
+			if(!device_region(ctx, bbox, drawn ? drawn_box : nullptr, &rx1, &ry1, &rx2, &ry2)) {
+				// Nothing is drawn through an empty filter region.
+				cairo_pattern_destroy(group);
+				return;
+			}
+			// The pixels of the group inside the filter region.
+			int x1 = static_cast<int>(clamp(std::floor(rx1 + ox), 0.0, static_cast<double>(sw)));
+			int y1 = static_cast<int>(clamp(std::floor(ry1 + oy), 0.0, static_cast<double>(sh)));
+			int x2 = static_cast<int>(clamp(std::ceil(rx2 + ox), 0.0, static_cast<double>(sw)));
+			int y2 = static_cast<int>(clamp(std::ceil(ry2 + oy), 0.0, static_cast<double>(sh)));
+
+			cairo_matrix_t m;
+			cairo_get_matrix(cairo, &m);
+			bool generates = false;
+			int margin = 0;
+			for(auto& p : primitives_) {
+				generates = generates || p->generates();
+				margin += p->margin(m);
+			}
+			if(!generates) {
+				// Everything filters to transparent away from what was drawn, so only
+				// that, plus room for it to spread, needs filtering.
+				if(!drawn) {
+					cairo_pattern_destroy(group);
+					return;
+				}
+				x1 = std::max(x1, bx1 - margin);
+				y1 = std::max(y1, by1 - margin);
+				x2 = std::min(x2, bx2 + margin);
+				y2 = std::min(y2, by2 + margin);
+			}
+			if(x2 <= x1 || y2 <= y1) {
+				cairo_pattern_destroy(group);
+				return;
+			}
+
+			filter_image source(x2 - x1, y2 - y1);
+			for(int y = y1; y != y2; ++y) {
+				memcpy(source.row(y - y1), data + static_cast<size_t>(y) * stride + x1 * sizeof(uint32_t), source.width * sizeof(uint32_t));
+			}
+			filter_run run(std::move(source), m, ctx.filter_threads());
+			for(auto& p : primitives_) {
+				p->apply(run);
+			}
+			ctx.count_filter(static_cast<uint64_t>(run.width()) * run.height());
+
+			filter_image& result = run.result();
+			cairo_surface_t* filtered = cairo_image_surface_create_for_data(reinterpret_cast<unsigned char*>(&result.pixels[0]),
+				CAIRO_FORMAT_ARGB32, result.width, result.height, result.width * sizeof(uint32_t));
+			cairo_save(cairo);
+			cairo_identity_matrix(cairo);
+			cairo_set_source_surface(cairo, filtered, x1 - ox, y1 - oy);
+			cairo_paint(cairo);
+			cairo_restore(cairo);
+			cairo_surface_destroy(filtered);
+			cairo_pattern_destroy(group);
+		}
+
+		void filter_element::handle_render(render_context& ctx) const
+		{
+			// Only drawn through the filter property of other elements.
+		}
+
+		void filter_element::handle_clip_render(render_context& ctx) const
+		{
+		}
+
+		void filter_element::handle_memory_usage(memory_report* mr) const
+		{
+			mr->element_nodes += vector_heap_bytes(primitives_);
+			for(auto& p : primitives_) {
+				mr->element_nodes += sizeof(filter_primitive) + shared_count_bytes + p->heap_bytes();
+			}
+		}
+	}
+}
@@ -0,0 +1,75 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "svg_element.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		class filter_primitive;
+		typedef std::shared_ptr<const filter_primitive> filter_primitive_ptr;
+
+		// <filter>, a chain of fe* primitives run over what an element draws.
+		// Supported are feGaussianBlur, feOffset, feFlood, feComposite, feMerge,
+		// feColorMatrix and feBlend. Others pass their input through unchanged.
+		//
+		// Filtering is done in device pixels over the filter region, the box 
+		// around it in device space when the element is rotated or skewed. 
+		// primitiveUnits and the primitive subregions aren't supported. Colours 
+		// are filtered in sRGB.
+		class filter_element : public element
+		{
+		public:
+			filter_element(element* parent, const boost::property_tree::ptree& pt);
+			virtual ~filter_element();
+
+			// Filters group, as returned by render_context::pop_group(), and paints
+			// the result. bbox is the element's bounding box as x1, y1, x2, y2 in 
+			// the current user space, null if it has no geometry.
+			void apply_filter(render_context& ctx, cairo_pattern_t* group, const double* bbox) const;
+		private:
+			DISALLOW_COPY_ASSIGN_AND_DEFAULT(filter_element);
+			// The filter region in device space, false if it's empty. drawn is the 
+			// part of the group drawn to, x1, y1, x2, y2 in device space, or null.
+			bool device_region(render_context& ctx, const double* bbox, const double* drawn, double* x1, double* y1, double* x2, double* y2) const;
+			void handle_render(render_context& ctx) const override;
+			void handle_clip_render(render_context& ctx) const override;
+			bool handle_is_definition() const override { return true; }
+			size_t handle_node_size() const override { return sizeof(*this); }
+			void handle_memory_usage(memory_report* mr) const override;
+
+			std::vector<filter_primitive_ptr> primitives_;
+			bool user_space_units_;
+			// x, y, width and height, as fractions of the bounding box or in user 
+			// units, depending on user_space_units_.
+			double region_[4];
+		};
+	}
+}
@@ -0,0 +1,753 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FILTER_USE_SSE2
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#include "svg_filter_kernels.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		namespace
+		{
+			// Pixels handed to each thread, below which it isn't worth starting one.
+			const int pixels_per_thread = 64 * 1024;
+
+			int min_rows(int width)
+			{
+				return std::max(1, pixels_per_thread / std::max(width, 1));
+			}
+
+			// Weights of the red, green and blue channels in luminance, out of 256,
+			// from the coefficients of the sRGB luminance.
+			const int lum_r = 54;
+			const int lum_g = 183;
+			const int lum_b = 19;
+
+			inline uint8_t luminance(uint32_t p)
+			{
+				return static_cast<uint8_t>((((p >> 16) & 0xff) * lum_r + ((p >> 8) & 0xff) * lum_g + (p & 0xff) * lum_b + 128) >> 8);
+			}
+
+			// The kernels in plain C++, always built so that the SSE2 ones can be
+			// checked against them.
+			struct scalar_kernels
+			{
+				struct channel_sum { int32_t c[4]; };
+
+				static channel_sum sum_zero() { channel_sum s = {{ 0, 0, 0, 0 }}; return s; }
+				static channel_sum sum_pixel(uint32_t p) {
+					channel_sum s = {{ static_cast<int32_t>(p & 0xff), static_cast<int32_t>((p >> 8) & 0xff), 
+						static_cast<int32_t>((p >> 16) & 0xff), static_cast<int32_t>(p >> 24) }};
+					return s;
+				}
+				static channel_sum sum_add(channel_sum a, channel_sum b) { for(int n = 0; n != 4; ++n) { a.c[n] += b.c[n]; } return a; }
+				static channel_sum sum_sub(channel_sum a, channel_sum b) { for(int n = 0; n != 4; ++n) { a.c[n] -= b.c[n]; } return a; }
+				static channel_sum sum_load(const int32_t* p) { channel_sum s; memcpy(s.c, p, sizeof(s.c)); return s; }
+				static void sum_store(int32_t* p, channel_sum s) { memcpy(p, s.c, sizeof(s.c)); }
+				static uint32_t sum_average(channel_sum s, float scale) {
+					uint32_t res = 0;
+					for(int n = 0; n != 4; ++n) {
+						// Rounded to even on halves, as _mm_cvtps_epi32() does.
+						const int v = static_cast<int>(std::lrint(s.c[n] * scale));
+						res |= static_cast<uint32_t>(std::min(255, std::max(0, v))) << (n * 8);
+					}
+					return res;
+				}
+
+				struct pixel_pair { int16_t v[8]; };
+
+				static pixel_pair pp_mul(pixel_pair a, pixel_pair b) {
+					for(int n = 0; n != 8; ++n) {
+						const int t = a.v[n] * b.v[n] + 128;
+						a.v[n] = static_cast<int16_t>((t + (t >> 8)) >> 8);
+					}
+					return a;
+				}
+				static pixel_pair pp_add(pixel_pair a, pixel_pair b) { for(int n = 0; n != 8; ++n) { a.v[n] += b.v[n]; } return a; }
+				static pixel_pair pp_sub(pixel_pair a, pixel_pair b) { for(int n = 0; n != 8; ++n) { a.v[n] -= b.v[n]; } return a; }
+				static pixel_pair pp_min(pixel_pair a, pixel_pair b) { for(int n = 0; n != 8; ++n) { a.v[n] = std::min(a.v[n], b.v[n]); } return a; }
+				static pixel_pair pp_max(pixel_pair a, pixel_pair b) { for(int n = 0; n != 8; ++n) { a.v[n] = std::max(a.v[n], b.v[n]); } return a; }
+				static pixel_pair pp_inv(pixel_pair a) { for(int n = 0; n != 8; ++n) { a.v[n] = 255 - a.v[n]; } return a; }
+				static pixel_pair pp_alpha(pixel_pair a) { 
+					for(int n = 0; n != 8; ++n) { a.v[n] = a.v[n < 4 ? 3 : 7]; } 
+					return a; 
+				}
+
+				template<typename Op>
+				static void combine_row(uint32_t* a, const uint32_t* b, int n, const Op& op)
+				{
+					for(int x = 0; x < n; x += 2) {
+						pixel_pair pa, pb;
+						for(int i = 0; i != 8; ++i) {
+							const int px = x + i / 4;
+							pa.v[i] = px < n ? static_cast<int16_t>((a[px] >> ((i % 4) * 8)) & 0xff) : 0;
+							pb.v[i] = px < n ? static_cast<int16_t>((b[px] >> ((i % 4) * 8)) & 0xff) : 0;
+						}
+						const pixel_pair r = op(pa, pb);
+						for(int i = 0; i != 2 && x + i < n; ++i) {
+							uint32_t p = 0;
+							for(int c = 0; c != 4; ++c) {
+								p |= static_cast<uint32_t>(std::min<int>(255, std::max<int>(0, r.v[i * 4 + c]))) << (c * 8);
+							}
+							a[x + i] = p;
+						}
+					}
+				}
+
+				static void color_matrix_row(uint32_t* p, int n, const float m[20])
+				{
+					// The same operations in the same order as the SSE2 version, on
+					// values from 0 to 255, so that the results are identical.
+					for(int x = 0; x != n; ++x) {
+						const uint32_t a = p[x] >> 24;
+						const float k = a == 0 ? 0 : 255.0f / a;
+						const float r = ((p[x] >> 16) & 0xff) * k, g = ((p[x] >> 8) & 0xff) * k, b = (p[x] & 0xff) * k;
+						const float al = static_cast<float>(a);
+						float out[4];
+						for(int row = 0; row != 4; ++row) {
+							const float* c = &m[row * 5];
+							const float v = (c[0] * r + c[1] * g) + ((c[2] * b + c[3] * al) + c[4] * 255.0f);
+							out[row] = std::min(255.0f, std::max(0.0f, v));
+						}
+						const float oa = out[3] * (1.0f / 255.0f);
+						p[x] = (static_cast<uint32_t>(std::lrint(out[3])) << 24) 
+							| (static_cast<uint32_t>(std::lrint(out[0] * oa)) << 16)
+							| (static_cast<uint32_t>(std::lrint(out[1] * oa)) << 8)
+							| static_cast<uint32_t>(std::lrint(out[2] * oa));
+					}
+				}
+
+				static void luminance_row(const uint32_t* src, uint8_t* dst, int n)
+				{
+					for(int x = 0; x != n; ++x) {
+						dst[x] = luminance(src[x]);
+					}
+				}
+
+				static int skip_transparent(const uint32_t* row, int x, int n)
+				{
+					while(x != n && row[x] == 0) {
+						++x;
+					}
+					return x;
+				}
+			};
+
+#ifdef FILTER_USE_SSE2
+			struct sse2_kernels
+			{
+				// The four channels of a pixel as 32-bit sums, in memory order B G R A.
+				typedef __m128i channel_sum;
+
+				static channel_sum sum_zero() { return _mm_setzero_si128(); }
+				static channel_sum sum_pixel(uint32_t p) {
+					const __m128i z = _mm_setzero_si128();
+					return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(p)), z), z);
+				}
+				static channel_sum sum_add(channel_sum a, channel_sum b) { return _mm_add_epi32(a, b); }
+				static channel_sum sum_sub(channel_sum a, channel_sum b) { return _mm_sub_epi32(a, b); }
+				static channel_sum sum_load(const int32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+				static void sum_store(int32_t* p, channel_sum s) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), s); }
+				// The sum times scale, rounded, as a pixel.
+				static uint32_t sum_average(channel_sum s, float scale) {
+					const __m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(s), _mm_set1_ps(scale)));
+					const __m128i v16 = _mm_packs_epi32(v, v);
+					return static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(v16, v16)));
+				}
+
+				// Two pixels as eight 16-bit channels, for the compositing operators.
+				typedef __m128i pixel_pair;
+
+				// a * b / 255, rounded.
+				static pixel_pair pp_mul(pixel_pair a, pixel_pair b) {
+					const __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, b), _mm_set1_epi16(128));
+					return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+				}
+				static pixel_pair pp_add(pixel_pair a, pixel_pair b) { return _mm_add_epi16(a, b); }
+				static pixel_pair pp_sub(pixel_pair a, pixel_pair b) { return _mm_sub_epi16(a, b); }
+				static pixel_pair pp_min(pixel_pair a, pixel_pair b) { return _mm_min_epi16(a, b); }
+				static pixel_pair pp_max(pixel_pair a, pixel_pair b) { return _mm_max_epi16(a, b); }
+				static pixel_pair pp_inv(pixel_pair a) { return _mm_sub_epi16(_mm_set1_epi16(255), a); }
+				// Each pixel's alpha in all four of its channels.
+				static pixel_pair pp_alpha(pixel_pair a) {
+					return _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+				}
+
+				// a = op(a, b) along a row, four pixels at a time.
+				template<typename Op>
+				static void combine_row(uint32_t* a, const uint32_t* b, int n, const Op& op)
+				{
+					const __m128i z = _mm_setzero_si128();
+					int x = 0;
+					for(; x + 4 <= n; x += 4) {
+						const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+						const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+						const __m128i lo = op(_mm_unpacklo_epi8(va, z), _mm_unpacklo_epi8(vb, z));
+						const __m128i hi = op(_mm_unpackhi_epi8(va, z), _mm_unpackhi_epi8(vb, z));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(a + x), _mm_packus_epi16(lo, hi));
+					}
+					if(x != n) {
+						uint32_t ta[4] = {}, tb[4] = {};
+						memcpy(ta, a + x, (n - x) * sizeof(uint32_t));
+						memcpy(tb, b + x, (n - x) * sizeof(uint32_t));
+						combine_row(ta, tb, 4, op);
+						memcpy(a + x, ta, (n - x) * sizeof(uint32_t));
+					}
+				}
+
+				static void color_matrix_row(uint32_t* p, int n, const float m[20])
+				{
+					// Lanes are B G R A, so each row of the matrix goes to a different lane
+					// and each column is multiplied by one input channel.
+					const __m128 cr = _mm_setr_ps(m[10], m[5], m[0], m[15]);
+					const __m128 cg = _mm_setr_ps(m[11], m[6], m[1], m[16]);
+					const __m128 cb = _mm_setr_ps(m[12], m[7], m[2], m[17]);
+					const __m128 ca = _mm_setr_ps(m[13], m[8], m[3], m[18]);
+					const __m128 co = _mm_mul_ps(_mm_setr_ps(m[14], m[9], m[4], m[19]), _mm_set1_ps(255.0f));
+					const __m128 rgb_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+					const __m128 alpha_one = _mm_setr_ps(0, 0, 0, 1.0f);
+					const __m128i z = _mm_setzero_si128();
+					for(int x = 0; x != n; ++x) {
+						const uint32_t a = p[x] >> 24;
+						__m128 v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(p[x])), z), z));
+						const __m128 va = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+						// Undo the premultiplication of the colour.
+						v = a == 0 ? _mm_setzero_ps() : _mm_mul_ps(v, _mm_set1_ps(255.0f / a));
+						const __m128 vr = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+						const __m128 vg = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+						const __m128 vb = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+						__m128 out = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cr, vr), _mm_mul_ps(cg, vg)), 
+							_mm_add_ps(_mm_add_ps(_mm_mul_ps(cb, vb), _mm_mul_ps(ca, va)), co));
+						out = _mm_min_ps(_mm_max_ps(out, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+						// Premultiply by the new alpha, leaving alpha itself alone.
+						const __m128 oa = _mm_mul_ps(_mm_shuffle_ps(out, out, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(1.0f / 255.0f));
+						out = _mm_mul_ps(out, _mm_or_ps(_mm_and_ps(rgb_mask, oa), alpha_one));
+						const __m128i i32 = _mm_cvtps_epi32(out);
+						const __m128i i16 = _mm_packs_epi32(i32, i32);
+						p[x] = static_cast<uint32_t>(_mm_cvtsi128_si32(_mm_packus_epi16(i16, i16)));
+					}
+				}
+
+				// Luminance of four pixels, as 32-bit lanes.
+				static __m128i luminance4(__m128i v)
+				{
+					const __m128i mask = _mm_set1_epi32(0xff);
+					const __m128i b = _mm_and_si128(v, mask);
+					const __m128i g = _mm_and_si128(_mm_srli_epi32(v, 8), mask);
+					const __m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), mask);
+					// The products fit in the low halves of the lanes.
+					__m128i sum = _mm_add_epi32(_mm_mullo_epi16(r, _mm_set1_epi32(lum_r)), _mm_mullo_epi16(g, _mm_set1_epi32(lum_g)));
+					sum = _mm_add_epi32(sum, _mm_mullo_epi16(b, _mm_set1_epi32(lum_b)));
+					return _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(128)), 8);
+				}
+
+				static void luminance_row(const uint32_t* src, uint8_t* dst, int n)
+				{
+					int x = 0;
+					for(; x + 16 <= n; x += 16) {
+						const __m128i* p = reinterpret_cast<const __m128i*>(src + x);
+						const __m128i lo = _mm_packs_epi32(luminance4(_mm_loadu_si128(p)), luminance4(_mm_loadu_si128(p + 1)));
+						const __m128i hi = _mm_packs_epi32(luminance4(_mm_loadu_si128(p + 2)), luminance4(_mm_loadu_si128(p + 3)));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(lo, hi));
+					}
+					for(; x != n; ++x) {
+						dst[x] = luminance(src[x]);
+					}
+				}
+
+				// Index of the first pixel from x that isn't transparent, or n.
+				static int skip_transparent(const uint32_t* row, int x, int n)
+				{
+					const __m128i z = _mm_setzero_si128();
+					for(; x + 4 <= n; x += 4) {
+						const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+						if(_mm_movemask_epi8(_mm_cmpeq_epi32(v, z)) != 0xffff) {
+							break;
+						}
+					}
+					while(x != n && row[x] == 0) {
+						++x;
+					}
+					return x;
+				}
+			};
+			typedef sse2_kernels default_kernels;
+#else
+			typedef scalar_kernels default_kernels;
+#endif
+
+			template<typename K>
+			struct op_over {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { return K::pp_add(a, K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))); }
+			};
+			template<typename K>
+			struct op_in {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { return K::pp_mul(a, K::pp_alpha(b)); }
+			};
+			template<typename K>
+			struct op_out {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { return K::pp_mul(a, K::pp_inv(K::pp_alpha(b))); }
+			};
+			template<typename K>
+			struct op_atop {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { 
+					return K::pp_add(K::pp_mul(a, K::pp_alpha(b)), K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))); 
+				}
+			};
+			template<typename K>
+			struct op_xor {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { 
+					return K::pp_add(K::pp_mul(a, K::pp_inv(K::pp_alpha(b))), K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))); 
+				}
+			};
+			// The blend modes, from the feBlend definitions on premultiplied colour.
+			// Applied to alpha as well they all give qa + qb - qa*qb, as they should.
+			template<typename K>
+			struct op_multiply {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { 
+					return K::pp_add(K::pp_add(K::pp_mul(a, K::pp_inv(K::pp_alpha(b))), K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))), K::pp_mul(a, b)); 
+				}
+			};
+			template<typename K>
+			struct op_screen {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { return K::pp_sub(K::pp_add(a, b), K::pp_mul(a, b)); }
+			};
+			template<typename K>
+			struct op_darken {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { 
+					return K::pp_min(K::pp_add(a, K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))), K::pp_add(b, K::pp_mul(a, K::pp_inv(K::pp_alpha(b))))); 
+				}
+			};
+			template<typename K>
+			struct op_lighten {
+				typedef typename K::pixel_pair pixel_pair;
+				pixel_pair operator()(pixel_pair a, pixel_pair b) const { 
+					return K::pp_max(K::pp_add(a, K::pp_mul(b, K::pp_inv(K::pp_alpha(a)))), K::pp_add(b, K::pp_mul(a, K::pp_inv(K::pp_alpha(b))))); 
+				}
+			};
+
+			template<typename K, template<typename> class Op>
+			void combine(filter_image& a, const filter_image& b, int threads)
+			{
+				filter_parallel_for(a.height, threads, min_rows(a.width), [&](int first, int last) {
+					for(int y = first; y != last; ++y) {
+						K::combine_row(a.row(y), b.row(y), a.width, Op<K>());
+					}
+				});
+			}
+
+			// k1*a*b + k2*a + k3*b + k4 on values from 0 to 1, for each channel.
+			void arithmetic_row(uint32_t* a, const uint32_t* b, int n, const double k[4])
+			{
+				for(int x = 0; x != n; ++x) {
+					float c[4];
+					for(int ch = 0; ch != 4; ++ch) {
+						const float ca = ((a[x] >> (ch * 8)) & 0xff) / 255.0f;
+						const float cb = ((b[x] >> (ch * 8)) & 0xff) / 255.0f;
+						const float v = static_cast<float>(k[0] * ca * cb + k[1] * ca + k[2] * cb + k[3]);
+						c[ch] = std::min(1.0f, std::max(0.0f, v));
+					}
+					// Premultiplied colour can't exceed alpha.
+					uint32_t p = static_cast<uint32_t>(c[3] * 255.0f + 0.5f) << 24;
+					for(int ch = 0; ch != 3; ++ch) {
+						p |= static_cast<uint32_t>(std::min(c[ch], c[3]) * 255.0f + 0.5f) << (ch * 8);
+					}
+					a[x] = p;
+				}
+			}
+
+			// One box blur of a row, from in to out.
+			template<typename K>
+			void blur_row(const uint32_t* in, uint32_t* out, int w, int left, int right)
+			{
+				const float scale = 1.0f / (left + right + 1);
+				typename K::channel_sum sum = K::sum_zero();
+				for(int x = 0; x < std::min(right, w); ++x) {
+					sum = K::sum_add(sum, K::sum_pixel(in[x]));
+				}
+				for(int x = 0; x != w; ++x) {
+					if(x + right < w) {
+						sum = K::sum_add(sum, K::sum_pixel(in[x + right]));
+					}
+					out[x] = K::sum_average(sum, scale);
+					if(x - left >= 0) {
+						sum = K::sum_sub(sum, K::sum_pixel(in[x - left]));
+					}
+				}
+			}
+
+			// Runs each of the box blurs, given as left and right extents, over 
+			// every row in turn, so a row stays in cache for all of them.
+			template<typename K>
+			void blur_rows(filter_image& img, const int (*boxes)[2], int nboxes, int threads)
+			{
+				filter_parallel_for(img.height, threads, min_rows(img.width), [&](int first, int last) {
+					std::vector<uint32_t> scratch(img.width * 2);
+					for(int y = first; y != last; ++y) {
+						uint32_t* src = img.row(y);
+						uint32_t* dst = &scratch[0];
+						for(int n = 0; n != nboxes; ++n) {
+							blur_row<K>(src, dst, img.width, boxes[n][0], boxes[n][1]);
+							src = dst;
+							dst = dst == &scratch[0] ? &scratch[img.width] : &scratch[0];
+						}
+						if(src != img.row(y)) {
+							memcpy(img.row(y), src, img.width * sizeof(uint32_t));
+						}
+					}
+				});
+			}
+
+			// One box blur down the columns [c1, c2) of src into dst. The sums for 
+			// each column are kept so rows are read in order.
+			template<typename K>
+			void blur_columns(const filter_image& src, filter_image& dst, int up, int down, int c1, int c2)
+			{
+				const int n = c2 - c1;
+				const int h = src.height;
+				const float scale = 1.0f / (up + down + 1);
+				std::vector<int32_t> sums(n * 4, 0);
+				for(int y = 0; y < std::min(down, h); ++y) {
+					const uint32_t* in = src.row(y) + c1;
+					for(int x = 0; x != n; ++x) {
+						K::sum_store(&sums[x * 4], K::sum_add(K::sum_load(&sums[x * 4]), K::sum_pixel(in[x])));
+					}
+				}
+				for(int y = 0; y != h; ++y) {
+					const uint32_t* add = y + down < h ? src.row(y + down) + c1 : nullptr;
+					const uint32_t* sub = y - up >= 0 ? src.row(y - up) + c1 : nullptr;
+					uint32_t* out = dst.row(y) + c1;
+					for(int x = 0; x != n; ++x) {
+						typename K::channel_sum s = K::sum_load(&sums[x * 4]);
+						if(add) {
+							s = K::sum_add(s, K::sum_pixel(add[x]));
+						}
+						out[x] = K::sum_average(s, scale);
+						if(sub) {
+							s = K::sum_sub(s, K::sum_pixel(sub[x]));
+						}
+						K::sum_store(&sums[x * 4], s);
+					}
+				}
+			}
+
+			template<typename K>
+			void blur_all_columns(filter_image& img, const int (*boxes)[2], int nboxes, int threads)
+			{
+				filter_image tmp(img.width, img.height);
+				filter_image* src = &img;
+				filter_image* dst = &tmp;
+				for(int n = 0; n != nboxes; ++n) {
+					// Bands of columns, each wide enough to make a thread worthwhile.
+					filter_parallel_for(img.width, threads, std::max(1, pixels_per_thread / std::max(img.height, 1)), [&](int first, int last) {
+						blur_columns<K>(*src, *dst, boxes[n][0], boxes[n][1], first, last);
+					});
+					std::swap(src, dst);
+				}
+				if(src != &img) {
+					img.pixels.swap(tmp.pixels);
+				}
+			}
+
+			// The three boxes for a gaussian with deviation dev, returns how many
+			// there are, 0 if the blur is too small to do anything.
+			int gaussian_boxes(double dev, int boxes[3][2])
+			{
+				const int d = static_cast<int>(std::floor(dev * 3.0 * std::sqrt(2.0 * M_PI) / 4.0 + 0.5));
+				if(d < 2) {
+					return 0;
+				}
+				if(d % 2 == 1) {
+					for(int n = 0; n != 3; ++n) {
+						boxes[n][0] = boxes[n][1] = d / 2;
+					}
+				} else {
+					// Two boxes of size d either side of the pixel, then one of d+1 
+					// centred on it.
+					boxes[0][0] = d / 2;
+					boxes[0][1] = d / 2 - 1;
+					boxes[1][0] = d / 2 - 1;
+					boxes[1][1] = d / 2;
+					boxes[2][0] = boxes[2][1] = d / 2;
+				}
+				return 3;
+			}
+
+			template<typename K>
+			void composite_with(filter_image& a, const filter_image& b, CompositeOperator op, const double k[4], int threads)
+			{
+				switch(op) {
+					case CompositeOperator::OVER: combine<K, op_over>(a, b, threads); break;
+					case CompositeOperator::IN: combine<K, op_in>(a, b, threads); break;
+					case CompositeOperator::OUT: combine<K, op_out>(a, b, threads); break;
+					case CompositeOperator::ATOP: combine<K, op_atop>(a, b, threads); break;
+					case CompositeOperator::XOR: combine<K, op_xor>(a, b, threads); break;
+					case CompositeOperator::ARITHMETIC:
+						filter_parallel_for(a.height, threads, min_rows(a.width), [&](int first, int last) {
+							for(int y = first; y != last; ++y) {
+								arithmetic_row(a.row(y), b.row(y), a.width, k);
+							}
+						});
+						break;
+				}
+			}
+
+			template<typename K>
+			void blend_with(filter_image& a, const filter_image& b, BlendMode mode, int threads)
+			{
+				switch(mode) {
+					case BlendMode::NORMAL: combine<K, op_over>(a, b, threads); break;
+					case BlendMode::MULTIPLY: combine<K, op_multiply>(a, b, threads); break;
+					case BlendMode::SCREEN: combine<K, op_screen>(a, b, threads); break;
+					case BlendMode::DARKEN: combine<K, op_darken>(a, b, threads); break;
+					case BlendMode::LIGHTEN: combine<K, op_lighten>(a, b, threads); break;
+				}
+			}
+
+			template<typename K>
+			void color_matrix_with(filter_image& img, const float m[20], int threads)
+			{
+				filter_parallel_for(img.height, threads, min_rows(img.width), [&](int first, int last) {
+					for(int y = first; y != last; ++y) {
+						K::color_matrix_row(img.row(y), img.width, m);
+					}
+				});
+			}
+
+			template<typename K>
+			void luminance_to_alpha_with(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height)
+			{
+				for(int y = 0; y != height; ++y) {
+					K::luminance_row(reinterpret_cast<const uint32_t*>(src + static_cast<size_t>(y) * src_stride), 
+						dst + static_cast<size_t>(y) * dst_stride, width);
+				}
+			}
+
+			template<typename K>
+			bool opaque_bounds_with(const uint8_t* data, int width, int height, int stride, int* x1, int* y1, int* x2, int* y2)
+			{
+				int minx = width, maxx = -1, miny = height, maxy = -1;
+				for(int y = 0; y != height; ++y) {
+					const uint32_t* row = reinterpret_cast<const uint32_t*>(data + static_cast<size_t>(y) * stride);
+					const int first = K::skip_transparent(row, 0, width);
+					if(first == width) {
+						continue;
+					}
+					// Only what's past the right edge found so far needs looking at.
+					int last = first;
+					for(int x = std::max(first, maxx) + 1; x < width; x = K::skip_transparent(row, x + 1, width)) {
+						if(row[x] != 0) {
+							last = x;
+						}
+					}
+					minx = std::min(minx, first);
+					maxx = std::max(maxx, last);
+					miny = std::min(miny, y);
+					maxy = y;
+				}
+				if(maxy < 0) {
+					return false;
+				}
+				*x1 = minx;
+				*y1 = miny;
+				*x2 = maxx + 1;
+				*y2 = maxy + 1;
+				return true;
+			}
+		}
+
+		void filter_parallel_for(int count, int threads, int min_items, const std::function<void(int, int)>& fn)
+		{
+			if(threads <= 0) {
+				threads = static_cast<int>(std::thread::hardware_concurrency());
+				if(threads <= 0) {
+					threads = 1;
+				}
+			}
+			threads = std::min(threads, count / std::max(min_items, 1));
+			if(threads <= 1) {
+				if(count > 0) {
+					fn(0, count);
+				}
+				return;
+			}
+			const int per_thread = (count + threads - 1) / threads;
+			std::vector<std::thread> workers;
+			for(int first = per_thread; first < count; first += per_thread) {
+				workers.emplace_back(fn, first, std::min(count, first + per_thread));
+			}
+			fn(0, std::min(count, per_thread));
+			for(auto& w : workers) {
+				w.join();
+			}
+		}
+
+		void box_blur_horizontal(filter_image& img, int left, int right, int threads)
+		{
+			const int boxes[1][2] = { { left, right } };
+			blur_rows<default_kernels>(img, boxes, 1, threads);
+		}
+
+		void box_blur_vertical(filter_image& img, int up, int down, int threads)
+		{
+			const int boxes[1][2] = { { up, down } };
+			blur_all_columns<default_kernels>(img, boxes, 1, threads);
+		}
+
+		void gaussian_blur(filter_image& img, double dev_x, double dev_y, int threads)
+		{
+			int boxes[3][2];
+			int nboxes = gaussian_boxes(dev_x, boxes);
+			if(nboxes > 0) {
+				blur_rows<default_kernels>(img, boxes, nboxes, threads);
+			}
+			nboxes = gaussian_boxes(dev_y, boxes);
+			if(nboxes > 0) {
+				blur_all_columns<default_kernels>(img, boxes, nboxes, threads);
+			}
+		}
+
+		int gaussian_blur_extent(double dev)
+		{
+			int boxes[3][2];
+			const int nboxes = gaussian_boxes(dev, boxes);
+			int extent = 0;
+			for(int n = 0; n != nboxes; ++n) {
+				extent += std::max(boxes[n][0], boxes[n][1]);
+			}
+			return extent;
+		}
+
+		void offset_image(filter_image& img, int dx, int dy)
+		{
+			if(dx == 0 && dy == 0) {
+				return;
+			}
+			filter_image out(img.width, img.height);
+			const int x1 = std::max(0, dx);
+			const int x2 = std::min(img.width, img.width + dx);
+			if(x1 < x2) {
+				for(int y = std::max(0, dy); y < std::min(img.height, img.height + dy); ++y) {
+					memcpy(out.row(y) + x1, img.row(y - dy) + x1 - dx, (x2 - x1) * sizeof(uint32_t));
+				}
+			}
+			img.pixels.swap(out.pixels);
+		}
+
+		void flood_image(filter_image& img, uint32_t premultiplied_argb)
+		{
+			std::fill(img.pixels.begin(), img.pixels.end(), premultiplied_argb);
+		}
+
+		void alpha_only(filter_image& img)
+		{
+			for(auto& p : img.pixels) {
+				p &= 0xff000000;
+			}
+		}
+
+		void composite_images(filter_image& a, const filter_image& b, CompositeOperator op, const double k[4], int threads)
+		{
+			composite_with<default_kernels>(a, b, op, k, threads);
+		}
+
+		void blend_images(filter_image& a, const filter_image& b, BlendMode mode, int threads)
+		{
+			blend_with<default_kernels>(a, b, mode, threads);
+		}
+
+		void color_matrix(filter_image& img, const float m[20], int threads)
+		{
+			color_matrix_with<default_kernels>(img, m, threads);
+		}
+
+		void luminance_to_alpha(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height)
+		{
+			luminance_to_alpha_with<default_kernels>(src, src_stride, dst, dst_stride, width, height);
+		}
+
+		bool opaque_bounds(const uint8_t* data, int width, int height, int stride, int* x1, int* y1, int* x2, int* y2)
+		{
+			return opaque_bounds_with<default_kernels>(data, width, height, stride, x1, y1, x2, y2);
+		}
+
+		namespace scalar
+		{
+			void box_blur_horizontal(filter_image& img, int left, int right, int threads)
+			{
+				const int boxes[1][2] = { { left, right } };
+				blur_rows<scalar_kernels>(img, boxes, 1, threads);
+			}
+
+			void box_blur_vertical(filter_image& img, int up, int down, int threads)
+			{
+				const int boxes[1][2] = { { up, down } };
+				blur_all_columns<scalar_kernels>(img, boxes, 1, threads);
+			}
+
+			void composite_images(filter_image& a, const filter_image& b, CompositeOperator op, const double k[4], int threads)
+			{
+				composite_with<scalar_kernels>(a, b, op, k, threads);
+			}
+
+			void blend_images(filter_image& a, const filter_image& b, BlendMode mode, int threads)
+			{
+				blend_with<scalar_kernels>(a, b, mode, threads);
+			}
+
+			void color_matrix(filter_image& img, const float m[20], int threads)
+			{
+				color_matrix_with<scalar_kernels>(img, m, threads);
+			}
+
+			void luminance_to_alpha(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height)
+			{
+				luminance_to_alpha_with<scalar_kernels>(src, src_stride, dst, dst_stride, width, height);
+			}
+
+			bool opaque_bounds(const uint8_t* data, int width, int height, int stride, int* x1, int* y1, int* x2, int* y2)
+			{
+				return opaque_bounds_with<scalar_kernels>(data, width, height, stride, x1, y1, x2, y2);
+			}
+		}
+	}
+}
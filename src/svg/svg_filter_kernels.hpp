@@ -0,0 +1,123 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// The per-pixel work of filter effects, kept apart from the element tree so it
+// can be timed on its own. Everything works on premultiplied ARGB32, the same
+// as cairo's image surfaces, using SSE2 where it's available. The slow kernels
+// split big images into bands of rows, or columns, run on separate threads.
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Pixels laid out as cairo's CAIRO_FORMAT_ARGB32, with no padding between
+		// rows.
+		struct filter_image
+		{
+			filter_image() : width(0), height(0) {}
+			filter_image(int w, int h) : width(w), height(h), pixels(static_cast<size_t>(w) * h, 0) {}
+			uint32_t* row(int y) { return &pixels[static_cast<size_t>(y) * width]; }
+			const uint32_t* row(int y) const { return &pixels[static_cast<size_t>(y) * width]; }
+			size_t bytes() const { return pixels.size() * sizeof(uint32_t); }
+			int width;
+			int height;
+			std::vector<uint32_t> pixels;
+		};
+
+		// Calls fn(first, last) on ranges covering [0, count). If there are at 
+		// least min_items items per thread the ranges are run on up to threads 
+		// threads, 0 for one per core, otherwise all on this one.
+		void filter_parallel_for(int count, int threads, int min_items, const std::function<void(int, int)>& fn);
+
+		// Blurs with a box left+right+1 pixels wide, covering left pixels to the
+		// left of each pixel and right to the right. Pixels outside the image are
+		// transparent.
+		void box_blur_horizontal(filter_image& img, int left, int right, int threads);
+		void box_blur_vertical(filter_image& img, int up, int down, int threads);
+		// Approximates a gaussian blur with three box blurs in each direction, as
+		// the SVG specification suggests. Deviations are in pixels.
+		void gaussian_blur(filter_image& img, double dev_x, double dev_y, int threads);
+		// How far gaussian_blur() can spread a pixel with the given deviation.
+		int gaussian_blur_extent(double dev);
+
+		// Moves the pixels by whole pixels.
+		void offset_image(filter_image& img, int dx, int dy);
+		void flood_image(filter_image& img, uint32_t premultiplied_argb);
+		// Keeps just the alpha channel, making everything black.
+		void alpha_only(filter_image& img);
+
+		enum class CompositeOperator {
+			OVER,
+			IN,
+			OUT,
+			ATOP,
+			XOR,
+			ARITHMETIC,
+		};
+		// Combines a on top of b, leaving the result in a. k is only used for 
+		// ARITHMETIC.
+		void composite_images(filter_image& a, const filter_image& b, CompositeOperator op, const double k[4], int threads);
+
+		enum class BlendMode {
+			NORMAL,
+			MULTIPLY,
+			SCREEN,
+			DARKEN,
+			LIGHTEN,
+		};
+		// Blends a on top of b, leaving the result in a.
+		void blend_images(filter_image& a, const filter_image& b, BlendMode mode, int threads);
+
+		// m is the 5x4 matrix of feColorMatrix, in row order, which works on
+		// non-premultiplied values from 0 to 1.
+		void color_matrix(filter_image& img, const float m[20], int threads);
+
+		// Writes the luminance of each premultiplied ARGB32 pixel of src, which is
+		// also its luminance times alpha, to the A8 dst, as a luminance mask.
+		void luminance_to_alpha(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height);
+
+		// The smallest rectangle holding every pixel that isn't transparent.
+		// Returns false if they all are.
+		bool opaque_bounds(const uint8_t* data, int width, int height, int stride, int* x1, int* y1, int* x2, int* y2);
+
+		// The same without the SSE2 paths, for checking and timing against.
+		namespace scalar
+		{
+			void box_blur_horizontal(filter_image& img, int left, int right, int threads);
+			void box_blur_vertical(filter_image& img, int up, int down, int threads);
+			void composite_images(filter_image& a, const filter_image& b, CompositeOperator op, const double k[4], int threads);
+			void blend_images(filter_image& a, const filter_image& b, BlendMode mode, int threads);
+			void color_matrix(filter_image& img, const float m[20], int threads);
+			void luminance_to_alpha(const uint8_t* src, int src_stride, uint8_t* dst, int dst_stride, int width, int height);
+			bool opaque_bounds(const uint8_t* data, int width, int height, int stride, int* x1, int* y1, int* x2, int* y2);
+		}
+	}
+}
@@ -53,6 +53,21 @@ namespace KRE
 		class container;
 		typedef std::shared_ptr<container> container_ptr;
 
+		class clip_path;
+		typedef std::shared_ptr<const clip_path> const_clip_path_ptr;
+
+		class filter_element;
+		typedef std::shared_ptr<const filter_element> const_filter_element_ptr;
+
+		class mask_element;
+		typedef std::shared_ptr<const mask_element> const_mask_element_ptr;
+
+		class marker_element;
+		typedef std::shared_ptr<const marker_element> const_marker_element_ptr;
+		struct marker_vertex;
+
+		struct tree_report;
+
 		typedef std::vector<std::pair<svg_length,svg_length>> point_list;
 
 	}
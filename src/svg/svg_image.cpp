@@ -0,0 +1,429 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <cctype>
+#include <chrono>
+#include <cstring>
+
+#include "asserts.hpp"
+#include "base64.hpp"
+#include "svg_image.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			// Size the cache is allowed to grow to before dropping images.
+			const size_t default_image_cache_bytes = 64 * 1024 * 1024;
+
+			double seconds_since(const std::chrono::steady_clock::time_point& start)
+			{
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			// 64-bit hash of the encoded data. Embedded images can be megabytes, so 
+			// this goes eight bytes at a time in four independent lanes rather than 
+			// a byte at a time like FNV.
+			uint64_t hash_data(const char* p, size_t n)
+			{
+				const uint64_t k = 0x9e3779b97f4a7c15ULL;
+				uint64_t h[4] = { k, k ^ 1, k ^ 2, k ^ 3 };
+				size_t i = 0;
+				for(; i + 32 <= n; i += 32) {
+					for(int lane = 0; lane != 4; ++lane) {
+						uint64_t w;
+						memcpy(&w, p + i + lane * 8, 8);
+						h[lane] = (h[lane] ^ w) * k;
+						h[lane] ^= h[lane] >> 29;
+					}
+				}
+				uint64_t res = n;
+				for(int lane = 0; lane != 4; ++lane) {
+					res = (res ^ h[lane]) * k;
+					res ^= res >> 32;
+				}
+				for(; i != n; ++i) {
+					res = (res ^ static_cast<unsigned char>(p[i])) * 1099511628211ULL;
+				}
+				return res;
+			}
+
+			struct png_reader
+			{
+				png_reader(const std::vector<uint8_t>& d) : data(d), pos(0) {}
+				const std::vector<uint8_t>& data;
+				size_t pos;
+			};
+
+			cairo_status_t read_png_data(void* closure, unsigned char* out, unsigned int length)
+			{
+				png_reader* rd = static_cast<png_reader*>(closure);
+				if(rd->data.size() - rd->pos < length) {
+					return CAIRO_STATUS_READ_ERROR;
+				}
+				memcpy(out, &rd->data[rd->pos], length);
+				rd->pos += length;
+				return CAIRO_STATUS_SUCCESS;
+			}
+
+			bool is_png(const std::vector<uint8_t>& data)
+			{
+				static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+				return data.size() >= sizeof(signature) && memcmp(&data[0], signature, sizeof(signature)) == 0;
+			}
+
+			// Given the text after "xMin", "xMid" or "xMax", or the Y equivalent.
+			double parse_align(const std::string& s)
+			{
+				if(s == "Min") {
+					return 0;
+				} else if(s == "Mid") {
+					return 0.5;
+				} else if(s == "Max") {
+					return 1.0;
+				}
+				LOG_WARN("Unrecognised alignment in preserveAspectRatio: " << s);
+				return 0.5;
+			}
+		}
+
+		decoded_image::decoded_image(cairo_surface_t* surface)
+			: surface_(surface)
+		{
+		}
+
+		decoded_image::~decoded_image()
+		{
+			cairo_surface_destroy(surface_);
+		}
+
+		int decoded_image::width() const
+		{
+			return cairo_image_surface_get_width(surface_);
+		}
+
+		int decoded_image::height() const
+		{
+			return cairo_image_surface_get_height(surface_);
+		}
+
+		size_t decoded_image::bytes() const
+		{
+			return static_cast<size_t>(cairo_image_surface_get_stride(surface_)) * height();
+		}
+
+		image_cache::image_cache(size_t max_bytes)
+			: max_bytes_(max_bytes)
+		{
+		}
+
+		image_cache& image_cache::instance()
+		{
+			static image_cache cache(default_image_cache_bytes);
+			return cache;
+		}
+
+		decoded_image_ptr image_cache::get_base64(const char* p, size_t n)
+		{
+			// Documents wrap base64 text however they like, which mustn't stop the 
+			// same image being found.
+			std::string encoded;
+			encoded.reserve(n);
+			for(const char* end = p + n; p != end; ++p) {
+				if(!isspace(static_cast<unsigned char>(*p))) {
+					encoded.push_back(*p);
+				}
+			}
+			const key k(hash_data(encoded.data(), encoded.size()), encoded.size());
+			std::shared_ptr<std::promise<decoded_image_ptr>> promise;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				auto it = entries_.find(k);
+				if(it != entries_.end() && it->second.encoded == encoded) {
+					++stats_.hits;
+					lru_.splice(lru_.begin(), lru_, it->second.lru);
+					return it->second.img;
+				}
+				auto pit = pending_.find(k);
+				if(it == entries_.end() && pit != pending_.end() && pit->second.encoded == encoded) {
+					// Somebody else is already decoding it, which saves decoding it 
+					// here just as a cached image would.
+					++stats_.hits;
+					auto fut = pit->second.result;
+					lock.unlock();
+					return fut.get();
+				}
+				++stats_.misses;
+				if(it != entries_.end() || pit != pending_.end()) {
+					// Different data with the same key, decoded without being cached.
+					lock.unlock();
+					return decode(encoded.data(), encoded.size());
+				}
+				promise = std::make_shared<std::promise<decoded_image_ptr>>();
+				pending_entry& pe = pending_[k];
+				pe.encoded = encoded;
+				pe.result = promise->get_future().share();
+			}
+
+			decoded_image_ptr img;
+			try {
+				img = decode(encoded.data(), encoded.size());
+			} catch(...) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				promise->set_exception(std::current_exception());
+				pending_.erase(k);
+				throw;
+			}
+
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_.erase(k);
+			promise->set_value(img);
+			if(img == nullptr) {
+				++stats_.failures;
+				return img;
+			}
+			lru_.push_front(k);
+			entry& e = entries_[k];
+			e.encoded.swap(encoded);
+			e.img = img;
+			e.lru = lru_.begin();
+			stats_.bytes += img->bytes() + e.encoded.size();
+			evict();
+			return img;
+		}
+
+		decoded_image_ptr image_cache::decode(const char* p, size_t n)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::vector<uint8_t> data;
+			const bool ok = base64::decode(p, n, &data);
+			const double base64_time = seconds_since(start);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stats_.encoded_bytes += n;
+				stats_.base64_seconds += base64_time;
+			}
+			if(!ok) {
+				LOG_ERROR("Bad base64 data in embedded image");
+				return decoded_image_ptr();
+			}
+			if(!is_png(data)) {
+				LOG_WARN("Only PNG images are supported, ignoring embedded image");
+				return decoded_image_ptr();
+			}
+
+			start = std::chrono::steady_clock::now();
+			png_reader rd(data);
+			cairo_surface_t* surface = cairo_image_surface_create_from_png_stream(read_png_data, &rd);
+			const double png_time = seconds_since(start);
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				stats_.compressed_bytes += data.size();
+				stats_.png_seconds += png_time;
+			}
+			const cairo_status_t status = cairo_surface_status(surface);
+			if(status != CAIRO_STATUS_SUCCESS) {
+				LOG_ERROR("Unable to decode embedded PNG image: " << cairo_status_to_string(status));
+				cairo_surface_destroy(surface);
+				return decoded_image_ptr();
+			}
+			return std::make_shared<decoded_image>(surface);
+		}
+
+		void image_cache::evict()
+		{
+			while(stats_.bytes > max_bytes_ && !lru_.empty()) {
+				auto it = entries_.find(lru_.back());
+				ASSERT_LOG(it != entries_.end(), "image_cache LRU list out of step with entries");
+				stats_.bytes -= it->second.img->bytes() + it->second.encoded.size();
+				entries_.erase(it);
+				lru_.pop_back();
+				++stats_.evictions;
+			}
+		}
+
+		void image_cache::set_max_bytes(size_t max_bytes)
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			max_bytes_ = max_bytes;
+			evict();
+		}
+
+		void image_cache::clear()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			entries_.clear();
+			lru_.clear();
+			stats_.bytes = 0;
+		}
+
+		image_cache::stats image_cache::get_stats() const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stats s = stats_;
+			s.entries = entries_.size();
+			return s;
+		}
+
+		image_element::image_element(element* parent, const ptree& pt)
+			: element(parent, pt),
+			  has_width_(false),
+			  has_height_(false),
+			  align_x_(0.5),
+			  align_y_(0.5),
+			  slice_(false)
+		{
+			auto attributes = pt.get_child_optional("<xmlattr>");
+			if(!attributes) {
+				return;
+			}
+			has_width_ = attributes->get_child_optional("width") ? true : false;
+			has_height_ = attributes->get_child_optional("height") ? true : false;
+
+			auto par = attributes->get_child_optional("preserveAspectRatio");
+			if(par) {
+				auto buf = utils::split(par->data(), " \t\r\n");
+				size_t n = 0;
+				if(n < buf.size() && buf[n] == "defer") {
+					++n;
+				}
+				if(n < buf.size()) {
+					if(buf[n] == "none") {
+						align_x_ = align_y_ = -1.0;
+					} else if(buf[n].size() == 8 && buf[n][0] == 'x' && buf[n][4] == 'Y') {
+						align_x_ = parse_align(buf[n].substr(1, 3));
+						align_y_ = parse_align(buf[n].substr(5, 3));
+					} else {
+						LOG_WARN("Unrecognised preserveAspectRatio value: " << par->data());
+					}
+					++n;
+				}
+				if(n < buf.size()) {
+					slice_ = buf[n] == "slice";
+				}
+			}
+
+			auto href = attributes->get_child_optional("xlink:href");
+			if(!href) {
+				href = attributes->get_child_optional("href");
+			}
+			if(!href) {
+				return;
+			}
+			// Decoded straight out of the attribute, there's no need to copy it.
+			const std::string& uri = href->data();
+			const size_t comma = uri.find(',');
+			if(uri.compare(0, 5, "data:") != 0 || comma == std::string::npos) {
+				LOG_WARN("Only images embedded as data: URIs are supported, ignoring: " << uri.substr(0, 64));
+				return;
+			}
+			const std::string header = uri.substr(5, comma - 5);
+			if(header.size() < 7 || header.compare(header.size() - 7, 7, ";base64") != 0) {
+				LOG_WARN("Only base64 encoded data: URIs are supported for images, ignoring: " << header);
+				return;
+			}
+			image_ = image_cache::instance().get_base64(uri.data() + comma + 1, uri.size() - comma - 1);
+		}
+
+		image_element::~image_element()
+		{
+		}
+
+		void image_element::handle_memory_usage(memory_report* mr) const
+		{
+			if(mr->first_visit(image_.get())) {
+				mr->images += image_->bytes();
+			}
+		}
+
+		void image_element::handle_render(render_context& ctx) const
+		{
+			if(image_ == nullptr) {
+				return;
+			}
+			// Recordings only hold paths and gradients.
+			ctx.not_recordable("image");
+			const double iw = image_->width();
+			const double ih = image_->height();
+			if(iw <= 0 || ih <= 0) {
+				return;
+			}
+			const double x1 = x().value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			const double y1 = y().value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			double w = has_width_ ? width().value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER) : iw;
+			double h = has_height_ ? height().value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER) : ih;
+			// With only one of them given the other keeps the image's aspect ratio.
+			if(has_width_ && !has_height_) {
+				h = w * ih / iw;
+			} else if(has_height_ && !has_width_) {
+				w = h * iw / ih;
+			}
+			if(w <= 0 || h <= 0) {
+				return;
+			}
+
+			// Where the image goes, in user space.
+			double sx = w / iw;
+			double sy = h / ih;
+			double tx = x1;
+			double ty = y1;
+			if(align_x_ >= 0) {
+				sx = sy = slice_ ? std::max(sx, sy) : std::min(sx, sy);
+				tx += (w - iw * sx) * align_x_;
+				ty += (h - ih * sy) * align_y_;
+			}
+
+			cairo_pattern_t* pattern = cairo_pattern_create_for_surface(image_->surface());
+			cairo_matrix_t mat;
+			cairo_matrix_init(&mat, sx, 0, 0, sy, tx, ty);
+			cairo_matrix_invert(&mat);
+			cairo_pattern_set_matrix(pattern, &mat);
+			cairo_pattern_set_filter(pattern, ctx.image_filter());
+			// Only the area covered by the image is filled, padding stops the 
+			// filter fading its edges out.
+			cairo_pattern_set_extend(pattern, CAIRO_EXTEND_PAD);
+			cairo_set_source(ctx.cairo(), pattern);
+			cairo_pattern_destroy(pattern);
+
+			// The image, cut down to the viewport for 'slice'.
+			const double left = std::max(x1, tx);
+			const double top = std::max(y1, ty);
+			const double right = std::min(x1 + w, tx + iw * sx);
+			const double bottom = std::min(y1 + h, ty + ih * sy);
+			cairo_new_path(ctx.cairo());
+			cairo_rectangle(ctx.cairo(), left, top, right - left, bottom - top);
+			ctx.add_filter_bounds();
+			ctx.fill();
+		}
+
+		void image_element::handle_clip_render(render_context& ctx) const
+		{
+			// Only shapes and text contribute to a clip path.
+		}
+	}
+}
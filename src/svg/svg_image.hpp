@@ -0,0 +1,168 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <cairo.h>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "svg_element.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// A decoded bitmap, premultiplied ARGB32. Shared by every image element 
+		// whose data decoded to it, so mustn't be modified.
+		class decoded_image
+		{
+		public:
+			// Takes over the reference to surface.
+			explicit decoded_image(cairo_surface_t* surface);
+			~decoded_image();
+			cairo_surface_t* surface() const { return surface_; }
+			int width() const;
+			int height() const;
+			size_t bytes() const;
+		private:
+			decoded_image(const decoded_image&);
+			void operator=(const decoded_image&);
+			cairo_surface_t* surface_;
+		};
+		typedef std::shared_ptr<const decoded_image> decoded_image_ptr;
+
+		// Process wide cache of decoded images, so identical images embedded in
+		// many documents, e.g. the same logo in every icon of a set, are only 
+		// decoded once. Keyed on a hash of the encoded data with any whitespace 
+		// removed, which is kept to check hits against. Images are held until 
+		// the byte budget, which counts the encoded data too, is exceeded, then
+		// the least recently used are dropped, though documents keep theirs 
+		// alive.
+		//
+		// Thread-safe. If several threads ask for the same image at once only 
+		// one of them decodes it.
+		class image_cache
+		{
+		public:
+			static image_cache& instance();
+
+			// Decodes the base64 text of a data URI, "data:image/png;base64,..." 
+			// with everything up to the comma removed. Returns nullptr for data
+			// which isn't a PNG image.
+			decoded_image_ptr get_base64(const char* p, size_t n);
+
+			void set_max_bytes(size_t max_bytes);
+			void clear();
+
+			struct stats
+			{
+				stats() : hits(0), misses(0), failures(0), evictions(0), entries(0), bytes(0), 
+					encoded_bytes(0), base64_seconds(0), compressed_bytes(0), png_seconds(0) {}
+				uint64_t hits;
+				uint64_t misses;
+				uint64_t failures;
+				uint64_t evictions;
+				size_t entries;
+				size_t bytes;
+				// Base64 text decoded and the time taken, for throughput.
+				uint64_t encoded_bytes;
+				double base64_seconds;
+				// PNG data decoded and the time taken.
+				uint64_t compressed_bytes;
+				double png_seconds;
+			};
+			stats get_stats() const;
+		private:
+			explicit image_cache(size_t max_bytes);
+			image_cache(const image_cache&);
+			void operator=(const image_cache&);
+
+			struct key
+			{
+				key(uint64_t h, size_t s) : hash(h), size(s) {}
+				bool operator<(const key& other) const {
+					return hash < other.hash || (hash == other.hash && size < other.size);
+				}
+				uint64_t hash;
+				size_t size;
+			};
+
+			struct entry
+			{
+				// The base64 text without whitespace, hits are checked against it in
+				// case of a collision on the key.
+				std::string encoded;
+				decoded_image_ptr img;
+				std::list<key>::iterator lru;
+			};
+
+			decoded_image_ptr decode(const char* p, size_t n);
+			// Caller must hold the lock.
+			void evict();
+
+			mutable std::mutex mutex_;
+			size_t max_bytes_;
+			std::map<key, entry> entries_;
+			// Most recently used at the front.
+			std::list<key> lru_;
+			struct pending_entry
+			{
+				std::string encoded;
+				std::shared_future<decoded_image_ptr> result;
+			};
+			std::map<key, pending_entry> pending_;
+			stats stats_;
+		};
+
+		// <image>, only for images embedded as base64 PNG data URIs. 
+		class image_element : public element
+		{
+		public:
+			image_element(element* parent, const boost::property_tree::ptree& pt);
+			virtual ~image_element();
+		private:
+			DISALLOW_COPY_ASSIGN_AND_DEFAULT(image_element);
+			void handle_render(render_context& ctx) const override;
+			void handle_clip_render(render_context& ctx) const override;
+			size_t handle_node_size() const override { return sizeof(*this); }
+			void handle_memory_usage(memory_report* mr) const override;
+
+			decoded_image_ptr image_;
+			// Whether width/height were given, if not the image's own size is used.
+			bool has_width_;
+			bool has_height_;
+			// preserveAspectRatio, as fractions of the spare space to put to the 
+			// left of and above the image. Negative for 'none'.
+			double align_x_;
+			double align_y_;
+			bool slice_;
+		};
+	}
+}
@@ -0,0 +1,512 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+
+#include "asserts.hpp"
+#include "svg_marker.hpp"
+#include "svg_parse.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			// Images are kept for scales this many steps per device pixel apart, 
+			// close enough that drawing one at a scale which rounds to it doesn't 
+			// show.
+			const double marker_scale_steps = 64.0;
+			// Images kept per marker, for different scales.
+			const size_t marker_image_cache_size = 8;
+			// Markers larger than this, in device pixels, are drawn from their 
+			// children, the image would cost more than it saves.
+			const double marker_max_image_size = 512.0;
+
+			struct path_vertex
+			{
+				path_vertex(double xx, double yy) 
+					: x(xx), y(yy), in_x(0), in_y(0), out_x(0), out_y(0), has_in(false), has_out(false) 
+				{}
+				double x;
+				double y;
+				double in_x;
+				double in_y;
+				double out_x;
+				double out_y;
+				bool has_in;
+				bool has_out;
+			};
+
+			bool is_zero(double x, double y)
+			{
+				return x == 0 && y == 0;
+			}
+
+			// Ends the current segment at (x, y), leaving the last vertex in the 
+			// direction (out_x, out_y) and arriving in the direction (in_x, in_y).
+			void add_segment(std::vector<path_vertex>* pv, double x, double y, double out_x, double out_y, double in_x, double in_y)
+			{
+				path_vertex& last = pv->back();
+				last.out_x = out_x;
+				last.out_y = out_y;
+				last.has_out = true;
+				pv->emplace_back(x, y);
+				pv->back().in_x = in_x;
+				pv->back().in_y = in_y;
+				pv->back().has_in = true;
+			}
+
+			double parse_number(const std::string& s, double def)
+			{
+				try {
+					return boost::lexical_cast<double>(s);
+				} catch(boost::bad_lexical_cast&) {
+					LOG_WARN("Bad marker attribute value: " << s);
+				}
+				return def;
+			}
+
+			// An orient angle, in degrees unless given in rad, grad or turn, 
+			// returned in radians.
+			double parse_angle(const std::string& s)
+			{
+				const size_t n = s.find_first_not_of("+-.0123456789eE");
+				const double value = parse_number(s.substr(0, n), 0.0);
+				const std::string units = n == std::string::npos ? std::string() : s.substr(n);
+				if(units == "rad") {
+					return value;
+				} else if(units == "grad") {
+					return value * M_PI / 200.0;
+				} else if(units == "turn") {
+					return value * 2.0 * M_PI;
+				} else if(!units.empty() && units != "deg") {
+					LOG_WARN("Unknown marker orient units: " << s);
+				}
+				return value * M_PI / 180.0;
+			}
+		}
+
+		void path_marker_vertices(cairo_t* cairo, std::vector<marker_vertex>* vertices)
+		{
+			cairo_path_t* path = cairo_copy_path(cairo);
+			if(path->status != CAIRO_STATUS_SUCCESS) {
+				cairo_path_destroy(path);
+				return;
+			}
+			std::vector<path_vertex> pv;
+			// Index in pv of the current subpath's first vertex.
+			size_t subpath = 0;
+			double cx = 0, cy = 0;
+			bool closed = false;
+			for(int i = 0; i < path->num_data; i += path->data[i].header.length) {
+				const cairo_path_data_t* d = &path->data[i];
+				const bool was_closed = closed;
+				closed = false;
+				switch(d->header.type) {
+					case CAIRO_PATH_MOVE_TO:
+						// cairo moves back to the start of a subpath after closing it,
+						// that's only a vertex if something follows.
+						if(was_closed && i + d->header.length >= path->num_data) {
+							break;
+						}
+						subpath = pv.size();
+						cx = d[1].point.x;
+						cy = d[1].point.y;
+						pv.emplace_back(cx, cy);
+						break;
+					case CAIRO_PATH_LINE_TO: {
+						const double x = d[1].point.x;
+						const double y = d[1].point.y;
+						add_segment(&pv, x, y, x - cx, y - cy, x - cx, y - cy);
+						cx = x;
+						cy = y;
+						break;
+					}
+					case CAIRO_PATH_CURVE_TO: {
+						const double x1 = d[1].point.x, y1 = d[1].point.y;
+						const double x2 = d[2].point.x, y2 = d[2].point.y;
+						const double x3 = d[3].point.x, y3 = d[3].point.y;
+						// A control point on an end point leaves the tangent there to
+						// the next point along.
+						double out_x = x1 - cx, out_y = y1 - cy;
+						if(is_zero(out_x, out_y)) {
+							out_x = x2 - cx;
+							out_y = y2 - cy;
+							if(is_zero(out_x, out_y)) {
+								out_x = x3 - cx;
+								out_y = y3 - cy;
+							}
+						}
+						double in_x = x3 - x2, in_y = y3 - y2;
+						if(is_zero(in_x, in_y)) {
+							in_x = x3 - x1;
+							in_y = y3 - y1;
+							if(is_zero(in_x, in_y)) {
+								in_x = x3 - cx;
+								in_y = y3 - cy;
+							}
+						}
+						add_segment(&pv, x3, y3, out_x, out_y, in_x, in_y);
+						cx = x3;
+						cy = y3;
+						break;
+					}
+					case CAIRO_PATH_CLOSE_PATH: {
+						closed = true;
+						if(pv.size() <= subpath) {
+							break;
+						}
+						const double sx = pv[subpath].x;
+						const double sy = pv[subpath].y;
+						if(cx != sx || cy != sy) {
+							add_segment(&pv, sx, sy, sx - cx, sy - cy, sx - cx, sy - cy);
+						}
+						// The closing vertex carries on into the first segment, and the
+						// first vertex is arrived at from the closing one.
+						if(pv.size() - 1 > subpath) {
+							path_vertex& first = pv[subpath];
+							path_vertex& last = pv.back();
+							last.out_x = first.out_x;
+							last.out_y = first.out_y;
+							last.has_out = first.has_out;
+							first.in_x = last.in_x;
+							first.in_y = last.in_y;
+							first.has_in = last.has_in;
+						}
+						cx = sx;
+						cy = sy;
+						break;
+					}
+				}
+			}
+			cairo_path_destroy(path);
+
+			vertices->reserve(vertices->size() + pv.size());
+			for(auto& v : pv) {
+				const double a_in = std::atan2(v.in_y, v.in_x);
+				const double a_out = std::atan2(v.out_y, v.out_x);
+				double angle = 0;
+				if(v.has_in && v.has_out) {
+					double d = a_out - a_in;
+					if(d > M_PI) {
+						d -= 2.0 * M_PI;
+					} else if(d < -M_PI) {
+						d += 2.0 * M_PI;
+					}
+					angle = a_in + d / 2.0;
+				} else if(v.has_in) {
+					angle = a_in;
+				} else if(v.has_out) {
+					angle = a_out;
+				}
+				marker_vertex mv = { v.x, v.y, angle };
+				vertices->push_back(mv);
+			}
+		}
+
+		void draw_markers(render_context& ctx, const std::vector<marker_vertex>& vertices)
+		{
+			const marker_set* markers = ctx.markers_top();
+			if(markers == nullptr || vertices.empty()) {
+				return;
+			}
+			// Held on to, drawing a marker changes the stack.
+			const marker_set m = *markers;
+			if(m.start) {
+				m.start->draw(ctx, &vertices.front(), 1, true);
+			}
+			if(m.mid && vertices.size() > 2) {
+				m.mid->draw(ctx, &vertices[1], vertices.size() - 2, false);
+			}
+			if(m.end) {
+				m.end->draw(ctx, &vertices.back(), 1, false);
+			}
+		}
+
+		marker_element::marker_element(element* parent, const ptree& pt)
+			: container(parent, pt),
+			  ref_x_(0),
+			  ref_y_(0),
+			  marker_width_(3.0),
+			  marker_height_(3.0),
+			  stroke_width_units_(true),
+			  orient_auto_(false),
+			  orient_reverse_start_(false),
+			  angle_(0),
+			  clip_overflow_(true),
+			  align_x_(0.5),
+			  align_y_(0.5),
+			  slice_(false)
+		{
+			auto attributes = pt.get_child_optional("<xmlattr>");
+			if(!attributes) {
+				return;
+			}
+			auto ref_x = attributes->get_child_optional("refX");
+			if(ref_x) {
+				ref_x_ = svg_length(ref_x->data()).value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			}
+			auto ref_y = attributes->get_child_optional("refY");
+			if(ref_y) {
+				ref_y_ = svg_length(ref_y->data()).value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			}
+			auto width = attributes->get_child_optional("markerWidth");
+			if(width) {
+				marker_width_ = svg_length(width->data()).value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			}
+			auto height = attributes->get_child_optional("markerHeight");
+			if(height) {
+				marker_height_ = svg_length(height->data()).value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			}
+			auto units = attributes->get_child_optional("markerUnits");
+			if(units) {
+				stroke_width_units_ = units->data() != "userSpaceOnUse";
+			}
+			auto orient = attributes->get_child_optional("orient");
+			if(orient) {
+				if(orient->data() == "auto") {
+					orient_auto_ = true;
+				} else if(orient->data() == "auto-start-reverse") {
+					orient_auto_ = true;
+					orient_reverse_start_ = true;
+				} else {
+					angle_ = parse_angle(orient->data());
+				}
+			}
+			// Markers clip to their viewport unless told otherwise.
+			auto overflow = attributes->get_child_optional("overflow");
+			if(overflow) {
+				clip_overflow_ = overflow->data() != "visible" && overflow->data() != "auto";
+			}
+			auto par = attributes->get_child_optional("preserveAspectRatio");
+			if(par) {
+				std::vector<std::string> buf = geometry::split(par->data(), " ");
+				const std::string align = buf.empty() ? std::string() : buf[0];
+				if(align == "none") {
+					align_x_ = align_y_ = -1.0;
+				} else if(align.size() == 8 && align[0] == 'x' && align[4] == 'Y') {
+					const std::string ax = align.substr(1, 3);
+					const std::string ay = align.substr(5, 3);
+					align_x_ = ax == "Min" ? 0.0 : ax == "Max" ? 1.0 : 0.5;
+					align_y_ = ay == "Min" ? 0.0 : ay == "Max" ? 1.0 : 0.5;
+				} else {
+					LOG_WARN("Unknown preserveAspectRatio value on marker: " << par->data());
+				}
+				slice_ = buf.size() > 1 && buf[1] == "slice";
+			}
+		}
+
+		marker_element::~marker_element()
+		{
+			for(auto& im : images_) {
+				cairo_surface_destroy(im.surface);
+			}
+		}
+
+		cairo_matrix_t marker_element::view_box_matrix() const
+		{
+			cairo_matrix_t m;
+			cairo_matrix_init_identity(&m);
+			const view_box_rect& vb = view_box();
+			if(vb.w() <= 0 || vb.h() <= 0) {
+				return m;
+			}
+			double sx = marker_width_ / vb.w();
+			double sy = marker_height_ / vb.h();
+			double tx = 0, ty = 0;
+			if(align_x_ >= 0) {
+				sx = sy = slice_ ? std::max(sx, sy) : std::min(sx, sy);
+				tx = align_x_ * (marker_width_ - vb.w() * sx);
+				ty = align_y_ * (marker_height_ - vb.h() * sy);
+			}
+			cairo_matrix_init(&m, sx, 0, 0, sy, tx - vb.x() * sx, ty - vb.y() * sy);
+			return m;
+		}
+
+		void marker_element::draw_content(render_context& ctx) const
+		{
+			// Start from the document defaults, as for the root element, and none
+			// of the markers of the element being marked.
+			parse::render_enter(ctx);
+			ctx.markers_push(marker_set());
+			try {
+				attribute_manager pp1(pp(), ctx);
+				for(auto& e : elements()) {
+					e->render(ctx);
+				}
+			} catch(...) {
+				ctx.markers_pop();
+				parse::render_leave(ctx);
+				throw;
+			}
+			ctx.markers_pop();
+			parse::render_leave(ctx);
+		}
+
+		cairo_surface_t* marker_element::build_image(render_context& ctx, double scale, int pad) const
+		{
+			const int w = static_cast<int>(std::ceil(marker_width_ * scale)) + 2 * pad;
+			const int h = static_cast<int>(std::ceil(marker_height_ * scale)) + 2 * pad;
+			cairo_surface_t* image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+			cairo_t* cairo = cairo_create(image);
+			{
+				render_context image_ctx(cairo, w, h);
+				image_ctx.set_quality(ctx.quality());
+				image_ctx.set_filter_threads(ctx.filter_threads());
+				// As drawn straight onto ctx, the marked element's shape-rendering 
+				// and image-rendering carry on into the content.
+				cairo_set_antialias(cairo, cairo_get_antialias(ctx.cairo()));
+				cairo_set_tolerance(cairo, cairo_get_tolerance(ctx.cairo()));
+				image_ctx.image_hint_push(ctx.image_hint());
+				cairo_translate(cairo, pad, pad);
+				cairo_scale(cairo, scale, scale);
+				cairo_rectangle(cairo, 0, 0, marker_width_, marker_height_);
+				cairo_clip(cairo);
+				const cairo_matrix_t vb = view_box_matrix();
+				cairo_transform(cairo, &vb);
+				draw_content(image_ctx);
+			}
+			cairo_destroy(cairo);
+			return image;
+		}
+
+		void marker_element::draw(render_context& ctx, const marker_vertex* vertices, size_t n, bool at_start) const
+		{
+			cairo_t* cairo = ctx.cairo();
+			const double units = stroke_width_units_ ? cairo_get_line_width(cairo) : 1.0;
+			// A zero sized viewport turns the marker off.
+			if(n == 0 || units <= 0 || marker_width_ <= 0 || marker_height_ <= 0) {
+				return;
+			}
+			ctx.flush();
+			cairo_new_path(cairo);
+
+			// The reference point, in viewport units, goes on the vertex.
+			const cairo_matrix_t vb = view_box_matrix();
+			double rx = ref_x_, ry = ref_y_;
+			cairo_matrix_transform_point(&vb, &rx, &ry);
+			const double reverse = at_start && orient_reverse_start_ ? M_PI : 0.0;
+			auto place = [&](const marker_vertex& v) {
+				cairo_translate(cairo, v.x, v.y);
+				cairo_rotate(cairo, orient_auto_ ? v.angle + reverse : angle_);
+				cairo_scale(cairo, units, units);
+				cairo_translate(cairo, -rx, -ry);
+			};
+
+			// Device pixels per viewport unit, which the image is drawn at.
+			cairo_matrix_t ctm;
+			cairo_get_matrix(cairo, &ctm);
+			const double scale = units * std::sqrt(std::max(ctm.xx*ctm.xx + ctm.yx*ctm.yx, ctm.xy*ctm.xy + ctm.yy*ctm.yy));
+			const int key = static_cast<int>(std::lround(scale * marker_scale_steps));
+			// Recordings have to be replayable at any size.
+			if(ctx.recorder() != nullptr || !clip_overflow_ || key <= 0 
+				|| std::max(marker_width_, marker_height_) * scale > marker_max_image_size) {
+				for(size_t i = 0; i != n; ++i) {
+					ctx.save();
+					place(vertices[i]);
+					if(clip_overflow_) {
+						cairo_rectangle(cairo, 0, 0, marker_width_, marker_height_);
+						ctx.clip();
+					}
+					cairo_transform(cairo, &vb);
+					draw_content(ctx);
+					ctx.restore();
+				}
+				ctx.count_markers(n);
+				return;
+			}
+
+			const cairo_antialias_t antialias = cairo_get_antialias(cairo);
+			const RenderingHint image_hint = ctx.image_hint();
+			cairo_surface_t* image = nullptr;
+			{
+				std::lock_guard<std::mutex> lock(images_mutex_);
+				for(auto it = images_.begin(); it != images_.end(); ++it) {
+					if(it->key == key && it->quality == ctx.quality() && it->antialias == antialias && it->image_hint == image_hint) {
+						images_.splice(images_.begin(), images_, it);
+						image = cairo_surface_reference(it->surface);
+						break;
+					}
+				}
+			}
+			const double image_scale = key / marker_scale_steps;
+			// A transparent border so the edges are filtered smoothly.
+			const int pad = 1;
+			if(image == nullptr) {
+				// Built outside the lock, if another thread builds the same one the
+				// first to finish is kept.
+				image = build_image(ctx, image_scale, pad);
+				ctx.count_marker_image();
+				std::lock_guard<std::mutex> lock(images_mutex_);
+				cached_image ci = { key, ctx.quality(), antialias, image_hint, cairo_surface_reference(image) };
+				images_.push_front(ci);
+				while(images_.size() > marker_image_cache_size) {
+					cairo_surface_destroy(images_.back().surface);
+					images_.pop_back();
+				}
+			}
+
+			cairo_pattern_t* pattern = cairo_pattern_create_for_surface(image);
+			cairo_pattern_set_filter(pattern, ctx.image_filter());
+			cairo_matrix_t pm;
+			cairo_matrix_init_translate(&pm, pad, pad);
+			cairo_matrix_scale(&pm, image_scale, image_scale);
+			cairo_pattern_set_matrix(pattern, &pm);
+			for(size_t i = 0; i != n; ++i) {
+				cairo_save(cairo);
+				place(vertices[i]);
+				cairo_set_source(cairo, pattern);
+				cairo_rectangle(cairo, 0, 0, marker_width_, marker_height_);
+				cairo_fill(cairo);
+				cairo_restore(cairo);
+			}
+			cairo_pattern_destroy(pattern);
+			cairo_surface_destroy(image);
+			ctx.count_markers(n);
+		}
+
+		void marker_element::handle_memory_usage(memory_report* mr) const
+		{
+			container::handle_memory_usage(mr);
+			std::lock_guard<std::mutex> lock(images_mutex_);
+			for(auto& im : images_) {
+				mr->images += cairo_image_surface_get_stride(im.surface) * cairo_image_surface_get_height(im.surface);
+			}
+		}
+
+		void marker_element::handle_render(render_context& ctx) const
+		{
+			// Only drawn through the marker properties of other elements.
+		}
+
+		void marker_element::handle_clip_render(render_context& ctx) const
+		{
+		}
+	}
+}
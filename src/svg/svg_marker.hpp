@@ -0,0 +1,129 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <cairo.h>
+#include <list>
+#include <mutex>
+#include <vector>
+
+#include "svg_container.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Where a marker goes on a path, in the user space of the element the path
+		// belongs to. angle is the direction of the path at the point, in radians,
+		// bisecting the incoming and outgoing directions at a corner.
+		struct marker_vertex
+		{
+			double x;
+			double y;
+			double angle;
+		};
+
+		// Gets the vertices of cairo's current path, in the current user space, 
+		// leaving the path alone. Each subpath's start and each segment's end are
+		// vertices, closing a subpath adds one back at its start unless the path
+		// is already there.
+		void path_marker_vertices(cairo_t* cairo, std::vector<marker_vertex>* vertices);
+
+		// Draws the markers on top of the context's marker stack at vertices, 
+		// which are in the current user space.
+		void draw_markers(render_context& ctx, const std::vector<marker_vertex>& vertices);
+
+		// <marker>. The marker is drawn once into an image at the device scale it
+		// is used at and then painted at each vertex, rather than its children
+		// being drawn again for each. Images are kept for a few scales.
+		//
+		// Recordings, markers with overflow="visible" and markers too large to be
+		// worth the image draw the children at each vertex instead. The children 
+		// inherit properties from the document defaults and the marker, not from 
+		// the element the marker is on, and draw no markers unless they set them.
+		class marker_element : public container
+		{
+		public:
+			marker_element(element* parent, const boost::property_tree::ptree& pt);
+			virtual ~marker_element();
+
+			// Draws the marker at each of n vertices, in the current user space. 
+			// at_start is set for marker-start, where orient="auto-start-reverse"
+			// turns the marker around.
+			void draw(render_context& ctx, const marker_vertex* vertices, size_t n, bool at_start) const;
+		private:
+			DISALLOW_COPY_ASSIGN_AND_DEFAULT(marker_element);
+			size_t handle_node_size() const override { return sizeof(*this); }
+			bool handle_is_definition() const override { return true; }
+			void handle_optimise_tree(tree_report* report) override {}
+			void handle_render(render_context& ctx) const override;
+			void handle_clip_render(render_context& ctx) const override;
+			void handle_memory_usage(memory_report* mr) const override;
+
+			// Maps the marker's content to the viewport, markerWidth by markerHeight
+			// with its origin at the top left.
+			cairo_matrix_t view_box_matrix() const;
+			// Draws the content into the viewport at the current transform.
+			void draw_content(render_context& ctx) const;
+			// The content drawn at scale device pixels per viewport unit, with a
+			// border of pad pixels, using the quality, antialiasing and image hint 
+			// in effect on ctx.
+			cairo_surface_t* build_image(render_context& ctx, double scale, int pad) const;
+
+			double ref_x_;
+			double ref_y_;
+			double marker_width_;
+			double marker_height_;
+			// Whether markerUnits="strokeWidth", scaling the viewport by the stroke
+			// width of the element the marker is on.
+			bool stroke_width_units_;
+			// orient="auto" or "auto-start-reverse", otherwise angle_ is used.
+			bool orient_auto_;
+			bool orient_reverse_start_;
+			// In radians.
+			double angle_;
+			bool clip_overflow_;
+			// preserveAspectRatio for the viewBox, as fractions of the spare space
+			// to leave before the content, or negative for "none".
+			double align_x_;
+			double align_y_;
+			bool slice_;
+
+			// An image is only reused for the same scale and the same settings it
+			// was drawn with. The tolerance follows from quality and antialias.
+			struct cached_image
+			{
+				int key;
+				RenderQuality quality;
+				cairo_antialias_t antialias;
+				RenderingHint image_hint;
+				cairo_surface_t* surface;
+			};
+			mutable std::mutex images_mutex_;
+			// Most recently used first.
+			mutable std::list<cached_image> images_;
+		};
+	}
+}
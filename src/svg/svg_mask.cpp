@@ -0,0 +1,232 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <boost/lexical_cast.hpp>
+#include <cmath>
+#include <limits>
+
+#include "asserts.hpp"
+#include "svg_filter_kernels.hpp"
+#include "svg_mask.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			// A mask region length, percentages are returned as fractions.
+			double parse_region_length(const std::string& s, double def)
+			{
+				const bool percent = !s.empty() && s.back() == '%';
+				try {
+					const double value = boost::lexical_cast<double>(percent ? s.substr(0, s.size() - 1) : s);
+					return percent ? value / 100.0 : value;
+				} catch(boost::bad_lexical_cast&) {
+					LOG_WARN("Bad mask region length: " << s);
+				}
+				return def;
+			}
+
+			// Converts an ARGB32 group to an A8 mask of its luminance, in the same
+			// place. Takes over the reference to group.
+			cairo_pattern_t* luminance_mask(cairo_pattern_t* group)
+			{
+				cairo_surface_t* surface = nullptr;
+				cairo_pattern_get_surface(group, &surface);
+				if(surface == nullptr 
+					|| cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE 
+					|| cairo_image_surface_get_format(surface) != CAIRO_FORMAT_ARGB32) {
+					LOG_WARN("Luminance masks need an image surface, using the mask's alpha instead.");
+					return group;
+				}
+				cairo_surface_flush(surface);
+				const int width = cairo_image_surface_get_width(surface);
+				const int height = cairo_image_surface_get_height(surface);
+				cairo_surface_t* alpha = cairo_image_surface_create(CAIRO_FORMAT_A8, width, height);
+				cairo_surface_flush(alpha);
+				luminance_to_alpha(cairo_image_surface_get_data(surface), cairo_image_surface_get_stride(surface),
+					cairo_image_surface_get_data(alpha), cairo_image_surface_get_stride(alpha), width, height);
+				cairo_surface_mark_dirty(alpha);
+
+				double ox, oy;
+				cairo_surface_get_device_offset(surface, &ox, &oy);
+				cairo_surface_set_device_offset(alpha, ox, oy);
+				cairo_pattern_t* mask = cairo_pattern_create_for_surface(alpha);
+				cairo_matrix_t m;
+				cairo_pattern_get_matrix(group, &m);
+				cairo_pattern_set_matrix(mask, &m);
+				cairo_surface_destroy(alpha);
+				cairo_pattern_destroy(group);
+				return mask;
+			}
+		}
+
+		mask_element::mask_element(element* parent, const ptree& pt)
+			: container(parent, pt),
+			  user_space_units_(false),
+			  luminance_(true)
+		{
+			region_[0] = region_[1] = -0.1;
+			region_[2] = region_[3] = 1.2;
+
+			auto attributes = pt.get_child_optional("<xmlattr>");
+			if(!attributes) {
+				return;
+			}
+			auto units = attributes->get_child_optional("maskUnits");
+			if(units && units->data() == "userSpaceOnUse") {
+				user_space_units_ = true;
+				// The defaults are relative to the viewport, which isn't known here, 
+				// so anything not given is as good as unlimited.
+				region_[0] = region_[1] = -1e6;
+				region_[2] = region_[3] = 2e6;
+			}
+			auto content_units = attributes->get_child_optional("maskContentUnits");
+			if(content_units && content_units->data() == "objectBoundingBox") {
+				LOG_WARN("maskContentUnits=\"objectBoundingBox\" isn't supported, using user space.");
+			}
+			auto type = attributes->get_child_optional("mask-type");
+			if(type) {
+				luminance_ = type->data() != "alpha";
+			}
+			const char* names[4] = { "x", "y", "width", "height" };
+			for(int n = 0; n != 4; ++n) {
+				auto value = attributes->get_child_optional(names[n]);
+				if(value) {
+					if(user_space_units_ && !value->data().empty() && value->data().back() == '%') {
+						LOG_WARN("Percentages in a userSpaceOnUse mask region aren't supported: " << value->data());
+						continue;
+					}
+					region_[n] = parse_region_length(value->data(), region_[n]);
+				}
+			}
+		}
+
+		mask_element::~mask_element()
+		{
+		}
+
+		bool mask_element::device_region(render_context& ctx, cairo_pattern_t* content, double* x1, double* y1, double* x2, double* y2) const
+		{
+			if(user_space_units_) {
+				double xs[4] = { region_[0], region_[0] + region_[2], region_[0], region_[0] + region_[2] };
+				double ys[4] = { region_[1], region_[1], region_[1] + region_[3], region_[1] + region_[3] };
+				*x1 = *y1 = std::numeric_limits<double>::max();
+				*x2 = *y2 = -std::numeric_limits<double>::max();
+				for(int n = 0; n != 4; ++n) {
+					cairo_user_to_device(ctx.cairo(), &xs[n], &ys[n]);
+					*x1 = std::min(*x1, xs[n]);
+					*y1 = std::min(*y1, ys[n]);
+					*x2 = std::max(*x2, xs[n]);
+					*y2 = std::max(*y2, ys[n]);
+				}
+				return region_[2] > 0 && region_[3] > 0;
+			}
+
+			// What the element drew stands in for its bounding box.
+			cairo_surface_t* surface = nullptr;
+			cairo_pattern_get_surface(content, &surface);
+			int bx1, by1, bx2, by2;
+			if(surface == nullptr || cairo_surface_get_type(surface) != CAIRO_SURFACE_TYPE_IMAGE) {
+				cairo_clip_extents(ctx.cairo(), x1, y1, x2, y2);
+				cairo_user_to_device(ctx.cairo(), x1, y1);
+				cairo_user_to_device(ctx.cairo(), x2, y2);
+				return *x2 > *x1 && *y2 > *y1;
+			}
+			cairo_surface_flush(surface);
+			if(!opaque_bounds(cairo_image_surface_get_data(surface), cairo_image_surface_get_width(surface),
+				cairo_image_surface_get_height(surface), cairo_image_surface_get_stride(surface), &bx1, &by1, &bx2, &by2)) {
+				return false;
+			}
+			double ox, oy;
+			cairo_surface_get_device_offset(surface, &ox, &oy);
+			const double w = bx2 - bx1;
+			const double h = by2 - by1;
+			*x1 = bx1 - ox + region_[0] * w;
+			*y1 = by1 - oy + region_[1] * h;
+			*x2 = *x1 + region_[2] * w;
+			*y2 = *y1 + region_[3] * h;
+			return region_[2] > 0 && region_[3] > 0;
+		}
+
+		void mask_element::apply_mask(render_context& ctx, cairo_pattern_t* content) const
+		{
+			cairo_t* cairo = ctx.cairo();
+			if(ctx.recorder() != nullptr) {
+				// Recordings have no way to hold a mask.
+				ctx.not_recordable("mask");
+				cairo_set_source(cairo, content);
+				cairo_paint(cairo);
+				cairo_pattern_destroy(content);
+				return;
+			}
+
+			double x1, y1, x2, y2;
+			if(!device_region(ctx, content, &x1, &y1, &x2, &y2)) {
+				// Nothing is drawn through an empty mask.
+				cairo_pattern_destroy(content);
+				return;
+			}
+
+			ctx.save();
+			// Clipping to the region first keeps the mask surface to its size.
+			cairo_matrix_t m;
+			cairo_get_matrix(cairo, &m);
+			cairo_identity_matrix(cairo);
+			cairo_rectangle(cairo, x1, y1, x2 - x1, y2 - y1);
+			ctx.clip();
+			cairo_set_matrix(cairo, &m);
+
+			// Alpha masks are drawn straight into A8, luminance masks need the colour.
+			ctx.push_group(luminance_ ? CAIRO_CONTENT_COLOR_ALPHA : CAIRO_CONTENT_ALPHA);
+			pp()->apply(ctx);
+			for(auto& e : elements()) {
+				e->render(ctx);
+			}
+			pp()->clear(ctx);
+			cairo_pattern_t* mask = ctx.pop_group();
+			if(luminance_) {
+				mask = luminance_mask(mask);
+			}
+
+			cairo_set_source(cairo, content);
+			cairo_mask(cairo, mask);
+			cairo_pattern_destroy(mask);
+			cairo_pattern_destroy(content);
+			ctx.restore();
+		}
+
+		void mask_element::handle_render(render_context& ctx) const
+		{
+			// Only drawn through the mask property of other elements.
+		}
+
+		void mask_element::handle_clip_render(render_context& ctx) const
+		{
+		}
+	}
+}
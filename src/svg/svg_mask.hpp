@@ -0,0 +1,69 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include "svg_container.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// <mask>. Its children are drawn into a mask, A8 for mask-type="alpha",
+		// otherwise ARGB32 converted to an A8 luminance mask, which is then 
+		// applied to what the masked element drew with cairo_mask().
+		//
+		// With the default maskUnits="objectBoundingBox" the mask region is taken
+		// relative to the device bounds of what the element drew, which stand in
+		// for its bounding box. maskContentUnits="objectBoundingBox" isn't 
+		// supported, the content is drawn in user space. Luminance is computed in
+		// sRGB.
+		class mask_element : public container
+		{
+		public:
+			mask_element(element* parent, const boost::property_tree::ptree& pt);
+			virtual ~mask_element();
+
+			// Paints content, as returned by render_context::pop_group(), through
+			// the mask.
+			void apply_mask(render_context& ctx, cairo_pattern_t* content) const;
+		private:
+			DISALLOW_COPY_ASSIGN_AND_DEFAULT(mask_element);
+			size_t handle_node_size() const override { return sizeof(*this); }
+			bool handle_is_definition() const override { return true; }
+			void handle_optimise_tree(tree_report* report) override {}
+			void handle_render(render_context& ctx) const override;
+			void handle_clip_render(render_context& ctx) const override;
+
+			// The mask region in device space, returns false if it's empty.
+			bool device_region(render_context& ctx, cairo_pattern_t* content, double* x1, double* y1, double* x2, double* y2) const;
+
+			bool user_space_units_;
+			bool luminance_;
+			// x, y, width and height, as fractions of the bounding box or in user
+			// units, depending on user_space_units_.
+			double region_[4];
+		};
+	}
+}
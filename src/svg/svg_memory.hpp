@@ -0,0 +1,94 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Bytes held by a parsed document, by what they're used for. Objects are
+		// counted at their sizeof() and heap blocks at the size requested, so the
+		// allocator's own overhead isn't included.
+		struct memory_report
+		{
+			memory_report() 
+				: elements(0), element_nodes(0), attributes(0), path_geometry(0), 
+				  paints(0), strings(0), text(0), images(0) 
+			{}
+
+			size_t total() const { 
+				return element_nodes + attributes + path_geometry + paints + strings + text; 
+			}
+
+			// Number of elements in the tree.
+			size_t elements;
+			// The element objects, less their attribute blocks, plus child lists and
+			// transforms.
+			size_t element_nodes;
+			// The seven attribute blocks every element has and anything they own
+			// which isn't covered below.
+			size_t attributes;
+			// Normalised paths, their levels of detail and point lists.
+			size_t path_geometry;
+			size_t paints;
+			// Heap storage of ids, references and other strings.
+			size_t strings;
+			// Character data and glyph positioning lists of text elements.
+			size_t text;
+			// Pixels of decoded images and cached clip masks. Not part of total(),
+			// they're allocated by cairo, and images may be shared with other 
+			// documents through image_cache.
+			size_t images;
+
+			// Objects can be shared between elements, returns true only the first
+			// time it's called for p so they're counted once.
+			bool first_visit(const void* p) { return p != nullptr && seen_.insert(p).second; }
+		private:
+			std::set<const void*> seen_;
+		};
+
+		// Separate block shared_ptr allocates for its reference counts when
+		// constructed from a raw pointer.
+		const size_t shared_count_bytes = 2 * sizeof(void*) + 2 * sizeof(int);
+
+		// Zero when the string is small enough to be kept inside the object.
+		inline size_t string_heap_bytes(const std::string& s)
+		{
+			const char* obj = reinterpret_cast<const char*>(&s);
+			const char* p = s.data();
+			return p >= obj && p < obj + sizeof(s) ? 0 : s.capacity() + 1;
+		}
+
+		template<typename T>
+		size_t vector_heap_bytes(const std::vector<T>& v)
+		{
+			return v.capacity() * sizeof(T);
+		}
+	}
+}
@@ -0,0 +1,1380 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <ostream>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <cairo.h>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "svg_optimise.hpp"
+#include "svg_transform.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			const char* const editor_namespaces[] = {
+				"inkscape", "sodipodi", "sketch", "rdf", "cc", "dc", "serif", "i", "x", "graph",
+			};
+
+			// Properties inherited by children, with their initial values where
+			// there's a single way of writing it.
+			struct property_default
+			{
+				const char* name;
+				const char* value;
+			};
+			const property_default inherited_properties[] = {
+				{ "clip-rule", "nonzero" },
+				{ "color", nullptr },
+				{ "color-interpolation", "sRGB" },
+				{ "color-rendering", "auto" },
+				{ "direction", "ltr" },
+				{ "fill", "black" },
+				{ "fill-opacity", "1" },
+				{ "fill-rule", "nonzero" },
+				{ "font-family", nullptr },
+				{ "font-size", "medium" },
+				{ "font-style", "normal" },
+				{ "font-variant", "normal" },
+				{ "font-weight", "normal" },
+				{ "image-rendering", "auto" },
+				{ "letter-spacing", "normal" },
+				{ "marker-end", "none" },
+				{ "marker-mid", "none" },
+				{ "marker-start", "none" },
+				{ "shape-rendering", "auto" },
+				{ "stroke", "none" },
+				{ "stroke-dasharray", "none" },
+				{ "stroke-dashoffset", "0" },
+				{ "stroke-linecap", "butt" },
+				{ "stroke-linejoin", "miter" },
+				{ "stroke-miterlimit", "4" },
+				{ "stroke-opacity", "1" },
+				{ "stroke-width", "1" },
+				{ "text-anchor", "start" },
+				{ "text-rendering", "auto" },
+				{ "visibility", "visible" },
+				{ "word-spacing", "normal" },
+				{ "writing-mode", "lr-tb" },
+			};
+
+			// Attributes that aren't inherited, with the value they have when left out.
+			struct attribute_default
+			{
+				const char* element;
+				const char* name;
+				const char* value;
+			};
+			const attribute_default attribute_defaults[] = {
+				{ nullptr, "opacity", "1" },
+				{ nullptr, "display", "inline" },
+				{ "rect", "x", "0" },
+				{ "rect", "y", "0" },
+				{ "use", "x", "0" },
+				{ "use", "y", "0" },
+				{ "image", "x", "0" },
+				{ "image", "y", "0" },
+				{ "circle", "cx", "0" },
+				{ "circle", "cy", "0" },
+				{ "ellipse", "cx", "0" },
+				{ "ellipse", "cy", "0" },
+				{ "line", "x1", "0" },
+				{ "line", "y1", "0" },
+				{ "line", "x2", "0" },
+				{ "line", "y2", "0" },
+			};
+
+			const char* const geometry_attributes[] = {
+				"x", "y", "width", "height", "rx", "ry", "cx", "cy", "r", "x1", "y1", "x2", "y2",
+			};
+
+			// Elements that are only drawn through a reference, or whose content
+			// takes its inherited properties from the referring element.
+			const char* const definition_elements[] = {
+				"defs", "symbol", "clipPath", "mask", "marker", "pattern", "linearGradient", "radialGradient", "filter",
+			};
+
+			const char* const drawn_elements[] = {
+				"g", "path", "rect", "circle", "ellipse", "line", "polyline", "polygon",
+			};
+
+			template<size_t N>
+			bool in_list(const char* const (&list)[N], const std::string& name)
+			{
+				for(auto s : list) {
+					if(name == s) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool is_element(const std::string& name)
+			{
+				return !name.empty() && name[0] != '<';
+			}
+
+			bool is_inherited(const std::string& name)
+			{
+				for(auto& p : inherited_properties) {
+					if(name == p.name) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool is_editor_name(const std::string& name)
+			{
+				for(auto ns : editor_namespaces) {
+					const std::string prefix = std::string(ns) + ":";
+					if(name.compare(0, prefix.size(), prefix) == 0 || name == std::string("xmlns:") + ns) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			bool keeps_text(const std::string& name)
+			{
+				return name == "text" || name == "tspan" || name == "textPath" || name == "title" 
+					|| name == "desc" || name == "style" || name == "script";
+			}
+
+			const std::string* get_attribute(const ptree& node, const std::string& name)
+			{
+				auto attrs = node.get_child_optional("<xmlattr>");
+				if(!attrs) {
+					return nullptr;
+				}
+				auto it = attrs->find(name);
+				return it == attrs->not_found() ? nullptr : &it->second.data();
+			}
+
+			void set_attribute(ptree& node, const std::string& name, const std::string& value)
+			{
+				auto attrs = node.get_child_optional("<xmlattr>");
+				if(!attrs) {
+					node.push_front(std::make_pair("<xmlattr>", ptree()));
+					attrs = node.get_child_optional("<xmlattr>");
+				}
+				auto it = attrs->find(name);
+				if(it == attrs->not_found()) {
+					attrs->push_back(std::make_pair(name, ptree(value)));
+				} else {
+					it->second.data() = value;
+				}
+			}
+
+			bool remove_attribute(ptree& node, const std::string& name)
+			{
+				auto attrs = node.get_child_optional("<xmlattr>");
+				return attrs && attrs->erase(name) > 0;
+			}
+
+			bool has_attributes(const ptree& node)
+			{
+				auto attrs = node.get_child_optional("<xmlattr>");
+				return attrs && !attrs->empty();
+			}
+
+			// Whether the element, or anything in it, has an id, so may be drawn 
+			// through a use as well as in place.
+			bool has_id_within(const ptree& node)
+			{
+				if(get_attribute(node, "id") != nullptr) {
+					return true;
+				}
+				for(auto& c : node) {
+					if(is_element(c.first) && has_id_within(c.second)) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// Declarations from a style attribute.
+			std::map<std::string, std::string> parse_style(const std::string& style)
+			{
+				std::map<std::string, std::string> res;
+				std::istringstream is(style);
+				std::string decl;
+				while(std::getline(is, decl, ';')) {
+					auto colon = decl.find(':');
+					if(colon == std::string::npos) {
+						continue;
+					}
+					auto trim = [](std::string s) {
+						s.erase(0, s.find_first_not_of(" \t\r\n"));
+						s.erase(s.find_last_not_of(" \t\r\n") + 1);
+						return s;
+					};
+					res[trim(decl.substr(0, colon))] = trim(decl.substr(colon + 1));
+				}
+				return res;
+			}
+
+			bool parse_plain_number(const std::string& s, double* v)
+			{
+				if(s.empty()) {
+					return false;
+				}
+				char* end = nullptr;
+				*v = std::strtod(s.c_str(), &end);
+				return end == s.c_str() + s.size();
+			}
+
+			double round_to(double v, int decimals)
+			{
+				const double scale = std::pow(10.0, decimals);
+				return std::round(v * scale) / scale;
+			}
+
+			// Shortest form of v with at most decimals places, no trailing zeros and 
+			// no leading zero, e.g. -0.50 becomes -.5
+			std::string format_number(double v, int decimals)
+			{
+				char buf[64];
+				std::snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+				std::string s(buf);
+				if(s.find('.') != std::string::npos) {
+					s.erase(s.find_last_not_of('0') + 1);
+					if(s.back() == '.') {
+						s.pop_back();
+					}
+				}
+				if(s == "-0") {
+					s = "0";
+				}
+				if(s.compare(0, 2, "0.") == 0) {
+					s.erase(0, 1);
+				} else if(s.compare(0, 3, "-0.") == 0) {
+					s.erase(1, 1);
+				}
+				return s;
+			}
+
+			// Whether next can follow prev in a list of numbers without a separator.
+			bool needs_separator(const std::string& prev, const std::string& next)
+			{
+				if(next[0] == '-') {
+					return false;
+				}
+				return !(next[0] == '.' && prev.find('.') != std::string::npos);
+			}
+
+			// Transform lists and points are split on whitespace and commas when 
+			// read back, unlike path data, so their numbers always need separating.
+			std::string join_numbers(const std::vector<std::string>& nums)
+			{
+				std::string res;
+				for(size_t n = 0; n != nums.size(); ++n) {
+					if(n != 0) {
+						res += ' ';
+					}
+					res += nums[n];
+				}
+				return res;
+			}
+
+			cairo_matrix_t parse_matrix(const std::string& s)
+			{
+				return transform::to_matrix(transform::factory(s));
+			}
+
+			bool is_identity(const cairo_matrix_t& m)
+			{
+				return m.xx == 1 && m.yx == 0 && m.xy == 0 && m.yy == 1 && m.x0 == 0 && m.y0 == 0;
+			}
+
+			// Scaling, rotation, reflection and translation only.
+			bool is_similarity(const cairo_matrix_t& m)
+			{
+				const double len1 = m.xx*m.xx + m.yx*m.yx;
+				const double len2 = m.xy*m.xy + m.yy*m.yy;
+				const double tolerance = 1e-9 * std::max(len1, len2);
+				return std::abs(m.xx*m.xy + m.yx*m.yy) <= tolerance && std::abs(len1 - len2) <= tolerance;
+			}
+
+			double matrix_scale(const cairo_matrix_t& m)
+			{
+				return std::sqrt(std::abs(m.xx*m.yy - m.yx*m.xy));
+			}
+
+			std::string matrix_to_string(const cairo_matrix_t& m, int decimals)
+			{
+				// The linear part multiplies co-ordinates so needs more places.
+				const int linear = decimals + 6;
+				auto t = [decimals](double v) { return format_number(v, decimals); };
+				auto l = [linear](double v) { return format_number(v, linear); };
+				const std::string xx = l(m.xx), yx = l(m.yx), xy = l(m.xy), yy = l(m.yy);
+				std::vector<std::string> nums;
+				if(xx == "1" && yx == "0" && xy == "0" && yy == "1") {
+					nums.emplace_back(t(m.x0));
+					if(t(m.y0) != "0") {
+						nums.emplace_back(t(m.y0));
+					}
+					return "translate(" + join_numbers(nums) + ")";
+				}
+				if(yx == "0" && xy == "0" && t(m.x0) == "0" && t(m.y0) == "0") {
+					nums.emplace_back(xx);
+					if(yy != xx) {
+						nums.emplace_back(yy);
+					}
+					return "scale(" + join_numbers(nums) + ")";
+				}
+				nums.emplace_back(xx);
+				nums.emplace_back(yx);
+				nums.emplace_back(xy);
+				nums.emplace_back(yy);
+				nums.emplace_back(t(m.x0));
+				nums.emplace_back(t(m.y0));
+				return "matrix(" + join_numbers(nums) + ")";
+			}
+
+			// A path command in absolute co-ordinates. H and V are stored as L,
+			// S as C and T as Q, with the control points they imply.
+			struct segment
+			{
+				// M, L, C, Q, A or Z
+				char type;
+				// M/L: x y. C: x1 y1 x2 y2 x y. Q: x1 y1 x y. 
+				// A: rx ry rotation large-arc sweep x y
+				double v[7];
+			};
+
+			bool parse_segments(const std::string& d, std::vector<segment>* out)
+			{
+				const char* p = d.c_str();
+				char cmd = 0;
+				double cx = 0, cy = 0, sx = 0, sy = 0;
+				// Last control point of a curve, for S and T.
+				char prev = 0;
+				double pcx = 0, pcy = 0;
+				auto skip = [&p]() {
+					while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ',') {
+						++p;
+					}
+				};
+				auto number = [&p, &skip](double* v) {
+					skip();
+					char* end = nullptr;
+					*v = std::strtod(p, &end);
+					if(end == p) {
+						return false;
+					}
+					p = end;
+					return true;
+				};
+				auto flag = [&p, &skip](double* v) {
+					skip();
+					if(*p != '0' && *p != '1') {
+						return false;
+					}
+					*v = *p++ - '0';
+					return true;
+				};
+				for(;;) {
+					skip();
+					if(*p == 0) {
+						break;
+					}
+					if(std::isalpha(static_cast<unsigned char>(*p))) {
+						cmd = *p++;
+					} else if(cmd == 0 || cmd == 'Z' || cmd == 'z') {
+						return false;
+					} else if(cmd == 'M') {
+						cmd = 'L';
+					} else if(cmd == 'm') {
+						cmd = 'l';
+					}
+					const bool rel = std::islower(static_cast<unsigned char>(cmd)) != 0;
+					const double ox = rel ? cx : 0;
+					const double oy = rel ? cy : 0;
+					segment s = {};
+					double a[7];
+					switch(std::toupper(static_cast<unsigned char>(cmd))) {
+						case 'M':
+						case 'L':
+							if(!number(&a[0]) || !number(&a[1])) {
+								return false;
+							}
+							s.type = std::toupper(static_cast<unsigned char>(cmd));
+							s.v[0] = a[0] + ox;
+							s.v[1] = a[1] + oy;
+							if(s.type == 'M') {
+								sx = s.v[0];
+								sy = s.v[1];
+							}
+							break;
+						case 'H':
+							if(!number(&a[0])) {
+								return false;
+							}
+							s.type = 'L';
+							s.v[0] = a[0] + ox;
+							s.v[1] = cy;
+							break;
+						case 'V':
+							if(!number(&a[0])) {
+								return false;
+							}
+							s.type = 'L';
+							s.v[0] = cx;
+							s.v[1] = a[0] + oy;
+							break;
+						case 'C':
+						case 'S': {
+							const bool smooth = std::toupper(static_cast<unsigned char>(cmd)) == 'S';
+							int first = 0;
+							if(smooth) {
+								s.v[0] = prev == 'C' ? 2*cx - pcx : cx;
+								s.v[1] = prev == 'C' ? 2*cy - pcy : cy;
+								first = 2;
+							}
+							for(int n = first; n != 6; ++n) {
+								if(!number(&a[n])) {
+									return false;
+								}
+								s.v[n] = a[n] + (n % 2 == 0 ? ox : oy);
+							}
+							s.type = 'C';
+							break;
+						}
+						case 'Q':
+						case 'T': {
+							const bool smooth = std::toupper(static_cast<unsigned char>(cmd)) == 'T';
+							int first = 0;
+							if(smooth) {
+								s.v[0] = prev == 'Q' ? 2*cx - pcx : cx;
+								s.v[1] = prev == 'Q' ? 2*cy - pcy : cy;
+								first = 2;
+							}
+							for(int n = first; n != 4; ++n) {
+								if(!number(&a[n])) {
+									return false;
+								}
+								s.v[n] = a[n] + (n % 2 == 0 ? ox : oy);
+							}
+							s.type = 'Q';
+							break;
+						}
+						case 'A':
+							if(!number(&a[0]) || !number(&a[1]) || !number(&a[2]) || !flag(&a[3]) 
+								|| !flag(&a[4]) || !number(&a[5]) || !number(&a[6])) {
+								return false;
+							}
+							s.type = 'A';
+							for(int n = 0; n != 5; ++n) {
+								s.v[n] = a[n];
+							}
+							s.v[5] = a[5] + ox;
+							s.v[6] = a[6] + oy;
+							break;
+						case 'Z':
+							s.type = 'Z';
+							break;
+						default:
+							return false;
+					}
+					switch(s.type) {
+						case 'M': case 'L': cx = s.v[0]; cy = s.v[1]; break;
+						case 'C': pcx = s.v[2]; pcy = s.v[3]; cx = s.v[4]; cy = s.v[5]; break;
+						case 'Q': pcx = s.v[0]; pcy = s.v[1]; cx = s.v[2]; cy = s.v[3]; break;
+						case 'A': cx = s.v[5]; cy = s.v[6]; break;
+						case 'Z': cx = sx; cy = sy; break;
+					}
+					prev = s.type;
+					out->emplace_back(s);
+				}
+				return !out->empty() && out->front().type == 'M';
+			}
+
+			// Applies m to the segments, false if it can't be done exactly.
+			bool transform_segments(std::vector<segment>* segs, const cairo_matrix_t& m)
+			{
+				const bool similar = is_similarity(m);
+				for(auto& s : *segs) {
+					if(s.type == 'A' && !similar) {
+						return false;
+					}
+				}
+				const double scale = matrix_scale(m);
+				const bool reflect = m.xx*m.yy - m.yx*m.xy < 0;
+				const double angle = std::atan2(m.yx, m.xx) * 180.0 / M_PI;
+				auto point = [&m](double* v) { cairo_matrix_transform_point(&m, &v[0], &v[1]); };
+				for(auto& s : *segs) {
+					switch(s.type) {
+						case 'M': case 'L': point(&s.v[0]); break;
+						case 'C': point(&s.v[0]); point(&s.v[2]); point(&s.v[4]); break;
+						case 'Q': point(&s.v[0]); point(&s.v[2]); break;
+						case 'A':
+							s.v[0] *= scale;
+							s.v[1] *= scale;
+							s.v[2] = reflect ? angle - s.v[2] : angle + s.v[2];
+							if(reflect) {
+								s.v[4] = 1 - s.v[4];
+							}
+							point(&s.v[5]);
+							break;
+					}
+				}
+				return true;
+			}
+
+			// Builds path data, choosing the shorter of the absolute or relative form
+			// of each command and leaving out repeated command letters.
+			class path_writer
+			{
+			public:
+				explicit path_writer(int decimals) : decimals_(decimals), last_command_(0) {}
+
+				std::string num(double v) const { return format_number(v, decimals_); }
+
+				void add(char cmd, const std::vector<std::string>& args) {
+					out_ += fragment(cmd, args);
+					last_command_ = cmd;
+					last_arg_ = args.empty() ? std::string() : args.back();
+				}
+
+				void add_shorter(char abs_cmd, const std::vector<std::string>& abs_args, char rel_cmd, const std::vector<std::string>& rel_args) {
+					if(fragment(rel_cmd, rel_args).size() < fragment(abs_cmd, abs_args).size()) {
+						add(rel_cmd, rel_args);
+					} else {
+						add(abs_cmd, abs_args);
+					}
+				}
+
+				const std::string& str() const { return out_; }
+			private:
+				std::string fragment(char cmd, const std::vector<std::string>& args) const {
+					// After a moveto, further pairs are taken to be linetos.
+					const char implicit = last_command_ == 'M' ? 'L' : last_command_ == 'm' ? 'l' : last_command_;
+					std::string s;
+					std::string prev = last_arg_;
+					if(cmd != implicit || cmd == 'z') {
+						s += cmd;
+						prev.clear();
+					}
+					for(auto& a : args) {
+						if(!prev.empty() && needs_separator(prev, a)) {
+							s += ' ';
+						}
+						s += a;
+						prev = a;
+					}
+					return s;
+				}
+
+				int decimals_;
+				std::string out_;
+				char last_command_;
+				std::string last_arg_;
+			};
+
+			std::string write_segments(const std::vector<segment>& segs, int decimals)
+			{
+				path_writer w(decimals);
+				const double epsilon = 0.5 * std::pow(10.0, -decimals);
+				auto near = [epsilon](double a, double b) { return std::abs(a - b) < epsilon; };
+				// Current point and start of the sub-path, as written.
+				double cx = 0, cy = 0, sx = 0, sy = 0;
+				char prev = 0;
+				double pcx = 0, pcy = 0;
+				for(auto& s : segs) {
+					double v[7];
+					for(int n = 0; n != 7; ++n) {
+						v[n] = round_to(s.v[n], decimals);
+					}
+					auto rx = [&](double x) { return w.num(x - cx); };
+					auto ry = [&](double y) { return w.num(y - cy); };
+					switch(s.type) {
+						case 'M':
+							w.add_shorter('M', { w.num(v[0]), w.num(v[1]) }, 'm', { rx(v[0]), ry(v[1]) });
+							cx = sx = v[0];
+							cy = sy = v[1];
+							break;
+						case 'L':
+							if(near(v[1], cy)) {
+								w.add_shorter('H', { w.num(v[0]) }, 'h', { rx(v[0]) });
+							} else if(near(v[0], cx)) {
+								w.add_shorter('V', { w.num(v[1]) }, 'v', { ry(v[1]) });
+							} else {
+								w.add_shorter('L', { w.num(v[0]), w.num(v[1]) }, 'l', { rx(v[0]), ry(v[1]) });
+							}
+							cx = v[0];
+							cy = v[1];
+							break;
+						case 'C': {
+							// S is only used where renderers agree on the reflected point,
+							// i.e. after another cubic or after a line or move.
+							const bool after_cubic = prev == 'C';
+							const bool smooth = after_cubic ? near(v[0], 2*cx - pcx) && near(v[1], 2*cy - pcy)
+								: prev != 'Q' && near(v[0], cx) && near(v[1], cy);
+							if(smooth) {
+								w.add_shorter('S', { w.num(v[2]), w.num(v[3]), w.num(v[4]), w.num(v[5]) }, 
+									's', { rx(v[2]), ry(v[3]), rx(v[4]), ry(v[5]) });
+							} else {
+								w.add_shorter('C', { w.num(v[0]), w.num(v[1]), w.num(v[2]), w.num(v[3]), w.num(v[4]), w.num(v[5]) }, 
+									'c', { rx(v[0]), ry(v[1]), rx(v[2]), ry(v[3]), rx(v[4]), ry(v[5]) });
+							}
+							pcx = v[2];
+							pcy = v[3];
+							cx = v[4];
+							cy = v[5];
+							break;
+						}
+						case 'Q': {
+							const bool after_quad = prev == 'Q';
+							const bool smooth = after_quad ? near(v[0], 2*cx - pcx) && near(v[1], 2*cy - pcy)
+								: prev != 'C' && near(v[0], cx) && near(v[1], cy);
+							if(smooth) {
+								w.add_shorter('T', { w.num(v[2]), w.num(v[3]) }, 't', { rx(v[2]), ry(v[3]) });
+								// The control point is the reflection, not the rounded value.
+								if(after_quad) {
+									v[0] = 2*cx - pcx;
+									v[1] = 2*cy - pcy;
+								} else {
+									v[0] = cx;
+									v[1] = cy;
+								}
+							} else {
+								w.add_shorter('Q', { w.num(v[0]), w.num(v[1]), w.num(v[2]), w.num(v[3]) }, 
+									'q', { rx(v[0]), ry(v[1]), rx(v[2]), ry(v[3]) });
+							}
+							pcx = v[0];
+							pcy = v[1];
+							cx = v[2];
+							cy = v[3];
+							break;
+						}
+						case 'A': {
+							std::vector<std::string> shared;
+							shared.emplace_back(w.num(v[0]));
+							shared.emplace_back(w.num(v[1]));
+							shared.emplace_back(w.num(v[2]));
+							shared.emplace_back(s.v[3] != 0 ? "1" : "0");
+							shared.emplace_back(s.v[4] != 0 ? "1" : "0");
+							auto abs_args = shared;
+							abs_args.emplace_back(w.num(v[5]));
+							abs_args.emplace_back(w.num(v[6]));
+							auto rel_args = shared;
+							rel_args.emplace_back(rx(v[5]));
+							rel_args.emplace_back(ry(v[6]));
+							w.add_shorter('A', abs_args, 'a', rel_args);
+							cx = v[5];
+							cy = v[6];
+							break;
+						}
+						case 'Z':
+							w.add('z', std::vector<std::string>());
+							cx = sx;
+							cy = sy;
+							break;
+					}
+					prev = s.type;
+				}
+				return w.str();
+			}
+
+			void escape(std::string* out, const std::string& s, bool attribute)
+			{
+				for(char c : s) {
+					switch(c) {
+						case '&': *out += "&amp;"; break;
+						case '<': *out += "&lt;"; break;
+						case '>': *out += attribute ? ">" : "&gt;"; break;
+						case '"': *out += attribute ? "&quot;" : "\""; break;
+						default: *out += c; break;
+					}
+				}
+			}
+
+			// Serialises an element. For comparing subtrees, leave_out_placement 
+			// drops the id and transform of the element itself. has_id is set if 
+			// any id is written.
+			void write_element(std::string* out, const std::string& name, const ptree& node, bool leave_out_placement, bool* has_id)
+			{
+				*out += '<';
+				*out += name;
+				auto attrs = node.get_child_optional("<xmlattr>");
+				if(attrs) {
+					for(auto& a : *attrs) {
+						if(leave_out_placement && (a.first == "id" || a.first == "transform")) {
+							continue;
+						}
+						if(a.first == "id" && has_id != nullptr) {
+							*has_id = true;
+						}
+						*out += ' ';
+						*out += a.first;
+						*out += "=\"";
+						escape(out, a.second.data(), true);
+						*out += '"';
+					}
+				}
+				// The text is read as separate <xmltext> children, so that in mixed 
+				// content it stays in place between the child elements.
+				std::string body;
+				for(auto& c : node) {
+					if(c.first == "<xmltext>") {
+						if(keeps_text(name)) {
+							escape(&body, c.second.data(), false);
+						}
+					} else if(c.first == "<xmlcomment>") {
+						body += "<!--" + c.second.data() + "-->";
+					} else if(is_element(c.first)) {
+						write_element(&body, c.first, c.second, false, has_id);
+					}
+				}
+				if(body.empty()) {
+					*out += "/>";
+				} else {
+					*out += '>';
+					*out += body;
+					*out += "</" + name + ">";
+				}
+			}
+
+			// What an element inherits and where it's drawn.
+			struct context
+			{
+				context() : decimals(3), in_definition(false), in_text(false), referenced(false) {
+					cairo_matrix_init_identity(&ctm);
+					for(auto& p : inherited_properties) {
+						if(p.value != nullptr) {
+							inherited[p.name] = p.value;
+						}
+					}
+				}
+				std::map<std::string, std::string> inherited;
+				// User space of the element relative to the root.
+				cairo_matrix_t ctm;
+				// Decimal places to write co-ordinates in this user space with.
+				int decimals;
+				bool in_definition;
+				bool in_text;
+				// The element or an ancestor may be used from elsewhere, where it would
+				// inherit different values.
+				bool referenced;
+
+				std::string property(const std::string& name) const {
+					auto it = inherited.find(name);
+					return it == inherited.end() ? std::string() : it->second;
+				}
+
+				std::string inherited_key() const {
+					std::string key;
+					for(auto& p : inherited) {
+						key += p.first + ":" + p.second + ";";
+					}
+					return key;
+				}
+			};
+
+			class optimiser
+			{
+			public:
+				optimiser(const optimise_options& opts, optimise_result* res) : opts_(opts), res_(res), next_id_(0), has_style_sheet_(false) {}
+
+				void run(ptree& root) {
+					collect_ids(root);
+					if(opts_.strip_metadata) {
+						strip_metadata(root);
+					}
+					if(opts_.strip_unused_ids) {
+						strip_unused_ids(root);
+					}
+					simplify("svg", root, context());
+					// Without the attribute a rule in the style sheet could win.
+					if(opts_.strip_defaults && !has_style_sheet_) {
+						strip_defaults("svg", root, context());
+					}
+					if(opts_.deduplicate) {
+						std::map<std::string, ptree*> seen;
+						deduplicate(root, child_context(context(), "svg", root), &seen);
+						if(res_->subtrees_deduplicated > 0 && get_attribute(root, "xmlns:xlink") == nullptr) {
+							set_attribute(root, "xmlns:xlink", "http://www.w3.org/1999/xlink");
+						}
+					}
+				}
+			private:
+				context child_context(const context& parent, const std::string& name, const ptree& node) const {
+					context ctx = parent;
+					auto attrs = node.get_child_optional("<xmlattr>");
+					if(attrs) {
+						for(auto& a : *attrs) {
+							if(is_inherited(a.first)) {
+								ctx.inherited[a.first] = a.second.data();
+							}
+						}
+					}
+					auto style = get_attribute(node, "style");
+					if(style) {
+						for(auto& p : parse_style(*style)) {
+							if(is_inherited(p.first)) {
+								ctx.inherited[p.first] = p.second;
+							}
+						}
+					}
+					auto trf = get_attribute(node, "transform");
+					if(trf) {
+						cairo_matrix_t m = parse_matrix(*trf);
+						cairo_matrix_multiply(&ctx.ctm, &m, &parent.ctm);
+					}
+					ctx.decimals = decimals_for(ctx.ctm);
+					ctx.in_definition = parent.in_definition || in_list(definition_elements, name);
+					ctx.in_text = parent.in_text || name == "text";
+					ctx.referenced = parent.referenced || ctx.in_definition || get_attribute(node, "id") != nullptr;
+					return ctx;
+				}
+
+				int decimals_for(const cairo_matrix_t& ctm) const {
+					const double scale = matrix_scale(ctm);
+					if(!(scale > 0)) {
+						return opts_.precision;
+					}
+					const int d = opts_.precision + static_cast<int>(std::ceil(std::log10(scale) - 1e-9));
+					return std::max(0, std::min(12, d));
+				}
+
+				void collect_ids(const ptree& node) {
+					for(auto& c : node) {
+						if(c.first == "<xmlattr>") {
+							auto id = c.second.find("id");
+							if(id != c.second.not_found()) {
+								ids_.insert(id->second.data());
+							}
+						} else if(is_element(c.first)) {
+							if(c.first == "style" || c.first == "script") {
+								has_style_sheet_ = true;
+							}
+							collect_ids(c.second);
+						}
+					}
+				}
+
+				void strip_metadata(ptree& node) {
+					auto attrs = node.get_child_optional("<xmlattr>");
+					if(attrs) {
+						for(auto it = attrs->begin(); it != attrs->end(); ) {
+							if(is_editor_name(it->first)) {
+								it = attrs->erase(it);
+								++res_->attributes_removed;
+							} else {
+								++it;
+							}
+						}
+					}
+					for(auto it = node.begin(); it != node.end(); ) {
+						if(it->first == "<xmlcomment>" || it->first == "metadata" || is_editor_name(it->first)) {
+							it = node.erase(it);
+							++res_->elements_removed;
+						} else {
+							if(is_element(it->first)) {
+								strip_metadata(it->second);
+							}
+							++it;
+						}
+					}
+				}
+
+				static void add_references(const std::string& name, const std::string& value, std::set<std::string>* refs) {
+					if((name == "xlink:href" || name == "href") && value.size() > 1 && value[0] == '#') {
+						refs->insert(value.substr(1));
+					}
+					for(size_t pos = value.find("url(#"); pos != std::string::npos; pos = value.find("url(#", pos)) {
+						pos += 5;
+						const size_t close = value.find(')', pos);
+						if(close == std::string::npos) {
+							break;
+						}
+						refs->insert(value.substr(pos, close - pos));
+					}
+				}
+
+				static void collect_references(const ptree& node, std::set<std::string>* refs) {
+					for(auto& c : node) {
+						if(c.first == "<xmlattr>") {
+							for(auto& a : c.second) {
+								add_references(a.first, a.second.data(), refs);
+							}
+						} else if(is_element(c.first)) {
+							collect_references(c.second, refs);
+						}
+					}
+				}
+
+				void remove_ids(ptree& node, const std::set<std::string>& refs) {
+					auto id = get_attribute(node, "id");
+					if(id != nullptr && refs.find(*id) == refs.end()) {
+						remove_attribute(node, "id");
+						++res_->attributes_removed;
+					}
+					for(auto& c : node) {
+						if(is_element(c.first)) {
+							remove_ids(c.second, refs);
+						}
+					}
+				}
+
+				void strip_unused_ids(ptree& root) {
+					// A style sheet or script could select by id.
+					if(has_style_sheet_) {
+						return;
+					}
+					std::set<std::string> refs;
+					collect_references(root, &refs);
+					remove_ids(root, refs);
+				}
+
+				// Whether m can be applied to the co-ordinates of a path without 
+				// changing what is drawn. ctx is what the path itself has in effect.
+				// If it can, the scale for the stroke width is returned in stroke_scale.
+				bool can_bake(const ptree& node, const context& ctx, const cairo_matrix_t& m, double* stroke_scale) const {
+					static const char* const blocking[] = {
+						"style", "clip-path", "mask", "filter", "marker", "vector-effect",
+					};
+					for(auto name : blocking) {
+						if(get_attribute(node, name) != nullptr) {
+							return false;
+						}
+					}
+					if(ctx.property("marker-start") != "none" || ctx.property("marker-mid") != "none" || ctx.property("marker-end") != "none") {
+						return false;
+					}
+					// Paint servers could be in the path's own user space.
+					if(ctx.property("fill").find("url(") != std::string::npos || ctx.property("stroke").find("url(") != std::string::npos) {
+						return false;
+					}
+					*stroke_scale = 1.0;
+					if(ctx.property("stroke") != "none") {
+						double width;
+						if(!is_similarity(m) || ctx.property("stroke-dasharray") != "none" || !parse_plain_number(ctx.property("stroke-width"), &width)) {
+							return false;
+						}
+						*stroke_scale = matrix_scale(m);
+					}
+					return true;
+				}
+
+				// Applies m to the path in node, if possible, writing it with decimals.
+				bool bake(ptree& node, const context& ctx, const cairo_matrix_t& m, int decimals) {
+					auto d = get_attribute(node, "d");
+					double stroke_scale;
+					std::vector<segment> segs;
+					if(d == nullptr || !can_bake(node, ctx, m, &stroke_scale) || !parse_segments(*d, &segs) || !transform_segments(&segs, m)) {
+						return false;
+					}
+					set_attribute(node, "d", write_segments(segs, decimals));
+					if(stroke_scale != 1.0) {
+						double width = 1.0;
+						parse_plain_number(ctx.property("stroke-width"), &width);
+						set_attribute(node, "stroke-width", format_number(width * stroke_scale, decimals));
+					}
+					++res_->transforms_baked;
+					return true;
+				}
+
+				void rewrite_path(ptree& node, const context& parent, const context& ctx) {
+					// A use of the path would inherit a different stroke and markers, which
+					// the baked stroke width and co-ordinates wouldn't be right for.
+					auto trf = get_attribute(node, "transform");
+					if(trf != nullptr && opts_.bake_transforms && !ctx.referenced && bake(node, ctx, parse_matrix(*trf), parent.decimals)) {
+						remove_attribute(node, "transform");
+						++res_->paths_rewritten;
+						return;
+					}
+					auto d = get_attribute(node, "d");
+					std::vector<segment> segs;
+					if(d != nullptr && parse_segments(*d, &segs)) {
+						set_attribute(node, "d", write_segments(segs, ctx.decimals));
+						++res_->paths_rewritten;
+					}
+				}
+
+				void round_attributes(const std::string& name, ptree& node, const context& ctx) {
+					auto attrs = node.get_child_optional("<xmlattr>");
+					if(!attrs) {
+						return;
+					}
+					for(auto& a : *attrs) {
+						double v;
+						if((in_list(geometry_attributes, a.first) || a.first == "stroke-width") && parse_plain_number(a.second.data(), &v)) {
+							a.second.data() = format_number(v, ctx.decimals);
+						} else if(a.first == "points" && (name == "polygon" || name == "polyline")) {
+							std::vector<std::string> nums;
+							std::istringstream is(a.second.data());
+							std::string tok;
+							while(is >> tok) {
+								std::istringstream parts(tok);
+								std::string part;
+								while(std::getline(parts, part, ',')) {
+									if(!part.empty()) {
+										if(!parse_plain_number(part, &v)) {
+											return;
+										}
+										nums.emplace_back(format_number(v, ctx.decimals));
+									}
+								}
+							}
+							a.second.data() = join_numbers(nums);
+						}
+					}
+				}
+
+				// Moves the group's transform into the paths it contains, if they can
+				// all take it.
+				void push_transform(ptree& g, const context& parent) {
+					auto trf = get_attribute(g, "transform");
+					if(trf == nullptr || !opts_.bake_transforms) {
+						return;
+					}
+					// These are in the group's user space.
+					if(get_attribute(g, "clip-path") || get_attribute(g, "mask") || get_attribute(g, "filter")) {
+						return;
+					}
+					const cairo_matrix_t m = parse_matrix(*trf);
+					const context inner = child_context(parent, "g", g);
+					bool any = false;
+					for(auto& c : g) {
+						if(!is_element(c.first)) {
+							continue;
+						}
+						// A use of the path would get the transform twice, once from the
+						// path and once from wherever the use is.
+						double stroke_scale;
+						const context cctx = child_context(inner, c.first, c.second);
+						if(c.first != "path" || get_attribute(c.second, "transform") != nullptr 
+							|| cctx.referenced || has_id_within(c.second)
+							|| !can_bake(c.second, cctx, m, &stroke_scale)) {
+							return;
+						}
+						any = true;
+					}
+					if(!any) {
+						return;
+					}
+					// Check every path has data that parses before changing any of them.
+					for(auto& c : g) {
+						if(!is_element(c.first)) {
+							continue;
+						}
+						auto d = get_attribute(c.second, "d");
+						std::vector<segment> segs;
+						if(d == nullptr || !parse_segments(*d, &segs)) {
+							return;
+						}
+					}
+					const std::string saved = *trf;
+					remove_attribute(g, "transform");
+					const context outer = child_context(parent, "g", g);
+					set_attribute(g, "transform", saved);
+					for(auto& c : g) {
+						if(is_element(c.first)) {
+							bake(c.second, child_context(inner, c.first, c.second), m, outer.decimals);
+						}
+					}
+					remove_attribute(g, "transform");
+				}
+
+				// Whether everything the group does can be moved onto a single child.
+				// ctx is the context the group is in.
+				bool can_move_onto(const ptree& g, const ptree& child, const context& ctx) const {
+					// Anything used from elsewhere would get the group's attributes there
+					// as well.
+					if(ctx.referenced || has_id_within(child)) {
+						return false;
+					}
+					auto attrs = g.get_child_optional("<xmlattr>");
+					if(!attrs) {
+						return true;
+					}
+					for(auto& a : *attrs) {
+						if(a.first == "opacity") {
+							double v;
+							if(!parse_plain_number(a.second.data(), &v) || get_attribute(child, "style") != nullptr) {
+								return false;
+							}
+							auto co = get_attribute(child, "opacity");
+							if(co != nullptr && !parse_plain_number(*co, &v)) {
+								return false;
+							}
+						} else if(a.first != "transform" && !is_inherited(a.first)) {
+							return false;
+						}
+					}
+					return true;
+				}
+
+				void move_onto(const ptree& g, ptree& child) {
+					auto attrs = g.get_child_optional("<xmlattr>");
+					if(!attrs) {
+						return;
+					}
+					std::map<std::string, std::string> child_style;
+					auto style = get_attribute(child, "style");
+					if(style) {
+						child_style = parse_style(*style);
+					}
+					for(auto& a : *attrs) {
+						const std::string& value = a.second.data();
+						if(a.first == "transform") {
+							auto ct = get_attribute(child, "transform");
+							set_attribute(child, "transform", ct ? value + " " + *ct : value);
+						} else if(a.first == "opacity") {
+							auto co = get_attribute(child, "opacity");
+							if(co) {
+								double v1 = 1, v2 = 1;
+								parse_plain_number(value, &v1);
+								parse_plain_number(*co, &v2);
+								set_attribute(child, "opacity", format_number(v1 * v2, 6));
+							} else {
+								set_attribute(child, "opacity", value);
+							}
+						} else if(get_attribute(child, a.first) == nullptr && child_style.find(a.first) == child_style.end()) {
+							set_attribute(child, a.first, value);
+						}
+					}
+				}
+
+				void collapse_groups(ptree& node, const context& ctx) {
+					ptree out;
+					out.data() = node.data();
+					for(auto& c : node) {
+						if(c.first != "g") {
+							out.push_back(c);
+							continue;
+						}
+						ptree g = c.second;
+						push_transform(g, ctx);
+						std::vector<ptree::value_type*> children;
+						for(auto& gc : g) {
+							if(is_element(gc.first)) {
+								children.emplace_back(&gc);
+							}
+						}
+						if(!has_attributes(g)) {
+							// Its children take its place.
+							for(auto& gc : g) {
+								if(gc.first != "<xmlattr>") {
+									out.push_back(gc);
+								}
+							}
+							++res_->groups_collapsed;
+						} else if(children.size() == 1 && get_attribute(g, "id") == nullptr && can_move_onto(g, children[0]->second, ctx)) {
+							ptree child = children[0]->second;
+							move_onto(g, child);
+							if(children[0]->first == "path") {
+								rewrite_path(child, ctx, child_context(ctx, "path", child));
+							}
+							out.push_back(std::make_pair(children[0]->first, child));
+							++res_->groups_collapsed;
+						} else {
+							out.push_back(std::make_pair(c.first, g));
+						}
+					}
+					node.swap(out);
+				}
+
+				void simplify(const std::string& name, ptree& node, const context& parent) {
+					const context ctx = child_context(parent, name, node);
+					for(auto& c : node) {
+						if(is_element(c.first)) {
+							simplify(c.first, c.second, ctx);
+						}
+					}
+					if(name == "path") {
+						rewrite_path(node, parent, ctx);
+					} else {
+						round_attributes(name, node, ctx);
+					}
+					// Selectors in a style sheet may match on the groups, and a switch
+					// picks the first of its direct children it can draw.
+					if(opts_.collapse_groups && !has_style_sheet_ && !ctx.in_text && name != "clipPath" && name != "switch") {
+						collapse_groups(node, ctx);
+					}
+				}
+
+				void strip_defaults(const std::string& name, ptree& node, const context& parent) {
+					auto attrs = node.get_child_optional("<xmlattr>");
+					const bool referenced = parent.referenced || in_list(definition_elements, name) || get_attribute(node, "id") != nullptr;
+					if(attrs && get_attribute(node, "style") == nullptr) {
+						for(auto it = attrs->begin(); it != attrs->end(); ) {
+							bool redundant = false;
+							if(is_inherited(it->first)) {
+								// Content that may be used elsewhere would inherit from there.
+								redundant = !referenced && parent.property(it->first) == it->second.data();
+							} else {
+								for(auto& d : attribute_defaults) {
+									if((d.element == nullptr || name == d.element) && it->first == d.name && it->second.data() == d.value) {
+										redundant = true;
+									}
+								}
+							}
+							if(redundant) {
+								it = attrs->erase(it);
+								++res_->attributes_removed;
+							} else {
+								++it;
+							}
+						}
+					}
+					const context ctx = child_context(parent, name, node);
+					for(auto& c : node) {
+						if(is_element(c.first)) {
+							strip_defaults(c.first, c.second, ctx);
+						}
+					}
+				}
+
+				std::string next_id() {
+					for(;;) {
+						std::string id;
+						for(unsigned n = next_id_++; ; n = n / 26 - 1) {
+							id.insert(id.begin(), static_cast<char>('a' + n % 26));
+							if(n < 26) {
+								break;
+							}
+						}
+						if(ids_.insert(id).second) {
+							return id;
+						}
+					}
+				}
+
+				// Replaces subtrees drawn identically to an earlier one, under the same
+				// inherited values, with a use of the earlier one.
+				void deduplicate(ptree& node, const context& ctx, std::map<std::string, ptree*>* seen) {
+					for(auto it = node.begin(); it != node.end(); ++it) {
+						if(!is_element(it->first)) {
+							continue;
+						}
+						const context child_ctx = child_context(ctx, it->first, it->second);
+						if(ctx.in_definition || ctx.in_text || !in_list(drawn_elements, it->first)) {
+							deduplicate(it->second, child_ctx, seen);
+							continue;
+						}
+						bool has_id = get_attribute(it->second, "id") != nullptr;
+						std::string key;
+						write_element(&key, it->first, it->second, true, &has_id);
+						if(has_id) {
+							deduplicate(it->second, child_ctx, seen);
+							continue;
+						}
+						key = ctx.inherited_key() + key;
+						auto existing = seen->find(key);
+						if(existing == seen->end()) {
+							(*seen)[key] = &it->second;
+							deduplicate(it->second, child_ctx, seen);
+							continue;
+						}
+
+						ptree& original = *existing->second;
+						// The use applies its transform after the original's own.
+						cairo_matrix_t target, source, inv, use_matrix;
+						cairo_matrix_init_identity(&target);
+						cairo_matrix_init_identity(&source);
+						auto tt = get_attribute(it->second, "transform");
+						if(tt) {
+							target = parse_matrix(*tt);
+						}
+						auto st = get_attribute(original, "transform");
+						if(st) {
+							source = parse_matrix(*st);
+						}
+						inv = source;
+						if(cairo_matrix_invert(&inv) != CAIRO_STATUS_SUCCESS) {
+							continue;
+						}
+						cairo_matrix_multiply(&use_matrix, &inv, &target);
+
+						auto id = get_attribute(original, "id");
+						ptree use;
+						set_attribute(use, "xlink:href", "#" + (id ? *id : std::string("a")));
+						if(!is_identity(use_matrix)) {
+							set_attribute(use, "transform", matrix_to_string(use_matrix, ctx.decimals));
+						}
+						std::string use_text;
+						write_element(&use_text, "use", use, false, nullptr);
+						// Giving the original an id costs about as much as the reference.
+						const size_t id_cost = id ? 0 : 8;
+						if(key.size() - ctx.inherited_key().size() <= use_text.size() + id_cost) {
+							continue;
+						}
+						if(!id) {
+							const std::string new_id = next_id();
+							set_attribute(original, "id", new_id);
+							set_attribute(use, "xlink:href", "#" + new_id);
+						}
+						it = node.insert(it, std::make_pair(std::string("use"), use));
+						node.erase(std::next(it));
+						++res_->subtrees_deduplicated;
+					}
+				}
+
+				optimise_options opts_;
+				optimise_result* res_;
+				std::set<std::string> ids_;
+				unsigned next_id_;
+				bool has_style_sheet_;
+			};
+		}
+
+		optimise_result optimise(const std::string& filename, std::ostream& os, const optimise_options& opts)
+		{
+			optimise_result res;
+			const std::string data = sys::read_file(filename);
+			res.input_bytes = data.size();
+			ptree pt;
+			std::istringstream is(data);
+			read_xml(is, pt, xml_parser::no_concat_text);
+			auto root = pt.get_child_optional("svg");
+			ASSERT_LOG(root, "No svg element in " << filename);
+
+			optimiser(opts, &res).run(*root);
+
+			std::string out;
+			write_element(&out, "svg", *root, false, nullptr);
+			os << out;
+			res.output_bytes = out.size();
+			return res;
+		}
+	}
+}
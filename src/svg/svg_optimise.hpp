@@ -0,0 +1,89 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <iosfwd>
+#include <string>
+
+namespace KRE
+{
+	namespace SVG
+	{
+		struct optimise_options
+		{
+			optimise_options() 
+				: precision(3), 
+				  strip_metadata(true), 
+				  strip_defaults(true), 
+				  strip_unused_ids(true),
+				  bake_transforms(true), 
+				  collapse_groups(true), 
+				  deduplicate(true)
+			{}
+			// Decimal places kept, in the user units of the root element. Elements 
+			// that are drawn scaled up get more and those scaled down fewer, so the
+			// error is the same size once drawn.
+			int precision;
+			// Comments, metadata and anything in an editor's namespace.
+			bool strip_metadata;
+			// Attributes set to the value they'd have anyway, the default or the
+			// inherited value. Ignored if the document has a style sheet.
+			bool strip_defaults;
+			// Ids nothing refers to. Ignored if the document has a style sheet.
+			bool strip_unused_ids;
+			// Apply transforms on paths to their co-ordinates. Only done where it
+			// doesn't change how the path is drawn, e.g. not for stroked paths under
+			// a non-uniform scale.
+			bool bake_transforms;
+			// Remove groups that do nothing, or move what they do onto their only 
+			// child or into their children's paths. Ignored if the document has a 
+			// style sheet.
+			bool collapse_groups;
+			// Replace repeated subtrees with use elements referring to the first.
+			bool deduplicate;
+		};
+
+		struct optimise_result
+		{
+			optimise_result() 
+				: input_bytes(0), output_bytes(0), paths_rewritten(0), 
+				  transforms_baked(0), groups_collapsed(0), subtrees_deduplicated(0), 
+				  attributes_removed(0), elements_removed(0) 
+			{}
+			size_t input_bytes;
+			size_t output_bytes;
+			unsigned paths_rewritten;
+			unsigned transforms_baked;
+			unsigned groups_collapsed;
+			unsigned subtrees_deduplicated;
+			unsigned attributes_removed;
+			unsigned elements_removed;
+		};
+
+		// Reads an SVG file and writes an equivalent but smaller document to os.
+		// Path data is rewritten with whichever of the absolute or relative form
+		// of each command is shorter and numbers are rounded to opts.precision.
+		optimise_result optimise(const std::string& filename, std::ostream& os, const optimise_options& opts=optimise_options());
+	}
+}
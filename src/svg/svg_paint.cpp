@@ -26,6 +26,7 @@
 #include <map>
 
 #include "asserts.hpp"
+#include "svg_memory.hpp"
 #include "svg_paint.hpp"
 
 namespace KRE
@@ -99,9 +100,12 @@ namespace KRE
 				}
 				color_value_ = Color(cv[0],cv[1],cv[2]);
 			} else if(s.length() > 4 && s.substr(0, 4) == "url(") {
-				auto st_it = std::find(s.begin(), s.end(), '(');
-				auto ed_it = std::find(s.begin(), s.end(), '0');
+				auto st_it = std::find(s.begin(), s.end(), '(') + 1;
+				auto ed_it = std::find(st_it, s.end(), ')');
 				color_ref_ = uri::uri::parse(std::string(st_it, ed_it));
+				if(ed_it != s.end()) {
+					++ed_it;
+				}
 				color_attrib_ = ColorAttrib::FUNC_IRI;
 
 				std::string backup(ed_it, s.end());
@@ -131,6 +135,23 @@ namespace KRE
 		{
 		}
 
+		size_t paint::heap_bytes() const
+		{
+			size_t bytes = string_heap_bytes(icc_color_name_) + vector_heap_bytes(icc_color_values_);
+			color_ref_.for_each_part([&bytes](const std::string& s) { bytes += string_heap_bytes(s); });
+			return bytes;
+		}
+
+		void paint::add_references(std::vector<std::string>* ids) const
+		{
+			if(color_attrib_ == ColorAttrib::FUNC_IRI) {
+				const std::string frag = color_ref_.fragment();
+				if(frag.size() > 1 && frag[0] == '#') {
+					ids->emplace_back(frag.substr(1));
+				}
+			}
+		}
+
 		bool paint::apply(const element* parent, render_context& ctx) const
 		{
 			switch(color_attrib_) {
@@ -26,6 +26,7 @@
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "Color.hpp"
 #include "svg_render.hpp"
@@ -61,6 +62,18 @@ namespace KRE
 
 			bool apply(const element* parent, render_context& ctx) const;
 
+			bool is_none() const { return color_attrib_ == ColorAttrib::NONE; }
+			// Whether the paint is a gradient or pattern, which is drawn relative to 
+			// the user space it's applied in.
+			bool uses_paint_server() const { return color_attrib_ == ColorAttrib::FUNC_IRI; }
+			// The colour, if the paint is a plain colour value, else nullptr.
+			const Color* color_value() const { return color_attrib_ == ColorAttrib::VALUE ? &color_value_ : nullptr; }
+
+			// Memory owned by the paint beyond sizeof(paint).
+			size_t heap_bytes() const;
+			// Adds the id of the paint server referred to, if any, to ids.
+			void add_references(std::vector<std::string>* ids) const;
+
 			static paint_ptr from_string(const std::string& s);
 		private:
 			explicit paint(const std::string& s);
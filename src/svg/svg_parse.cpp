@@ -23,10 +23,13 @@
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/xml_parser.hpp>
+#include <chrono>
+#include <set>
 #include <sstream>
 
 #include "asserts.hpp"
 #include "geometry.hpp"
+#include "trace.hpp"
 
 #include "svg_element.hpp"
 #include "svg_paint.hpp"
@@ -50,6 +53,41 @@ namespace KRE
 				}
 			}
 
+			double seconds_since(const std::chrono::steady_clock::time_point& start)
+			{
+				return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			// Removes definitions that can't be reached from anything drawn.
+			memory_report prune_definitions(const std::vector<element_ptr>& roots)
+			{
+				std::vector<std::string> pending;
+				for(auto& e : roots) {
+					e->collect_references(&pending, true);
+				}
+				std::set<std::string> keep;
+				while(!pending.empty()) {
+					const std::string id = pending.back();
+					pending.pop_back();
+					if(!keep.insert(id).second) {
+						continue;
+					}
+					for(auto& e : roots) {
+						auto target = e->find_child(id);
+						if(target) {
+							target->collect_references(&pending, false);
+							break;
+						}
+					}
+				}
+
+				memory_report freed;
+				for(auto& e : roots) {
+					e->prune_definitions(keep, &freed);
+				}
+				return freed;
+			}
+
 			void print_matrix(const cairo_matrix_t& mat)
 			{
 				LOG_DEBUG("MAT(" << mat.xx << " " << mat.yx << " " << mat.xy << " " << mat.yy << " " << mat.x0 << " " << mat.y0 << ")");
@@ -57,15 +95,66 @@ namespace KRE
 		}
 
 
-		parse::parse(const std::string& filename)
+		parse::parse(const std::string& filename, const parse_options& opts)
 		{
+			TRACE_ZONE_DETAIL("parse", "file", filename);
+			parse_timings timings;
+			auto start = std::chrono::steady_clock::now();
 			ptree pt;
-			read_xml(filename, pt);
+			{
+				TRACE_ZONE("read_xml");
+				read_xml(filename, pt);
+			}
+			timings.read_xml = seconds_since(start);
+
+			start = std::chrono::steady_clock::now();
+			{
+				TRACE_ZONE("construct");
+				svg_data_.emplace_back(element::factory(nullptr, pt));
+				if(!opts.lazy_paths) {
+					for(auto p : svg_data_) {
+						p->decode_geometry();
+					}
+				}
+			}
+			timings.construct = seconds_since(start);
 
-			svg_data_.emplace_back(element::factory(nullptr, pt));
 			// Resolve all the references.
-			for(auto p : svg_data_) {
-				p->resolve();
+			start = std::chrono::steady_clock::now();
+			{
+				TRACE_ZONE("resolve");
+				for(auto p : svg_data_) {
+					p->resolve();
+				}
+				if(opts.prune_definitions) {
+					auto freed = prune_definitions(svg_data_);
+					if(opts.pruned != nullptr) {
+						*opts.pruned = freed;
+					}
+				}
+				if(opts.optimise_tree) {
+					TRACE_ZONE("optimise_tree");
+					tree_report report;
+					for(auto p : svg_data_) {
+						p->optimise_tree(&report);
+					}
+					if(opts.optimised != nullptr) {
+						*opts.optimised = report;
+					}
+				}
+			}
+			timings.resolve = seconds_since(start);
+
+			if(opts.level_of_detail) {
+				TRACE_ZONE("level_of_detail");
+				start = std::chrono::steady_clock::now();
+				for(auto p : svg_data_) {
+					p->build_level_of_detail(opts.lod_pixel_tolerance);
+				}
+				timings.level_of_detail = seconds_since(start);
+			}
+			if(opts.timings != nullptr) {
+				*opts.timings = timings;
 			}
 		}
 
@@ -73,7 +162,32 @@ namespace KRE
 		{
 		}
 
-		void parse::render(render_context& ctx) const
+		memory_report parse::memory_usage() const
+		{
+			memory_report mr;
+			mr.element_nodes += sizeof(*this) + vector_heap_bytes(svg_data_);
+			for(auto& e : svg_data_) {
+				e->add_memory_usage(&mr);
+			}
+			return mr;
+		}
+
+		render_stats parse::render(render_context& ctx) const
+		{
+			render_enter(ctx);
+			try {
+				for(auto p : svg_data_) {
+					p->render(ctx);
+				}
+			} catch(...) {
+				render_leave(ctx);
+				throw;
+			}
+			render_leave(ctx);
+			return ctx.stats();
+		}
+
+		void parse::render_enter(render_context& ctx)
 		{
 			cairo_set_source_rgb(ctx.cairo(), 0.0, 0.0, 0.0);
 			cairo_set_line_cap(ctx.cairo(), CAIRO_LINE_CAP_BUTT);
@@ -86,11 +200,12 @@ namespace KRE
 			ctx.opacity_push(1.0);
 			ctx.letter_spacing_push(0);
 			ctx.fa().push_font_size(12);
+		}
 
-			for(auto p : svg_data_) {
-				p->render(ctx);
-			}
-
+		void parse::render_leave(render_context& ctx)
+		{
+			ctx.flush();
+			ctx.fa().pop_font_size();
 			ctx.letter_spacing_pop();
 			ctx.opacity_pop();
 			ctx.stroke_color_pop();
@@ -28,21 +28,83 @@
 #include <vector>
 
 #include "svg_fwd.hpp"
+#include "svg_memory.hpp"
 #include "svg_render.hpp"
 
 namespace KRE
 {
 	namespace SVG
 	{
+		// Wall-clock seconds spent in each phase of loading a document.
+		struct parse_timings
+		{
+			parse_timings() : read_xml(0), construct(0), resolve(0), level_of_detail(0) {}
+			double read_xml;
+			double construct;
+			double resolve;
+			double level_of_detail;
+		};
+
+		// What element::optimise_tree() changed.
+		struct tree_report
+		{
+			tree_report() : groups_flattened(0), groups_removed(0), transforms_baked(0), containers_removed(0) {}
+			// Groups whose transform was moved onto their children.
+			unsigned groups_flattened;
+			// Groups that did nothing and were replaced by their children.
+			unsigned groups_removed;
+			// Paths with their transform applied to their co-ordinates.
+			unsigned transforms_baked;
+			// Groups with nothing in them.
+			unsigned containers_removed;
+		};
+
+		struct parse_options
+		{
+			parse_options() : level_of_detail(false), lod_pixel_tolerance(0.25), lazy_paths(false), prune_definitions(true), optimise_tree(false), pruned(nullptr), optimised(nullptr), timings(nullptr) {}
+			// Precompute simplified versions of paths for rendering at small sizes.
+			bool level_of_detail;
+			// Maximum error, in device pixels, the simplified paths may introduce.
+			double lod_pixel_tolerance;
+			// Keep path data as text until the path is first drawn, rather than 
+			// decoding all of it while loading. Saves the time and memory for paths
+			// that are never drawn, such as unused definitions, but errors in the
+			// path data are then thrown from render() instead of the constructor.
+			bool lazy_paths;
+			// After resolving, drop definitions (children of defs, clipPaths) that
+			// nothing drawn refers to, directly or through other definitions.
+			bool prune_definitions;
+			// After resolving, simplify the drawn tree, see element::optimise_tree().
+			bool optimise_tree;
+			// If set, filled in with the memory the pruned definitions were using.
+			memory_report* pruned;
+			// If set, filled in with what optimise_tree did.
+			tree_report* optimised;
+			// If set, filled in with how long each phase took.
+			parse_timings* timings;
+		};
+
 		class parse
 		{
 		public:
-			parse(const std::string& filename);
+			explicit parse(const std::string& filename, const parse_options& opts=parse_options());
 			~parse();
 
-			void render(render_context& ctx) const;
+			// Returns the statistics collected on ctx, if it has them enabled.
+			render_stats render(render_context& ctx) const;
+
+			// Used by progressive_renderer and render_stream(), render() is 
+			// render_enter(), rendering each of elements() then render_leave(). They
+			// set up and tear down the default state any document is drawn with.
+			static void render_enter(render_context& ctx);
+			static void render_leave(render_context& ctx);
+			const std::vector<element_ptr>& elements() const { return svg_data_; }
+
+			// What the document is using, see memory_report.
+			memory_report memory_usage() const;
 		private:
 			std::vector<element_ptr> svg_data_;
 		};
+		typedef std::shared_ptr<const parse> parse_ptr;
 	}
 }
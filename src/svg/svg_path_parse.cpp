@@ -35,6 +35,7 @@ reflected point (i.e., (newx1, newy1), the first control point of the current pa
 
 */
 
+#include <algorithm>
 #include <cfloat>
 #include <cmath>
 #include <iostream>
@@ -71,12 +72,103 @@ namespace KRE
 		{
 		}
 
-		void path_command::cairo_render(path_cmd_context& ctx)
+		void path_command::render(path_cmd_context& ctx)
 		{
-			handle_cairo_render(ctx);
+			handle_render(ctx);
+		}
+
+		void path_cmd_context::add_header(cairo_path_data_type_t type, int length)
+		{
+			cairo_path_data_t hdr;
+			hdr.header.type = type;
+			hdr.header.length = length;
+			last_header_ = data_->size();
+			data_->push_back(hdr);
+		}
+
+		void path_cmd_context::add_point(double x, double y)
+		{
+			cairo_path_data_t pt;
+			pt.point.x = x;
+			pt.point.y = y;
+			data_->push_back(pt);
+			cx_ = x;
+			cy_ = y;
+			has_current_point_ = true;
+		}
+
+		void path_cmd_context::move_to(double x, double y)
+		{
+			// A move straight after another move replaces it, as cairo does.
+			if(!data_->empty() && (*data_)[last_header_].header.type == CAIRO_PATH_MOVE_TO) {
+				data_->resize(last_header_);
+			}
+			add_header(CAIRO_PATH_MOVE_TO, 2);
+			add_point(x, y);
+			sx_ = x;
+			sy_ = y;
+			needs_move_to_ = false;
+		}
+
+		void path_cmd_context::begin_segment()
+		{
+			// Anything drawn after a close starts with an explicit move back to the 
+			// start of the sub-path, as cairo_copy_path() gives.
+			if(needs_move_to_) {
+				move_to(sx_, sy_);
+			}
+		}
+
+		void path_cmd_context::line_to(double x, double y)
+		{
+			if(!has_current_point_) {
+				move_to(x, y);
+				return;
+			}
+			begin_segment();
+			add_header(CAIRO_PATH_LINE_TO, 2);
+			add_point(x, y);
+		}
+
+		void path_cmd_context::curve_to(double x1, double y1, double x2, double y2, double x3, double y3)
+		{
+			if(!has_current_point_) {
+				move_to(x1, y1);
+			}
+			begin_segment();
+			add_header(CAIRO_PATH_CURVE_TO, 4);
+			add_point(x1, y1);
+			add_point(x2, y2);
+			add_point(x3, y3);
+		}
+
+		void path_cmd_context::close_path()
+		{
+			if(!has_current_point_ || needs_move_to_) {
+				return;
+			}
+			add_header(CAIRO_PATH_CLOSE_PATH, 1);
+			cx_ = sx_;
+			cy_ = sy_;
+			needs_move_to_ = true;
+		}
+
+		void path_cmd_context::rel_move_to(double dx, double dy)
+		{
+			ASSERT_LOG(has_current_point_, "Relative move with no current point");
+			move_to(cx_ + dx, cy_ + dy);
+		}
+
+		void path_cmd_context::rel_line_to(double dx, double dy)
+		{
+			ASSERT_LOG(has_current_point_, "Relative line with no current point");
+			line_to(cx_ + dx, cy_ + dy);
+		}
 
-			auto status = cairo_status(ctx.cairo_context());
-			ASSERT_LOG(status == CAIRO_STATUS_SUCCESS, "Cairo error: " << cairo_status_to_string(status) << " : " << static_cast<int>(ins_));
+		void path_cmd_context::rel_curve_to(double dx1, double dy1, double dx2, double dy2, double dx3, double dy3)
+		{
+			ASSERT_LOG(has_current_point_, "Relative curve with no current point");
+			curve_to(cx_ + dx1, cy_ + dy1, cx_ + dx2, cy_ + dy2, cx_ + dx3, cy_ + dy3);
 		}
 
 		class move_to_command : public path_command
@@ -90,14 +182,14 @@ namespace KRE
 			}
 			virtual ~move_to_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				if(is_absolute()) {
-					cairo_move_to(ctx.cairo_context(), x_, y_); 
+					ctx.move_to(x_, y_); 
 				} else {
-					if(!cairo_has_current_point(ctx.cairo_context())) {
-						cairo_move_to(ctx.cairo_context(), 0, 0);
+					if(!ctx.has_current_point()) {
+						ctx.move_to(0, 0);
 					}
-					cairo_rel_move_to(ctx.cairo_context(), x_, y_);
+					ctx.rel_move_to(x_, y_);
 				}
 				ctx.clear_control_points();
 			}
@@ -116,11 +208,11 @@ namespace KRE
 			}
 			virtual ~line_to_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				if(is_absolute()) {
-					cairo_line_to(ctx.cairo_context(), x_, y_);
+					ctx.line_to(x_, y_);
 				} else {
-					cairo_rel_line_to(ctx.cairo_context(), x_, y_);
+					ctx.rel_line_to(x_, y_);
 				}
 				ctx.clear_control_points();
 			}
@@ -136,8 +228,8 @@ namespace KRE
 			}
 			virtual ~closepath_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
-				cairo_close_path(ctx.cairo_context());
+			void handle_render(path_cmd_context& ctx) override {
+				ctx.close_path();
 				ctx.clear_control_points();
 			}
 		};
@@ -152,14 +244,15 @@ namespace KRE
 			}
 			virtual ~line_to_h_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				if(is_absolute()) {
 					double cx, cy;
-					cairo_get_current_point(ctx.cairo_context(), &cx, &cy);
-					cairo_line_to(ctx.cairo_context(), x_, cy);
+					ctx.get_current_point(&cx, &cy);
+					ctx.line_to(x_, cy);
 				} else {
-					cairo_rel_line_to(ctx.cairo_context(), x_, 0.0);
+					ctx.rel_line_to(x_, 0.0);
 				}
+				ctx.clear_control_points();
 			}
 			double x_;
 		};
@@ -174,13 +267,13 @@ namespace KRE
 			}
 			virtual ~line_to_v_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				if(is_absolute()) {
 					double cx, cy;
-					cairo_get_current_point(ctx.cairo_context(), &cx, &cy);
-					cairo_line_to(ctx.cairo_context(), cx, y_);
+					ctx.get_current_point(&cx, &cy);
+					ctx.line_to(cx, y_);
 				} else {
-					cairo_rel_line_to(ctx.cairo_context(), 0.0, y_);
+					ctx.rel_line_to(0.0, y_);
 				}
 				ctx.clear_control_points();
 			}
@@ -200,22 +293,26 @@ namespace KRE
 			}
 			virtual ~cubic_bezier_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				double c0x, c0y;
-				cairo_get_current_point(ctx.cairo_context(), &c0x, &c0y);
+				ctx.get_current_point(&c0x, &c0y);
+				// Reflected control points are calculated into locals, so that
+				// rendering never modifies the command.
+				double cp1x = cp1x_;
+				double cp1y = cp1y_;
 				if(smooth_) {
-					ctx.get_control_points(&cp1x_, &cp1y_);
-					cp1x_ = 2.0*c0x - cp1x_;
-					cp1y_ = 2.0*c0y - cp1y_;
+					ctx.get_control_points(&cp1x, &cp1y);
+					cp1x = 2.0*c0x - cp1x;
+					cp1y = 2.0*c0y - cp1y;
 					if(!is_absolute()) {
-						cp1x_ -= c0x;
-						cp1y_ -= c0y;
+						cp1x -= c0x;
+						cp1y -= c0y;
 					}
 				}
 				if(is_absolute()) {
-					cairo_curve_to(ctx.cairo_context(), cp1x_, cp1y_, cp2x_, cp2y_, x_, y_);
+					ctx.curve_to(cp1x, cp1y, cp2x_, cp2y_, x_, y_);
 				} else {
-					cairo_rel_curve_to(ctx.cairo_context(), cp1x_, cp1y_, cp2x_, cp2y_, x_, y_);
+					ctx.rel_curve_to(cp1x, cp1y, cp2x_, cp2y_, x_, y_);
 				}
 				// we always write control points in absolute co-ords
 				ctx.set_control_points(is_absolute() ? cp2x_ : cp2x_ + c0x, is_absolute() ? cp2y_ : cp2y_ + c0y);
@@ -243,17 +340,19 @@ namespace KRE
 			}
 			virtual ~quadratic_bezier_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				double c0x, c0y;
-				cairo_get_current_point(ctx.cairo_context(), &c0x, &c0y);
+				ctx.get_current_point(&c0x, &c0y);
+				double cp1x = cp1x_;
+				double cp1y = cp1y_;
 				if(smooth_) {
-					double cp1x, cp1y;
-					ctx.get_control_points(&cp1x, &cp1y);
-					cp1x_ = 2.0*c0x - cp1x;
-					cp1y_ = 2.0*c0y - cp1y;
+					double rcp1x, rcp1y;
+					ctx.get_control_points(&rcp1x, &rcp1y);
+					cp1x = 2.0*c0x - rcp1x;
+					cp1y = 2.0*c0y - rcp1y;
 					if(!is_absolute()) {
-						cp1x_ -= c0x;
-						cp1y_ -= c0y;
+						cp1x -= c0x;
+						cp1y -= c0y;
 					}
 				}
 				double dx, dy;
@@ -261,8 +360,8 @@ namespace KRE
 				// Simple quadratic -> cubic conversion.
 				dx = x_;
 				dy = y_;
-				acp1x = cp1x_;
-				acp1y = cp1y_;
+				acp1x = cp1x;
+				acp1y = cp1y;
 				if(!is_absolute()) {
 					dx += c0x;
 					dy += c0y;
@@ -274,10 +373,10 @@ namespace KRE
 				const double cpx2 = dx + 2.0/3.0 * (acp1x - dx);
 				const double cpy2 = dy + 2.0/3.0 * (acp1y - dy);
 
-				cairo_curve_to(ctx.cairo_context(), cpx1, cpy1, cpx2, cpy2, x_, y_);
+				ctx.curve_to(cpx1, cpy1, cpx2, cpy2, dx, dy);
 
 				// we always write control points in absolute co-ords
-				ctx.set_control_points(is_absolute() ? cp1x_ : cp1x_ + c0x, is_absolute() ? cp1y_ : cp1y_ + c0y);
+				ctx.set_control_points(is_absolute() ? cp1x : cp1x + c0x, is_absolute() ? cp1y : cp1y + c0y);
 			}
 			bool smooth_;
 			double x_;
@@ -303,9 +402,9 @@ namespace KRE
 			}
 			virtual ~elliptical_arc_command() {}
 		private:
-			void handle_cairo_render(path_cmd_context& ctx) override {
+			void handle_render(path_cmd_context& ctx) override {
 				double x1, y1;
-				cairo_get_current_point(ctx.cairo_context(), &x1, &y1);
+				ctx.get_current_point(&x1, &y1);
 
 				// calculate some ellipse stuff
 				// a is the length of the major axis
@@ -383,7 +482,7 @@ namespace KRE
 					const double y3 = b*std::sin(th1);
 					const double x2 = x3 + a*(t * std::sin(th1));
 					const double y2 = y3 + b*(-t * std::cos(th1));
-					cairo_curve_to(ctx.cairo_context(), 
+					ctx.curve_to(
 						xc + cosp*x1 - sinp*y1, 
 						yc + sinp*x1 + cosp*y1, 
 						xc + cosp*x2 - sinp*y2, 
@@ -783,5 +882,307 @@ namespace KRE
 			path_parser pp(s);
 			return pp.get_command_list();
 		}
+
+		namespace
+		{
+			size_t count_segments(const std::vector<cairo_path_data_t>& data)
+			{
+				size_t count = 0;
+				for(size_t n = 0; n < data.size(); n += data[n].header.length) {
+					++count;
+				}
+				return count;
+			}
+		}
+
+		path_geometry::path_geometry(const std::vector<path_commandPtr>& cmds)
+			: segments_(0),
+			  extent_(0),
+			  lod_tolerance_(0)
+		{
+			bounds_[0] = bounds_[1] = bounds_[2] = bounds_[3] = 0;
+			if(cmds.empty()) {
+				return;
+			}
+			// Built directly in doubles, in user space. Going through a cairo context
+			// would round every point to cairo's 24.8 fixed point.
+			path_cmd_context path_ctx(&data_);
+			for(auto& p : cmds) {
+				p->render(path_ctx);
+			}
+
+			segments_ = count_segments(data_);
+			compute_bounds();
+		}
+
+		path_geometry::path_geometry(const path_geometry& src, const cairo_matrix_t& mat)
+			: data_(src.data_),
+			  segments_(src.segments_),
+			  extent_(0),
+			  lod_tolerance_(0)
+		{
+			for(size_t n = 0; n < data_.size(); n += data_[n].header.length) {
+				for(int i = 1; i < data_[n].header.length; ++i) {
+					cairo_matrix_transform_point(&mat, &data_[n+i].point.x, &data_[n+i].point.y);
+				}
+			}
+			compute_bounds();
+			if(src.lod_tolerance_ > 0) {
+				build_level_of_detail(src.lod_tolerance_);
+			}
+		}
+
+		void path_geometry::compute_bounds()
+		{
+			bounds_[0] = bounds_[1] = bounds_[2] = bounds_[3] = 0;
+			bool first = true;
+			for(size_t n = 0; n < data_.size(); n += data_[n].header.length) {
+				for(int i = 1; i < data_[n].header.length; ++i) {
+					const double x = data_[n+i].point.x;
+					const double y = data_[n+i].point.y;
+					if(first) {
+						bounds_[0] = bounds_[2] = x;
+						bounds_[1] = bounds_[3] = y;
+						first = false;
+					}
+					bounds_[0] = std::min(bounds_[0], x);
+					bounds_[1] = std::min(bounds_[1], y);
+					bounds_[2] = std::max(bounds_[2], x);
+					bounds_[3] = std::max(bounds_[3], y);
+				}
+			}
+		}
+
+		size_t path_geometry::heap_bytes() const
+		{
+			size_t bytes = data_.capacity() * sizeof(cairo_path_data_t) + lod_.capacity() * sizeof(lod_level);
+			for(auto& level : lod_) {
+				bytes += level.data.capacity() * sizeof(cairo_path_data_t);
+			}
+			return bytes;
+		}
+
+		bool path_geometry::bounds(double* x1, double* y1, double* x2, double* y2) const
+		{
+			if(data_.empty()) {
+				return false;
+			}
+			*x1 = bounds_[0];
+			*y1 = bounds_[1];
+			*x2 = bounds_[2];
+			*y2 = bounds_[3];
+			return true;
+		}
+
+		path_geometry::~path_geometry()
+		{
+		}
+
+		size_t path_geometry::append_to(cairo_t* cairo, bool use_lod) const
+		{
+			if(data_.empty()) {
+				return 0;
+			}
+			const std::vector<cairo_path_data_t>* data = &data_;
+			size_t segments = segments_;
+			if(use_lod && !lod_.empty()) {
+				// Largest scale of the current user space to device space, i.e. the
+				// largest singular value. The average would under-estimate it for 
+				// skews and non-uniform scales and pick too coarse a level.
+				cairo_matrix_t mat;
+				cairo_get_matrix(cairo, &mat);
+				const double sum = mat.xx*mat.xx + mat.yx*mat.yx + mat.xy*mat.xy + mat.yy*mat.yy;
+				const double det = mat.xx * mat.yy - mat.xy * mat.yx;
+				const double scale = std::sqrt((sum + std::sqrt(std::max(0.0, sum*sum - 4*det*det))) / 2);
+				const double device_extent = extent_ * scale;
+				for(auto& level : lod_) {
+					if(device_extent <= level.max_device_extent) {
+						data = &level.data;
+						segments = level.segments;
+						// The curves are already flattened, this only affects joins and caps.
+						cairo_set_tolerance(cairo, lod_tolerance_);
+						break;
+					}
+				}
+			}
+			cairo_path_t path;
+			path.status = CAIRO_STATUS_SUCCESS;
+			// cairo only reads from the data.
+			path.data = const_cast<cairo_path_data_t*>(&(*data)[0]);
+			path.num_data = static_cast<int>(data->size());
+			cairo_append_path(cairo, &path);
+			return segments;
+		}
+
+		namespace
+		{
+			struct point
+			{
+				point(double xx, double yy) : x(xx), y(yy) {}
+				double x, y;
+			};
+
+			double distance_to_segment(const point& p, const point& a, const point& b)
+			{
+				const double dx = b.x - a.x;
+				const double dy = b.y - a.y;
+				const double len2 = dx*dx + dy*dy;
+				double t = len2 > 0 ? ((p.x - a.x)*dx + (p.y - a.y)*dy) / len2 : 0;
+				t = std::max(0.0, std::min(1.0, t));
+				const double ex = a.x + t*dx - p.x;
+				const double ey = a.y + t*dy - p.y;
+				return std::sqrt(ex*ex + ey*ey);
+			}
+
+			// Adaptive subdivision of a cubic bezier, adds everything except p0.
+			void flatten_curve(const point& p0, const point& p1, const point& p2, const point& p3, double tolerance, int depth, std::vector<point>* out)
+			{
+				if(depth >= 16 || (distance_to_segment(p1, p0, p3) <= tolerance && distance_to_segment(p2, p0, p3) <= tolerance)) {
+					out->push_back(p3);
+					return;
+				}
+				const point p01((p0.x+p1.x)/2, (p0.y+p1.y)/2);
+				const point p12((p1.x+p2.x)/2, (p1.y+p2.y)/2);
+				const point p23((p2.x+p3.x)/2, (p2.y+p3.y)/2);
+				const point p012((p01.x+p12.x)/2, (p01.y+p12.y)/2);
+				const point p123((p12.x+p23.x)/2, (p12.y+p23.y)/2);
+				const point mid((p012.x+p123.x)/2, (p012.y+p123.y)/2);
+				flatten_curve(p0, p01, p012, mid, tolerance, depth+1, out);
+				flatten_curve(mid, p123, p23, p3, tolerance, depth+1, out);
+			}
+
+			// Douglas-Peucker, marks the points to keep.
+			void simplify(const std::vector<point>& pts, size_t first, size_t last, double tolerance, std::vector<bool>* keep)
+			{
+				if(last <= first + 1) {
+					return;
+				}
+				double max_dist = 0;
+				size_t index = first;
+				for(size_t n = first + 1; n < last; ++n) {
+					const double d = distance_to_segment(pts[n], pts[first], pts[last]);
+					if(d > max_dist) {
+						max_dist = d;
+						index = n;
+					}
+				}
+				if(max_dist > tolerance) {
+					(*keep)[index] = true;
+					simplify(pts, first, index, tolerance, keep);
+					simplify(pts, index, last, tolerance, keep);
+				}
+			}
+
+			void add_point(cairo_path_data_type_t type, const point& p, std::vector<cairo_path_data_t>* out)
+			{
+				cairo_path_data_t hdr;
+				hdr.header.type = type;
+				hdr.header.length = 2;
+				out->push_back(hdr);
+				cairo_path_data_t pt;
+				pt.point.x = p.x;
+				pt.point.y = p.y;
+				out->push_back(pt);
+			}
+
+			void emit_subpath(const std::vector<point>& pts, bool closed, double tolerance, std::vector<cairo_path_data_t>* out)
+			{
+				if(pts.empty()) {
+					return;
+				}
+				std::vector<bool> keep(pts.size(), false);
+				keep.front() = keep.back() = true;
+				simplify(pts, 0, pts.size() - 1, tolerance, &keep);
+				add_point(CAIRO_PATH_MOVE_TO, pts.front(), out);
+				for(size_t n = 1; n != pts.size(); ++n) {
+					if(keep[n]) {
+						add_point(CAIRO_PATH_LINE_TO, pts[n], out);
+					}
+				}
+				if(closed) {
+					cairo_path_data_t hdr;
+					hdr.header.type = CAIRO_PATH_CLOSE_PATH;
+					hdr.header.length = 1;
+					out->push_back(hdr);
+				}
+			}
+
+			// Flatten then simplify path data, tolerance is in the same units as the path.
+			std::vector<cairo_path_data_t> simplify_path(const std::vector<cairo_path_data_t>& data, double tolerance)
+			{
+				// Split the tolerance between the two stages.
+				const double flatten_tolerance = tolerance / 2;
+				const double simplify_tolerance = tolerance / 2;
+
+				std::vector<cairo_path_data_t> res;
+				std::vector<point> pts;
+				for(size_t n = 0; n < data.size(); n += data[n].header.length) {
+					const cairo_path_data_t* d = &data[n];
+					switch(d->header.type) {
+						case CAIRO_PATH_MOVE_TO:
+							emit_subpath(pts, false, simplify_tolerance, &res);
+							pts.clear();
+							pts.emplace_back(d[1].point.x, d[1].point.y);
+							break;
+						case CAIRO_PATH_LINE_TO:
+							pts.emplace_back(d[1].point.x, d[1].point.y);
+							break;
+						case CAIRO_PATH_CURVE_TO:
+							ASSERT_LOG(!pts.empty(), "Curve with no current point in path data");
+							flatten_curve(pts.back(), 
+								point(d[1].point.x, d[1].point.y), 
+								point(d[2].point.x, d[2].point.y), 
+								point(d[3].point.x, d[3].point.y), 
+								flatten_tolerance, 0, &pts);
+							break;
+						case CAIRO_PATH_CLOSE_PATH:
+							emit_subpath(pts, true, simplify_tolerance, &res);
+							pts.clear();
+							break;
+					}
+				}
+				emit_subpath(pts, false, simplify_tolerance, &res);
+				return res;
+			}
+		}
+
+		void path_geometry::build_level_of_detail(double pixel_tolerance)
+		{
+			lod_.clear();
+			if(data_.empty() || pixel_tolerance <= 0) {
+				return;
+			}
+			lod_tolerance_ = pixel_tolerance;
+
+			double x1 = DBL_MAX, y1 = DBL_MAX, x2 = -DBL_MAX, y2 = -DBL_MAX;
+			for(size_t n = 0; n < data_.size(); n += data_[n].header.length) {
+				for(int i = 1; i < data_[n].header.length; ++i) {
+					x1 = std::min(x1, data_[n+i].point.x);
+					y1 = std::min(y1, data_[n+i].point.y);
+					x2 = std::max(x2, data_[n+i].point.x);
+					y2 = std::max(y2, data_[n+i].point.y);
+				}
+			}
+			extent_ = std::sqrt((x2-x1)*(x2-x1) + (y2-y1)*(y2-y1));
+			if(extent_ <= 0) {
+				return;
+			}
+
+			// Above 128 pixels the full path is cheap compared to the area being filled.
+			static const double buckets[] = { 16, 32, 64, 128 };
+			for(double max_extent : buckets) {
+				// Any error in user space scales by at most max_extent/extent_ when drawn.
+				auto simplified = simplify_path(data_, pixel_tolerance * extent_ / max_extent);
+				// Don't bother keeping levels that don't save much over the next one up.
+				if(simplified.size() * 10 > data_.size() * 9) {
+					break;
+				}
+				lod_level level;
+				level.max_device_extent = max_extent;
+				level.data.swap(simplified);
+				level.segments = count_segments(level.data);
+				lod_.push_back(level);
+			}
+		}
 	}
 }
@@ -51,17 +51,41 @@ namespace KRE
 			ARC,
 		};
 
+		// Builds the path in the layout cairo uses, following the same rules as 
+		// the cairo path functions, but keeping every co-ordinate as a double 
+		// rather than cairo's fixed point.
 		class path_cmd_context
 		{
 		public:
-			path_cmd_context(cairo_t* cairo) 
-				: cairo_(cairo), 
+			explicit path_cmd_context(std::vector<cairo_path_data_t>* data) 
+				: data_(data),
+				last_header_(0),
+				has_current_point_(false),
+				needs_move_to_(false),
+				cx_(0),
+				cy_(0),
+				sx_(0),
+				sy_(0),
+				control_point_set_(false),
 				cp1x_(0), 
-				cp1y_(0),
-				control_point_set_(false) {
+				cp1y_(0) {
 			}
 			~path_cmd_context() {}
-			cairo_t* cairo_context() { return cairo_; }
+
+			void move_to(double x, double y);
+			void line_to(double x, double y);
+			void curve_to(double x1, double y1, double x2, double y2, double x3, double y3);
+			void close_path();
+			void rel_move_to(double dx, double dy);
+			void rel_line_to(double dx, double dy);
+			void rel_curve_to(double dx1, double dy1, double dx2, double dy2, double dx3, double dy3);
+			bool has_current_point() const { return has_current_point_; }
+			// (0,0) if there isn't one, like cairo_get_current_point().
+			void get_current_point(double* x, double* y) const {
+				*x = cx_;
+				*y = cy_;
+			}
+
 			void set_control_points(double x, double y) {
 				cp1x_ = x;
 				cp1y_ = y;
@@ -77,11 +101,25 @@ namespace KRE
 					*x = cp1x_;
 					*y = cp1y_;
 				} else {
-					cairo_get_current_point(cairo_, x, y);
+					get_current_point(x, y);
 				}
 			}
 		private:
-			cairo_t* cairo_;
+			void add_point(double x, double y);
+			void add_header(cairo_path_data_type_t type, int length);
+			void begin_segment();
+
+			std::vector<cairo_path_data_t>* data_;
+			// Index in data_ of the most recent element's header.
+			size_t last_header_;
+			bool has_current_point_;
+			// Set by close_path(), the next segment has to start with a move.
+			bool needs_move_to_;
+			double cx_;
+			double cy_;
+			// Start of the current sub-path, where close_path() returns to.
+			double sx_;
+			double sy_;
 			bool control_point_set_;
 			double cp1x_;
 			double cp1y_;
@@ -92,14 +130,14 @@ namespace KRE
 		public:
 			virtual ~path_command();
 
-			void cairo_render(path_cmd_context& ctx);
+			void render(path_cmd_context& ctx);
 
 			bool is_absolute() const { return absolute_; }
 			bool is_relative() const { return !absolute_; }
 		protected:
 			path_command(PathInstruction ins, bool absolute);
 		private:
-			virtual void handle_cairo_render(path_cmd_context& ctx) = 0;
+			virtual void handle_render(path_cmd_context& ctx) = 0;
 			PathInstruction ins_;
 			bool absolute_;
 		};
@@ -117,5 +155,65 @@ namespace KRE
 		};
 
 		std::vector<path_commandPtr> parse_path(const std::string& s);
+
+		// A path reduced to absolute co-ordinates using only move/line/curve/close,
+		// stored in the same layout cairo uses. It's built once from the parsed
+		// commands, in the path's own user space, so it can be replayed at any
+		// scale or transform with a single cairo_append_path() rather than going
+		// through the command list every time we render.
+		class path_geometry
+		{
+		public:
+			explicit path_geometry(const std::vector<path_commandPtr>& cmds);
+			// src with every point transformed by mat, with levels of detail rebuilt 
+			// if src had them.
+			path_geometry(const path_geometry& src, const cairo_matrix_t& mat);
+			~path_geometry();
+
+			// Adds the path to the current path of cairo, under the current transform.
+			// If use_lod is set and simplified versions of the path have been built,
+			// the one matching the current device scale is used instead, setting the
+			// cairo tolerance to match. Returns the number of segments added.
+			size_t append_to(cairo_t* cairo, bool use_lod=false) const;
+
+			// Bounding box of the points, including curve control points, in user
+			// space. Returns false if the path is empty.
+			bool bounds(double* x1, double* y1, double* x2, double* y2) const;
+
+			// Precompute simplified versions of the path for when it is drawn small.
+			// Each level is the path with curves flattened and then reduced with
+			// Douglas-Peucker, such that when it's selected the result is within
+			// pixel_tolerance device pixels of the real path. Not thread-safe, must
+			// be done before the path is shared between renders.
+			void build_level_of_detail(double pixel_tolerance);
+
+			bool empty() const { return data_.empty(); }
+			// Memory used beyond sizeof(path_geometry).
+			size_t heap_bytes() const;
+			const std::vector<cairo_path_data_t>& data() const { return data_; }
+		private:
+			path_geometry(const path_geometry&);
+			void operator=(const path_geometry&);
+			void compute_bounds();
+
+			std::vector<cairo_path_data_t> data_;
+			size_t segments_;
+			double bounds_[4];
+
+			struct lod_level
+			{
+				// Largest size, in device pixels, of the path's bounding box that this
+				// level can be used for.
+				double max_device_extent;
+				std::vector<cairo_path_data_t> data;
+				size_t segments;
+			};
+			// Sorted smallest first.
+			std::vector<lod_level> lod_;
+			// Diagonal of the bounding box in user units.
+			double extent_;
+			double lod_tolerance_;
+		};
+		typedef std::shared_ptr<path_geometry> path_geometry_ptr;
 	}
 }
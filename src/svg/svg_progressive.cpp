@@ -0,0 +1,143 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <cstring>
+
+#include "asserts.hpp"
+#include "svg_element.hpp"
+#include "svg_progressive.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		progressive_renderer::progressive_renderer(const parse_ptr& doc, unsigned width, unsigned height)
+			: doc_(doc),
+			  bitmap_(std::make_shared<SVG::bitmap>(width, height)),
+			  surface_(nullptr),
+			  cairo_(nullptr)
+		{
+			ASSERT_LOG(doc_ != nullptr, "progressive_renderer needs a document to render");
+			reset();
+		}
+
+		progressive_renderer::~progressive_renderer()
+		{
+			release();
+		}
+
+		void progressive_renderer::release()
+		{
+			// Unwind anything still open so the context stacks are balanced.
+			while(!stack_.empty()) {
+				if(stack_.back().owner) {
+					stack_.back().owner->children_leave(*ctx_);
+					stack_.back().owner->render_leave(*ctx_);
+				} else {
+					doc_->render_leave(*ctx_);
+				}
+				stack_.pop_back();
+			}
+			ctx_.reset();
+			if(cairo_) {
+				cairo_destroy(cairo_);
+				cairo_ = nullptr;
+			}
+			if(surface_) {
+				cairo_surface_destroy(surface_);
+				surface_ = nullptr;
+			}
+		}
+
+		void progressive_renderer::reset()
+		{
+			release();
+			memset(bitmap_->data(), 0, bitmap_->size_in_bytes());
+			surface_ = bitmap_->create_surface();
+			cairo_ = cairo_create(surface_);
+			ctx_.reset(new render_context(cairo_, bitmap_->width(), bitmap_->height()));
+			cursor_ = render_cursor();
+
+			doc_->render_enter(*ctx_);
+			stack_.emplace_back(nullptr, &doc_->elements());
+		}
+
+		bool progressive_renderer::step()
+		{
+			while(!stack_.empty()) {
+				frame& top = stack_.back();
+				if(top.next >= top.children->size()) {
+					if(top.owner) {
+						top.owner->children_leave(*ctx_);
+						top.owner->render_leave(*ctx_);
+					} else {
+						doc_->render_leave(*ctx_);
+					}
+					stack_.pop_back();
+					continue;
+				}
+
+				const element_ptr& e = (*top.children)[top.next++];
+				auto children = e->render_children_list();
+				if(children) {
+					// Descend rather than drawing the whole sub-tree at once.
+					e->render_enter(*ctx_);
+					e->children_enter(*ctx_);
+					stack_.emplace_back(e.get(), children);
+					continue;
+				}
+				e->render(*ctx_);
+				++cursor_.elements_rendered;
+				cursor_.depth = stack_.size() - 1;
+				return true;
+			}
+
+			cursor_.depth = 0;
+			if(!cursor_.finished) {
+				cursor_.finished = true;
+				cairo_surface_flush(surface_);
+				auto status = cairo_status(cairo_);
+				ASSERT_LOG(status == CAIRO_STATUS_SUCCESS, "Cairo error: " << cairo_status_to_string(status));
+			}
+			return false;
+		}
+
+		const render_cursor& progressive_renderer::render(std::chrono::microseconds budget)
+		{
+			auto deadline = std::chrono::steady_clock::now() + budget;
+			while(step()) {
+				if(std::chrono::steady_clock::now() >= deadline) {
+					break;
+				}
+			}
+			return cursor_;
+		}
+
+		const render_cursor& progressive_renderer::render_all()
+		{
+			while(step()) {
+			}
+			return cursor_;
+		}
+	}
+}
@@ -0,0 +1,106 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "svg_bitmap.hpp"
+#include "svg_fwd.hpp"
+#include "svg_parse.hpp"
+#include "svg_render.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		// Where a progressive_renderer has got to in the document.
+		struct render_cursor
+		{
+			render_cursor() : elements_rendered(0), depth(0), finished(false) {}
+			// Number of elements drawn so far, containers aren't counted.
+			size_t elements_rendered;
+			// How many containers we are currently inside.
+			size_t depth;
+			bool finished;
+		};
+
+		// Renders a document a piece at a time into a bitmap that persists between
+		// calls. Each call to render() draws elements until the time budget runs out
+		// then returns, the next call carries on from the same place. Useful for
+		// spreading a large document over several frames.
+		//
+		// The granularity is a single leaf element (or 'use' reference), we never
+		// stop part way through drawing one so a call may overrun its budget by the
+		// cost of one element, and always draws at least one element to guarantee
+		// progress. Containers draw into intermediate groups, so the contents of
+		// bitmap() are only meaningful once the cursor reports finished.
+		//
+		// The document must not be modified while a render is in progress. It's
+		// fine to render the same document with several renderers at once.
+		class progressive_renderer
+		{
+		public:
+			progressive_renderer(const parse_ptr& doc, unsigned width, unsigned height);
+			~progressive_renderer();
+
+			// Render until the budget has been used up or the document is complete.
+			const render_cursor& render(std::chrono::microseconds budget);
+			// Render everything left in one go.
+			const render_cursor& render_all();
+
+			// Start over, clearing the bitmap.
+			void reset();
+
+			const render_cursor& cursor() const { return cursor_; }
+			bool finished() const { return cursor_.finished; }
+			const_bitmap_ptr bitmap() const { return bitmap_; }
+		private:
+			progressive_renderer(const progressive_renderer&);
+			void operator=(const progressive_renderer&);
+
+			// Draws the next element, returns false if there was nothing left to do.
+			bool step();
+			void release();
+
+			struct frame
+			{
+				frame(const element* o, const std::vector<element_ptr>* c) : owner(o), children(c), next(0) {}
+				// nullptr for the document itself.
+				const element* owner;
+				const std::vector<element_ptr>* children;
+				size_t next;
+			};
+
+			parse_ptr doc_;
+			bitmap_ptr bitmap_;
+			cairo_surface_t* surface_;
+			cairo_t* cairo_;
+			std::unique_ptr<render_context> ctx_;
+			std::vector<frame> stack_;
+			render_cursor cursor_;
+		};
+	}
+}
@@ -23,12 +23,20 @@
 
 #pragma once
 
+#include <algorithm>
 #include <cairo.h>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
 #include <stack>
+#include <string>
+#include <vector>
 
 #include "asserts.hpp"
 #include "ft_iface.hpp"
 #include "Color.hpp"
+#include "svg_fill_batch.hpp"
 
 namespace KRE
 {
@@ -36,6 +44,17 @@ namespace KRE
 	{
 		class paint;
 		typedef std::shared_ptr<paint> paint_ptr;
+		class marker_element;
+
+		// The markers in effect, from the marker properties of an element or the
+		// nearest of its ancestors to set them.
+		struct marker_set
+		{
+			std::shared_ptr<const marker_element> start;
+			std::shared_ptr<const marker_element> mid;
+			std::shared_ptr<const marker_element> end;
+			bool empty() const { return !start && !mid && !end; }
+		};
 
 		// Basically the concrete values that are set and stacked.
 		class font_attribs_set 
@@ -56,6 +75,99 @@ namespace KRE
 			std::stack<FT_Face> face_;
 		};
 
+		// Trade off between speed and accuracy of the output.
+		enum class RenderQuality {
+			PREVIEW,
+			NORMAL,
+			BEST,
+		};
+
+		// Accepts "preview", "normal" or "best". Returns false, leaving q alone, 
+		// for anything else.
+		inline bool parse_render_quality(const std::string& s, RenderQuality* q) {
+			if(s == "preview") {
+				*q = RenderQuality::PREVIEW;
+			} else if(s == "normal") {
+				*q = RenderQuality::NORMAL;
+			} else if(s == "best") {
+				*q = RenderQuality::BEST;
+			} else {
+				return false;
+			}
+			return true;
+		}
+
+		// What shape-rendering, text-rendering and image-rendering ask for, 
+		// boiled down to the settings cairo has.
+		enum class RenderingHint {
+			AUTO,
+			SPEED,
+			CRISP_EDGES,
+			PRECISION,
+		};
+
+		// Counters for what a render did, to find out why something is slow.
+		// Only collected if enabled on the render_context.
+		struct render_stats
+		{
+			render_stats() 
+				: elements_visited(0), elements_culled(0), groups_pushed(0), saves(0),
+				  path_segments(0), fills(0), fills_batched(0), strokes(0), glyphs(0), surface_bytes(0),
+				  filters(0), filter_pixels(0), rectangle_clips(0), clip_masks_built(0), clip_masks_reused(0),
+				  markers(0), marker_images(0)
+			{}
+			unsigned elements_visited;
+			// Shapes skipped because they're entirely outside the clip.
+			unsigned elements_culled;
+			unsigned groups_pushed;
+			unsigned saves;
+			// move/line/curve/close operations handed to cairo.
+			unsigned path_segments;
+			unsigned fills;
+			// Fills that were merged into another, so didn't need a call of their own.
+			unsigned fills_batched;
+			unsigned strokes;
+			unsigned glyphs;
+			// Estimated size of the intermediate surfaces cairo allocated for groups.
+			uint64_t surface_bytes;
+			// Filter effects applied, and the pixels in the regions they covered.
+			unsigned filters;
+			uint64_t filter_pixels;
+			// Clip paths applied as a plain rectangle.
+			unsigned rectangle_clips;
+			// Clip paths drawn into a mask, and draws that reused one.
+			unsigned clip_masks_built;
+			unsigned clip_masks_reused;
+			// Markers drawn, and images of them built to stamp at each vertex.
+			unsigned markers;
+			unsigned marker_images;
+		};
+
+		// Receives the drawing operations made through a render_context, as they
+		// happen. Used to capture a document in a form that can be replayed without
+		// the element tree, see svg_binary.hpp.
+		class render_recorder
+		{
+		public:
+			virtual ~render_recorder() {}
+			virtual void save() = 0;
+			virtual void restore() = 0;
+			virtual void push_group() = 0;
+			// alpha is only meaningful if paint is true
+			virtual void pop_group(bool paint, double alpha) = 0;
+			// The following are called before the operation is done, so the current
+			// path and state of cairo can be inspected.
+			virtual void fill(cairo_t* cairo) = 0;
+			virtual void stroke(cairo_t* cairo) = 0;
+			virtual void clip(cairo_t* cairo) = 0;
+			// Bracket the operations which make up an element that has an id.
+			virtual void begin_element(const std::string& id) = 0;
+			virtual void end_element(const std::string& id) = 0;
+			// Drawing the recording has no way to hold was done, e.g. a filter. 
+			// What gets recorded in its place is wrong.
+			virtual void unsupported(const std::string& what) = 0;
+		};
+
 		class render_context
 		{
 		public:
@@ -66,10 +178,20 @@ namespace KRE
 				  width_(width),
 				  height_(height),
 				  text_x_(0),
-				  text_y_(0)
+				  text_y_(0),
+				  use_level_of_detail_(true),
+				  quality_(RenderQuality::NORMAL),
+				  recorder_(nullptr),
+				  collect_stats_(false),
+				  batch_fills_(false),
+				  filter_threads_(0),
+				  save_depth_(0)
 			{
 			}
 			~render_context() {
+				if(!batch_.empty()) {
+					LOG_ERROR("Fills still held back in rendering context at exit, flush() wasn't called.");
+				}
                 if(!fill_color_stack_.empty()) {
                     LOG_ERROR("Fill color stack in rendering context not empty at exit.");
                 }
@@ -79,6 +201,136 @@ namespace KRE
 			}
 
 			cairo_t* cairo() { return cairo_; }
+
+			// Operations that affect what ends up on the surface go through these
+			// rather than calling cairo directly, so that they can be recorded.
+			void save() {
+				cairo_save(cairo_);
+				++save_depth_;
+				if(recorder_) recorder_->save();
+				if(collect_stats_) ++stats_.saves;
+			}
+			void restore() {
+				// Held fills were made inside any clip this removes.
+				if(!clip_depths_.empty() && clip_depths_.back() == save_depth_) {
+					flush();
+					while(!clip_depths_.empty() && clip_depths_.back() == save_depth_) {
+						clip_depths_.pop_back();
+					}
+				}
+				--save_depth_;
+				cairo_restore(cairo_);
+				if(recorder_) recorder_->restore();
+			}
+			// CAIRO_CONTENT_ALPHA gives an A8 surface, a quarter of the size, for 
+			// groups where only coverage matters, e.g. masks. The recorder doesn't
+			// keep the content, so those aren't pushed while recording.
+			void push_group(cairo_content_t content=CAIRO_CONTENT_COLOR_ALPHA) {
+				flush();
+				if(collect_stats_) {
+					++stats_.groups_pushed;
+					stats_.surface_bytes += group_surface_bytes(content == CAIRO_CONTENT_ALPHA ? 1 : 4);
+				}
+				cairo_push_group_with_content(cairo_, content);
+				if(recorder_) recorder_->push_group();
+			}
+			// Composite the group onto what was there before.
+			void pop_group_and_paint(double alpha) {
+				flush();
+				cairo_pop_group_to_source(cairo_);
+				cairo_paint_with_alpha(cairo_, alpha);
+				if(recorder_) recorder_->pop_group(true, alpha);
+			}
+			// Hands the group to the caller to draw, e.g. after filtering it. The 
+			// recorder sees it painted unchanged, so callers drawing it any other way
+			// must call not_recordable(). The caller must destroy it.
+			cairo_pattern_t* pop_group() {
+				flush();
+				if(recorder_) recorder_->pop_group(true, 1.0);
+				return cairo_pop_group(cairo_);
+			}
+			void pop_group_and_discard() {
+				flush();
+				cairo_pattern_destroy(cairo_pop_group(cairo_));
+				if(recorder_) recorder_->pop_group(false, 0);
+			}
+			void fill_preserve() {
+				flush();
+				if(recorder_) recorder_->fill(cairo_);
+				if(collect_stats_) ++stats_.fills;
+				cairo_fill_preserve(cairo_);
+			}
+			// Fills and clears the current path. With fill batching on, the fill may 
+			// be held back and done along with following ones.
+			void fill() {
+				if(batch_fills_ && recorder_ == nullptr) {
+					bool merged;
+					if(batch_.add(cairo_, &merged)) {
+						if(collect_stats_) {
+							++(merged ? stats_.fills_batched : stats_.fills);
+						}
+						return;
+					}
+				}
+				fill_preserve();
+				cairo_new_path(cairo_);
+			}
+			void stroke() {
+				flush();
+				if(recorder_) recorder_->stroke(cairo_);
+				if(collect_stats_) ++stats_.strokes;
+				cairo_stroke(cairo_);
+			}
+			void clip() {
+				flush();
+				if(batch_fills_) {
+					clip_depths_.push_back(save_depth_);
+				}
+				if(recorder_) recorder_->clip(cairo_);
+				cairo_clip(cairo_);
+			}
+			// Draws any fills being held back. Anything that draws through a context
+			// with fill batching on must call this before using what was drawn, 
+			// parse::render_leave() does.
+			void flush() {
+				if(!batch_.empty()) {
+					batch_.flush(cairo_);
+				}
+			}
+			void begin_element(const std::string& id) {
+				if(recorder_ && !id.empty()) recorder_->begin_element(id);
+			}
+			void end_element(const std::string& id) {
+				if(recorder_ && !id.empty()) recorder_->end_element(id);
+			}
+
+			render_recorder* recorder() const { return recorder_; }
+
+			bool stats_enabled() const { return collect_stats_; }
+			void enable_stats(bool en) { collect_stats_ = en; }
+			const render_stats& stats() const { return stats_; }
+			void reset_stats() { stats_ = render_stats(); }
+			void count_element() { if(collect_stats_) ++stats_.elements_visited; }
+			void count_culled() { if(collect_stats_) ++stats_.elements_culled; }
+			void count_path_segments(size_t n) { if(collect_stats_) stats_.path_segments += static_cast<unsigned>(n); }
+			void count_glyphs(size_t n) { if(collect_stats_) stats_.glyphs += static_cast<unsigned>(n); }
+			void count_rectangle_clip() { if(collect_stats_) ++stats_.rectangle_clips; }
+			void count_clip_mask(bool reused) { if(collect_stats_) ++(reused ? stats_.clip_masks_reused : stats_.clip_masks_built); }
+			void count_markers(size_t n) { if(collect_stats_) stats_.markers += static_cast<unsigned>(n); }
+			void count_marker_image() { if(collect_stats_) ++stats_.marker_images; }
+			void count_filter(uint64_t pixels) { 
+				if(collect_stats_) {
+					++stats_.filters;
+					stats_.filter_pixels += pixels;
+				}
+			}
+			void set_recorder(render_recorder* rec) { recorder_ = rec; }
+			// Tells the recorder, if any, that what's being drawn can't be recorded.
+			void not_recordable(const std::string& what) {
+				if(recorder_) {
+					recorder_->unsupported(what);
+				}
+			}
 			
 			void fill_color_push(const paint_ptr& p) {
 				fill_color_stack_.emplace(p);
@@ -115,6 +367,13 @@ namespace KRE
 			double opacity_top() const {
 				return opacity_stack_.top();
 			}
+
+			void markers_push(const marker_set& m) { marker_stack_.push(m); }
+			void markers_pop() { marker_stack_.pop(); }
+			// The markers shapes should draw, nullptr for none.
+			const marker_set* markers_top() const {
+				return marker_stack_.empty() || marker_stack_.top().empty() ? nullptr : &marker_stack_.top();
+			}
 			ColorPtr get_current_color() const { return current_color_; }
 			void set_current_color(ColorPtr cc) { current_color_ = cc; }
 			unsigned width() const { return width_; }
@@ -132,12 +391,156 @@ namespace KRE
 			void set_text_xy(double x, double y) { text_x_ = x; text_y_ = y; }
 			double get_text_x() { return text_x_; }
 			double get_text_y() { return text_y_; }
+
+			// Whether to draw simplified paths when they're small, if the document
+			// was loaded with level of detail enabled.
+			bool use_level_of_detail() const { return use_level_of_detail_; }
+			void set_use_level_of_detail(bool en) { use_level_of_detail_ = en; }
+
+			// Merge runs of fills with the same solid colour that don't touch the same
+			// pixels into one cairo_fill(). Not used while recording.
+			bool batch_fills() const { return batch_fills_; }
+			void set_batch_fills(bool en) { 
+				flush();
+				batch_fills_ = en; 
+			}
+
+			// Threads the slower filter effects, like blurs, may split their work
+			// over, 0 for one per core. Set to 1 when documents are already being 
+			// rendered in parallel.
+			int filter_threads() const { return filter_threads_; }
+			void set_filter_threads(int n) { filter_threads_ = n; }
+			// Tracks the filters being drawn into, what's drawn under one can end up
+			// somewhere else entirely once filtered. Each keeps the bounding box of
+			// the geometry drawn under it, in the user space it was entered in.
+			void filter_enter() { 
+				filter_bounds fb;
+				cairo_get_matrix(cairo_, &fb.user_to_device);
+				filter_bounds_.push_back(fb);
+			}
+			// Returns false if nothing added to the bounding box, otherwise sets it.
+			// What's drawn under a filter is part of the bounding box of any filter
+			// it's in.
+			bool filter_leave(double* x1, double* y1, double* x2, double* y2) {
+				ASSERT_LOG(!filter_bounds_.empty(), "filter_leave() without filter_enter()");
+				const filter_bounds fb = filter_bounds_.back();
+				filter_bounds_.pop_back();
+				if(fb.x1 > fb.x2) {
+					return false;
+				}
+				if(!filter_bounds_.empty()) {
+					filter_bounds_.back().add(fb.user_to_device, fb.x1, fb.y1, fb.x2, fb.y2);
+				}
+				*x1 = fb.x1;
+				*y1 = fb.y1;
+				*x2 = fb.x2;
+				*y2 = fb.y2;
+				return true;
+			}
+			bool in_filter() const { return !filter_bounds_.empty(); }
+			// Adds the current path to the bounding box of the filters being drawn 
+			// into. Shapes call this whether or not they're painted, it's their 
+			// geometry that counts.
+			void add_filter_bounds() {
+				if(filter_bounds_.empty() || !cairo_has_current_point(cairo_)) {
+					return;
+				}
+				double x1, y1, x2, y2;
+				cairo_path_extents(cairo_, &x1, &y1, &x2, &y2);
+				cairo_matrix_t m;
+				cairo_get_matrix(cairo_, &m);
+				filter_bounds_.back().add(m, x1, y1, x2, y2);
+			}
+
+			// Sets the antialiasing and flattening tolerance of the cairo context
+			// to suit the quality, and the filter used for scaling images. Elements
+			// with a rendering hint adjust these for themselves, see apply_hint().
+			RenderQuality quality() const { return quality_; }
+			void set_quality(RenderQuality q) { 
+				quality_ = q; 
+				apply_hint(RenderingHint::AUTO);
+			}
+
+			// Sets the cairo antialiasing and tolerance for drawing with the given 
+			// hint, relative to the quality. In preview quality nothing is drawn 
+			// more accurately than the preview settings.
+			void apply_hint(RenderingHint hint) {
+				cairo_antialias_t aa = CAIRO_ANTIALIAS_DEFAULT;
+				double tolerance = 0.1;
+				switch(quality_) {
+					case RenderQuality::PREVIEW: aa = CAIRO_ANTIALIAS_FAST; tolerance = 0.5; break;
+					case RenderQuality::NORMAL: break;
+					case RenderQuality::BEST: aa = CAIRO_ANTIALIAS_BEST; tolerance = 0.05; break;
+				}
+				switch(hint) {
+					case RenderingHint::AUTO: break;
+					case RenderingHint::SPEED:
+						aa = CAIRO_ANTIALIAS_FAST;
+						tolerance = std::max(tolerance, 0.5);
+						break;
+					case RenderingHint::CRISP_EDGES:
+						aa = CAIRO_ANTIALIAS_NONE;
+						break;
+					case RenderingHint::PRECISION:
+						if(quality_ != RenderQuality::PREVIEW) {
+							aa = CAIRO_ANTIALIAS_BEST;
+							tolerance = std::min(tolerance, 0.05);
+						}
+						break;
+				}
+				cairo_set_antialias(cairo_, aa);
+				cairo_set_tolerance(cairo_, tolerance);
+			}
+
+			// text-rendering only applies to text, but is inherited through 
+			// everything else, so it's kept here until text is drawn.
+			void text_hint_push(RenderingHint hint) { text_hint_.push(hint); }
+			void text_hint_pop() { text_hint_.pop(); }
+			bool has_text_hint() const { return !text_hint_.empty(); }
+			RenderingHint text_hint() const { return text_hint_.empty() ? RenderingHint::AUTO : text_hint_.top(); }
+
+			// Likewise for image-rendering.
+			void image_hint_push(RenderingHint hint) { image_hint_.push(hint); }
+			void image_hint_pop() { image_hint_.pop(); }
+			RenderingHint image_hint() const { return image_hint_.empty() ? RenderingHint::AUTO : image_hint_.top(); }
+			// Filter to use for drawing scaled images.
+			cairo_filter_t image_filter() const {
+				const RenderingHint hint = image_hint();
+				if(quality_ == RenderQuality::PREVIEW || hint == RenderingHint::SPEED) {
+					return CAIRO_FILTER_FAST;
+				}
+				if(hint == RenderingHint::CRISP_EDGES) {
+					return CAIRO_FILTER_NEAREST;
+				}
+				return quality_ == RenderQuality::BEST || hint == RenderingHint::PRECISION ? CAIRO_FILTER_BEST : CAIRO_FILTER_GOOD;
+			}
 		private:
+			// cairo sizes a group's surface to the device space extents of the clip.
+			uint64_t group_surface_bytes(int bytes_per_pixel) const {
+				double x1, y1, x2, y2;
+				cairo_clip_extents(cairo_, &x1, &y1, &x2, &y2);
+				double xs[4] = { x1, x2, x1, x2 };
+				double ys[4] = { y1, y1, y2, y2 };
+				double dx1 = width_, dy1 = height_, dx2 = 0, dy2 = 0;
+				for(int n = 0; n != 4; ++n) {
+					cairo_user_to_device(cairo_, &xs[n], &ys[n]);
+					dx1 = std::min(dx1, xs[n]);
+					dy1 = std::min(dy1, ys[n]);
+					dx2 = std::max(dx2, xs[n]);
+					dy2 = std::max(dy2, ys[n]);
+				}
+				if(dx2 <= dx1 || dy2 <= dy1) {
+					return 0;
+				}
+				return static_cast<uint64_t>(std::ceil(dx2 - dx1)) * static_cast<uint64_t>(std::ceil(dy2 - dy1)) * bytes_per_pixel;
+			}
+
 			cairo_t* cairo_;
 			ColorPtr current_color_;
 			std::stack<paint_ptr> fill_color_stack_;
 			std::stack<paint_ptr> stroke_color_stack_;
 			std::stack<double> opacity_stack_;
+			std::stack<marker_set> marker_stack_;
 			font_attribs_set font_attributes_;
 			unsigned width_;
 			unsigned height_;
@@ -163,6 +566,51 @@ namespace KRE
 			std::stack<double> letter_spacing_;
 			double text_x_;
 			double text_y_;
+			bool use_level_of_detail_;
+			RenderQuality quality_;
+			std::stack<RenderingHint> text_hint_;
+			std::stack<RenderingHint> image_hint_;
+			render_recorder* recorder_;
+			bool collect_stats_;
+			render_stats stats_;
+			bool batch_fills_;
+			fill_batch batch_;
+			int filter_threads_;
+			struct filter_bounds {
+				filter_bounds() 
+					: x1(std::numeric_limits<double>::max()), y1(x1), 
+					  x2(-std::numeric_limits<double>::max()), y2(x2) 
+				{
+				}
+				// Adds a box in the user space given by user_to_device, as the box
+				// around its corners in this one's.
+				void add(const cairo_matrix_t& m, double bx1, double by1, double bx2, double by2) {
+					cairo_matrix_t from_device = user_to_device;
+					if(cairo_matrix_invert(&from_device) != CAIRO_STATUS_SUCCESS) {
+						// Nothing can be drawn under a filter in a degenerate space.
+						return;
+					}
+					cairo_matrix_t to_user;
+					cairo_matrix_multiply(&to_user, &m, &from_device);
+					const double xs[4] = { bx1, bx2, bx1, bx2 };
+					const double ys[4] = { by1, by1, by2, by2 };
+					for(int n = 0; n != 4; ++n) {
+						double x = xs[n], y = ys[n];
+						cairo_matrix_transform_point(&to_user, &x, &y);
+						x1 = std::min(x1, x);
+						y1 = std::min(y1, y);
+						x2 = std::max(x2, x);
+						y2 = std::max(y2, y);
+					}
+				}
+				cairo_matrix_t user_to_device;
+				double x1, y1, x2, y2;
+			};
+			// Innermost last.
+			std::vector<filter_bounds> filter_bounds_;
+			int save_depth_;
+			// Save depths at which clips were added while batching.
+			std::vector<int> clip_depths_;
 		};
 
 	}
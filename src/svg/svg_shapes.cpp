@@ -21,13 +21,19 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
+#include <cmath>
 #include <set>
 #include <cstdint>
+#include <typeinfo>
 
-#include "svg_shapes.hpp"
 #include "svg_element.hpp"
+#include "svg_marker.hpp"
+#include "svg_paint.hpp"
+#include "svg_parse.hpp"
+#include "svg_shapes.hpp"
 
 namespace KRE
 {
@@ -48,6 +54,63 @@ namespace KRE
 				return res;
 			}
 
+			// Whether the path is one closed subpath of four axis-aligned edges, if so
+			// gets its bounds.
+			bool path_rectangle(const std::vector<cairo_path_data_t>& data, double* x, double* y, double* w, double* h)
+			{
+				std::vector<std::pair<double, double>> pts;
+				bool closed = false;
+				for(size_t n = 0; n < data.size(); n += data[n].header.length) {
+					switch(data[n].header.type) {
+						case CAIRO_PATH_MOVE_TO:
+							// Allowed first, or last after the close, where cairo puts one.
+							if(!pts.empty() && !(closed && n + data[n].header.length == data.size())) {
+								return false;
+							}
+							if(pts.empty()) {
+								pts.emplace_back(data[n + 1].point.x, data[n + 1].point.y);
+							}
+							break;
+						case CAIRO_PATH_LINE_TO:
+							if(pts.empty() || closed) {
+								return false;
+							}
+							pts.emplace_back(data[n + 1].point.x, data[n + 1].point.y);
+							break;
+						case CAIRO_PATH_CLOSE_PATH:
+							closed = true;
+							break;
+						default:
+							return false;
+					}
+				}
+				if(pts.size() == 5 && pts[4] == pts[0]) {
+					pts.pop_back();
+				}
+				if(!closed || pts.size() != 4) {
+					return false;
+				}
+				// Edges alternating between horizontal and vertical.
+				bool prev_horizontal = false;
+				for(int n = 0; n != 4; ++n) {
+					const auto& a = pts[n];
+					const auto& b = pts[(n + 1) % 4];
+					const bool horizontal = a.second == b.second && a.first != b.first;
+					const bool vertical = a.first == b.first && a.second != b.second;
+					if(horizontal == vertical || (n > 0 && horizontal == prev_horizontal)) {
+						return false;
+					}
+					prev_horizontal = horizontal;
+				}
+				const double x1 = std::min(pts[0].first, pts[2].first);
+				const double y1 = std::min(pts[0].second, pts[2].second);
+				*x = x1;
+				*y = y1;
+				*w = std::max(pts[0].first, pts[2].first) - x1;
+				*h = std::max(pts[0].second, pts[2].second) - y1;
+				return true;
+			}
+
 			point_list create_point_list(const std::string& s)
 			{
 				auto res = parse_list_of_lengths(s);
@@ -81,13 +144,18 @@ namespace KRE
 		}
 
 		shape::shape(element* doc, const ptree& pt)
-				: container(doc, pt)
+				: container(doc, pt),
+				  lod_tolerance_(0),
+				  baked_(false)
 		{
+			cairo_matrix_init_identity(&paint_matrix_);
+			// Decoding is left until the path is first needed, so paths that are
+			// never drawn never cost more than their text.
 			auto attributes = pt.get_child_optional("<xmlattr>");
 			if(attributes) {
 				auto dpath = attributes->get_child_optional("d");
-				if(dpath && !dpath->data().empty()) {
-					path_ = parse_path(dpath->data());
+				if(dpath) {
+					path_data_ = dpath->data();
 				}
 			}
 		}
@@ -106,26 +174,180 @@ namespace KRE
 			clip_render_path(ctx);
 		}
 
+		bool shape::handle_clip_rectangle(double* x, double* y, double* w, double* h) const
+		{
+			// The other shapes draw from their own attributes rather than the path.
+			if(typeid(*this) != typeid(shape) || !elements().empty()) {
+				return false;
+			}
+			auto path = geometry();
+			return path && path_rectangle(path->data(), x, y, w, h);
+		}
+
+		int shape::handle_clip_complexity() const
+		{
+			if(!elements().empty()) {
+				return -1;
+			}
+			// The other shapes only add a few segments of their own.
+			auto path = geometry();
+			return 4 + (path ? static_cast<int>(path->data().size()) : 0);
+		}
+
+		void shape::handle_memory_usage(memory_report* mr) const
+		{
+			container::handle_memory_usage(mr);
+			// Don't decode just to measure, report what's held now.
+			mr->path_geometry += string_heap_bytes(path_data_);
+			if(mr->first_visit(path_.get())) {
+				mr->path_geometry += sizeof(path_geometry) + shared_count_bytes + path_->heap_bytes();
+			}
+		}
+
+		void shape::handle_build_level_of_detail(double pixel_tolerance)
+		{
+			container::handle_build_level_of_detail(pixel_tolerance);
+			// Still single threaded here. If the path hasn't been decoded yet the 
+			// levels are built when it is.
+			lod_tolerance_ = pixel_tolerance;
+			if(path_) {
+				path_->build_level_of_detail(pixel_tolerance);
+			}
+		}
+
+		void shape::handle_decode_geometry() const
+		{
+			container::handle_decode_geometry();
+			geometry();
+		}
+
+		void shape::handle_optimise_tree(tree_report* report)
+		{
+			// The other shapes draw from their own attributes rather than the path.
+			// Anything with an id may be drawn through a use inside a clipPath, which
+			// ignores transforms.
+			if(typeid(*this) != typeid(shape) || !has_transforms() || !id().empty() || has_user_space_effects()) {
+				return;
+			}
+			if(path_data_.empty() && path_ == nullptr) {
+				return;
+			}
+			cairo_matrix_t mat = transform::to_matrix(transforms());
+			cairo_matrix_t inverse = mat;
+			if(cairo_matrix_invert(&inverse) != CAIRO_STATUS_SUCCESS) {
+				return;
+			}
+			// Still single threaded here. If the path hasn't been decoded yet the
+			// transform is applied when it is.
+			if(path_) {
+				path_ = std::make_shared<path_geometry>(*path_, mat);
+			}
+			paint_matrix_ = mat;
+			baked_ = true;
+			clear_transforms();
+			++report->transforms_baked;
+		}
+
+		const path_geometry* shape::geometry() const
+		{
+			std::call_once(decoded_, &shape::decode, this);
+			return path_.get();
+		}
+
+		void shape::decode() const
+		{
+			if(path_data_.empty()) {
+				return;
+			}
+			auto geom = std::make_shared<path_geometry>(parse_path(path_data_));
+			if(baked_) {
+				geom = std::make_shared<path_geometry>(*geom, paint_matrix_);
+			}
+			if(lod_tolerance_ > 0) {
+				geom->build_level_of_detail(lod_tolerance_);
+			}
+			path_ = geom;
+			std::string().swap(path_data_);
+		}
+
+		void shape::marker_vertices(render_context& ctx, std::vector<marker_vertex>* vertices) const
+		{
+			if(handle_accepts_markers() && ctx.markers_top() != nullptr) {
+				path_marker_vertices(ctx.cairo(), vertices);
+			}
+		}
+
 		void shape::stroke_and_fill(render_context& ctx) const
 		{
+			// Taken first, filling and stroking clear the path.
+			std::vector<marker_vertex> vertices;
+			marker_vertices(ctx, &vertices);
+			ctx.add_filter_bounds();
+
 			auto fc = ctx.fill_color_top();
+			auto sc = ctx.stroke_color_top();
+			const bool stroked = sc && !sc->is_none();
 			if(fc && fc->apply(parent(), ctx)) {
-				cairo_fill_preserve(ctx.cairo());
+				// Without a stroke to follow, the fill can be batched.
+				if(stroked) {
+					ctx.fill_preserve();
+				} else {
+					ctx.fill();
+				}
 			}
-			auto sc = ctx.stroke_color_top();
-			if(sc && sc->apply(parent(), ctx)) {
-				cairo_stroke(ctx.cairo());
+			if(stroked && sc->apply(parent(), ctx)) {
+				ctx.stroke();
 			}
 			// Clear the current path, regardless
 			cairo_new_path(ctx.cairo());
+			draw_markers(ctx, vertices);
+		}
+
+		bool shape::outside_clip(render_context& ctx) const
+		{
+			// A recording has to be replayable at any size, so keep everything.
+			// Markers can reach well outside the path and filters can move it, e.g.
+			// feOffset or a blur.
+			if(ctx.recorder() != nullptr || ctx.markers_top() != nullptr || ctx.in_filter()) {
+				return false;
+			}
+			double x1, y1, x2, y2;
+			if(!geometry()->bounds(&x1, &y1, &x2, &y2)) {
+				return false;
+			}
+			// Allow for the stroke, a miter join can stick out by up to half the
+			// miter limit times the line width and the corners of a square cap by
+			// half the diagonal, whatever the join.
+			double grow = cairo_get_line_width(ctx.cairo()) * std::max(M_SQRT2, cairo_get_miter_limit(ctx.cairo())) / 2.0;
+			if(baked_) {
+				// The line width is in the original user space, this is at least the 
+				// largest it gets scaled by.
+				const cairo_matrix_t& m = paint_matrix_;
+				grow *= std::sqrt(m.xx*m.xx + m.yx*m.yx + m.xy*m.xy + m.yy*m.yy);
+			}
+			double cx1, cy1, cx2, cy2;
+			cairo_clip_extents(ctx.cairo(), &cx1, &cy1, &cx2, &cy2);
+			return x2 + grow < cx1 || x1 - grow > cx2 || y2 + grow < cy1 || y1 - grow > cy2;
 		}
 
 		void shape::render_path(render_context& ctx) const 
 		{
-			if(!path_.empty()) {
-				path_cmd_context path_ctx(ctx.cairo());
-				for(auto p : path_) {
-					p->cairo_render(path_ctx);
+			auto path = geometry();
+			if(path && !path->empty()) {
+				if(outside_clip(ctx)) {
+					ctx.count_culled();
+					return;
+				}
+				ctx.count_path_segments(path->append_to(ctx.cairo(), ctx.use_level_of_detail()));
+				if(baked_) {
+					// cairo has the path in device space now, so this only changes how
+					// the stroke, paint servers and markers are drawn. Markers may be 
+					// inherited from an ancestor, which the bake couldn't see.
+					auto fc = ctx.fill_color_top();
+					auto sc = ctx.stroke_color_top();
+					if((sc && !sc->is_none()) || (fc && fc->uses_paint_server()) || ctx.markers_top() != nullptr) {
+						cairo_transform(ctx.cairo(), &paint_matrix_);
+					}
 				}
 				stroke_and_fill(ctx);
 			}
@@ -133,12 +355,10 @@ namespace KRE
 
 		void shape::clip_render_path(render_context& ctx) const
 		{
-			if(!path_.empty()) {
-				path_cmd_context path_ctx(ctx.cairo());
-				for(auto p : path_) {
-					p->cairo_render(path_ctx);
-				}
-				cairo_clip(ctx.cairo());
+			auto path = geometry();
+			if(path && !path->empty()) {
+				path->append_to(ctx.cairo());
+				ctx.clip();
 			}
 		}
 
@@ -191,7 +411,7 @@ namespace KRE
 		void circle::handle_clip_render(render_context& ctx) const
 		{
 			render_circle(ctx);
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			shape::clip_render_path(ctx);
 		}
 
@@ -235,12 +455,12 @@ namespace KRE
 			double rx = rx_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
 			double ry = ry_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
 
-			cairo_save(ctx.cairo());
+			ctx.save();
 			cairo_translate(ctx.cairo(), cx+rx, cy+ry);
 			cairo_scale(ctx.cairo(), rx, ry);
 			cairo_arc_negative(ctx.cairo(), 0.0, 0.0, 1.0, 0.0, 2*M_PI);
 			stroke_and_fill(ctx);
-			cairo_restore(ctx.cairo());
+			ctx.restore();
 
 			shape::render_path(ctx);
 		}
@@ -252,12 +472,12 @@ namespace KRE
 			double rx = rx_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
 			double ry = ry_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
 
-			cairo_save(ctx.cairo());
+			ctx.save();
 			cairo_translate(ctx.cairo(), cx+rx, cy+ry);
 			cairo_scale(ctx.cairo(), rx, ry);
 			cairo_arc_negative(ctx.cairo(), 0.0, 0.0, 1.0, 0.0, 2*M_PI);
-			cairo_clip(ctx.cairo());	// XXX this may not be correct, since cairo_restore will kill the clip-path
-			cairo_restore(ctx.cairo());
+			ctx.clip();	// XXX this may not be correct, since cairo_restore will kill the clip-path
+			ctx.restore();
 
 			shape::clip_render_path(ctx);
 		}
@@ -325,10 +545,22 @@ namespace KRE
 		void rectangle::handle_clip_render(render_context& ctx) const
 		{
 			render_rectangle(ctx);
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			shape::clip_render_path(ctx);
 		}
 
+		bool rectangle::handle_clip_rectangle(double* x, double* y, double* w, double* h) const
+		{
+			if(is_rounded_ || !elements().empty()) {
+				return false;
+			}
+			*x = x_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			*y = y_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			*w = width_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			*h = height_.value_in_specified_units(svg_length::SVG_LENGTHTYPE_NUMBER);
+			return *w > 0 && *h > 0;
+		}
+
 		polygon::polygon(element* doc, const ptree& pt) 
 			: shape(doc, pt)
 		{
@@ -345,6 +577,12 @@ namespace KRE
 		{
 		}
 
+		void polygon::handle_memory_usage(memory_report* mr) const
+		{
+			shape::handle_memory_usage(mr);
+			mr->path_geometry += vector_heap_bytes(points_);
+		}
+
 		void polygon::render_polygon(render_context& ctx) const
 		{
 			auto it = points_.begin();
@@ -370,7 +608,7 @@ namespace KRE
 		void polygon::handle_clip_render(render_context& ctx) const
 		{
 			render_polygon(ctx);
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			shape::clip_render_path(ctx);
 		}
 
@@ -425,6 +663,13 @@ namespace KRE
 		{
 		}
 
+		void text::handle_memory_usage(memory_report* mr) const
+		{
+			shape::handle_memory_usage(mr);
+			mr->text += string_heap_bytes(text_) + vector_heap_bytes(x1_) + vector_heap_bytes(y1_) 
+				+ vector_heap_bytes(dx_) + vector_heap_bytes(dy_) + vector_heap_bytes(rotate_);
+		}
+
 		void text::render_text(render_context& ctx) const
 		{
 			attribute_manager ta1(ta(), ctx);
@@ -454,6 +699,10 @@ namespace KRE
 				} 
 				y += extent.y_advance;
 			}
+			ctx.count_glyphs(glyphs.size());
+			if(ctx.has_text_hint()) {
+				ctx.apply_hint(ctx.text_hint());
+			}
 			cairo_glyph_path(ctx.cairo(), &glyphs[0], static_cast<int>(glyphs.size()));
 			stroke_and_fill(ctx);
 			ctx.set_text_xy(x, y);
@@ -473,7 +722,7 @@ namespace KRE
 			if(!text_.empty()) {
 				render_text(ctx);
 			}
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			clip_render_children(ctx);
 			shape::clip_render_path(ctx);
 		}
@@ -524,10 +773,15 @@ namespace KRE
 		void line::handle_render(render_context& ctx) const
 		{
 			render_line(ctx);
+			std::vector<marker_vertex> vertices;
+			marker_vertices(ctx, &vertices);
+			ctx.add_filter_bounds();
 			auto sc = ctx.stroke_color_top();
 			if(sc && sc->apply(parent(), ctx)) {
-				cairo_stroke(ctx.cairo());
+				ctx.stroke();
 			}
+			cairo_new_path(ctx.cairo());
+			draw_markers(ctx, vertices);
 			shape::render_path(ctx);
 		}
 
@@ -535,7 +789,7 @@ namespace KRE
 		{
 			// XXX
 			render_line(ctx);
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			shape::clip_render_path(ctx);
 		}
 
@@ -555,6 +809,12 @@ namespace KRE
 		{
 		}
 
+		void polyline::handle_memory_usage(memory_report* mr) const
+		{
+			shape::handle_memory_usage(mr);
+			mr->path_geometry += vector_heap_bytes(points_);
+		}
+
 		void polyline::render_polyline(render_context& ctx) const
 		{
 			bool is_first = true;
@@ -580,7 +840,7 @@ namespace KRE
 		void polyline::handle_clip_render(render_context& ctx) const
 		{
 			render_polyline(ctx);
-			cairo_clip(ctx.cairo());
+			ctx.clip();
 			shape::clip_render_path(ctx);
 		}
 	}
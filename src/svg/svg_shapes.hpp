@@ -24,6 +24,7 @@
 #pragma once
 
 #include <boost/property_tree/ptree.hpp>
+#include <mutex>
 #include <set>
 #include "svg_container.hpp"
 #include "svg_fwd.hpp"
@@ -44,11 +45,42 @@ namespace KRE
 		protected:
 			void render_path(render_context& ctx) const;
 			void clip_render_path(render_context& ctx) const;
+			// Fills and strokes the current path, then draws any markers on it.
 			void stroke_and_fill(render_context& ctx) const;
+			// Gets the vertices of the current path for the markers in effect, 
+			// leaving vertices empty if there are none to draw.
+			void marker_vertices(render_context& ctx, std::vector<marker_vertex>* vertices) const;
+			void handle_memory_usage(memory_report* mr) const override;
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			virtual void handle_render(render_context& ctx) const override;
 			virtual void handle_clip_render(render_context& ctx) const override;
-			std::vector<path_commandPtr> path_;
+			bool handle_clip_rectangle(double* x, double* y, double* w, double* h) const override;
+			int handle_clip_complexity() const override;
+			// Whether markers are drawn on the shape's vertices, only path, line, 
+			// polyline and polygon take them.
+			virtual bool handle_accepts_markers() const { return true; }
+			void handle_build_level_of_detail(double pixel_tolerance) override;
+			void handle_decode_geometry() const override;
+			void handle_optimise_tree(tree_report* report) override;
+			// Whether the path, including any stroke, can't touch the clip region.
+			bool outside_clip(render_context& ctx) const;
+			// The path, decoded from path_data_ on the first call. Safe to call from
+			// multiple renders at once.
+			const path_geometry* geometry() const;
+			void decode() const;
+
+			mutable std::once_flag decoded_;
+			// The d attribute as written, released once it has been decoded. 
+			mutable std::string path_data_;
+			mutable path_geometry_ptr path_;
+			// Tolerance to build levels of detail with once decoded, 0 for none.
+			double lod_tolerance_;
+			// Set if the element's transform has been applied to the path, which is
+			// then in its parent's user space. The stroke and any gradient still need
+			// drawing in the original user space, paint_matrix_ gets back to it.
+			bool baked_;
+			cairo_matrix_t paint_matrix_;
 		};
 
 		class rectangle : public shape
@@ -57,9 +89,12 @@ namespace KRE
 			rectangle(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~rectangle();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_rectangle(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			bool handle_clip_rectangle(double* x, double* y, double* w, double* h) const override;
+			bool handle_accepts_markers() const override { return false; }
 			svg_length x_;
 			svg_length y_;
 			svg_length rx_;
@@ -75,9 +110,11 @@ namespace KRE
 			circle(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~circle();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_circle(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			bool handle_accepts_markers() const override { return false; }
 			svg_length cx_;
 			svg_length cy_;
 			svg_length radius_;
@@ -89,8 +126,10 @@ namespace KRE
 			ellipse(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~ellipse();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			bool handle_accepts_markers() const override { return false; }
 			svg_length cx_;
 			svg_length cy_;
 			svg_length rx_;
@@ -103,6 +142,7 @@ namespace KRE
 			line(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~line();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_line(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
@@ -118,9 +158,11 @@ namespace KRE
 			polyline(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~polyline();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_polyline(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			void handle_memory_usage(memory_report* mr) const override;
 			point_list points_;
 		};
 
@@ -130,9 +172,11 @@ namespace KRE
 			polygon(element* doc, const boost::property_tree::ptree& pt);
 			virtual ~polygon();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_polygon(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			void handle_memory_usage(memory_report* mr) const override;
 			point_list points_;
 		};
 
@@ -142,9 +186,13 @@ namespace KRE
 			text(element* doc, const boost::property_tree::ptree& pt, bool is_tspan=false);
 			virtual ~text();
 		private:
+			size_t handle_node_size() const override { return sizeof(*this); }
 			void render_text(render_context& ctx) const;
 			void handle_render(render_context& ctx) const override;
 			void handle_clip_render(render_context& ctx) const override;
+			int handle_clip_complexity() const override { return -1; }
+			bool handle_accepts_markers() const override { return false; }
+			void handle_memory_usage(memory_report* mr) const override;
 			std::string text_;
 			std::vector<svg_length> x1_;
 			std::vector<svg_length> y1_;
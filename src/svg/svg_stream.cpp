@@ -0,0 +1,517 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <boost/property_tree/ptree.hpp>
+#include <cstring>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "svg_container.hpp"
+#include "svg_parse.hpp"
+#include "svg_stream.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		using namespace boost::property_tree;
+
+		namespace
+		{
+			// Pull style tokeniser for the subset of XML found in SVG files. Produces
+			// the same names and decoded values as boost's read_xml(), one tag at a
+			// time.
+			class xml_reader
+			{
+			public:
+				enum Token {
+					TOKEN_END_OF_FILE,
+					TOKEN_START,
+					TOKEN_END,
+					TOKEN_TEXT,
+				};
+				typedef std::vector<std::pair<std::string, std::string>> attribute_list;
+
+				xml_reader(const std::string& filename, const char* begin, const char* end) 
+					: filename_(filename), p_(begin), end_(end), self_closing_(false) 
+				{}
+
+				Token next() {
+					if(p_ == end_) {
+						return TOKEN_END_OF_FILE;
+					}
+					if(*p_ != '<') {
+						const char* start = p_;
+						while(p_ != end_ && *p_ != '<') {
+							++p_;
+						}
+						text_.clear();
+						decode(start, p_, &text_);
+						return TOKEN_TEXT;
+					}
+					if(starts_with("<?")) {
+						skip_past("?>");
+						return next();
+					}
+					if(starts_with("<!--")) {
+						skip_past("-->");
+						return next();
+					}
+					if(starts_with("<![CDATA[")) {
+						p_ += 9;
+						const char* start = p_;
+						skip_past("]]>");
+						text_.assign(start, p_ - 3);
+						return TOKEN_TEXT;
+					}
+					if(starts_with("<!")) {
+						// DOCTYPE, possibly with an internal subset in brackets.
+						int depth = 0;
+						for(; p_ != end_; ++p_) {
+							if(*p_ == '[') {
+								++depth;
+							} else if(*p_ == ']') {
+								--depth;
+							} else if(*p_ == '>' && depth == 0) {
+								++p_;
+								break;
+							}
+						}
+						return next();
+					}
+					if(starts_with("</")) {
+						p_ += 2;
+						read_name(&name_);
+						skip_space();
+						expect('>');
+						return TOKEN_END;
+					}
+
+					++p_;
+					read_name(&name_);
+					attributes_.clear();
+					self_closing_ = false;
+					for(;;) {
+						skip_space();
+						ASSERT_LOG(p_ != end_, "Unexpected end of file in tag '" << name_ << "' in " << filename_);
+						if(*p_ == '>') {
+							++p_;
+							break;
+						}
+						if(*p_ == '/') {
+							++p_;
+							expect('>');
+							self_closing_ = true;
+							break;
+						}
+						std::string attr_name;
+						read_name(&attr_name);
+						skip_space();
+						expect('=');
+						skip_space();
+						ASSERT_LOG(p_ != end_ && (*p_ == '"' || *p_ == '\''), "Expected quoted value for attribute '" << attr_name << "' in " << filename_);
+						const char quote = *p_++;
+						const char* start = p_;
+						while(p_ != end_ && *p_ != quote) {
+							++p_;
+						}
+						ASSERT_LOG(p_ != end_, "Unterminated value for attribute '" << attr_name << "' in " << filename_);
+						std::string value;
+						decode(start, p_, &value);
+						++p_;
+						attributes_.emplace_back(attr_name, value);
+					}
+					return TOKEN_START;
+				}
+
+				const std::string& name() const { return name_; }
+				const attribute_list& attributes() const { return attributes_; }
+				bool self_closing() const { return self_closing_; }
+				const std::string& text() const { return text_; }
+				const std::string& filename() const { return filename_; }
+
+				const std::string* attribute(const char* name) const {
+					for(auto& a : attributes_) {
+						if(a.first == name) {
+							return &a.second;
+						}
+					}
+					return nullptr;
+				}
+			private:
+				bool starts_with(const char* s) const {
+					const size_t len = std::strlen(s);
+					return static_cast<size_t>(end_ - p_) >= len && std::memcmp(p_, s, len) == 0;
+				}
+
+				void skip_past(const char* s) {
+					const size_t len = std::strlen(s);
+					while(p_ != end_ && !starts_with(s)) {
+						++p_;
+					}
+					ASSERT_LOG(p_ != end_, "Expected '" << s << "' before end of file in " << filename_);
+					p_ += len;
+				}
+
+				void skip_space() {
+					while(p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n')) {
+						++p_;
+					}
+				}
+
+				void expect(char c) {
+					ASSERT_LOG(p_ != end_ && *p_ == c, "Expected '" << c << "' in " << filename_);
+					++p_;
+				}
+
+				void read_name(std::string* name) {
+					const char* start = p_;
+					while(p_ != end_ && !std::strchr(" \t\r\n/>=", *p_)) {
+						++p_;
+					}
+					ASSERT_LOG(p_ != start, "Expected a name in " << filename_);
+					name->assign(start, p_);
+				}
+
+				static void append_utf8(unsigned cp, std::string* out) {
+					if(cp < 0x80) {
+						out->push_back(static_cast<char>(cp));
+					} else if(cp < 0x800) {
+						out->push_back(static_cast<char>(0xc0 | (cp >> 6)));
+						out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+					} else if(cp < 0x10000) {
+						out->push_back(static_cast<char>(0xe0 | (cp >> 12)));
+						out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+						out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+					} else {
+						out->push_back(static_cast<char>(0xf0 | (cp >> 18)));
+						out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3f)));
+						out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3f)));
+						out->push_back(static_cast<char>(0x80 | (cp & 0x3f)));
+					}
+				}
+
+				// Replaces the predefined and numeric character references.
+				static void decode(const char* p, const char* end, std::string* out) {
+					out->reserve(out->size() + (end - p));
+					while(p != end) {
+						if(*p != '&') {
+							out->push_back(*p++);
+							continue;
+						}
+						const char* semi = p;
+						while(semi != end && *semi != ';' && semi - p < 12) {
+							++semi;
+						}
+						if(semi == end || *semi != ';') {
+							out->push_back(*p++);
+							continue;
+						}
+						const std::string ent(p + 1, semi);
+						if(ent == "amp") {
+							out->push_back('&');
+						} else if(ent == "lt") {
+							out->push_back('<');
+						} else if(ent == "gt") {
+							out->push_back('>');
+						} else if(ent == "quot") {
+							out->push_back('"');
+						} else if(ent == "apos") {
+							out->push_back('\'');
+						} else if(ent.size() > 1 && ent[0] == '#') {
+							const bool hex = ent[1] == 'x' || ent[1] == 'X';
+							append_utf8(static_cast<unsigned>(std::strtoul(ent.c_str() + (hex ? 2 : 1), nullptr, hex ? 16 : 10)), out);
+						} else {
+							out->append(p, semi + 1);
+						}
+						p = semi + 1;
+					}
+				}
+
+				std::string filename_;
+				const char* p_;
+				const char* end_;
+				std::string name_;
+				attribute_list attributes_;
+				bool self_closing_;
+				std::string text_;
+			};
+
+			// Just the attributes of the current start tag.
+			ptree attribute_node(const xml_reader& rd)
+			{
+				ptree node;
+				if(!rd.attributes().empty()) {
+					ptree attrs;
+					for(auto& a : rd.attributes()) {
+						attrs.push_back(std::make_pair(a.first, ptree(a.second)));
+					}
+					node.push_back(std::make_pair("<xmlattr>", attrs));
+				}
+				return node;
+			}
+
+			// The whole subtree of the current start tag, in the form read_xml() gives.
+			ptree subtree_node(xml_reader& rd, unsigned* count)
+			{
+				ptree node = attribute_node(rd);
+				++*count;
+				if(rd.self_closing()) {
+					return node;
+				}
+				const std::string name = rd.name();
+				for(;;) {
+					switch(rd.next()) {
+						case xml_reader::TOKEN_START: {
+							const std::string child_name = rd.name();
+							node.push_back(std::make_pair(child_name, subtree_node(rd, count)));
+							break;
+						}
+						case xml_reader::TOKEN_TEXT:
+							node.data() += rd.text();
+							break;
+						case xml_reader::TOKEN_END:
+							ASSERT_LOG(rd.name() == name, "Mismatched end tag '" << rd.name() << "' for '" << name << "' in " << rd.filename());
+							return node;
+						case xml_reader::TOKEN_END_OF_FILE:
+							ASSERT_LOG(false, "Unexpected end of file inside '" << name << "' in " << rd.filename());
+					}
+				}
+			}
+
+			// Before an element is built, whether it's one of those whose 
+			// is_definition() is set. Keep in step with the handle_is_definition() 
+			// overrides.
+			bool is_definition_name(const std::string& name)
+			{
+				return name == "defs" || name == "clipPath" || name == "mask" || name == "marker" || name == "filter";
+			}
+
+			// Stands in for the root of the tree. Every element is created with this
+			// as its parent, so all references are looked up here, in what has been
+			// kept so far.
+			class stream_root : public element
+			{
+			public:
+				stream_root() : element(nullptr, ptree()) {}
+				void retain(const element_ptr& e) { retained_.emplace_back(e); }
+				size_t retained() const { return retained_.size(); }
+				const std::set<std::string>& missing() const { return missing_; }
+				void resolve_retained() {
+					for(auto& e : retained_) {
+						e->resolve();
+					}
+				}
+			private:
+				element_ptr handle_find_child(const std::string& id) const override {
+					for(auto& e : retained_) {
+						if(e->id() == id) {
+							return e;
+						}
+						auto child = e->find_child(id);
+						if(child) {
+							return child;
+						}
+					}
+					missing_.insert(id);
+					return element_ptr();
+				}
+				void handle_render(render_context& ctx) const override {}
+				void handle_clip_render(render_context& ctx) const override {}
+				size_t handle_node_size() const override { return sizeof(*this); }
+
+				std::vector<element_ptr> retained_;
+				mutable std::set<std::string> missing_;
+			};
+
+			// Reads the file drawing as it goes. If keep_definitions is false they
+			// were already collected by collect_referenced().
+			void render_pass(xml_reader& rd, render_context& ctx, stream_root* root, bool keep_definitions, stream_result* res)
+			{
+				xml_reader::Token tok;
+				while((tok = rd.next()) != xml_reader::TOKEN_START) {
+					ASSERT_LOG(tok != xml_reader::TOKEN_END_OF_FILE, "No root element in " << rd.filename());
+				}
+				ASSERT_LOG(rd.name() == "svg", "Root element is '" << rd.name() << "' not 'svg' in " << rd.filename());
+				// create_child() doesn't make roots, see element::factory().
+				element_ptr doc(new svg(root, attribute_node(rd)));
+				ASSERT_LOG(doc != nullptr, "Unable to create the root element for " << rd.filename());
+				if(rd.self_closing()) {
+					return;
+				}
+				doc->resolve();
+
+				parse::render_enter(ctx);
+				doc->render_enter(ctx);
+				doc->children_enter(ctx);
+				std::vector<element_ptr> open(1, doc);
+				while(!open.empty()) {
+					tok = rd.next();
+					if(tok == xml_reader::TOKEN_START) {
+						const std::string name = rd.name();
+						if(name == "g" && !rd.self_closing()) {
+							element_ptr g = container::create_child(root, name, attribute_node(rd));
+							g->resolve();
+							g->render_enter(ctx);
+							g->children_enter(ctx);
+							open.emplace_back(g);
+							res->max_depth = std::max(res->max_depth, static_cast<unsigned>(open.size() - 1));
+							continue;
+						}
+						unsigned count = 0;
+						element_ptr e = container::create_child(root, name, subtree_node(rd, &count));
+						res->largest_subtree = std::max(res->largest_subtree, count);
+						if(!e) {
+							continue;
+						}
+						if(e->is_definition()) {
+							if(keep_definitions) {
+								e->resolve();
+								root->retain(e);
+							}
+						} else {
+							e->resolve();
+							e->render(ctx);
+							++res->elements_rendered;
+						}
+					} else if(tok == xml_reader::TOKEN_END) {
+						open.back()->children_leave(ctx);
+						open.back()->render_leave(ctx);
+						open.pop_back();
+					} else if(tok == xml_reader::TOKEN_END_OF_FILE) {
+						ASSERT_LOG(false, "Unexpected end of file, " << open.size() << " elements not closed in " << rd.filename());
+					}
+				}
+				parse::render_leave(ctx);
+			}
+
+			// Adds the id referred to by an attribute value, if any, to ids.
+			void add_references(const std::string& name, const std::string& value, std::set<std::string>* ids)
+			{
+				if((name == "xlink:href" || name == "href") && !value.empty() && value[0] == '#') {
+					ids->insert(value.substr(1));
+				}
+				for(size_t pos = value.find("url(#"); pos != std::string::npos; pos = value.find("url(#", pos)) {
+					pos += 5;
+					const size_t close = value.find(')', pos);
+					if(close == std::string::npos) {
+						break;
+					}
+					ids->insert(value.substr(pos, close - pos));
+				}
+			}
+
+			// Reads the file without building anything, collecting every id that's
+			// referred to. Returns whether any of the ids in wanted is defined.
+			bool scan_ids(const std::string& filename, const char* begin, const char* end, const std::set<std::string>& wanted, std::set<std::string>* referenced)
+			{
+				bool found = false;
+				xml_reader rd(filename, begin, end);
+				for(xml_reader::Token tok; (tok = rd.next()) != xml_reader::TOKEN_END_OF_FILE; ) {
+					if(tok == xml_reader::TOKEN_START) {
+						for(auto& a : rd.attributes()) {
+							add_references(a.first, a.second, referenced);
+						}
+						const std::string* id = rd.attribute("id");
+						if(id != nullptr && wanted.find(*id) != wanted.end()) {
+							found = true;
+						}
+					}
+				}
+				return found;
+			}
+
+			// Keeps the elements whose ids are in referenced, along with all the
+			// definitions.
+			void collect_referenced(const std::string& filename, const char* begin, const char* end, const std::set<std::string>& ids, stream_root* root)
+			{
+				xml_reader rd(filename, begin, end);
+				bool seen_root = false;
+				for(xml_reader::Token tok; (tok = rd.next()) != xml_reader::TOKEN_END_OF_FILE; ) {
+					if(tok != xml_reader::TOKEN_START) {
+						continue;
+					}
+					if(!seen_root) {
+						seen_root = true;
+						continue;
+					}
+					const std::string name = rd.name();
+					const std::string* id = rd.attribute("id");
+					if(is_definition_name(name) || (id != nullptr && ids.find(*id) != ids.end())) {
+						unsigned count = 0;
+						element_ptr e = container::create_child(root, name, subtree_node(rd, &count));
+						if(e) {
+							root->retain(e);
+						}
+					}
+				}
+				root->resolve_retained();
+			}
+		}
+
+		stream_result render_stream(const std::string& filename, render_context& ctx)
+		{
+			stream_result res;
+			auto file = sys::mapped_file::open(filename);
+			ASSERT_LOG(file != nullptr, "Unable to read " << filename);
+			const char* begin = static_cast<const char*>(file->data());
+			const char* end = begin + file->size();
+
+			// Drawn into a group so it can be thrown away if we have to start again.
+			std::set<std::string> referenced;
+			{
+				stream_root root;
+				xml_reader rd(filename, begin, end);
+				ctx.push_group();
+				render_pass(rd, ctx, &root, true, &res);
+				res.passes = 1;
+				res.definitions_retained = static_cast<unsigned>(root.retained());
+				if(root.missing().empty()) {
+					ctx.pop_group_and_paint(1.0);
+					return res;
+				}
+				// References to ids the document doesn't have are broken anyway,
+				// reading it again wouldn't draw anything differently.
+				res.passes = 2;
+				if(!scan_ids(filename, begin, end, root.missing(), &referenced)) {
+					ctx.pop_group_and_paint(1.0);
+					return res;
+				}
+				ctx.pop_group_and_discard();
+				LOG_INFO(filename << " has forward references, reading it again");
+			}
+
+			stream_result second;
+			stream_root root;
+			collect_referenced(filename, begin, end, referenced, &root);
+			xml_reader rd(filename, begin, end);
+			render_pass(rd, ctx, &root, false, &second);
+			second.passes = 3;
+			second.definitions_retained = static_cast<unsigned>(root.retained());
+			return second;
+		}
+	}
+}
@@ -0,0 +1,66 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+#include "svg_render.hpp"
+
+namespace KRE
+{
+	namespace SVG
+	{
+		struct stream_result
+		{
+			stream_result() 
+				: passes(0), elements_rendered(0), definitions_retained(0), 
+				  max_depth(0), largest_subtree(0) 
+			{}
+			// Passes over the file. 1 if it could be drawn as it was read, 2 if
+			// it refers to ids it doesn't have, 3 if something was referenced before
+			// it was defined, see render_stream().
+			unsigned passes;
+			unsigned elements_rendered;
+			unsigned definitions_retained;
+			// Deepest nesting of groups that were streamed into.
+			unsigned max_depth;
+			// Most nodes held at once for a single element that was read whole.
+			unsigned largest_subtree;
+		};
+
+		// Draws a document while it is being read, for documents too big to hold
+		// the whole element tree in memory. Groups are entered and left as their
+		// tags are read, every other element is read whole, drawn and then thrown
+		// away. Only definitions (defs and clipPath) are kept for later references,
+		// so memory use is proportional to the depth of the tree plus the size of
+		// the definitions rather than the size of the document.
+		//
+		// If anything refers to an element that hasn't been read yet, or that was
+		// thrown away, the file is scanned for the ids that were missing. References
+		// to ids the document doesn't have at all are left broken. Otherwise what
+		// was drawn is discarded and the file is read twice more: once to keep the
+		// elements that are referenced, then again to draw it.
+		stream_result render_stream(const std::string& filename, render_context& ctx);
+	}
+}
@@ -28,7 +28,11 @@
 #include <cairo-ft.h>
 
 #include "asserts.hpp"
+#include "svg_container.hpp"
 #include "svg_element.hpp"
+#include "svg_filter.hpp"
+#include "svg_marker.hpp"
+#include "svg_mask.hpp"
 #include "svg_style.hpp"
 
 namespace KRE
@@ -37,6 +41,33 @@ namespace KRE
 	{
 		namespace
 		{
+			void add_paint_memory(memory_report* mr, const paint_ptr& p)
+			{
+				if(p && mr->first_visit(p.get())) {
+					mr->paints += sizeof(paint) + shared_count_bytes + p->heap_bytes();
+				}
+			}
+
+			void add_uri_memory(memory_report* mr, const uri::uri& u)
+			{
+				u.for_each_part([mr](const std::string& s) { mr->strings += string_heap_bytes(s); });
+			}
+
+			// ref is a local reference of the form #id
+			void add_local_reference(const std::string& ref, std::vector<std::string>* ids)
+			{
+				if(ref.size() > 1 && ref[0] == '#') {
+					ids->emplace_back(ref.substr(1));
+				}
+			}
+
+			void add_paint_references(const paint_ptr& p, std::vector<std::string>* ids)
+			{
+				if(p) {
+					p->add_references(ids);
+				}
+			}
+
 			FuncIriValue parse_func_iri_value(const std::string& value, uri::uri& iri)
 			{
 				FuncIriValue ret = FuncIriValue::NONE;
@@ -274,6 +305,14 @@ namespace KRE
 			}
 		}
 
+		void font_attribs::add_memory_usage(memory_report* mr) const
+		{
+			mr->attributes += vector_heap_bytes(family_);
+			for(auto& f : family_) {
+				mr->strings += string_heap_bytes(f);
+			}
+		}
+
 		void font_attribs::resolve(const element* doc)
 		{
 			// nothing need be done
@@ -732,20 +771,26 @@ namespace KRE
 		void visual_attribs::apply(render_context& ctx) const
 		{
 			// XXX
-			cairo_push_group(ctx.cairo());
+			ctx.push_group();
 		}
 
 		void visual_attribs::clear(render_context& ctx) const
 		{
 			// XXX
-			auto patt = cairo_pop_group(ctx.cairo());
 			if(display_ == Display::NONE) {
-				cairo_pattern_destroy(patt);
+				ctx.pop_group_and_discard();
 			} else {
-				cairo_set_source(ctx.cairo(), patt);
-				cairo_pattern_destroy(patt);
-				cairo_paint(ctx.cairo());
+				ctx.pop_group_and_paint(1.0);
+			}
+		}
+
+		void visual_attribs::add_memory_usage(memory_report* mr) const
+		{
+			mr->attributes += vector_heap_bytes(cursor_funciri_);
+			for(auto& c : cursor_funciri_) {
+				mr->strings += string_heap_bytes(c);
 			}
+			add_paint_memory(mr, current_color_);
 		}
 
 		void visual_attribs::resolve(const element* doc)
@@ -755,7 +800,7 @@ namespace KRE
 
 		clipping_attribs::clipping_attribs(const ptree& pt)
 			: path_(FuncIriValue::NONE),
-			rule_(ClipRule::NON_ZERO),
+			rule_(ClipRule::UNSET),
 			mask_(FuncIriValue::NONE),
 			opacity_(OpacityAttrib::VALUE),
 			opacity_value_(1.0)
@@ -841,18 +886,54 @@ namespace KRE
 			}
 			
 			if(path_ == FuncIriValue::FUNC_IRI && path_resolved_ != nullptr) {
-				path_resolved_->clip(ctx);
+				if(clip_mask_ && clip_mask_->clips_with_mask(ctx)) {
+					ctx.push_group();
+				} else {
+					path_resolved_->clip(ctx);
+				}
+			}
+			if(mask_resolved_) {
+				ctx.push_group();
 			}
 		}
 
 		void clipping_attribs::clear(render_context& ctx) const
 		{
-			// XXX
+			if(mask_resolved_) {
+				mask_resolved_->apply_mask(ctx, ctx.pop_group());
+			}
+			if(path_ == FuncIriValue::FUNC_IRI && clip_mask_ && clip_mask_->clips_with_mask(ctx)) {
+				clip_mask_->apply_clip_mask(ctx, ctx.pop_group());
+			}
 			if(opacity_ == OpacityAttrib::VALUE) {
 				ctx.opacity_pop();
 			}
 		}
 
+		void clipping_attribs::apply_clip_rule(render_context& ctx) const
+		{
+			switch(rule_) {
+				case ClipRule::NON_ZERO:	cairo_set_fill_rule(ctx.cairo(), CAIRO_FILL_RULE_WINDING); break;
+				case ClipRule::EVEN_ODD:	cairo_set_fill_rule(ctx.cairo(), CAIRO_FILL_RULE_EVEN_ODD); break;
+				default: break;
+			}
+		}
+
+		void clipping_attribs::add_memory_usage(memory_report* mr) const
+		{
+			mr->strings += string_heap_bytes(path_ref_) + string_heap_bytes(mask_ref_);
+		}
+
+		void clipping_attribs::add_references(std::vector<std::string>* ids) const
+		{
+			if(path_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(path_ref_, ids);
+			}
+			if(mask_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(mask_ref_, ids);
+			}
+		}
+
 		void clipping_attribs::resolve(const element* doc)
 		{
 			if(path_ == FuncIriValue::FUNC_IRI) {
@@ -862,11 +943,25 @@ namespace KRE
 				if(child) {
 					path_resolved_ = child;
 					// XXX we should check child is of type clip_path here and Warn/unset the clip path if not.
+					auto cp = std::dynamic_pointer_cast<clip_path>(child);
+					if(cp) {
+						cp->add_user();
+						clip_mask_ = cp;
+					}
 				} else {
 					LOG_WARN("Reference to clip-path child element not found:  (will ignore clip-path)" << path_ref_);
 					path_ = FuncIriValue::UNSET;
 				}
 			}
+			if(mask_ == FuncIriValue::FUNC_IRI && doc != nullptr) {
+				if(!mask_ref_.empty() && mask_ref_[0] == '#') {
+					mask_resolved_ = std::dynamic_pointer_cast<const mask_element>(doc->find_child(mask_ref_.substr(1)));
+				}
+				if(mask_resolved_ == nullptr) {
+					LOG_WARN("Reference to mask element not found: (will ignore mask) " << mask_ref_);
+					mask_ = FuncIriValue::UNSET;
+				}
+			}
 		}
 
 		filter_effect_attribs::filter_effect_attribs(const ptree& pt)
@@ -959,17 +1054,51 @@ namespace KRE
 
 		void filter_effect_attribs::apply(render_context& ctx) const
 		{
-			// XXX
+			if(filter_resolved_) {
+				ctx.push_group();
+				ctx.filter_enter();
+			}
 		}
 
 		void filter_effect_attribs::clear(render_context& ctx) const
 		{
-			// XXX
+			if(filter_resolved_) {
+				double bbox[4];
+				const bool has_bbox = ctx.filter_leave(&bbox[0], &bbox[1], &bbox[2], &bbox[3]);
+				ctx.not_recordable("filter");
+				filter_resolved_->apply_filter(ctx, ctx.pop_group(), has_bbox ? bbox : nullptr);
+			}
+		}
+
+		void filter_effect_attribs::add_memory_usage(memory_report* mr) const
+		{
+			add_uri_memory(mr, filter_ref_);
+			add_paint_memory(mr, flood_color_);
+			add_paint_memory(mr, lighting_color_);
+		}
+
+		void filter_effect_attribs::add_references(std::vector<std::string>* ids) const
+		{
+			if(filter_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(filter_ref_.fragment(), ids);
+			}
+			add_paint_references(flood_color_, ids);
+			add_paint_references(lighting_color_, ids);
 		}
 
 		void filter_effect_attribs::resolve(const element* doc)
 		{
-			// XXX
+			if(filter_ != FuncIriValue::FUNC_IRI || doc == nullptr) {
+				return;
+			}
+			const std::string ref = filter_ref_.fragment();
+			if(!ref.empty() && ref[0] == '#') {
+				filter_resolved_ = std::dynamic_pointer_cast<const filter_element>(doc->find_child(ref.substr(1)));
+			}
+			if(filter_resolved_ == nullptr) {
+				LOG_WARN("Reference to filter element not found: (will ignore filter) " << filter_ref_.fragment());
+				filter_ = FuncIriValue::UNSET;
+			}
 		}
 
 		painting_properties::painting_properties(const ptree& pt)
@@ -1275,6 +1404,16 @@ namespace KRE
 					}
 				}
 			}
+
+			// Opacities are attached to the element's own paint when the document is
+			// loaded, so that rendering doesn't modify shared state. Without a paint
+			// of its own, apply() uses a copy of the inherited one.
+			if(stroke_ && stroke_opacity_ == OpacityAttrib::VALUE) {
+				stroke_->set_opacity(stroke_opacity_value_);
+			}
+			if(fill_ && fill_opacity_ == OpacityAttrib::VALUE) {
+				fill_->set_opacity(fill_opacity_value_);
+			}
 		}
 
 		painting_properties::~painting_properties()
@@ -1283,38 +1422,21 @@ namespace KRE
 
 		void painting_properties::apply(render_context& ctx) const
 		{
-			cairo_save(ctx.cairo());
+			ctx.save();
 
 			if(stroke_) {
 				ctx.stroke_color_push(stroke_);
+			} else if(pushes_stroke()) {
+				paint_ptr p = std::make_shared<paint>(*ctx.stroke_color_top());
+				p->set_opacity(stroke_opacity_value_);
+				ctx.stroke_color_push(p);
 			}
 			if(fill_) {
 				ctx.fill_color_push(fill_);
-			}
-
-			switch(stroke_opacity_)
-			{
-				case OpacityAttrib::UNSET:		/* do nothing */ break;
-				case OpacityAttrib::INHERIT:	/* do nothing */ break;
-				case OpacityAttrib::VALUE:
-					// XXX This might not be right, if "stroke" is not set but
-					// "stroke_opacity" is. Since then we're setting the opacity
-					// on the current parent.
-					ctx.stroke_color_top()->set_opacity(stroke_opacity_value_);
-					break;
-				default: break;
-			}
-			switch(fill_opacity_)
-			{
-				case OpacityAttrib::UNSET:		/* do nothing */ break;
-				case OpacityAttrib::INHERIT:	/* do nothing */ break;
-				case OpacityAttrib::VALUE:
-					// XXX This might not be right, if "stroke" is not set but
-					// "stroke_opacity" is. Since then we're setting the opacity
-					// on the current parent.
-					ctx.fill_color_top()->set_opacity(fill_opacity_value_);
-					break;
-				default: break;
+			} else if(pushes_fill()) {
+				paint_ptr p = std::make_shared<paint>(*ctx.fill_color_top());
+				p->set_opacity(fill_opacity_value_);
+				ctx.fill_color_push(p);
 			}
 
 			switch(stroke_width_) {
@@ -1384,21 +1506,87 @@ namespace KRE
 			}
 			// XXX color_interpolation_
 			// XXX color_rendering_
-			// XXX shape_rendering_
-			// XXX text_rendering_
-			// XXX image_rendering_
+			switch(shape_rendering_)
+			{
+				case ShapeRenderingAttrib::UNSET:		/* do nothing */ break;
+				case ShapeRenderingAttrib::INHERIT:		/* do nothing */ break;
+				case ShapeRenderingAttrib::AUTO:
+					ctx.apply_hint(RenderingHint::AUTO);
+					break;
+				case ShapeRenderingAttrib::OPTIMIZE_SPEED:
+					ctx.apply_hint(RenderingHint::SPEED);
+					break;
+				case ShapeRenderingAttrib::CRISP_EDGES:
+					ctx.apply_hint(RenderingHint::CRISP_EDGES);
+					break;
+				case ShapeRenderingAttrib::GEOMETRIC_PRECISION:
+					ctx.apply_hint(RenderingHint::PRECISION);
+					break;
+				default: break;
+			}
+			switch(text_rendering_)
+			{
+				case TextRenderingAttrib::UNSET:		/* do nothing */ break;
+				case TextRenderingAttrib::INHERIT:		/* do nothing */ break;
+				case TextRenderingAttrib::AUTO:
+				case TextRenderingAttrib::OPTIMIZE_LEGIBILITY:
+					ctx.text_hint_push(RenderingHint::AUTO);
+					break;
+				case TextRenderingAttrib::OPTIMIZE_SPEED:
+					ctx.text_hint_push(RenderingHint::SPEED);
+					break;
+				case TextRenderingAttrib::GEOMETRIC_PRECISION:
+					ctx.text_hint_push(RenderingHint::PRECISION);
+					break;
+				default: break;
+			}
+			switch(image_rendering_)
+			{
+				case RenderingAttrib::UNSET:		/* do nothing */ break;
+				case RenderingAttrib::INHERIT:		/* do nothing */ break;
+				case RenderingAttrib::AUTO:
+					ctx.image_hint_push(RenderingHint::AUTO);
+					break;
+				case RenderingAttrib::OPTIMIZE_SPEED:
+					ctx.image_hint_push(RenderingHint::SPEED);
+					break;
+				case RenderingAttrib::OPTIMIZE_QUALITY:
+					ctx.image_hint_push(RenderingHint::PRECISION);
+					break;
+				default: break;
+			}
 			// XXX color_profile_
 		}
 
 		void painting_properties::clear(render_context& ctx) const
 		{
-			if(fill_) {
+			if(pushes_text_hint()) {
+				ctx.text_hint_pop();
+			}
+			if(pushes_image_hint()) {
+				ctx.image_hint_pop();
+			}
+			if(pushes_fill()) {
 				ctx.fill_color_pop();
 			}
-			if(stroke_) {
+			if(pushes_stroke()) {
 				ctx.stroke_color_pop();
 			}
-			cairo_restore(ctx.cairo());
+			ctx.restore();
+		}
+
+		void painting_properties::add_memory_usage(memory_report* mr) const
+		{
+			add_paint_memory(mr, stroke_);
+			add_paint_memory(mr, fill_);
+			mr->attributes += vector_heap_bytes(stroke_dash_array_value_);
+			mr->strings += string_heap_bytes(color_profile_value_);
+		}
+
+		void painting_properties::add_references(std::vector<std::string>* ids) const
+		{
+			add_paint_references(stroke_, ids);
+			add_paint_references(fill_, ids);
 		}
 
 		void painting_properties::resolve(const element* doc)
@@ -1407,6 +1595,9 @@ namespace KRE
 		}
 
 		marker_attribs::marker_attribs(const ptree& pt)
+			: start_(FuncIriValue::UNSET),
+			  mid_(FuncIriValue::UNSET),
+			  end_(FuncIriValue::UNSET)
 		{
 			auto attributes = pt.get_child_optional("<xmlattr>");
 
@@ -1437,19 +1628,91 @@ namespace KRE
 		{
 		}
 
+		namespace
+		{
+			bool is_set(FuncIriValue v)
+			{
+				return v != FuncIriValue::UNSET && v != FuncIriValue::INHERIT;
+			}
+
+			const_marker_element_ptr choose_marker(FuncIriValue v, const const_marker_element_ptr& own, const const_marker_element_ptr& inherited)
+			{
+				return is_set(v) ? own : inherited;
+			}
+		}
+
+		bool marker_attribs::pushes_markers() const
+		{
+			return is_set(start_) || is_set(mid_) || is_set(end_);
+		}
+
 		void marker_attribs::apply(render_context& ctx) const
 		{
-			// XXX
+			// Markers are drawn by shapes once they have their path, from whatever
+			// is on top of the stack, see draw_markers().
+			if(!pushes_markers()) {
+				return;
+			}
+			const marker_set* inherited = ctx.markers_top();
+			marker_set m;
+			m.start = choose_marker(start_, start_resolved_, inherited ? inherited->start : const_marker_element_ptr());
+			m.mid = choose_marker(mid_, mid_resolved_, inherited ? inherited->mid : const_marker_element_ptr());
+			m.end = choose_marker(end_, end_resolved_, inherited ? inherited->end : const_marker_element_ptr());
+			ctx.markers_push(m);
 		}
 
 		void marker_attribs::clear(render_context& ctx) const
 		{
-			// XXX
+			if(pushes_markers()) {
+				ctx.markers_pop();
+			}
+		}
+
+		void marker_attribs::add_memory_usage(memory_report* mr) const
+		{
+			add_uri_memory(mr, start_iri_);
+			add_uri_memory(mr, mid_iri_);
+			add_uri_memory(mr, end_iri_);
+		}
+
+		void marker_attribs::add_references(std::vector<std::string>* ids) const
+		{
+			if(start_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(start_iri_.fragment(), ids);
+			}
+			if(mid_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(mid_iri_.fragment(), ids);
+			}
+			if(end_ == FuncIriValue::FUNC_IRI) {
+				add_local_reference(end_iri_.fragment(), ids);
+			}
+		}
+
+		namespace
+		{
+			const_marker_element_ptr resolve_marker(const element* doc, FuncIriValue* value, const uri::uri& iri)
+			{
+				if(*value != FuncIriValue::FUNC_IRI || doc == nullptr) {
+					return const_marker_element_ptr();
+				}
+				const std::string ref = iri.fragment();
+				const_marker_element_ptr marker;
+				if(!ref.empty() && ref[0] == '#') {
+					marker = std::dynamic_pointer_cast<const marker_element>(doc->find_child(ref.substr(1)));
+				}
+				if(marker == nullptr) {
+					LOG_WARN("Reference to marker element not found: (will ignore marker) " << iri.fragment());
+					*value = FuncIriValue::NONE;
+				}
+				return marker;
+			}
 		}
 
 		void marker_attribs::resolve(const element* doc)
 		{
-			// XXX
+			start_resolved_ = resolve_marker(doc, &start_, start_iri_);
+			mid_resolved_ = resolve_marker(doc, &mid_, mid_iri_);
+			end_resolved_ = resolve_marker(doc, &end_, end_iri_);
 		}
 	}
 }
@@ -30,6 +30,7 @@
 #include "ft_iface.hpp"
 #include "svg_fwd.hpp"
 #include "svg_length.hpp"
+#include "svg_memory.hpp"
 #include "svg_paint.hpp"
 #include "svg_render.hpp"
 #include "uri.hpp"
@@ -47,6 +48,11 @@ namespace KRE
 			virtual void apply(render_context& ctx) const = 0;
 			virtual void clear(render_context& ctx) const = 0;
 			virtual void resolve(const element* doc) = 0;
+			// Heap memory owned by the attributes, the block itself is counted by the
+			// element.
+			virtual void add_memory_usage(memory_report* mr) const {}
+			// Adds the ids of any elements referred to, e.g. by url(#id), to ids.
+			virtual void add_references(std::vector<std::string>* ids) const {}
 		private:
 			DISALLOW_COPY_AND_ASSIGN(base_attrib);
 		};
@@ -144,6 +150,7 @@ namespace KRE
 			virtual void apply(render_context& ctx) const override;
 			virtual void clear(render_context& ctx) const override;
 			virtual void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
 		private:
 			std::vector<std::string> family_;
 			FontStyle style_;
@@ -361,6 +368,7 @@ namespace KRE
 			void apply(render_context& ctx) const override;
 			void clear(render_context& ctx) const override;
 			void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
 		private:
 			Overflow overflow_;
 			Clip clip_;
@@ -405,13 +413,22 @@ namespace KRE
 			void apply(render_context& ctx) const override;
 			void clear(render_context& ctx) const override;
 			void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
+			void add_references(std::vector<std::string>* ids) const override;
+			// Whether a clip-path or mask is set.
+			bool clips() const { return path_ == FuncIriValue::FUNC_IRI || mask_ == FuncIriValue::FUNC_IRI; }
+			// Sets the cairo fill rule to the clip-rule, if one is given.
+			void apply_clip_rule(render_context& ctx) const;
 		private:
 			FuncIriValue path_;
 			std::string path_ref_;
 			element_ptr path_resolved_;
+			// path_resolved_, if it's a clipPath that may clip through a cached mask.
+			const_clip_path_ptr clip_mask_;
 			ClipRule rule_;
 			FuncIriValue mask_;
 			std::string mask_ref_;
+			const_mask_element_ptr mask_resolved_;
 			OpacityAttrib opacity_;
 			double opacity_value_;
 		};
@@ -431,6 +448,9 @@ namespace KRE
 			void apply(render_context& ctx) const override;
 			void clear(render_context& ctx) const override;
 			void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
+			void add_references(std::vector<std::string>* ids) const override;
+			bool has_filter() const { return filter_ == FuncIriValue::FUNC_IRI; }
 		private:
 			Background enable_background_;
 			// if enable_background_==NEW these contain the co-ordinates specified.
@@ -440,6 +460,7 @@ namespace KRE
 			svg_length h_;
 			FuncIriValue filter_;
 			uri::uri filter_ref_;
+			const_filter_element_ptr filter_resolved_;
 			paint_ptr flood_color_;
 			OpacityAttrib flood_opacity_;
 			double flood_opacity_value_;
@@ -544,7 +565,19 @@ namespace KRE
 			void apply(render_context& ctx) const override;
 			void clear(render_context& ctx) const override;
 			void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
+			void add_references(std::vector<std::string>* ids) const override;
 		private:
+			bool pushes_text_hint() const { 
+				return text_rendering_ != TextRenderingAttrib::UNSET && text_rendering_ != TextRenderingAttrib::INHERIT;
+			}
+			bool pushes_image_hint() const { 
+				return image_rendering_ != RenderingAttrib::UNSET && image_rendering_ != RenderingAttrib::INHERIT;
+			}
+			// Whether apply() pushes a paint, either the element's own or a copy of 
+			// the inherited one with the element's opacity.
+			bool pushes_stroke() const { return stroke_ || stroke_opacity_ == OpacityAttrib::VALUE; }
+			bool pushes_fill() const { return fill_ || fill_opacity_ == OpacityAttrib::VALUE; }
 			// default none
 			paint_ptr stroke_;
 			OpacityAttrib stroke_opacity_;
@@ -598,13 +631,24 @@ namespace KRE
 			void apply(render_context& ctx) const override;
 			void clear(render_context& ctx) const override;
 			void resolve(const element* doc) override;
+			void add_memory_usage(memory_report* mr) const override;
+			void add_references(std::vector<std::string>* ids) const override;
+			bool has_markers() const { 
+				return start_ == FuncIriValue::FUNC_IRI || mid_ == FuncIriValue::FUNC_IRI || end_ == FuncIriValue::FUNC_IRI; 
+			}
 		private:
+			// Whether any of the marker properties are set, rather than inherited.
+			bool pushes_markers() const;
+
 			FuncIriValue start_;
 			uri::uri start_iri_;
+			const_marker_element_ptr start_resolved_;
 			FuncIriValue mid_;
 			uri::uri mid_iri_;
+			const_marker_element_ptr mid_resolved_;
 			FuncIriValue end_;
 			uri::uri end_iri_;
+			const_marker_element_ptr end_resolved_;
 		};
 	}
 }
@@ -62,7 +62,8 @@ namespace KRE
 				cairo_transform(ctx.cairo(), &mat_);
 			}
 			void handle_apply_matrix(cairo_matrix_t* mtx) const override {
-				cairo_matrix_multiply(mtx, mtx, &mat_);
+				// Same as cairo_transform(), mat_ is applied to points first.
+				cairo_matrix_multiply(mtx, &mat_, mtx);
 			}
 			cairo_matrix_t mat_;
 		};
@@ -101,10 +102,12 @@ namespace KRE
 			virtual ~rotation_transform() {}
 			std::string as_string() const override {
 				std::stringstream str;
+				// angle_ is in radians, rotate() takes degrees.
+				const double degrees = angle_ * 180.0 / M_PI;
 				if(std::abs(cx_) < DBL_EPSILON && std::abs(cy_) < DBL_EPSILON) {
-					str << "rotate(" << angle_ << ")";
+					str << "rotate(" << degrees << ")";
 				} else {
-					str << "rotate(" << angle_ << " " << cx_ << " " << cy_ << ")";
+					str << "rotate(" << degrees << " " << cx_ << " " << cy_ << ")";
 				}
 				return str.str();
 			}
@@ -124,7 +127,7 @@ namespace KRE
 				} else {
 					cairo_matrix_translate(mtx, cx_, cy_);
 					cairo_matrix_rotate(mtx, angle_);
-					cairo_matrix_translate(mtx, cx_, cy_);
+					cairo_matrix_translate(mtx, -cx_, -cy_);
 				}
 			}
 			double angle_;
@@ -163,7 +166,7 @@ namespace KRE
 			virtual ~skew_x_transform() {}
 			std::string as_string() const override {
 				std::stringstream str;
-				str << "skewX(" << sx_ << ")";
+				str << "skewX(" << std::atan(sx_) * 180.0 / M_PI << ")";
 				return str.str();
 			}
 		private:
@@ -171,7 +174,8 @@ namespace KRE
 				cairo_transform(ctx.cairo(), &mat_);
 			}
 			void handle_apply_matrix(cairo_matrix_t* mtx) const override {
-				cairo_matrix_multiply(mtx, mtx, &mat_);
+				// Same as cairo_transform(), mat_ is applied to points first.
+				cairo_matrix_multiply(mtx, &mat_, mtx);
 			}
 			double sx_;
 			cairo_matrix_t mat_;
@@ -186,7 +190,7 @@ namespace KRE
 			virtual ~skew_y_transform() {}
 			std::string as_string() const override {
 				std::stringstream str;
-				str << "skewY(" << sy_ << ")";
+				str << "skewY(" << std::atan(sy_) * 180.0 / M_PI << ")";
 				return str.str();
 			}
 		private:
@@ -194,7 +198,8 @@ namespace KRE
 				cairo_transform(ctx.cairo(), &mat_);
 			}
 			void handle_apply_matrix(cairo_matrix_t* mtx) const override {
-				cairo_matrix_multiply(mtx, mtx, &mat_);
+				// Same as cairo_transform(), mat_ is applied to points first.
+				cairo_matrix_multiply(mtx, &mat_, mtx);
 			}
 			double sy_;
 			cairo_matrix_t mat_;
@@ -249,6 +254,16 @@ namespace KRE
 			return transform_ptr();
 		}
 
+		cairo_matrix_t transform::to_matrix(const std::vector<transform_ptr>& trfs)
+		{
+			cairo_matrix_t mat;
+			cairo_matrix_init_identity(&mat);
+			for(auto& trf : trfs) {
+				trf->apply_matrix(&mat);
+			}
+			return mat;
+		}
+
 		std::vector<transform_ptr> transform::factory(const std::string& s)
 		{
 			std::vector<transform_ptr> results;
@@ -318,14 +333,14 @@ namespace KRE
 							}
 							case TransformType::SKEW_X: {
 								ASSERT_LOG(parameters.size() == 1, "Parsing transform:skewX found " << parameters.size() << " parameter(s), expected 1");
-								double sa = tan(parameters[0]);
+								double sa = tan(parameters[0] / 180.0 * M_PI);
 								skew_x_transform* sxtrf = new skew_x_transform(sa);
 								results.emplace_back(sxtrf);
 								break;
 							}
 							case TransformType::SKEW_Y: {
 								ASSERT_LOG(parameters.size() == 1, "Parsing transform:skewY found " << parameters.size() << " parameter(s), expected 1");
-								double sa = tan(parameters[0]);
+								double sa = tan(parameters[0] / 180.0 * M_PI);
 								skew_y_transform* sxtrf = new skew_y_transform(sa);
 								results.emplace_back(sxtrf);
 								break;
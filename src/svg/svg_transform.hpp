@@ -51,6 +51,8 @@ namespace KRE
 			virtual std::string as_string() const = 0;
 			static std::vector<transform_ptr> factory(const std::string& s);
 			static transform_ptr factory(TransformType, const std::vector<double>& params);
+			// The single matrix that has the same effect as applying trfs in order.
+			static cairo_matrix_t to_matrix(const std::vector<transform_ptr>& trfs);
 			void apply(render_context& ctx);
 			void apply_matrix(cairo_matrix_t* mtx) const;
 		protected:
@@ -92,6 +92,17 @@ namespace uri
             return result;
         }
 
+        // Calls f with each of the parts, e.g. to account for their memory.
+        template<typename F>
+        void for_each_part(F f) const
+        {
+            f(query_string_);
+            f(path_);
+            f(protocol_);
+            f(host_);
+            f(port_);
+            f(fragment_);
+        }
     private:
         std::string query_string_;
         std::string path_;
@@ -0,0 +1,146 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <exception>
+
+#include "asserts.hpp"
+#include "thread_pool.hpp"
+
+namespace threading
+{
+	thread_pool::thread_pool(int nthreads)
+		: queued_(0),
+		  outstanding_(0),
+		  next_queue_(0),
+		  done_(false)
+	{
+		if(nthreads <= 0) {
+			nthreads = static_cast<int>(std::thread::hardware_concurrency());
+			if(nthreads <= 0) {
+				nthreads = 1;
+			}
+		}
+		for(int n = 0; n != nthreads; ++n) {
+			queues_.emplace_back(new task_queue());
+		}
+		for(int n = 0; n != nthreads; ++n) {
+			workers_.emplace_back(&thread_pool::worker_loop, this, n);
+		}
+	}
+
+	thread_pool::~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			done_ = true;
+		}
+		work_cv_.notify_all();
+		for(auto& w : workers_) {
+			w.join();
+		}
+	}
+
+	void thread_pool::submit(const task& t)
+	{
+		unsigned index;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			index = next_queue_++ % queues_.size();
+			++outstanding_;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+			queues_[index]->tasks.emplace_back(t);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			++queued_;
+		}
+		work_cv_.notify_one();
+	}
+
+	void thread_pool::wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		idle_cv_.wait(lock, [this]() { return outstanding_ == 0; });
+	}
+
+	bool thread_pool::pop_local(int index, task* t)
+	{
+		auto& q = *queues_[index];
+		std::lock_guard<std::mutex> lock(q.mutex);
+		if(q.tasks.empty()) {
+			return false;
+		}
+		*t = std::move(q.tasks.front());
+		q.tasks.pop_front();
+		--queued_;
+		return true;
+	}
+
+	bool thread_pool::steal(int index, task* t)
+	{
+		const int nqueues = static_cast<int>(queues_.size());
+		for(int n = 1; n < nqueues; ++n) {
+			auto& q = *queues_[(index + n) % nqueues];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if(!q.tasks.empty()) {
+				*t = std::move(q.tasks.back());
+				q.tasks.pop_back();
+				--queued_;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void thread_pool::task_done()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if(--outstanding_ == 0) {
+			idle_cv_.notify_all();
+		}
+	}
+
+	void thread_pool::worker_loop(int index)
+	{
+		for(;;) {
+			task t;
+			if(pop_local(index, &t) || steal(index, &t)) {
+				try {
+					t(index);
+				} catch(std::exception& e) {
+					LOG_ERROR("Uncaught exception in worker thread " << index << ": " << e.what());
+				}
+				task_done();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(mutex_);
+			work_cv_.wait(lock, [this]() { return done_ || queued_ > 0; });
+			if(done_ && queued_ == 0) {
+				return;
+			}
+		}
+	}
+}
@@ -0,0 +1,88 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace threading
+{
+	// A fixed size pool of worker threads with one task queue per worker.
+	// Workers take tasks from the front of their own queue and when that runs
+	// dry they steal from the back of the other workers' queues, so a handful
+	// of long running tasks can't leave the rest of the pool sitting idle.
+	class thread_pool
+	{
+	public:
+		// The argument passed to a task is the index of the worker running it,
+		// in the range [0,size()). Useful for indexing per-thread resources.
+		typedef std::function<void(int)> task;
+
+		// If nthreads is zero or less we use the number of hardware threads.
+		explicit thread_pool(int nthreads=0);
+		~thread_pool();
+
+		int size() const { return static_cast<int>(workers_.size()); }
+
+		// Queue a task. Tasks are dealt out to the worker queues round-robin, so
+		// submission order is roughly the order that work gets started in.
+		void submit(const task& t);
+
+		// Blocks until every task submitted so far has finished running.
+		void wait_idle();
+	private:
+		thread_pool(const thread_pool&);
+		void operator=(const thread_pool&);
+
+		struct task_queue
+		{
+			std::mutex mutex;
+			std::deque<task> tasks;
+		};
+
+		void worker_loop(int index);
+		bool pop_local(int index, task* t);
+		bool steal(int index, task* t);
+		void task_done();
+
+		std::vector<std::unique_ptr<task_queue>> queues_;
+		std::vector<std::thread> workers_;
+
+		std::mutex mutex_;
+		std::condition_variable work_cv_;
+		std::condition_variable idle_cv_;
+		// Number of tasks sitting in queues. Only incremented while holding mutex_.
+		std::atomic<int> queued_;
+		// Number of tasks submitted that haven't finished yet.
+		int outstanding_;
+		unsigned next_queue_;
+		bool done_;
+	};
+}
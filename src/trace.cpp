@@ -0,0 +1,249 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__GNUC__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+#include "trace.hpp"
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+namespace trace
+{
+	namespace
+	{
+		struct event
+		{
+			const char* name;
+			const char* type;
+			uint64_t start;
+			uint64_t duration;
+			char detail[32];
+		};
+
+		// Only written to by the thread which owns it.
+		struct thread_buffer
+		{
+			explicit thread_buffer(unsigned t) : tid(t), count(0), events(events_per_thread) {}
+			unsigned tid;
+			uint64_t count;
+			std::vector<event> events;
+		};
+
+		std::atomic<bool> tracing_enabled(false);
+
+		// Buffers live for as long as the program so that the events of threads
+		// which have exited can still be written out.
+		std::mutex& registry_mutex()
+		{
+			static std::mutex m;
+			return m;
+		}
+
+		std::vector<std::unique_ptr<thread_buffer>>& registry()
+		{
+			static std::vector<std::unique_ptr<thread_buffer>> buffers;
+			return buffers;
+		}
+
+		TRACE_THREAD_LOCAL thread_buffer* current_buffer = nullptr;
+
+		thread_buffer* get_thread_buffer()
+		{
+			if(current_buffer == nullptr) {
+				std::lock_guard<std::mutex> lock(registry_mutex());
+				auto& buffers = registry();
+				buffers.emplace_back(new thread_buffer(static_cast<unsigned>(buffers.size() + 1)));
+				current_buffer = buffers.back().get();
+			}
+			return current_buffer;
+		}
+
+		std::string readable_type_name(const char* name)
+		{
+#if defined(__GNUC__)
+			int status = 0;
+			char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+			if(status == 0 && demangled != nullptr) {
+				std::string res(demangled);
+				std::free(demangled);
+				return res;
+			}
+#endif
+			return name;
+		}
+
+		void write_json_string(std::ostream& os, const char* s)
+		{
+			os << '"';
+			for(; *s; ++s) {
+				const unsigned char c = static_cast<unsigned char>(*s);
+				if(c == '"' || c == '\\') {
+					os << '\\' << *s;
+				} else if(c < 0x20) {
+					static const char hex[] = "0123456789abcdef";
+					os << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+				} else {
+					os << *s;
+				}
+			}
+			os << '"';
+		}
+	}
+
+	uint64_t now_ns()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	void set_enabled(bool en)
+	{
+		tracing_enabled = en;
+	}
+
+	bool enabled()
+	{
+		return tracing_enabled;
+	}
+
+	void clear()
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		for(auto& b : registry()) {
+			b->count = 0;
+		}
+	}
+
+	void write_chrome_trace(std::ostream& os)
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex());
+		uint64_t base = UINT64_MAX;
+		for(auto& b : registry()) {
+			const uint64_t n = std::min<uint64_t>(b->count, events_per_thread);
+			for(uint64_t i = b->count - n; i != b->count; ++i) {
+				base = std::min(base, b->events[i % events_per_thread].start);
+			}
+		}
+
+		std::map<const char*, std::string> type_names;
+		bool first = true;
+		os << "{\"traceEvents\":[";
+		for(auto& b : registry()) {
+			const uint64_t n = std::min<uint64_t>(b->count, events_per_thread);
+			for(uint64_t i = b->count - n; i != b->count; ++i) {
+				const event& e = b->events[i % events_per_thread];
+				os << (first ? "\n" : ",\n") << "{\"name\":";
+				first = false;
+				write_json_string(os, e.name);
+				os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+					<< ",\"ts\":" << (e.start - base) / 1000 << "." << (e.start - base) % 1000 / 100
+					<< ",\"dur\":" << e.duration / 1000 << "." << e.duration % 1000 / 100;
+				if(e.type != nullptr) {
+					auto it = type_names.find(e.type);
+					if(it == type_names.end()) {
+						it = type_names.insert(std::make_pair(e.type, readable_type_name(e.type))).first;
+					}
+					os << ",\"args\":{\"type\":";
+					write_json_string(os, it->second.c_str());
+					os << ",\"detail\":";
+					write_json_string(os, e.detail);
+					os << "}";
+				}
+				os << "}";
+			}
+		}
+		os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+	}
+
+	bool write_chrome_trace(const std::string& filename)
+	{
+		std::ofstream os(filename.c_str());
+		if(!os) {
+			// Not LOG_ERROR, this file doesn't depend on SDL.
+			std::cerr << "Unable to open trace file for writing: " << filename << std::endl;
+			return false;
+		}
+		write_chrome_trace(os);
+		return os.good();
+	}
+
+	zone::zone(const char* name)
+		: name_(name),
+		  type_(nullptr),
+		  detail_(nullptr),
+		  start_(tracing_enabled ? now_ns() : 0)
+	{
+	}
+
+	zone::zone(const char* name, const char* type, const std::string* detail)
+		: name_(name),
+		  type_(type),
+		  detail_(detail),
+		  start_(tracing_enabled ? now_ns() : 0)
+	{
+	}
+
+	zone::~zone()
+	{
+		if(start_ == 0) {
+			return;
+		}
+		const uint64_t end = now_ns();
+		thread_buffer* b = get_thread_buffer();
+		event& e = b->events[b->count % events_per_thread];
+		e.name = name_;
+		e.type = type_;
+		e.start = start_;
+		e.duration = end - start_;
+		e.detail[0] = '\0';
+		if(detail_ != nullptr) {
+			size_t len = std::min(detail_->size(), sizeof(e.detail) - 1);
+			// Cut before any UTF-8 character that doesn't fit, half of one would
+			// make the trace invalid JSON.
+			while(len != 0 && len < detail_->size() && (static_cast<unsigned char>((*detail_)[len]) & 0xc0) == 0x80) {
+				--len;
+			}
+			std::memcpy(e.detail, detail_->data(), len);
+			e.detail[len] = '\0';
+		}
+		++b->count;
+	}
+}
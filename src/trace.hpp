@@ -0,0 +1,84 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgment in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+// Low overhead scoped timing zones, exported in the Chrome trace event format
+// (load the output in chrome://tracing).
+//
+// Zones are only compiled in when ENABLE_TRACING is defined, otherwise the
+// TRACE_ZONE macros expand to nothing. Even when compiled in nothing is
+// recorded until set_enabled(true) is called. Each thread records into its own
+// fixed size ring buffer, so once a thread has recorded more than
+// events_per_thread zones the oldest ones are overwritten.
+
+#ifdef ENABLE_TRACING
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+// name must be a string literal, or otherwise live for the life of the program.
+#define TRACE_ZONE(name) trace::zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+// As above, tagged with a type name with static lifetime and a detail string
+// that must outlive the zone, e.g. an element type and id.
+#define TRACE_ZONE_DETAIL(name, type, detail) trace::zone TRACE_CONCAT(trace_zone_, __LINE__)(name, type, &(detail))
+#else
+#define TRACE_ZONE(name)
+#define TRACE_ZONE_DETAIL(name, type, detail)
+#endif
+
+namespace trace
+{
+	enum { events_per_thread = 1 << 16 };
+
+	// Monotonic time in nanoseconds.
+	uint64_t now_ns();
+
+	void set_enabled(bool enabled);
+	bool enabled();
+
+	// Discard everything recorded so far.
+	void clear();
+
+	// These must not be called while zones are being recorded on other threads.
+	void write_chrome_trace(std::ostream& os);
+	bool write_chrome_trace(const std::string& filename);
+
+	class zone
+	{
+	public:
+		explicit zone(const char* name);
+		zone(const char* name, const char* type, const std::string* detail);
+		~zone();
+	private:
+		zone(const zone&);
+		void operator=(const zone&);
+
+		const char* name_;
+		const char* type_;
+		const std::string* detail_;
+		uint64_t start_;
+	};
+}